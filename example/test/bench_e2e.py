@@ -0,0 +1,339 @@
+#!/usr/bin/python
+
+"""
+End to end benchmark of the driver, using the example IOC and the
+simulated controller in p6k_sim.py.
+
+For each number of axes, the simulator is started on a free local port,
+and the example IOC is started with a generated startup script that
+calls p6kCreateController and p6kCreateAxes, and loads a motor record
+for each axis. The following are then measured over Channel Access:
+
+  startup_s         IOC launch until the controller records connect
+  poll_ms           Poll cycle time (PollTime_RBV samples and PollHist_RBV)
+  move_to_go_ms     caput to the motor record until the GO command
+                    arrives at the simulator
+  stop_to_dmov_ms   End of the simulated move until DMOV goes to 1
+                    (using the record timestamp)
+  deferred_go_ms    Defer=0 caput until the GO command for all axes
+                    arrives at the simulator (deferred move fan out)
+  stop_to_s_ms      caput to the motor record STOP field, during a move,
+                    until the !S command arrives at the simulator
+
+The results are written as JSON, so that runs can be compared.
+The IOC must already be built (make in the example directory), because
+the startup script uses the envPaths file in iocBoot/iocexample.
+
+Usage: bench_e2e.py [-h] [--ioc IOC] [--axes AXES] [--moves MOVES]
+                    [--latency MS] [--jitter MS] [--window S]
+                    [--output FILE]
+
+For example, to compare 1, 4 and 8 axes with a 2 ms round trip:
+
+  bench_e2e.py --axes 1,4,8 --latency 2 --output bench.json
+"""
+
+from __future__ import print_function
+
+import os
+import sys
+import json
+import time
+import random
+import argparse
+import tempfile
+import subprocess
+
+import cothread
+from cothread.catools import caget, caput, camonitor, connect, FORMAT_TIME
+
+from p6k_sim import P6KSimulator
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+EXAMPLE = os.path.normpath(os.path.join(HERE, ".."))
+IOC_DIR = os.path.join(EXAMPLE, "iocBoot", "iocexample")
+
+PREFIX = "P6KBENCH:"
+CONTROLLER = PREFIX + "Controller"
+
+# Motor record settings. The simulator uses DRES=25000 steps/rev,
+# so 50000 steps/s is 2 revs/s.
+MOTOR_MACROS = ("DTYP=asynMotor,DIR=0,VELO=50000,VBAS=0,ACCL=0.1,BDST=0,BVEL=0,BACC=0,"
+                "MRES=1,PREC=0,EGU=steps,DHLM=1000000000,DLLM=-1000000000,INIT=")
+
+MOVE_DISTANCE = 10000
+
+# The upper edge of PollHist_RBV bucket 0 (ms). Each bucket after that is twice as wide.
+HIST_FIRST_EDGE = 0.125
+
+STARTUP = """< envPaths
+cd ${TOP}
+dbLoadDatabase "dbd/example.dbd"
+example_registerRecordDeviceDriver pdbbase
+
+drvAsynIPPortConfigure("6K","127.0.0.1:%(port)d",0,0,0)
+p6kCreateController("P6K","6K",0,%(axes)d,%(moving)d,%(idle)d)
+p6kCreateAxes("P6K",%(axes)d)
+
+dbLoadRecords("$(PARKER6K)/db/p6k_controller.template","S=%(controller)s,PORT=P6K,ADDR=0,TIMEOUT=1,COMMSPORT=6K,COMMSADDR=0")
+%(records)s
+iocInit
+"""
+
+AXIS_RECORDS = """dbLoadRecords("$(MOTOR)/db/basic_asyn_motor.db","P=%(prefix)s,M=M%(axis)d,DESC=M%(axis)d,PORT=P6K,ADDR=%(axis)d,%(macros)s")
+dbLoadRecords("$(PARKER6K)/db/p6k_axis.template","M=%(prefix)sM%(axis)d,C=%(controller)s,PORT=P6K,ADDR=%(axis)d,TIMEOUT=1")
+"""
+
+
+def summary(values):
+    """Mean, min, max and median of a list of numbers, or None if it is empty."""
+    if not values:
+        return None
+    ordered = sorted(values)
+    return {"n": len(ordered), "mean": sum(ordered) / len(ordered), "min": ordered[0],
+            "max": ordered[-1], "median": ordered[len(ordered) // 2]}
+
+
+def hist_percentile(buckets, fraction):
+    """The upper bucket edge (ms) below which fraction of the counts lie."""
+    total = sum(buckets)
+    if total <= 0:
+        return None
+    count = 0
+    for i, n in enumerate(buckets):
+        count += n
+        if count >= fraction * total:
+            return HIST_FIRST_EDGE * (2 ** i)
+    return HIST_FIRST_EDGE * (2 ** (len(buckets) - 1))
+
+
+def motor(axis):
+    return PREFIX + "M" + str(axis)
+
+
+def find_command(sim, start, text, timeout=5.0):
+    """Wait for a command line containing text, recorded after index start. Return its time."""
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        for t, line in sim.commands(start):
+            if text in line:
+                return t
+        cothread.Sleep(0.001)
+    return None
+
+
+def wait_dmov(dmov, axes, since, timeout=30.0):
+    """Wait until DMOV has gone to 1 for all the axes after a time. Return the record timestamps."""
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        done = {}
+        for axis in axes:
+            for timestamp, value in dmov[axis]:
+                if value == 1 and timestamp >= since:
+                    done[axis] = timestamp
+                    break
+        if len(done) == len(axes):
+            return done
+        cothread.Sleep(0.01)
+    return None
+
+
+class Run(object):
+    """One IOC, with a simulator, for a number of axes."""
+
+    def __init__(self, args, axes):
+        self.args = args
+        self.axes = axes
+        self.sim = P6KSimulator(axes=axes, latency=args.latency / 1000.0, jitter=args.jitter / 1000.0)
+        self.sim.start()
+        self.ioc = None
+        self.startup = None
+
+    def start_ioc(self):
+        records = "".join([AXIS_RECORDS % {"prefix": PREFIX, "axis": axis, "controller": CONTROLLER,
+                                           "macros": MOTOR_MACROS}
+                           for axis in range(1, self.axes + 1)])
+        script = STARTUP % {"port": self.sim.port, "axes": self.axes, "moving": self.args.moving,
+                            "idle": self.args.idle, "controller": CONTROLLER, "records": records}
+        handle, self.startup = tempfile.mkstemp(suffix=".cmd", prefix="p6kbench")
+        os.write(handle, script.encode())
+        os.close(handle)
+
+        self.sim.record(True)
+        self.log = open(os.path.join(tempfile.gettempdir(), "p6kbench_ioc_%d.log" % self.axes), "w")
+        launch = time.time()
+        self.ioc = subprocess.Popen([self.args.ioc, self.startup], cwd=IOC_DIR,
+                                    stdin=subprocess.PIPE, stdout=self.log, stderr=subprocess.STDOUT)
+        pvs = [CONTROLLER + ":PollTime_RBV"] + [motor(axis) + ".DMOV" for axis in range(1, self.axes + 1)]
+        connect(pvs, timeout=60.0)
+        return time.time() - launch
+
+    def stop_ioc(self):
+        if self.ioc is not None:
+            try:
+                self.ioc.stdin.write(b"exit\n")
+                self.ioc.stdin.flush()
+            except IOError:
+                pass
+            for i in range(50):
+                if self.ioc.poll() is not None:
+                    break
+                time.sleep(0.1)
+            if self.ioc.poll() is None:
+                self.ioc.kill()
+            self.log.close()
+        if self.startup is not None:
+            os.remove(self.startup)
+
+    def poll_time(self):
+        samples = []
+        monitor = camonitor(CONTROLLER + ":PollTime_RBV", lambda value: samples.append(float(value)))
+        caput(CONTROLLER + ":StatsReset", 1, wait=True)
+        cothread.Sleep(self.args.window)
+        monitor.close()
+        buckets = list(caget(CONTROLLER + ":PollHist_RBV"))
+        result = summary(samples) or {}
+        result["hist_max"] = float(caget(CONTROLLER + ":PollTimeMax_RBV"))
+        result["hist_p50"] = hist_percentile(buckets, 0.5)
+        result["hist_p99"] = hist_percentile(buckets, 0.99)
+        result["hist_count"] = sum(buckets)
+        return result
+
+    def moves(self, dmov):
+        to_go = []
+        stop_to_dmov = []
+        position = 0
+        for i in range(self.args.moves):
+            position = MOVE_DISTANCE if position == 0 else 0
+            start = self.sim.command_count()
+            t0 = time.time()
+            caput(motor(1) + ".VAL", position, wait=False)
+            go = find_command(self.sim, start, "1GO")
+            if go is None:
+                print("ERROR: No GO command seen for move " + str(i), file=sys.stderr)
+                continue
+            to_go.append((go - t0) * 1000.0)
+            done = wait_dmov(dmov, [1], go)
+            if done is None:
+                print("ERROR: DMOV did not go to 1 for move " + str(i), file=sys.stderr)
+                continue
+            stop_to_dmov.append((done[1] - self.sim.controller.axes[0].end_time()) * 1000.0)
+            cothread.Sleep(0.2)
+        return summary(to_go), summary(stop_to_dmov)
+
+    def deferred(self, dmov):
+        fanout = []
+        axes = list(range(1, self.axes + 1))
+        position = 0
+        for i in range(self.args.moves):
+            position = MOVE_DISTANCE if position == 0 else 0
+            caput(CONTROLLER + ":Defer", 1, wait=True)
+            for axis in axes:
+                caput(motor(axis) + ".VAL", position, wait=False)
+            # Give the driver time to record the deferred positions
+            cothread.Sleep(0.5)
+            start = self.sim.command_count()
+            t0 = time.time()
+            caput(CONTROLLER + ":Defer", 0, wait=False)
+            go = find_command(self.sim, start, "GO1")
+            if go is None:
+                print("ERROR: No GO command seen for deferred move " + str(i), file=sys.stderr)
+                continue
+            fanout.append((go - t0) * 1000.0)
+            if wait_dmov(dmov, axes, go) is None:
+                print("ERROR: DMOV did not go to 1 for deferred move " + str(i), file=sys.stderr)
+            cothread.Sleep(0.2)
+        return summary(fanout)
+
+    def stops(self, dmov):
+        to_s = []
+        position = 0
+        for i in range(self.args.moves):
+            position = MOVE_DISTANCE if position == 0 else 0
+            start = self.sim.command_count()
+            caput(motor(1) + ".VAL", position, wait=False)
+            go = find_command(self.sim, start, "1GO")
+            if go is None:
+                print("ERROR: No GO command seen for stopped move " + str(i), file=sys.stderr)
+                continue
+            # Stop part way through the move, at a random point in the poll cycle
+            cothread.Sleep(0.05 + random.uniform(0.0, self.args.moving / 1000.0))
+            start = self.sim.command_count()
+            t0 = time.time()
+            caput(motor(1) + ".STOP", 1, wait=False)
+            stop = find_command(self.sim, start, "!1S")
+            if stop is None:
+                print("ERROR: No stop command seen for move " + str(i), file=sys.stderr)
+                continue
+            to_s.append((stop - t0) * 1000.0)
+            if wait_dmov(dmov, [1], stop) is None:
+                print("ERROR: DMOV did not go to 1 after stop " + str(i), file=sys.stderr)
+            cothread.Sleep(0.2)
+        return summary(to_s)
+
+    def measure(self):
+        result = {"axes": self.axes}
+        try:
+            result["startup_s"] = self.start_ioc()
+            result["startup_commands"] = self.sim.command_count()
+            # Let the first polls finish before measuring
+            cothread.Sleep(2.0)
+
+            dmov = dict([(axis, []) for axis in range(1, self.axes + 1)])
+            monitors = [camonitor(motor(axis) + ".DMOV",
+                                  lambda value, axis=axis: dmov[axis].append((value.timestamp, int(value))),
+                                  format=FORMAT_TIME)
+                        for axis in range(1, self.axes + 1)]
+
+            result["poll_ms"] = self.poll_time()
+            result["move_to_go_ms"], result["stop_to_dmov_ms"] = self.moves(dmov)
+            result["deferred_go_ms"] = self.deferred(dmov)
+            result["stop_to_s_ms"] = self.stops(dmov)
+
+            for m in monitors:
+                m.close()
+        finally:
+            self.stop_ioc()
+        return result
+
+
+def main():
+
+    parser = argparse.ArgumentParser(description="End to end driver benchmark with a simulated 6K")
+    parser.add_argument("--ioc", default=os.path.join(EXAMPLE, "bin", os.environ.get("EPICS_HOST_ARCH", "linux-x86_64"), "example"),
+                        help="IOC executable (default the example IOC)")
+    parser.add_argument("--axes", default="1,2,3,4,5,6,7,8", help="comma separated numbers of axes (default 1 to 8)")
+    parser.add_argument("--moves", type=int, default=10, help="number of moves to time (default 10)")
+    parser.add_argument("--latency", type=float, default=2.0, help="simulator reply latency in ms (default 2.0)")
+    parser.add_argument("--jitter", type=float, default=0.0, help="simulator random extra latency, up to this many ms")
+    parser.add_argument("--moving", type=int, default=100, help="moving poll period in ms (default 100)")
+    parser.add_argument("--idle", type=int, default=100, help="idle poll period in ms (default 100)")
+    parser.add_argument("--window", type=float, default=5.0, help="poll time measurement period in s (default 5)")
+    parser.add_argument("--output", help="write the JSON results to this file (default stdout)")
+    args = parser.parse_args()
+
+    if not os.path.exists(args.ioc):
+        print("ERROR: IOC executable " + args.ioc + " not found. Build the example IOC first.", file=sys.stderr)
+        sys.exit(1)
+
+    results = {
+        "time": time.strftime("%Y-%m-%dT%H:%M:%S"),
+        "config": {"latency_ms": args.latency, "jitter_ms": args.jitter, "moving_poll_ms": args.moving,
+                   "idle_poll_ms": args.idle, "moves": args.moves, "window_s": args.window},
+        "runs": [],
+    }
+
+    for axes in [int(a) for a in args.axes.split(",")]:
+        print("Running with " + str(axes) + " axes", file=sys.stderr)
+        results["runs"].append(Run(args, axes).measure())
+
+    text = json.dumps(results, indent=2, sort_keys=True)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(text + "\n")
+    else:
+        print(text)
+
+
+if __name__ == "__main__":
+        main()
@@ -0,0 +1,78 @@
+#!/usr/bin/python
+
+"""
+Benchmark the time taken for a command that the controller rejects,
+compared with one that it accepts. The driver returns as soon as either
+the > or the ? prompt arrives at the start of a line, so a rejected
+command should cost about the same as an accepted one (one round trip),
+rather than the comms timeout that it would cost if the driver waited
+for the > prompt.
+
+This uses the example IOC and the simulated controller in p6k_sim.py, in
+the same way as bench_e2e.py. Each command is written to the controller
+Command record with a completion callback, so the time measured includes
+the driver's transport and parser, and Channel Access. Valid commands get
+a *response followed by a > prompt, anything else gets an error message
+followed by a ? prompt.
+
+The IOC must already be built (make in the example directory).
+
+Usage: bench_error_reply.py [-h] [--ioc IOC] [--latency MS] [--jitter MS]
+                            [--count N]
+"""
+
+from __future__ import print_function
+
+import os
+import sys
+import time
+import argparse
+
+import cothread
+from cothread.catools import caget, caput
+
+from bench_e2e import Run, CONTROLLER, EXAMPLE
+
+
+def time_commands(command, count):
+    """The mean time (ms) for the Command record to complete, and the last response and error."""
+    start = time.time()
+    for i in range(count):
+        caput(CONTROLLER + ":Command", command, datatype=str, wait=True)
+    elapsed = (time.time() - start) * 1000.0 / count
+    return elapsed, caget(CONTROLLER + ":Response", datatype=str), caget(CONTROLLER + ":Error", datatype=str)
+
+
+def main():
+
+    parser = argparse.ArgumentParser(description="Time taken for a rejected command, through the IOC")
+    parser.add_argument("--ioc", default=os.path.join(EXAMPLE, "bin", os.environ.get("EPICS_HOST_ARCH", "linux-x86_64"), "example"),
+                        help="IOC executable (default the example IOC)")
+    parser.add_argument("--latency", type=float, default=1.0, help="simulator reply latency in ms (default 1.0)")
+    parser.add_argument("--jitter", type=float, default=0.0, help="simulator random extra latency, up to this many ms")
+    parser.add_argument("--moving", type=int, default=100, help="moving poll period in ms (default 100)")
+    parser.add_argument("--idle", type=int, default=1000, help="idle poll period in ms (default 1000)")
+    parser.add_argument("--count", type=int, default=20, help="number of each command (default 20)")
+    args = parser.parse_args()
+
+    if not os.path.exists(args.ioc):
+        print("ERROR: IOC executable " + args.ioc + " not found. Build the example IOC first.", file=sys.stderr)
+        sys.exit(1)
+
+    run = Run(args, 1)
+    try:
+        run.start_ioc()
+        cothread.Sleep(2.0)
+        timeout = float(caget(CONTROLLER + ":TimeoutMax"))
+        print("Command time (ms), round trip time " + str(args.latency) + " ms, timeout " +
+              str(timeout) + " s, " + str(args.count) + " commands")
+        print("%10s %12s  %s" % ("command", "time", "response"))
+        for command in ("1TPC", "1XYZ"):
+            elapsed, response, error = time_commands(command, args.count)
+            print("%10s %12.2f  %s" % (command, elapsed, (response + " " + error).strip()))
+    finally:
+        run.stop_ioc()
+
+
+if __name__ == "__main__":
+        main()
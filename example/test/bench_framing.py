@@ -0,0 +1,89 @@
+#!/usr/bin/python
+
+"""
+Compare the number of characters per poll cycle with the controller's
+default framing and the driver's compact framing (EOT0,0,0 and EOL13,0,0),
+for a number of axes.
+
+This uses the example IOC and the simulated controller in p6k_sim.py, in
+the same way as bench_e2e.py, so the characters counted are the ones the
+driver actually sends and receives (PollBytes_RBV). EnableAxisSchedule is
+turned off and the TSS, TLIM, TIN and TOUT queries are sent every poll, so
+each cycle is the bulk status queries (TAS, TPC and TPE once for all axes)
+and the controller queries. The time each cycle would take to transmit on
+a serial link, and the driver's poll cycle time, are also shown.
+
+The IOC must already be built (make in the example directory).
+
+Usage: bench_framing.py [-h] [--ioc IOC] [--axes AXES] [--baud BAUD]
+                        [--latency MS] [--window S]
+"""
+
+from __future__ import print_function
+
+import os
+import sys
+import argparse
+
+import cothread
+from cothread.catools import caget, caput
+
+from bench_e2e import Run, CONTROLLER, EXAMPLE
+
+QUERIES = ["TSS", "TLIM", "TIN", "TOUT"]
+
+
+def measure(run, compact):
+    """The mean characters per poll cycle and poll time (ms), with compact framing on or off."""
+    caput(CONTROLLER + ":CompactFraming", compact, wait=True)
+    # Let the polls settle with the new setting
+    cothread.Sleep(1.0)
+    result = run.poll_time()
+    # PollBytes_RBV is updated once a second, so wait for one more update
+    cothread.Sleep(1.5)
+    return float(caget(CONTROLLER + ":PollBytes_RBV")), result.get("mean", float("nan"))
+
+
+def main():
+
+    parser = argparse.ArgumentParser(description="Characters per poll cycle, default and compact framing")
+    parser.add_argument("--ioc", default=os.path.join(EXAMPLE, "bin", os.environ.get("EPICS_HOST_ARCH", "linux-x86_64"), "example"),
+                        help="IOC executable (default the example IOC)")
+    parser.add_argument("--axes", default="1,2,4,8", help="comma separated numbers of axes (default 1,2,4,8)")
+    parser.add_argument("--baud", type=float, default=9600.0, help="serial baud rate for the transmit time (default 9600)")
+    parser.add_argument("--latency", type=float, default=1.0, help="simulator reply latency in ms (default 1.0)")
+    parser.add_argument("--jitter", type=float, default=0.0, help="simulator random extra latency, up to this many ms")
+    parser.add_argument("--moving", type=int, default=100, help="moving poll period in ms (default 100)")
+    parser.add_argument("--idle", type=int, default=100, help="idle poll period in ms (default 100)")
+    parser.add_argument("--window", type=float, default=5.0, help="measurement period for each setting in s (default 5)")
+    args = parser.parse_args()
+
+    if not os.path.exists(args.ioc):
+        print("ERROR: IOC executable " + args.ioc + " not found. Build the example IOC first.", file=sys.stderr)
+        sys.exit(1)
+
+    print("Characters per poll cycle, time at " + str(int(args.baud)) + " baud (ms), and driver poll time (ms)")
+    print("%5s %10s %10s %8s %10s %10s %10s %10s" % ("axes", "default", "compact", "saved",
+          "default ms", "compact ms", "poll ms", "poll ms"))
+    for axes in [int(a) for a in args.axes.split(",")]:
+        run = Run(args, axes)
+        try:
+            run.start_ioc()
+            cothread.Sleep(2.0)
+            caput(CONTROLLER + ":EnableAxisSchedule", 0, wait=True)
+            caput(CONTROLLER + ":EnableBulkStatus", 1, wait=True)
+            for query in QUERIES:
+                caput(CONTROLLER + ":" + query + "Tier", 0, wait=True)
+            default, default_poll = measure(run, 0)
+            compact, compact_poll = measure(run, 1)
+        finally:
+            run.stop_ioc()
+        # 10 bits per character with 8N1
+        print("%5d %10.1f %10.1f %7.1f%% %10.2f %10.2f %10.2f %10.2f" % (axes, default, compact,
+              100.0 * (default - compact) / default,
+              default * 10000.0 / args.baud, compact * 10000.0 / args.baud,
+              default_poll, compact_poll))
+
+
+if __name__ == "__main__":
+        main()
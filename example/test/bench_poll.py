@@ -0,0 +1,131 @@
+#!/usr/bin/python
+
+"""
+Benchmark the driver's poll cycle time for a number of axes, comparing
+the per-axis status queries (nTAS, nTPC and nTPE for each axis) with the
+bulk status queries (TAS, TPC and TPE once for all axes).
+
+This uses the example IOC and the simulated controller in p6k_sim.py, in
+the same way as bench_e2e.py, so the time measured is the driver's own
+poll cycle (PollTime_RBV), including its transport and parser.
+EnableAxisSchedule is turned off, so that every axis is read every poll.
+For each setting of EnableBulkStatus the number of commands the
+simulator receives per poll cycle is also shown.
+
+With --cruise, the axis status queries (TAS, TPC and TPE, bulk or per-axis)
+the simulator receives per second during a long move of axis 1 are counted
+instead, with the default settings (bulk status and the axis schedule on),
+with CruisePollPeriod set to 0 (every poll) and to its default.
+
+The IOC must already be built (make in the example directory).
+
+Usage: bench_poll.py [-h] [--ioc IOC] [--axes AXES] [--latency MS]
+                     [--jitter MS] [--window S] [--cruise]
+"""
+
+from __future__ import print_function
+
+import os
+import sys
+import argparse
+
+import cothread
+from cothread.catools import caget, caput
+
+from bench_e2e import Run, CONTROLLER, EXAMPLE, motor
+from p6k_sim import split_command
+
+STATUS_QUERIES = ("TAS", "TPC", "TPE")
+# The simulated axes move at 50000 steps/s (see bench_e2e.py)
+VELOCITY = 50000.0
+
+
+def measure(run, bulk):
+    """The mean poll time (ms) and the commands per poll cycle, with bulk status on or off."""
+    caput(CONTROLLER + ":EnableBulkStatus", bulk, wait=True)
+    # Let the polls settle with the new setting
+    cothread.Sleep(1.0)
+    start = run.sim.command_count()
+    result = run.poll_time()
+    commands = run.sim.command_count() - start
+    # The poll rate since the statistics were reset at the start of poll_time
+    cycles = max(1.0, float(caget(CONTROLLER + ":PollRate_RBV")) * run.args.window)
+    return result.get("mean", float("nan")), commands / cycles
+
+
+def status_queries(lines):
+    """The number of axis status queries in a list of (time, command line)."""
+    count = 0
+    for t, line in lines:
+        for command in line.split(":"):
+            if split_command(command.lstrip("!"))[1] in STATUS_QUERIES:
+                count += 1
+    return count
+
+
+def cruise(run, period):
+    """The axis status queries per second during a long move of axis 1, for a cruise poll period."""
+    caput(motor(1) + ":CruisePollPeriod", period, wait=True)
+    position = float(caget(motor(1) + ".RBV"))
+    # Long enough to still be cruising at the end of the window
+    caput(motor(1) + ".VAL", position + VELOCITY * (run.args.window + 3.0), wait=False)
+    cothread.Sleep(1.0)
+    start = run.sim.command_count()
+    cothread.Sleep(run.args.window)
+    queries = status_queries(run.sim.commands(start))
+    caput(motor(1) + ".STOP", 1, wait=True)
+    cothread.Sleep(1.0)
+    return queries / run.args.window
+
+
+def main():
+
+    parser = argparse.ArgumentParser(description="Driver poll cycle time, per-axis and bulk status")
+    parser.add_argument("--ioc", default=os.path.join(EXAMPLE, "bin", os.environ.get("EPICS_HOST_ARCH", "linux-x86_64"), "example"),
+                        help="IOC executable (default the example IOC)")
+    parser.add_argument("--axes", default="1,2,4,8", help="comma separated numbers of axes (default 1,2,4,8)")
+    parser.add_argument("--latency", type=float, default=1.0, help="simulator reply latency in ms (default 1.0)")
+    parser.add_argument("--jitter", type=float, default=0.0, help="simulator random extra latency, up to this many ms")
+    parser.add_argument("--moving", type=int, default=100, help="moving poll period in ms (default 100)")
+    parser.add_argument("--idle", type=int, default=100, help="idle poll period in ms (default 100)")
+    parser.add_argument("--window", type=float, default=5.0, help="measurement period for each setting in s (default 5)")
+    parser.add_argument("--cruise", action="store_true", help="count the status queries during a long move instead")
+    args = parser.parse_args()
+
+    if not os.path.exists(args.ioc):
+        print("ERROR: IOC executable " + args.ioc + " not found. Build the example IOC first.", file=sys.stderr)
+        sys.exit(1)
+
+    if args.cruise:
+        print("Axis status queries per second while axis 1 cruises, moving poll period " + str(args.moving) + " ms")
+        print("%5s %12s %12s" % ("axes", "every poll", "cruise"))
+        for axes in [int(a) for a in args.axes.split(",")]:
+            run = Run(args, axes)
+            try:
+                run.start_ioc()
+                cothread.Sleep(2.0)
+                every = cruise(run, 0.0)
+                cruising = cruise(run, 0.5)
+            finally:
+                run.stop_ioc()
+            print("%5d %12.1f %12.1f" % (axes, every, cruising))
+        return
+
+    print("Driver poll cycle time (ms) and commands per poll, round trip time " + str(args.latency) + " ms")
+    print("%5s %12s %12s %8s %12s %12s" % ("axes", "per-axis", "bulk", "speedup", "per-axis cmd", "bulk cmd"))
+    for axes in [int(a) for a in args.axes.split(",")]:
+        run = Run(args, axes)
+        try:
+            run.start_ioc()
+            cothread.Sleep(2.0)
+            caput(CONTROLLER + ":EnableAxisSchedule", 0, wait=True)
+            per_axis, per_axis_cmds = measure(run, 0)
+            bulk, bulk_cmds = measure(run, 1)
+        finally:
+            run.stop_ioc()
+        print("%5d %12.2f %12.2f %8.2f %12.1f %12.1f" % (axes, per_axis, bulk,
+              per_axis / bulk, per_axis_cmds, bulk_cmds))
+
+
+if __name__ == "__main__":
+        main()
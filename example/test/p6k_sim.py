@@ -0,0 +1,585 @@
+#!/usr/bin/python
+
+"""
+Simulated Parker 6K controller, for running the driver and the benchmarks
+without a real controller.
+
+It listens on a TCP port and implements the subset of the 6K command
+language that the driver uses:
+
+  ECHO, COMEXC, EOT, EOL, ERRLVL, TREV, TCMDER, TSS, TLIM, TIN, TOUT, OUT
+  TAS, TPC, TPE, TASX (per axis, eg. 1TAS, or for all axes, eg. TAS)
+  MA, V, A, AA, AD, ADA, D, GO, HOM, HOMV, HOMA, HOMAA, HOMAD, HOMADA
+  S, PSET, PESET, DRIVE, and the axis setup parameters read at startup
+  DEF and END (program definition, where the prompt changes to -)
+  WRITE"text" (sends the text back, used by the driver to resynchronise)
+
+Commands can be combined with : and prefixed with ! (immediate).
+Successful commands end with a > prompt and errors with a ? prompt, in
+the same format as the real controller with ECHO0. Each response body
+is followed by the EOT and EOL characters (\r and \r\n by default), and
+a command with no response by EOL, so the driver's compact framing
+(EOT0,0,0 and EOL13,0,0) can be compared with the default. A prompt is
+always at the start of a line, so an empty reply is EOL and the prompt,
+never a bare prompt. With the default EOL the > prompt is followed by a
+second one, so a reply ends \r\r\n> \n> like the real controller's.
+
+Each axis has a simple trapezoidal profile (no S curve). Positions are
+in steps, and velocities and accelerations are in revs/s and revs/s/s
+using DRES, like the real controller. The encoder position is the step
+position scaled by ERES/DRES.
+
+The reply latency, jitter and the fraction of replies that are dropped,
+or sent late (after the replies that follow them would normally have been
+sent), can be set on the command line, or when the simulator is used from
+another script (see bench_poll.py). When used from another script, the
+arrival time of each command line can be recorded (see bench_e2e.py).
+
+Usage: p6k_sim.py [-h] [--host HOST] [--port PORT] [--axes AXES]
+                  [--servo] [--latency MS] [--jitter MS] [--drop FRACTION]
+                  [--late FRACTION] [--late-delay MS] [--verbose]
+
+To use it with the example IOC, change the drvAsynIPPortConfigure line
+in st.cmd to point at the simulator, for example:
+
+  drvAsynIPPortConfigure("6K","127.0.0.1:4001",0,0,0)
+"""
+
+from __future__ import print_function
+
+import sys
+import time
+import random
+import socket
+import argparse
+import threading
+
+MAX_AXES = 8
+
+# TAS bit positions (position in the string, including the underscores).
+# These match the P6K_TAS_ constants in parker6kAxis.cpp.
+TAS_MOVING = 0
+TAS_DIRECTION = 1
+TAS_ACCELERATING = 2
+TAS_ATVELOCITY = 3
+TAS_HOMED = 5
+TAS_ABSOLUTE = 6
+TAS_DRIVE = 15
+TAS_TARGETZONE = 28
+
+# TSS bit positions (position in the string, including the underscores)
+TSS_SYSTEMREADY = 0
+
+# Parameters read or written by the driver that have no effect on the model.
+# The value is the default returned to a query.
+AXIS_PARAMS = {
+    "AXSDEF": 0, "CMDDIR": 0, "DRFEN": 0, "ENCCNT": 0, "ENCPOL": 0,
+    "ESK": 0, "ESTALL": 0, "LH": 0, "LS": 0, "LSPOS": 0, "LSNEG": 0,
+    "DRES": 25000, "ERES": 4000, "DRIVE": 1,
+    "V": 1.0, "A": 10.0, "AA": 5.0, "AD": 10.0, "ADA": 10.0, "MA": 1,
+    "HOMV": 1.0, "HOMA": 10.0, "HOMAA": 5.0, "HOMAD": 10.0, "HOMADA": 10.0,
+}
+
+# Parameters that are reported with a fixed number of decimal places
+FLOAT_PARAMS = ("V", "A", "AA", "AD", "ADA", "HOMV", "HOMA", "HOMAA", "HOMAD", "HOMADA",
+                "LSPOS", "LSNEG")
+
+ERROR_UNDEFINED = "UNDEFINED LABEL"
+ERROR_DATA = "INVALID DATA"
+ERROR_DRIVE = "DRIVE SHUTDOWN"
+
+
+def bits(values):
+    """Format a list of booleans as a 6K bit string, eg. 0100_0000."""
+    chars = ["1" if v else "0" for v in values]
+    return "_".join(["".join(chars[i:i + 4]) for i in range(0, len(chars), 4)])
+
+
+def set_bit(chars, position, value):
+    """Set a bit in a list of characters made by bits(). position includes the underscores."""
+    chars[position] = "1" if value else "0"
+
+
+class Profile(object):
+    """A move, as a list of phases of constant acceleration."""
+
+    def __init__(self, start_time, position):
+        self.start_time = start_time
+        self.position = position
+        self.phases = []
+
+    def add(self, duration, velocity, accel):
+        if duration > 0:
+            self.phases.append((duration, velocity, accel))
+
+    def duration(self):
+        return sum([p[0] for p in self.phases])
+
+    def state(self, now):
+        """Return (position, velocity, accel, done) at a time."""
+        t = now - self.start_time
+        pos = self.position
+        for duration, vel, accel in self.phases:
+            if t < duration:
+                return pos + vel * t + 0.5 * accel * t * t, vel + accel * t, accel, False
+            pos += vel * duration + 0.5 * accel * duration * duration
+            t -= duration
+        return pos, 0.0, 0.0, True
+
+    @staticmethod
+    def trapezoid(start_time, start, target, vmax, accel, decel):
+        """A move from rest to rest. Triangular if there is no time at vmax."""
+        profile = Profile(start_time, start)
+        distance = abs(target - start)
+        sign = 1.0 if target >= start else -1.0
+        if distance == 0 or vmax <= 0 or accel <= 0 or decel <= 0:
+            profile.position = target
+            return profile
+        ramp = vmax * vmax / (2.0 * accel) + vmax * vmax / (2.0 * decel)
+        if ramp > distance:
+            vmax = (2.0 * distance * accel * decel / (accel + decel)) ** 0.5
+            ramp = distance
+        profile.add(vmax / accel, 0.0, sign * accel)
+        profile.add((distance - ramp) / vmax, sign * vmax, 0.0)
+        profile.add(vmax / decel, sign * vmax, -sign * decel)
+        return profile
+
+    @staticmethod
+    def stop(start_time, start, velocity, decel):
+        """Decelerate to rest from the current velocity."""
+        profile = Profile(start_time, start)
+        if velocity != 0 and decel > 0:
+            sign = 1.0 if velocity > 0 else -1.0
+            profile.add(abs(velocity) / decel, velocity, -sign * decel)
+        return profile
+
+
+class Axis(object):
+    """One simulated axis."""
+
+    def __init__(self, number, servo):
+        self.number = number
+        self.params = dict(AXIS_PARAMS)
+        self.params["AXSDEF"] = 1 if servo else 0
+        self.distance = 0
+        self.offset = 0.0
+        self.encoder_offset = 0.0
+        self.homed = False
+        self.homing = False
+        self.profile = Profile(0.0, 0.0)
+        self.direction = 1.0
+
+    def steps_per_rev(self):
+        return float(self.params["DRES"]) or 1.0
+
+    def state(self, now):
+        pos, vel, accel, done = self.profile.state(now)
+        if done and self.homing:
+            self.homing = False
+            self.homed = True
+            self.profile = Profile(now, 0.0)
+            self.offset = 0.0
+            pos = 0.0
+        return pos, vel, accel, done
+
+    def position(self, now):
+        return int(round(self.state(now)[0] + self.offset))
+
+    def encoder(self, now):
+        scale = float(self.params["ERES"]) / self.steps_per_rev()
+        return int(round((self.state(now)[0] + self.offset) * scale + self.encoder_offset))
+
+    def moving(self, now):
+        return not self.state(now)[3]
+
+    def end_time(self):
+        """The time that the current move finishes (or finished)."""
+        return self.profile.start_time + self.profile.duration()
+
+    def go(self, now):
+        """Start a move using the current MA, D, V, A and AD."""
+        if int(self.params["DRIVE"]) == 0:
+            return ERROR_DRIVE
+        # The real controller blends a new move into one that is running.
+        # Starting again from the current position is close enough here.
+        pos = self.state(now)[0]
+        scale = self.steps_per_rev()
+        target = self.distance - self.offset
+        if int(self.params["MA"]) == 0:
+            target = pos + self.distance
+        self.direction = 1.0 if target >= pos else -1.0
+        self.profile = Profile.trapezoid(now, pos, target, float(self.params["V"]) * scale,
+                                         float(self.params["A"]) * scale, float(self.params["AD"]) * scale)
+        return None
+
+    def home(self, now, reverse):
+        """Move to the home switch, which is where the axis started, then zero the position."""
+        if int(self.params["DRIVE"]) == 0:
+            return ERROR_DRIVE
+        pos = self.state(now)[0]
+        scale = self.steps_per_rev()
+        self.direction = -1.0 if reverse else 1.0
+        self.homed = False
+        self.homing = True
+        self.profile = Profile.trapezoid(now, pos, -self.offset, float(self.params["HOMV"]) * scale,
+                                         float(self.params["HOMA"]) * scale, float(self.params["HOMAD"]) * scale)
+        return None
+
+    def stop(self, now):
+        pos, vel, accel, done = self.state(now)
+        self.homing = False
+        self.profile = Profile.stop(now, pos, vel, float(self.params["AD"]) * self.steps_per_rev())
+
+    def set_position(self, now, value):
+        self.offset = value - self.state(now)[0]
+
+    def set_encoder(self, now, value):
+        scale = float(self.params["ERES"]) / self.steps_per_rev()
+        self.encoder_offset = value - (self.state(now)[0] + self.offset) * scale
+
+    def tas(self, now):
+        pos, vel, accel, done = self.state(now)
+        status = list(bits([False] * 32))
+        set_bit(status, TAS_MOVING, not done)
+        set_bit(status, TAS_DIRECTION, self.direction < 0)
+        set_bit(status, TAS_ACCELERATING, (not done) and accel != 0)
+        set_bit(status, TAS_ATVELOCITY, (not done) and accel == 0)
+        set_bit(status, TAS_HOMED, self.homed)
+        set_bit(status, TAS_ABSOLUTE, int(self.params["MA"]) != 0)
+        set_bit(status, TAS_DRIVE, int(self.params["DRIVE"]) == 0)
+        set_bit(status, TAS_TARGETZONE, done and int(self.params["AXSDEF"]) == 1)
+        return "".join(status)
+
+
+class Controller(object):
+    """The state of the simulated controller, shared by all connections."""
+
+    def __init__(self, axes=2, servo=False):
+        self.lock = threading.Lock()
+        self.axes = [Axis(i + 1, servo) for i in range(axes)]
+        self.outputs = [False] * 32
+        self.inputs = [False] * 32
+        self.last_error = ""
+        self.programs = {}
+
+    def axis_value(self, axis, name, now):
+        if name == "TAS":
+            return axis.tas(now)
+        if name == "TPC":
+            return "%+d" % axis.position(now)
+        if name == "TPE":
+            return "%+d" % axis.encoder(now)
+        value = axis.params[name]
+        if name in FLOAT_PARAMS:
+            return "%.4f" % float(value)
+        return "%d" % int(value)
+
+    def command(self, axis_no, name, arg, now):
+        """
+        Run one command. Return (reply, error). reply is the body of a
+        response, or None if there is no response.
+        """
+        axes = self.axes
+        if axis_no is not None:
+            if axis_no < 1 or axis_no > len(self.axes):
+                return None, ERROR_DATA
+            axes = [self.axes[axis_no - 1]]
+        prefix = "" if axis_no is None else str(axis_no)
+
+        if name in ("ECHO", "COMEXC", "EOT", "EOL", "ERRLVL"):
+            return None, None
+        if name == "TREV":
+            return "TREV92-016740-01-5.3.0 6K" + str(MAX_AXES), None
+        if name == "TCMDER":
+            return "TCMDER" + self.last_error, None
+        if name == "TSS":
+            status = [False] * 32
+            status[TSS_SYSTEMREADY] = True
+            return "TSS" + bits(status), None
+        if name == "TLIM":
+            return "TLIM" + "_".join(["000"] * len(self.axes)), None
+        if name == "TIN":
+            return "TIN" + bits(self.inputs), None
+        if name == "TOUT":
+            return "TOUT" + bits(self.outputs), None
+        if name == "OUT":
+            for i, c in enumerate(arg.replace("_", "")[:32]):
+                if c in "01":
+                    self.outputs[i] = (c == "1")
+            return None, None
+
+        if name in ("TAS", "TPC", "TPE"):
+            values = [self.axis_value(axis, name, now) for axis in axes]
+            return prefix + name + ",".join(values), None
+        if name == "TASX":
+            values = [bits([False] * 32) for axis in axes]
+            return prefix + name + ",".join(values), None
+
+        if name == "GO":
+            if axis_no is None:
+                mask = arg if arg else "1" * len(self.axes)
+                axes = [self.axes[i] for i, c in enumerate(mask[:len(self.axes)]) if c == "1"]
+            for axis in axes:
+                error = axis.go(now)
+                if error:
+                    return None, error
+            return None, None
+        if name == "S":
+            for axis in axes:
+                axis.stop(now)
+            return None, None
+        if name == "HOM":
+            for axis in axes:
+                error = axis.home(now, arg == "1")
+                if error:
+                    return None, error
+            return None, None
+
+        if name in ("D", "PSET", "PESET"):
+            if not arg:
+                if name == "D":
+                    return prefix + "D" + ",".join(["%+d" % axis.distance for axis in axes]), None
+                return None, ERROR_DATA
+            try:
+                value = int(float(arg))
+            except ValueError:
+                return None, ERROR_DATA
+            for axis in axes:
+                if name == "D":
+                    axis.distance = value
+                elif name == "PSET":
+                    axis.set_position(now, value)
+                else:
+                    axis.set_encoder(now, value)
+            return None, None
+
+        if name in AXIS_PARAMS:
+            if not arg:
+                values = [self.axis_value(axis, name, now) for axis in axes]
+                return prefix + name + ",".join(values), None
+            try:
+                value = float(arg) if name in FLOAT_PARAMS else int(arg)
+            except ValueError:
+                return None, ERROR_DATA
+            for axis in axes:
+                axis.params[name] = value
+            return None, None
+
+        return None, ERROR_UNDEFINED
+
+
+def split_command(command):
+    """Split a command into (axis, name, argument). The axis is None if there isn't one."""
+    i = 0
+    while i < len(command) and command[i].isdigit():
+        i += 1
+    axis = int(command[:i]) if i > 0 else None
+    j = i
+    while j < len(command) and command[j].isalpha():
+        j += 1
+    return axis, command[i:j].upper(), command[j:]
+
+
+class Connection(threading.Thread):
+    """One client connection. The 6K only has one Ethernet command channel,
+    but more than one connection is allowed so that the driver can reconnect."""
+
+    def __init__(self, sim, conn):
+        threading.Thread.__init__(self)
+        self.daemon = True
+        self.sim = sim
+        self.conn = conn
+        self.echo = False
+        self.eot = "\r"
+        self.eol = "\r\n"
+        self.program = None
+
+    def prompt(self):
+        """The success prompt. With the default EOL it is sent twice."""
+        if self.eol == "\r\n":
+            return "> \n>"
+        return ">"
+
+    def reply(self, line):
+        """Run a command line. Return the text to send back."""
+        controller = self.sim.controller
+        stripped = line.strip()
+
+        if self.program is not None:
+            if stripped.upper().startswith("END"):
+                controller.programs[self.program[0]] = self.program[1:]
+                self.program = None
+                return self.eol + self.prompt()
+            self.program.append(stripped)
+            return self.eol + "-"
+
+        if stripped.upper().startswith("DEF"):
+            self.program = [stripped[3:].strip()]
+            return self.eol + "-"
+
+        body = []
+        error = None
+        framing = {}
+        now = time.time()
+        with controller.lock:
+            for command in [c.strip() for c in stripped.split(":")]:
+                if command.startswith("!"):
+                    command = command[1:]
+                if not command:
+                    continue
+                axis, name, arg = split_command(command)
+                if name == "WRITE":
+                    body.append(arg.strip('"'))
+                    continue
+                if name == "ECHO":
+                    self.echo = (arg != "0")
+                if name in ("EOT", "EOL"):
+                    try:
+                        chars = "".join([chr(int(c)) for c in arg.split(",") if int(c) != 0])
+                    except ValueError:
+                        error = ERROR_DATA
+                        break
+                    framing[name] = chars
+                response, error = controller.command(axis, name, arg, now)
+                if error is not None:
+                    controller.last_error = command
+                    break
+                if response is not None:
+                    body.append("*" + response + self.eot + self.eol)
+
+        if error is not None:
+            return "*" + error + self.eol + "?"
+        if not body:
+            response = self.eol + self.prompt()
+        else:
+            response = "".join(body) + self.prompt()
+        # New EOT and EOL characters apply from the next reply
+        self.eot = framing.get("EOT", self.eot)
+        self.eol = framing.get("EOL", self.eol)
+        return response
+
+    def run(self):
+        self.conn.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        data = ""
+        while True:
+            try:
+                chunk = self.conn.recv(1024)
+            except socket.error:
+                break
+            if not chunk:
+                break
+            data += chunk.decode()
+            while "\n" in data or "\r" in data:
+                end = min([i for i in (data.find("\n"), data.find("\r")) if i >= 0])
+                line, data = data[:end], data[end + 1:]
+                if not line.strip():
+                    continue
+                self.sim.record_command(line.strip())
+                response = self.reply(line)
+                if self.sim.verbose:
+                    print(line.strip() + " -> " + repr(response))
+                if self.echo:
+                    response = line + "\r\n" + response
+                delay = self.sim.latency + random.uniform(0.0, self.sim.jitter)
+                if delay > 0:
+                    time.sleep(delay)
+                if random.random() < self.sim.drop:
+                    continue
+                if random.random() < self.sim.late:
+                    time.sleep(self.sim.late_delay)
+                try:
+                    self.conn.sendall(response.encode())
+                except socket.error:
+                    break
+        self.conn.close()
+
+
+class P6KSimulator(threading.Thread):
+    """
+    The simulated controller. Call start() to accept connections on a background
+    thread. If port is 0 a free port is chosen, and can be read from the port attribute.
+    latency and jitter are in seconds. drop is the fraction of replies that are not sent.
+    late is the fraction of replies that are delayed by an extra late_delay seconds.
+    """
+
+    def __init__(self, host="127.0.0.1", port=0, axes=2, servo=False,
+                 latency=0.0, jitter=0.0, drop=0.0, verbose=False, late=0.0, late_delay=0.5):
+        threading.Thread.__init__(self)
+        self.daemon = True
+        self.controller = Controller(axes, servo)
+        self.latency = latency
+        self.jitter = jitter
+        self.drop = drop
+        self.late = late
+        self.late_delay = late_delay
+        self.verbose = verbose
+        self.history = []
+        self.recording = False
+        self.history_lock = threading.Lock()
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.sock.bind((host, port))
+        self.sock.listen(4)
+        self.port = self.sock.getsockname()[1]
+
+    def record(self, on):
+        """Start or stop recording the time that each command line arrives."""
+        with self.history_lock:
+            self.recording = on
+
+    def record_command(self, line):
+        with self.history_lock:
+            if self.recording:
+                self.history.append((time.time(), line))
+
+    def commands(self, start=0):
+        """Return a copy of the recorded (time, command line) list, from index start."""
+        with self.history_lock:
+            return list(self.history[start:])
+
+    def command_count(self):
+        with self.history_lock:
+            return len(self.history)
+
+    def run(self):
+        while True:
+            conn, addr = self.sock.accept()
+            if self.verbose:
+                print("Connection from " + str(addr))
+            Connection(self, conn).start()
+
+
+def main():
+
+    parser = argparse.ArgumentParser(description="Simulated Parker 6K controller")
+    parser.add_argument("--host", default="0.0.0.0", help="address to listen on (default 0.0.0.0)")
+    parser.add_argument("--port", type=int, default=4001, help="TCP port (default 4001)")
+    parser.add_argument("--axes", type=int, default=2, help="number of axes, 1 to 8 (default 2)")
+    parser.add_argument("--servo", action="store_true", help="simulate servo axes (default stepper)")
+    parser.add_argument("--latency", type=float, default=1.0, help="reply latency in ms (default 1.0)")
+    parser.add_argument("--jitter", type=float, default=0.0, help="random extra latency, up to this many ms")
+    parser.add_argument("--drop", type=float, default=0.0, help="fraction of replies to drop (0 to 1)")
+    parser.add_argument("--late", type=float, default=0.0, help="fraction of replies to send late (0 to 1)")
+    parser.add_argument("--late-delay", type=float, default=500.0, help="extra latency of a late reply in ms (default 500)")
+    parser.add_argument("--verbose", action="store_true", help="print each command and reply")
+    args = parser.parse_args()
+
+    if args.axes < 1 or args.axes > MAX_AXES:
+        print("ERROR: --axes must be between 1 and " + str(MAX_AXES))
+        sys.exit(1)
+
+    sim = P6KSimulator(args.host, args.port, args.axes, args.servo,
+                       args.latency / 1000.0, args.jitter / 1000.0, args.drop, args.verbose,
+                       args.late, args.late_delay / 1000.0)
+    sim.start()
+    print("Simulated 6K with " + str(args.axes) + " axes listening on " + args.host + ":" + str(sim.port))
+
+    try:
+        while True:
+            time.sleep(1.0)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+        main()
@@ -24,37 +24,38 @@
 #include <iocsh.h>
 
 #include "asynOctetSyncIO.h"
-#include "asynInt32SyncIO.h"
 
 #include "parker6kController.h"
+#include "parker6kProfile.h"
 #include <iostream>
 #include <limits>
 using std::cout;
 using std::endl;
 
-/* TAS Status Bits (position in char array, not TAS bit position) */
+/* TAS Status Bits (bit number in the mask from p6kParser::toMask, which is the TAS bit number minus 1) */
 const epicsUInt32 p6kAxis::P6K_TAS_MOVING_        = 0;
 const epicsUInt32 p6kAxis::P6K_TAS_DIRECTION_     = 1;
 const epicsUInt32 p6kAxis::P6K_TAS_ACCELERATING_  = 2;
 const epicsUInt32 p6kAxis::P6K_TAS_ATVELOCITY_    = 3;
-const epicsUInt32 p6kAxis::P6K_TAS_HOMED_         = 5;
-const epicsUInt32 p6kAxis::P6K_TAS_ABSOLUTE_      = 6;
-const epicsUInt32 p6kAxis::P6K_TAS_CONTINUOUS_    = 7;
-const epicsUInt32 p6kAxis::P6K_TAS_JOG_           = 8;
-const epicsUInt32 p6kAxis::P6K_TAS_JOYSTICK_      = 10;
-const epicsUInt32 p6kAxis::P6K_TAS_STALL_         = 13;
-const epicsUInt32 p6kAxis::P6K_TAS_DRIVE_         = 15;
-const epicsUInt32 p6kAxis::P6K_TAS_DRIVEFAULT_    = 16;
-const epicsUInt32 p6kAxis::P6K_TAS_POSLIM_        = 17;
-const epicsUInt32 p6kAxis::P6K_TAS_NEGLIM_        = 18;
-const epicsUInt32 p6kAxis::P6K_TAS_POSLIMSOFT_    = 20;
-const epicsUInt32 p6kAxis::P6K_TAS_NEGLIMSOFT_    = 21;
-const epicsUInt32 p6kAxis::P6K_TAS_POSERROR_      = 27;
-const epicsUInt32 p6kAxis::P6K_TAS_TARGETZONE_    = 28;
-const epicsUInt32 p6kAxis::P6K_TAS_TARGETTIMEOUT_ = 30;
-const epicsUInt32 p6kAxis::P6K_TAS_GOWHENPEND_    = 31;
-const epicsUInt32 p6kAxis::P6K_TAS_MOVEPEND_      = 33; 
-const epicsUInt32 p6kAxis::P6K_TAS_PREEMPT_       = 36;
+const epicsUInt32 p6kAxis::P6K_TAS_HOMED_         = 4;
+const epicsUInt32 p6kAxis::P6K_TAS_ABSOLUTE_      = 5;
+const epicsUInt32 p6kAxis::P6K_TAS_CONTINUOUS_    = 6;
+const epicsUInt32 p6kAxis::P6K_TAS_JOG_           = 7;
+const epicsUInt32 p6kAxis::P6K_TAS_JOYSTICK_      = 8;
+const epicsUInt32 p6kAxis::P6K_TAS_STALL_         = 11;
+const epicsUInt32 p6kAxis::P6K_TAS_DRIVE_         = 12;
+const epicsUInt32 p6kAxis::P6K_TAS_DRIVEFAULT_    = 13;
+const epicsUInt32 p6kAxis::P6K_TAS_POSLIM_        = 14;
+const epicsUInt32 p6kAxis::P6K_TAS_NEGLIM_        = 15;
+const epicsUInt32 p6kAxis::P6K_TAS_POSLIMSOFT_    = 16;
+const epicsUInt32 p6kAxis::P6K_TAS_NEGLIMSOFT_    = 17;
+const epicsUInt32 p6kAxis::P6K_TAS_POSERROR_      = 22;
+const epicsUInt32 p6kAxis::P6K_TAS_TARGETZONE_    = 23;
+const epicsUInt32 p6kAxis::P6K_TAS_TARGETTIMEOUT_ = 24;
+const epicsUInt32 p6kAxis::P6K_TAS_GOWHENPEND_    = 25;
+const epicsUInt32 p6kAxis::P6K_TAS_MOVEPEND_      = 27;
+const epicsUInt32 p6kAxis::P6K_TAS_PREEMPT_       = 29;
+
 
 const epicsUInt32 p6kAxis::P6K_STEPPER_     = 0;
 const epicsUInt32 p6kAxis::P6K_SERVO_       = 1;
@@ -63,6 +64,8 @@ const epicsUInt32 p6kAxis::P6K_LIM_DISABLE_ = 0;
 const epicsUInt32 p6kAxis::P6K_LIM_ENABLE_  = 3;
 
 const char * p6kAxis::P6K_DRIVE_SHUTDOWN_STR_ = "DRIVE SHUTDOWN";
+//Time to wait after a DRIVE SHUTDOWN before enabling the drive again (s)
+const epicsFloat64 p6kAxis::P6K_DRIVE_RETRY_DELAY_ = 10.0;
 
 /**
  * Asyn shutdown function
@@ -103,21 +106,42 @@ p6kAxis::p6kAxis(p6kController *pC, int32_t axisNo)
   deferredRelative_ = 0;
   nowTimeSecs_ = 0.0;
   lastTimeSecs_ = 0.0;
-  doneTimeSecs_ = 0.0;
+  doneTime_ = 0;
   movingLastPoll_ = false;
   delayDoneMove_ = false;
+  pollDue_ = true;
+  lastPoll_ = 0;
+  lastCommand_ = 0;
+  driveState_ = P6K_DRIVE_OFF;
+  driveDeadline_ = 0;
+  driveRetried_ = false;
+  drivePending_ = false;
+  drivePendingMove_ = false;
+  predictedTime_ = 0.0;
+  predictedEnd_ = 0;
+  bulkStatusValid_ = false;
+  bulkEncoderValid_ = false;
+  bulkTAS_ = 0;
+  tasMask_ = 0;
+  tasMaskValid_ = false;
+  bulkTPC_ = 0;
+  bulkTPE_ = 0;
   printNextError_ = true;
   printErrors_ = true;
   commandError_ = false;
   axisError_ = false;
   driveType_ = P6K_STEPPER_;
-  modbusEncPort_ = NULL;
+  modbusEnc_ = false;
+  modbusEncAddr_ = 0;
+  modbusEncOffset_ = 0;
+  modbusEncWords_ = 0;
 
   p6k_cmddir_ = 0;
   p6k_drfen_ = 0;
   p6k_encpol_ = 0;
   p6k_esk_ = 0;
   p6k_estall_ = 0;
+  shadowInvalidate();
 
   /* Set an EPICS exit handler that will shut down polling before asyn kills the IP sockets */
   epicsAtExit(shutdownCallback, pC_);
@@ -140,11 +164,20 @@ p6kAxis::p6kAxis(p6kController *pC, int32_t axisNo)
   paramStatus = ((setStringParam(pC_->P6K_A_Error_, " ") == asynSuccess) && paramStatus);
   paramStatus = ((setStringParam(pC_->P6K_A_MoveError_, " ") == asynSuccess) && paramStatus);
   paramStatus = ((setIntegerParam(pC_->P6K_A_TAS_DriveFault_, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(pC_->P6K_A_PredictEnable_, 1) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(pC_->P6K_A_CruisePollPeriod_, 0.5) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(pC_->P6K_A_PredictedTime_, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(pC_->P6K_A_PredictError_, 0.0) == asynSuccess) && paramStatus);
   paramStatus = ((setIntegerParam(pC_->P6K_A_TAS_Timeout_, 0) == asynSuccess) && paramStatus);
   paramStatus = ((setIntegerParam(pC_->P6K_A_TAS_PosErr_, 0) == asynSuccess) && paramStatus);
   paramStatus = ((setIntegerParam(pC_->P6K_A_ModbusEncoder_, 0) == asynSuccess) && paramStatus);
   paramStatus = ((setIntegerParam(pC_->P6K_A_ModbusEncoderAddr_, 0) == asynSuccess) && paramStatus);
   paramStatus = ((setIntegerParam(pC_->P6K_A_ModbusEncoderOffset_, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(pC_->P6K_A_StopLatency_, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(pC_->P6K_A_SettleLatency_, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(pC_->P6K_A_DriveState_, P6K_DRIVE_OFF) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(pC_->P6K_A_ExternalEncoderMaxAge_, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(pC_->P6K_A_ExternalEncoderAge_, 0.0) == asynSuccess) && paramStatus);
   if (!paramStatus) {
     asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
 	      "%s Unable To Set Driver Parameters In Constructor. Axis:%d\n", 
@@ -169,18 +202,17 @@ p6kAxis::p6kAxis(p6kController *pC, int32_t axisNo)
 }
 
 /**
- * Connect to the modbus asyn port.
+ * Read the encoder position over Modbus.
  * This function is used if we are creating Axis objects using 
- * the p6kController::p6kCreateModbusEncAxis function. This will allow
- * us to read the encoder position over Modbus.
- * This uses the asynInt32SyncIO interface, and passes the INT32_BE message to the modbus driver.
- * NOTE: This is assuming we never read more than 4 bytes worth of counts. If we find we do
- *       then we'll have to add the second address (typically the existing
- *       address+2), and use a second asynUser, and then in the driver apply a scaling 
- *       factor so we lose some precision - this would be necessary in order to fit into the motor
- *       record limitation of 4-byte positions.  
+ * the p6kController::p6kCreateModbusEncAxis function. The registers are
+ * added to the controller's p6kModbusEncoders, which reads the encoders of
+ * all the Modbus axes on its own thread. The poller uses the cached positions.
+ * @param modbusPort The Modbus asyn port
+ * @param modbusAddr The first register of the count (in 16-bit words)
+ * @param modbusOffset Count offset added to the position
+ * @param modbusWords 2 for a 32 bit count, or 4 for a 64 bit count
  */
-asynStatus p6kAxis::modbusPortConnect(const char *modbusPort, int modbusAddr, int modbusOffset)
+asynStatus p6kAxis::modbusPortConnect(const char *modbusPort, int modbusAddr, int modbusOffset, int modbusWords)
 {
   asynStatus status = asynSuccess;
  
@@ -188,16 +220,18 @@ asynStatus p6kAxis::modbusPortConnect(const char *modbusPort, int modbusAddr, in
 
   asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
 
-  status = pasynInt32SyncIO->connect(modbusPort, modbusAddr, &this->modbusEncPort_, "INT32_BE");
-  if ((status) || (this->modbusEncPort_ == NULL)) {
+  status = pC_->modbus_->add(axisNo_, modbusPort, modbusAddr, modbusWords);
+  if (status != asynSuccess) {
     asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR,
-	      "p6kAxis::modbusPortConnect: unable to connect to modbus port %s, addr %d\n", 
+	      "p6kAxis::modbusPortConnect: unable to add modbus port %s, addr %d\n", 
 	      modbusPort, modbusAddr);
     return status;
   }
 
+  modbusEnc_ = true;
   modbusEncAddr_ = modbusAddr;
   modbusEncOffset_ = modbusOffset;
+  modbusEncWords_ = modbusWords;
 
   setIntegerParam(pC_->P6K_A_ModbusEncoder_, 1);
   setIntegerParam(pC_->P6K_A_ModbusEncoderAddr_, modbusEncAddr_);
@@ -215,29 +249,24 @@ asynStatus p6kAxis::modbusPortConnect(const char *modbusPort, int modbusAddr, in
  */
 asynStatus p6kAxis::readIntParam(const char *cmd, epicsUInt32 param, uint32_t *val)
 {
-  char command[P6K_MAXBUF] = {0};
-  char response[P6K_MAXBUF] = {0};
-  char scan[P6K_MAXBUF] = {0};
-  uint32_t nvals = 0;
-  uint32_t axisNum = 0;
+  char command[P6K_STATUS_MAXBUF] = {0};
+  const p6kParser *pResponse = NULL;
+  epicsInt32 intVal = 0;
   asynStatus status = asynSuccess; 
 
   static const char *functionName = "p6kAxis::readIntParam";
   
   asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
 
-  epicsSnprintf(command, P6K_MAXBUF, "%d%s", axisNo_, cmd);
-  status = pC_->lowLevelWriteRead(command, response);
+  epicsSnprintf(command, P6K_STATUS_MAXBUF, "%d%s", axisNo_, cmd);
+  status = pC_->lowLevelQuery(command, &pResponse);
   if (status == asynSuccess) {
-    epicsSnprintf(scan,  P6K_MAXBUF, "%%d%s%%d", cmd);
-    nvals = sscanf(response, scan, &axisNum, val);    
-    if (nvals == 2) {
+    status = pResponse->getInt(cmd, &intVal);
+    if (status == asynSuccess) {
+      *val = intVal;
       if (param != 0) {
 	setIntegerParam(param, *val);
       }
-      status = asynSuccess;
-    } else {
-      status = asynError;
     }
   }
 
@@ -260,29 +289,20 @@ asynStatus p6kAxis::readIntParam(const char *cmd, epicsUInt32 param, uint32_t *v
  */
 asynStatus p6kAxis::readDoubleParam(const char *cmd, epicsUInt32 param, double *val)
 {
-  char command[P6K_MAXBUF] = {0};
-  char response[P6K_MAXBUF] = {0};
-  char scan[P6K_MAXBUF] = {0};
-  uint32_t nvals = 0;
-  uint32_t axisNum = 0;
+  char command[P6K_STATUS_MAXBUF] = {0};
+  const p6kParser *pResponse = NULL;
   asynStatus status = asynSuccess; 
 
   static const char *functionName = "p6kAxis::readDoubleParam";
   
   asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
 
-  epicsSnprintf(command, P6K_MAXBUF, "%d%s", axisNo_, cmd);
-  status = pC_->lowLevelWriteRead(command, response);
+  epicsSnprintf(command, P6K_STATUS_MAXBUF, "%d%s", axisNo_, cmd);
+  status = pC_->lowLevelQuery(command, &pResponse);
   if (status == asynSuccess) {
-    epicsSnprintf(scan,  P6K_MAXBUF, "%%d%s%%lf", cmd);
-    nvals = sscanf(response, scan, &axisNum, val);
-    if (nvals == 2) {
-      if (param != 0) {
-	setDoubleParam(param, *val);
-      }
-      status = asynSuccess;
-    } else {
-      status = asynError;
+    status = pResponse->getDouble(cmd, val);
+    if ((status == asynSuccess) && (param != 0)) {
+      setDoubleParam(param, *val);
     }
   }
 
@@ -310,6 +330,9 @@ asynStatus p6kAxis::getAxisInitialStatus(void)
 
   asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
 
+  //Set all the status parameters on the next poll
+  tasMaskValid_ = false;
+
   if (axisNo_ != 0) {
     char command[P6K_MAXBUF] = {0};
     char response[P6K_MAXBUF] = {0};
@@ -424,7 +447,6 @@ void p6kAxis::printAxisParams(void)
 asynStatus p6kAxis::move(double position, int32_t relative, double min_velocity, double max_velocity, double acceleration)
 {
   asynStatus status = asynError;
-  char command[P6K_MAXBUF]  = {0};
   char response[P6K_MAXBUF] = {0};
   static const char *functionName = "p6kAxis::move";
 
@@ -468,18 +490,26 @@ asynStatus p6kAxis::move(double position, int32_t relative, double min_velocity,
     }
   }
 
+  //A new move replaces one that is still waiting for the drive
+  driveCancel();
+
   //Enable the drive if we are using this drivers parameter to control power.
   //NOTE: this function will fail if the drive is not on.
-  if (autoDriveEnable() != asynSuccess) {
+  bool ready = false;
+  if (autoDriveEnable(&ready) != asynSuccess) {
     return asynError;
   }
 
   if (relative > 1) {
     relative = 1;
   }
-  epicsSnprintf(command, P6K_MAXBUF, "%d%s%d", axisNo_, P6K_CMD_MA, !relative);
-  status = pC_->lowLevelWriteRead(command, response);
-  memset(command, 0, sizeof(command));
+
+  setCommanded();
+
+  //Build up the move as a single command line, so that it costs one round trip.
+  p6kCommandBatch batch;
+  bool added = true;
+  added = (shadowAdd(&batch, p6kCommand::integer(P6K_CMDID_MA, axisNo_, !relative)) == asynSuccess) && added;
 
   //If SendPositionOnly is active, then we don't want to set velocity and accel params
   int32_t sendPositionOnly = 0;
@@ -488,9 +518,7 @@ asynStatus p6kAxis::move(double position, int32_t relative, double min_velocity,
   if (sendPositionOnly == 0) {
     if (max_velocity != 0) {
       epicsFloat64 vel = max_velocity / scale;
-      epicsSnprintf(command, P6K_MAXBUF, "%d%s%.*f", axisNo_, P6K_CMD_V, maxDigits, vel);
-      status = pC_->lowLevelWriteRead(command, response);
-      memset(command, 0, sizeof(command));
+      added = (shadowAdd(&batch, p6kCommand::fixed(P6K_CMDID_V, axisNo_, vel, maxDigits)) == asynSuccess) && added;
     }
   }
 
@@ -498,31 +526,18 @@ asynStatus p6kAxis::move(double position, int32_t relative, double min_velocity,
 
   // Make sure 1/2 A <= AA <= A as required per command reference.
   // Use int arithmetic to ensure we don't run into rounding issues.
-  int iA = rint(pow(10.0, maxDigits) * accel);
-  int iAA = (iA % 2) ? iA / 2 + 1 : iA / 2;
-  double dA = iA / pow(10.0, maxDigits);
-  double dAA = iAA / pow(10.0, maxDigits);
+  // The scaled values are sent as they are, so there is no conversion back.
+  epicsInt64 iA = p6kCommand::scale(accel, maxDigits);
+  epicsInt64 iAA = (iA % 2) ? iA / 2 + 1 : iA / 2;
 
   if (sendPositionOnly == 0) {
     if (iA != 0) {
       if (max_velocity != 0) {
-	
-	epicsSnprintf(command, P6K_MAXBUF, "%d%s%.*f", axisNo_, P6K_CMD_A, maxDigits, dA);
-	status = pC_->lowLevelWriteRead(command, response);
-	memset(command, 0, sizeof(command));
-	
+	added = (shadowAdd(&batch, p6kCommand::fixedScaled(P6K_CMDID_A, axisNo_, iA, maxDigits)) == asynSuccess) && added;
 	//Set S curve parameters too
-	epicsSnprintf(command, P6K_MAXBUF, "%d%s%.*f", axisNo_, P6K_CMD_AA, maxDigits, dAA);
-	status = pC_->lowLevelWriteRead(command, response);
-	memset(command, 0, sizeof(command));
-	
-	epicsSnprintf(command, P6K_MAXBUF, "%d%s%.*f", axisNo_, P6K_CMD_AD, maxDigits, dA);
-	status = pC_->lowLevelWriteRead(command, response);
-	memset(command, 0, sizeof(command));
-	
-	epicsSnprintf(command, P6K_MAXBUF, "%d%s%.*f", axisNo_, P6K_CMD_ADA, maxDigits, dA);
-	status = pC_->lowLevelWriteRead(command, response);
-	memset(command, 0, sizeof(command));
+	added = (shadowAdd(&batch, p6kCommand::fixedScaled(P6K_CMDID_AA, axisNo_, iAA, maxDigits)) == asynSuccess) && added;
+	added = (shadowAdd(&batch, p6kCommand::fixedScaled(P6K_CMDID_AD, axisNo_, iA, maxDigits)) == asynSuccess) && added;
+	added = (shadowAdd(&batch, p6kCommand::fixedScaled(P6K_CMDID_ADA, axisNo_, iA, maxDigits)) == asynSuccess) && added;
       } else {
 	asynPrint(pC_->pasynUserSelf, ASYN_TRACE_WARNING,
 		  "%s: maximum velocity too small (exactly 0 or close to 0). Skip setting S curve parameters.\n",
@@ -534,50 +549,76 @@ asynStatus p6kAxis::move(double position, int32_t relative, double min_velocity,
 		functionName);
     }
   } //end if (sendPositionOnly == 0)
+
+  //Predict how long the move will take. If only the position is sent we don't know the profile.
+  //The deceleration (AD and ADA) is the same as the acceleration.
+  predictedTime_ = 0.0;
+  if ((sendPositionOnly == 0) && (max_velocity != 0) && (iA != 0)) {
+    double distance = position;
+    if (!relative) {
+      double motorPosition = 0.0;
+      pC_->getDoubleParam(axisNo_, pC_->motorPosition_, &motorPosition);
+      distance = position - motorPosition;
+    }
+    p6kProfile profile(max_velocity, acceleration, acceleration/2, acceleration, acceleration);
+    predictedTime_ = profile.moveTime(distance);
+  }
+  setDoubleParam(pC_->P6K_A_PredictedTime_, predictedTime_);
   
   //Don't set position if we are doing deferred moves.
   //In case we cancel the deferred move.
   epicsUInt32 pos = static_cast<epicsUInt32>(position);
   if (pC_->movesDeferred_ == 0) {
-    epicsSnprintf(command, P6K_MAXBUF, "%d%s%d", axisNo_, P6K_CMD_D, pos);
-    status = pC_->lowLevelWriteRead(command, response);
-    memset(command, 0, sizeof(command));
-    epicsSnprintf(command, P6K_MAXBUF, "%d%s", axisNo_, P6K_CMD_GO);
-    movingLastPoll_ = true;
-  } else { /* deferred moves */
+    added = (batch.add(p6kCommand::integer(P6K_CMDID_D, axisNo_, static_cast<epicsInt32>(pos))) == asynSuccess) && added;
+    added = (batch.add(p6kCommand(P6K_CMDID_GO, axisNo_)) == asynSuccess) && added;
+  }
+
+  //Don't send part of a move, eg. the GO without the parameters it depends on
+  if (!added) {
+    batchError(functionName);
+    return asynError;
+  }
+
+  if (pC_->movesDeferred_ != 0) { /* deferred moves */
     deferredPosition_ = pos;
     deferredMove_ = 1;
     //deferredRelative_ = relative; //This is already taken care of on the controller by the MA command
+    //Nothing moves until the deferred GO, so the batch doesn't need to wait for the drive
+    ready = true;
   }
-        
-  status = pC_->lowLevelWriteRead(command, response);
 
-  //Detect a "DRIVE SHUTDOWN" error. Here we attempt to retry the drive enable.
-  if (strstr(response, P6K_DRIVE_SHUTDOWN_STR_) != NULL) {
-    int32_t retryDriveEnable = 0;
-    pC_->getIntegerParam(axisNo_, pC_->P6K_A_DriveRetry_, &retryDriveEnable);
-    if (retryDriveEnable == 1) {
-      asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
-                "%s We detected a DRIVE SHUTDOWN on axis %d. Waiting 10s...\n", functionName, axisNo_);
-      epicsThreadSleep(10);
-      asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
-                "%s Sending DRIVE1 again on axis %d...\n", functionName, axisNo_);
-      sprintf(command, "%d%s1",  axisNo_, P6K_CMD_DRIVE);
-      status = pC_->lowLevelWriteRead(command, response); 
-      if (status == asynSuccess) {
-        setIntegerParam(pC_->motorStatusPowerOn_, 1);
-        asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
-                  "%s Successfully sent DRIVE1 on axis %d. Now sending %dGO...\n", functionName, axisNo_, axisNo_);
-        memset(command, 0, sizeof(command));
-        epicsSnprintf(command, P6K_MAXBUF, "%d%s", axisNo_, P6K_CMD_GO);
-        status = pC_->lowLevelWriteRead(command, response);
-      }
+  //If the drive is still being enabled, the move is sent by driveService when it is ready.
+  //The poller carries on in the meantime.
+  if (!ready) {
+    driveBatch_ = batch;
+    drivePending_ = true;
+    drivePendingMove_ = true;
+    driveRetried_ = false;
+    setStringParam(pC_->P6K_A_MoveError_, " ");
+    commandError_ = false;
+    return asynSuccess;
+  }
+        
+  int32_t failed = -1;
+  status = pC_->lowLevelWriteReadBatch(&batch, response, &failed);
+  if (status == asynSuccess) {
+    shadowCommit();
+    if (pC_->movesDeferred_ == 0) {
+      movingLastPoll_ = true;
+      startPrediction();
+    }
+  } else {
+    shadowInvalidate();
+    //Detect a "DRIVE SHUTDOWN" error. The GO is retried once the drive has been enabled again.
+    driveRetried_ = false;
+    if ((pC_->movesDeferred_ == 0) && (driveShutdown(response))) {
+      return asynSuccess;
     }
   }
   
-  //Check the status of the GO command so we are notified of failed moves.
+  //Check the status of the move so we are notified of failed moves.
   if (status != asynSuccess) {
-    setStringParam(pC_->P6K_A_MoveError_, response);
+    setMoveError(&batch, failed, response);
     commandError_ = true;
   } else {
     setStringParam(pC_->P6K_A_MoveError_, " ");
@@ -587,6 +628,100 @@ asynStatus p6kAxis::move(double position, int32_t relative, double min_velocity,
   return status;
 }
 
+/**
+ * Set the move error message, including the command that failed 
+ * if it could be identified.
+ * @param batch The batch of commands that was sent
+ * @param failed The position in the batch of the command that failed, or -1 if not known.
+ * @param response The error message from the controller.
+ */
+void p6kAxis::setMoveError(const p6kCommandBatch *batch, int32_t failed, const char *response)
+{
+  char error[P6K_MAXBUF] = {0};
+
+  if (failed >= 0) {
+    epicsSnprintf(error, P6K_MAXBUF, "%s: %s", batch->getCommand(failed), response);
+    setStringParam(pC_->P6K_A_MoveError_, error);
+  } else {
+    setStringParam(pC_->P6K_A_MoveError_, response);
+  }
+}
+
+/**
+ * A command did not fit in the batch for a move, home or set position.
+ * Nothing from the batch is sent, so forget the pending motion parameters
+ * and report the error.
+ * @param functionName The function that built the batch
+ */
+void p6kAxis::batchError(const char *functionName)
+{
+  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
+            "%s: ERROR: Command line too long on axis %d. Nothing was sent.\n", 
+            functionName, axisNo_);
+  memset(shadowPending_, 0, sizeof(shadowPending_));
+  setStringParam(pC_->P6K_A_MoveError_, "ERROR: Command line too long");
+  commandError_ = true;
+}
+
+/**
+ * Add a motion parameter to a batch, only if it is different from the value
+ * last acknowledged by the controller. Fixed point values are compared at the
+ * precision sent to the controller, so smaller changes are ignored. The value
+ * is held as pending until shadowCommit is called. Commands that are not
+ * cached (shadow position -1 in p6kCommandTable) are always added.
+ * @param batch The batch to add the command to
+ * @param command The command to add
+ * @return asynStatus, asynError if the batch is full
+ */
+asynStatus p6kAxis::shadowAdd(p6kCommandBatch *batch, const p6kCommand &command)
+{
+  int32_t slot = command.getDesc().shadow;
+
+  if (slot < 0) {
+    return batch->add(command);
+  }
+
+  if ((shadow_[slot].valid) &&
+      (shadow_[slot].value == command.getValue()) &&
+      (shadow_[slot].digits == command.getDigits())) {
+    asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, 
+              "p6kAxis::shadowAdd: Axis %d %s already set\n", axisNo_, command.getDesc().name);
+    return asynSuccess;
+  }
+
+  if (batch->add(command) != asynSuccess) {
+    return asynError;
+  }
+  shadowPending_[slot].valid = true;
+  shadowPending_[slot].value = command.getValue();
+  shadowPending_[slot].digits = command.getDigits();
+  return asynSuccess;
+}
+
+/**
+ * Record the pending motion parameters as acknowledged by the controller.
+ * This should be called after a batch has been sent successfully.
+ */
+void p6kAxis::shadowCommit(void)
+{
+  for (uint32_t i=0; i<P6K_CMD_SHADOW_NUM; ++i) {
+    if (shadowPending_[i].valid) {
+      shadow_[i] = shadowPending_[i];
+      shadowPending_[i].valid = false;
+    }
+  }
+}
+
+/**
+ * Forget all the motion parameters, so that they are sent on the next move.
+ * This is used when we can no longer be sure of the controller state.
+ */
+void p6kAxis::shadowInvalidate(void)
+{
+  memset(shadow_, 0, sizeof(shadow_));
+  memset(shadowPending_, 0, sizeof(shadowPending_));
+}
+
 /**
  * Determin the scale factor to use for velocity and accel scaling 
  * which is required by the controller.
@@ -617,57 +752,259 @@ int32_t p6kAxis::getScaleFactor(void)
 
 
 /**
- * Deal with automatic drive enable. If this is enabled then
- * the drive will be powered on. If a P6K_A_AutoDriveEnableDelay_
- * is set then this function will block until a timer expires.
+ * Deal with automatic drive enable. If this is enabled and the drive
+ * is off, DRIVE1 is sent and the drive waits in the settling state for 
+ * P6K_A_AutoDriveEnableDelay_ ms. This function doesn't wait for the delay.
+ * Instead the caller queues the move, and driveService sends it when the
+ * drive is ready. The controller lock is not held while waiting, so the other
+ * axes carry on polling and moving.
  *
  * We should always call this in the move functions to make sure the
  * drive is powered on before sending a move, even if we are making use
  * use of the asynMotorController auto enable instead. This function 
  * will prevent sending a move command if the drive is not on, which can 
  * cause the next move to fail.
+ * @param ready Set to true if the move can be sent now, or false if it must wait for the drive
+ * @return asynStatus
  */
-asynStatus p6kAxis::autoDriveEnable(void)
+asynStatus p6kAxis::autoDriveEnable(bool *ready)
 {
   static const char *functionName = "p6kAxis::autoDriveEnable";
 
   asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
 
+  *ready = false;
+
+  //Already on the way to ready, or waiting to retry after a DRIVE SHUTDOWN
+  if ((driveState_ == P6K_DRIVE_ENABLING) || (driveState_ == P6K_DRIVE_SETTLING) || 
+      (driveState_ == P6K_DRIVE_FAULT)) {
+    return asynSuccess;
+  }
+
+  int32_t power = 0;
+  pC_->getIntegerParam(axisNo_, pC_->motorStatusPowerOn_, &power);
+  if (power == 1) {
+    if (driveState_ != P6K_DRIVE_READY) {
+      setDriveState(P6K_DRIVE_READY, 0.0);
+    }
+    *ready = true;
+    return asynSuccess;
+  }
+
   int32_t auto_drive_enable = 0;
   pC_->getIntegerParam(axisNo_, pC_->P6K_A_AutoDriveEnable_, &auto_drive_enable);
   if (auto_drive_enable == 1) {
     asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, 
 	      "%s Auto drive enable\n", functionName);
-    if (setClosedLoop(true) != asynSuccess) {
+    setDriveState(P6K_DRIVE_ENABLING, 0.0);
+    driveService();
+    if (driveState_ == P6K_DRIVE_OFF) {
       asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
 		"%s ERROR: Failed to enable axis %d\n", functionName, axisNo_);
-      setStringParam(pC_->P6K_A_MoveError_, "ERROR: Failed to enable drive");
       return asynError;
     }
+    *ready = (driveState_ == P6K_DRIVE_READY);
   } else {
     //If auto_drive_enable is not on, check motor power is on. Return an error if not.
     //If we send move commands to the GT6K/6K controllers, without the power on
     //then the next move will fail even if we enable the power. So we try to
     //prevent that by this check.
-    int32_t power = 0;
-    pC_->getIntegerParam(axisNo_, pC_->motorStatusPowerOn_, &power);
-    if (power == 0) {
-      asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
-		"%s ERROR: Not sending move because drive is off. Axis: %d\n", functionName, axisNo_);
-      setStringParam(pC_->P6K_A_MoveError_, "ERROR: Drive was off when attempting last move.");
-      return asynError;
-      }
+    asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
+	      "%s ERROR: Not sending move because drive is off. Axis: %d\n", functionName, axisNo_);
+    setStringParam(pC_->P6K_A_MoveError_, "ERROR: Drive was off when attempting last move.");
+    return asynError;
   }
 
-  int32_t drive_enable_delay = 0;
-  pC_->getIntegerParam(axisNo_, pC_->P6K_A_AutoDriveEnableDelay_, &drive_enable_delay);
-  if (drive_enable_delay > 0) {
+  return asynSuccess;
+}
+
+/**
+ * Move the drive power state machine on. This is called by every axis poll, 
+ * and by autoDriveEnable at the start of a move.
+ *   - P6K_DRIVE_FAULT waits P6K_DRIVE_RETRY_DELAY_ after a DRIVE SHUTDOWN, then goes to enabling.
+ *   - P6K_DRIVE_ENABLING sends DRIVE1, then goes to settling.
+ *   - P6K_DRIVE_SETTLING waits for P6K_A_AutoDriveEnableDelay_ ms, then goes to ready
+ *     and sends the pending move.
+ * While waiting, a poll is asked for at the end of the wait (see p6kController::pollAt).
+ * This must be called with the lock held.
+ */
+void p6kAxis::driveService(void)
+{
+  char command[P6K_MAXBUF]  = {0};
+  char response[P6K_MAXBUF] = {0};
+  static const char *functionName = "p6kAxis::driveService";
+
+  if ((driveState_ == P6K_DRIVE_FAULT) && (epicsMonotonicGet() >= driveDeadline_)) {
+    asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
+              "%s Sending DRIVE1 again on axis %d...\n", functionName, axisNo_);
+    setDriveState(P6K_DRIVE_ENABLING, 0.0);
+  }
+
+  if (driveState_ == P6K_DRIVE_ENABLING) {
+    p6kCommand::integer(P6K_CMDID_DRIVE, axisNo_, 1).format(command, P6K_MAXBUF);
+    setCommanded();
+    if (pC_->lowLevelWriteRead(command, response) != asynSuccess) {
+      driveFail("ERROR: Failed to enable drive");
+      return;
+    }
+    setIntegerParam(pC_->motorStatusPowerOn_, 1);
+    //Set it from TAS again on the next poll
+    tasMaskValid_ = false;
+    int32_t drive_enable_delay = 0;
+    pC_->getIntegerParam(axisNo_, pC_->P6K_A_AutoDriveEnableDelay_, &drive_enable_delay);
     asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, 
 	      "%s Auto drive enable delay: %d\n", functionName, drive_enable_delay);
-    epicsThreadSleep(static_cast<double>(drive_enable_delay) / 1000.0);
+    setDriveState(P6K_DRIVE_SETTLING, static_cast<double>(drive_enable_delay) / 1000.0);
   }
 
-  return asynSuccess;
+  if ((driveState_ == P6K_DRIVE_SETTLING) && (epicsMonotonicGet() >= driveDeadline_)) {
+    setDriveState(P6K_DRIVE_READY, 0.0);
+  }
+
+  if ((driveState_ == P6K_DRIVE_READY) && (drivePending_)) {
+    driveRelease();
+  }
+
+  if (driveDeadline_ != 0) {
+    pC_->pollAt(driveDeadline_);
+  }
+}
+
+/**
+ * Set the drive power state.
+ * @param state The new state
+ * @param delay How long to stay in the state before driveService moves it on (s).
+ *        This is only used for the settling and fault states.
+ */
+void p6kAxis::setDriveState(p6kDriveState state, double delay)
+{
+  driveState_ = state;
+  driveDeadline_ = 0;
+  if ((state == P6K_DRIVE_SETTLING) || (state == P6K_DRIVE_FAULT)) {
+    driveDeadline_ = epicsMonotonicGet() + static_cast<epicsUInt64>((delay > 0.0 ? delay : 0.0) * 1.0e9);
+  }
+  setIntegerParam(pC_->P6K_A_DriveState_, state);
+}
+
+/**
+ * Send the move or home that was waiting for the drive to be ready.
+ * @return asynStatus
+ */
+asynStatus p6kAxis::driveRelease(void)
+{
+  asynStatus status = asynError;
+  char response[P6K_MAXBUF] = {0};
+  int32_t failed = -1;
+
+  drivePending_ = false;
+  setCommanded();
+  status = pC_->lowLevelWriteReadBatch(&driveBatch_, response, &failed);
+  if (status == asynSuccess) {
+    shadowCommit();
+    if (drivePendingMove_) {
+      movingLastPoll_ = true;
+      startPrediction();
+    }
+    setStringParam(pC_->P6K_A_MoveError_, " ");
+    commandError_ = false;
+  } else {
+    shadowInvalidate();
+    if ((drivePendingMove_) && (driveShutdown(response))) {
+      return asynSuccess;
+    }
+    setMoveError(&driveBatch_, failed, response);
+    commandError_ = true;
+  }
+  //So that the motor record sees the end of the move 
+  callParamCallbacks();
+
+  return status;
+}
+
+/**
+ * Detect a "DRIVE SHUTDOWN" error in the response to a move. If P6K_A_DriveRetry_
+ * is set, the drive is enabled again after P6K_DRIVE_RETRY_DELAY_ and the GO is sent
+ * again. This is only tried once for each move.
+ * @param response The response to the move
+ * @return true if the move will be retried
+ */
+bool p6kAxis::driveShutdown(const char *response)
+{
+  static const char *functionName = "p6kAxis::driveShutdown";
+
+  if (strstr(response, P6K_DRIVE_SHUTDOWN_STR_) == NULL) {
+    return false;
+  }
+
+  int32_t retryDriveEnable = 0;
+  pC_->getIntegerParam(axisNo_, pC_->P6K_A_DriveRetry_, &retryDriveEnable);
+  if ((retryDriveEnable != 1) || (driveRetried_)) {
+    return false;
+  }
+
+  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
+            "%s We detected a DRIVE SHUTDOWN on axis %d. Retrying in %.0fs...\n", 
+            functionName, axisNo_, P6K_DRIVE_RETRY_DELAY_);
+  driveBatch_.clear();
+  if (driveBatch_.add(p6kCommand(P6K_CMDID_GO, axisNo_)) != asynSuccess) {
+    return false;
+  }
+  drivePending_ = true;
+  drivePendingMove_ = true;
+  driveRetried_ = true;
+  setStringParam(pC_->P6K_A_MoveError_, response);
+  setDriveState(P6K_DRIVE_FAULT, P6K_DRIVE_RETRY_DELAY_);
+  pC_->pollAt(driveDeadline_);
+
+  return true;
+}
+
+/**
+ * Forget the move that is waiting for the drive, if there is one. The drive
+ * state is not changed.
+ */
+void p6kAxis::driveCancel(void)
+{
+  if (drivePending_) {
+    drivePending_ = false;
+    //The motion parameters in the batch were never sent
+    memset(shadowPending_, 0, sizeof(shadowPending_));
+  }
+}
+
+/**
+ * The drive could not be enabled. Drop the pending move and report the error.
+ * @param error The error message for P6K_A_MoveError_
+ */
+void p6kAxis::driveFail(const char *error)
+{
+  static const char *functionName = "p6kAxis::driveFail";
+
+  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
+            "%s ERROR: Failed to enable drive on axis %d\n", functionName, axisNo_);
+  if (drivePending_) {
+    commandError_ = true;
+  }
+  driveCancel();
+  setDriveState(P6K_DRIVE_OFF, 0.0);
+  setStringParam(pC_->P6K_A_MoveError_, error);
+}
+
+/**
+ * Forget any move that has not been sent yet: a deferred move, a move waiting
+ * for the drive, or the GO that is retried after a DRIVE SHUTDOWN. This is
+ * called before an immediate stop is sent, because the controller lock is
+ * released while the stop is with the transport (see 
+ * p6kController::lowLevelWriteReadImmediate), and the poller must not
+ * send the move from driveService in that time.
+ */
+void p6kAxis::stopPending(void)
+{
+  deferredMove_ = 0;
+  driveCancel();
+  if (driveState_ == P6K_DRIVE_FAULT) {
+    setDriveState(P6K_DRIVE_OFF, 0.0);
+  }
 }
 
 
@@ -677,7 +1014,6 @@ asynStatus p6kAxis::autoDriveEnable(void)
 asynStatus p6kAxis::home(double min_velocity, double max_velocity, double acceleration, int32_t forwards)
 {
   asynStatus status = asynError;
-  char command[P6K_MAXBUF] = {0};
   char response[P6K_MAXBUF] = {0};
   static const char *functionName = "p6kAxis::home";
 
@@ -691,12 +1027,22 @@ asynStatus p6kAxis::home(double min_velocity, double max_velocity, double accele
     return asynError;
   }
 
+  //A new home replaces a move that is still waiting for the drive
+  driveCancel();
+
   //Enable the drive if we are using this drivers parameter to control power.
   //NOTE: this function will fail if the drive is not on.
-  if (autoDriveEnable() != asynSuccess) {
+  bool ready = false;
+  if (autoDriveEnable(&ready) != asynSuccess) {
     return asynError;
   }
 
+  setCommanded();
+
+  //Build up the home as a single command line, so that it costs one round trip.
+  p6kCommandBatch batch;
+  bool added = true;
+
   //If SendPositionOnly is active, then we don't want to set velocity and accel params
   int32_t sendPositionOnly = 0;
   pC_->getIntegerParam(axisNo_, pC_->P6K_A_SendPositionOnly_, &sendPositionOnly);
@@ -704,9 +1050,7 @@ asynStatus p6kAxis::home(double min_velocity, double max_velocity, double accele
   if (sendPositionOnly == 0) {
     if (max_velocity != 0) {
       epicsFloat64 vel = max_velocity / scale;
-      epicsSnprintf(command, P6K_MAXBUF, "%d%s%.*f", axisNo_, P6K_CMD_HOMV, maxDigits, vel);
-      status = pC_->lowLevelWriteRead(command, response);
-      memset(command, 0, sizeof(command));
+      added = (shadowAdd(&batch, p6kCommand::fixed(P6K_CMDID_HOMV, axisNo_, vel, maxDigits)) == asynSuccess) && added;
     }
   }
 
@@ -714,30 +1058,41 @@ asynStatus p6kAxis::home(double min_velocity, double max_velocity, double accele
     if (acceleration != 0) {
       if (max_velocity != 0) {
 	epicsFloat64 accel = acceleration / scale;
-	epicsSnprintf(command, P6K_MAXBUF, "%d%s%.*f", axisNo_, P6K_CMD_HOMA, maxDigits, accel);
-	status = pC_->lowLevelWriteRead(command, response);
-	memset(command, 0, sizeof(command));
-	
+	added = (shadowAdd(&batch, p6kCommand::fixed(P6K_CMDID_HOMA, axisNo_, accel, maxDigits)) == asynSuccess) && added;
 	//Set S curve parameters too
-	epicsSnprintf(command, P6K_MAXBUF, "%d%s%.*f", axisNo_, P6K_CMD_HOMAA, maxDigits, accel/2);
-	status = pC_->lowLevelWriteRead(command, response);
-	memset(command, 0, sizeof(command));
-	
-	epicsSnprintf(command, P6K_MAXBUF, "%d%s%.*f", axisNo_, P6K_CMD_HOMAD, maxDigits, accel);
-	status = pC_->lowLevelWriteRead(command, response);
-	memset(command, 0, sizeof(command));
-	
-	epicsSnprintf(command, P6K_MAXBUF, "%d%s%.*f", axisNo_, P6K_CMD_HOMADA, maxDigits, accel);
-	status = pC_->lowLevelWriteRead(command, response);
-	memset(command, 0, sizeof(command));
+	added = (shadowAdd(&batch, p6kCommand::fixed(P6K_CMDID_HOMAA, axisNo_, accel/2, maxDigits)) == asynSuccess) && added;
+	added = (shadowAdd(&batch, p6kCommand::fixed(P6K_CMDID_HOMAD, axisNo_, accel, maxDigits)) == asynSuccess) && added;
+	added = (shadowAdd(&batch, p6kCommand::fixed(P6K_CMDID_HOMADA, axisNo_, accel, maxDigits)) == asynSuccess) && added;
       }
     }
   } // end if (sendPositionOnly == 0)
   
-  epicsSnprintf(command, P6K_MAXBUF, "%d%s%d", axisNo_, P6K_CMD_HOM, (forwards>0?0:1));
-  status = pC_->lowLevelWriteRead(command, response);
-  memset(command, 0, sizeof(command));
+  added = (batch.add(p6kCommand::integer(P6K_CMDID_HOM, axisNo_, (forwards>0?0:1))) == asynSuccess) && added;
+  if (!added) {
+    batchError(functionName);
+    return asynError;
+  }
 
+  //Wait for the drive to be ready, as for move
+  if (!ready) {
+    driveBatch_ = batch;
+    drivePending_ = true;
+    drivePendingMove_ = false;
+    driveRetried_ = false;
+    setStringParam(pC_->P6K_A_MoveError_, " ");
+    commandError_ = false;
+    return asynSuccess;
+  }
+
+  int32_t failed = -1;
+  status = pC_->lowLevelWriteReadBatch(&batch, response, &failed);
+  if (status != asynSuccess) {
+    shadowInvalidate();
+    setMoveError(&batch, failed, response);
+  } else {
+    shadowCommit();
+    setStringParam(pC_->P6K_A_MoveError_, " ");
+  }
 
   return status;
 }
@@ -766,7 +1121,6 @@ asynStatus p6kAxis::setPosition(double position)
 {
   asynStatus asynStatus = asynError;
   bool stat = true;
-  char command[P6K_MAXBUF]  = {0};
   char response[P6K_MAXBUF] = {0};
   static const char *functionName = "p6kAxis::setPosition";
   
@@ -779,35 +1133,48 @@ asynStatus p6kAxis::setPosition(double position)
 	    "%s: Set axis %d on controller %s to position %d\n", 
 	    functionName, axisNo_, pC_->portName, pos);
 
-  epicsSnprintf(command, P6K_MAXBUF, "!%d%s", axisNo_, P6K_CMD_S);
-  stat = (pC_->lowLevelWriteRead(command, response) == asynSuccess) && stat;
-  memset(command, 0, sizeof(command));
+  setCommanded();
 
-  if (stat) {
-    epicsSnprintf(command, P6K_MAXBUF, "%d%s%d", axisNo_, P6K_CMD_PSET, pos);
-    stat = (pC_->lowLevelWriteRead(command, response) == asynSuccess) && stat;
-  memset(command, 0, sizeof(command));
+  //Stop the axis on its own, so that only the stop goes ahead of queued commands.
+  //Anything not sent yet is dropped first, as in stop.
+  stopPending();
+  char command[P6K_MAXBUF] = {0};
+  p6kCommand(P6K_CMDID_S, axisNo_).immediate().format(command, P6K_MAXBUF);
+  if (pC_->lowLevelWriteReadImmediate(command, response) != asynSuccess) {
+    asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
+	      "%s: Failed to stop axis %d before setting the position: %s\n", 
+	      functionName, axisNo_, response);
   }
 
+  //Then set the position in a single command line.
+  p6kCommandBatch batch;
+  stat = (batch.add(p6kCommand::integer(P6K_CMDID_PSET, axisNo_, pos)) == asynSuccess) && stat;
+
   /*Now set position on encoder axis.*/
   epicsFloat64 encRatio = 0.0;
   pC_->getDoubleParam(axisNo_, pC_->motorEncoderRatio_, &encRatio);
   epicsInt32 encpos = (epicsInt32) floor((position*encRatio) + 0.5);
-  if (stat) {             
-    if (encRatio != 0) {
-      
-      asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, 
-		"%s: Set encoder axis %d on controller %s to position %d, encRatio: %f\n", 
-		functionName, axisNo_, pC_->portName, pos, encRatio);
-      
-      epicsSnprintf(command, P6K_MAXBUF, "%d%s%d", axisNo_, P6K_CMD_PESET, encpos);
-      stat = (pC_->lowLevelWriteRead(command, response) == asynSuccess) && stat;
-      memset(command, 0, sizeof(command));
-    } else {
-      asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
+  if (encRatio != 0) {
+    asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, 
+	      "%s: Set encoder axis %d on controller %s to position %d, encRatio: %f\n", 
+	      functionName, axisNo_, pC_->portName, pos, encRatio);
+    stat = (batch.add(p6kCommand::integer(P6K_CMDID_PESET, axisNo_, encpos)) == asynSuccess) && stat;
+  } else {
+    asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
 	      "%s: encRation is zero. Not setting encoder position.\n", 
 	      functionName);
-    }
+  }
+
+  int32_t failed = -1;
+  if (!stat) {
+    batchError(functionName);
+  } else {
+    stat = (pC_->lowLevelWriteReadBatch(&batch, response, &failed) == asynSuccess) && stat;
+  }
+  if ((!stat) && (failed >= 0)) {
+    asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
+	      "%s: Command %s failed on axis %d: %s\n", 
+	      functionName, batch.getCommand(failed), axisNo_, response);
   }
 
   /*Set the motor and encoder position here, regardless of if any of the 
@@ -844,10 +1211,19 @@ asynStatus p6kAxis::stop(double acceleration)
 
   asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
 
-  epicsSnprintf(command, P6K_MAXBUF, "!%d%s", axisNo_, P6K_CMD_S);
-  status = pC_->lowLevelWriteRead(command, response);
-
-  deferredMove_ = 0;
+  //Immediate commands go ahead of any queued status queries, and the
+  //controller lock is released while we wait for the acknowledgement.
+  //Record the time from here to the controller acknowledging the stop.
+  //Don't send a move that is waiting for the drive, or retry one after a DRIVE SHUTDOWN.
+  //This must be done before the lock is released.
+  stopPending();
+  p6kCommand(P6K_CMDID_S, axisNo_).immediate().format(command, P6K_MAXBUF);
+  setCommanded();
+  epicsUInt64 startTime = epicsMonotonicGet();
+  status = pC_->lowLevelWriteReadImmediate(command, response);
+  if (status == asynSuccess) {
+    setDoubleParam(pC_->P6K_A_StopLatency_, (epicsMonotonicGet() - startTime) / 1.0e6);
+  }
 
   return status;
 }
@@ -1014,16 +1390,93 @@ asynStatus p6kAxis::setClosedLoop(bool closedLoop)
 		"%s Drive disable on axis %d\n", functionName, axisNo_);
       sprintf(command, "%d%s0",  axisNo_, P6K_CMD_DRIVE);
     }
+    setCommanded();
     status = pC_->lowLevelWriteRead(command, response);
     
     if (status == asynSuccess) {
       setIntegerParam(pC_->motorStatusPowerOn_, static_cast<int>(closedLoop));
+      //Set it from TAS again on the next poll
+      tasMaskValid_ = false;
+      if (!closedLoop) {
+        driveCancel();
+        setDriveState(P6K_DRIVE_OFF, 0.0);
+      } else if (driveState_ == P6K_DRIVE_OFF) {
+        setDriveState(P6K_DRIVE_READY, 0.0);
+      }
     }
 
   }
   return status;
 }
 
+/**
+ * Record that a command which may change the axis state has been sent,
+ * so that the axis is read every poll for a while (see p6kController::scheduleAxisPolls).
+ */
+void p6kAxis::setCommanded(void)
+{
+  lastCommand_ = epicsMonotonicGet();
+  pollDue_ = true;
+  predictedEnd_ = 0;
+}
+
+/**
+ * Start the predicted end time of a move from now. This is called when GO has 
+ * been acknowledged, using the move time calculated by move.
+ */
+void p6kAxis::startPrediction(void)
+{
+  int32_t enable = 0;
+
+  predictedEnd_ = 0;
+  pC_->getIntegerParam(axisNo_, pC_->P6K_A_PredictEnable_, &enable);
+  if ((enable == 1) && (predictedTime_ > 0.0)) {
+    predictedEnd_ = epicsMonotonicGet() + static_cast<epicsUInt64>(predictedTime_ * 1.0e9);
+  }
+}
+
+/**
+ * Decide if a move is in the middle of its profile, so that the axis only
+ * needs to be read at the cruise poll period.
+ * @param now The start time of this poll cycle (ns)
+ * @param guard How long before the predicted end to start reading every poll (s)
+ * @return true if the axis is moving, has been read since GO, and won't end for a while
+ */
+bool p6kAxis::cruising(epicsUInt64 now, double guard)
+{
+  double cruisePeriod = 0.0;
+
+  if ((predictedEnd_ == 0) || (!movingLastPoll_) || (deferredMove_) || (lastPoll_ <= lastCommand_)) {
+    return false;
+  }
+  pC_->getDoubleParam(axisNo_, pC_->P6K_A_CruisePollPeriod_, &cruisePeriod);
+  if (cruisePeriod <= 0.0) {
+    return false;
+  }
+  return ((now + static_cast<epicsUInt64>(guard * 1.0e9)) < predictedEnd_);
+}
+
+/**
+ * If a move is predicted to end before the next poll, ask the poller for a poll at
+ * the predicted end, and then every P6K_END_POLL_PERIOD_ until it is done, for up to
+ * one moving poll period after it (see p6kController::pollAt). The axis is read in
+ * those polls like any other, using the bulk status if it is enabled, so nothing
+ * waits here. This means DMOV is set within a few ms of the end of the move.
+ */
+void p6kAxis::pollMoveEnd(void)
+{
+  epicsUInt64 now = epicsMonotonicGet();
+  epicsUInt64 period = static_cast<epicsUInt64>(pC_->movingPollPeriod_ * 1.0e9);
+  epicsUInt64 interval = static_cast<epicsUInt64>(pC_->P6K_END_POLL_PERIOD_ * 1.0e9);
+
+  if ((predictedEnd_ == 0) || (!movingLastPoll_) || (predictedEnd_ > (now + period)) ||
+      (now > (predictedEnd_ + period))) {
+    return;
+  }
+
+  pC_->pollAt((predictedEnd_ > (now + interval)) ? predictedEnd_ : (now + interval));
+}
+
 /**
  * See asynMotorAxis::poll
  */
@@ -1040,6 +1493,29 @@ asynStatus p6kAxis::poll(bool *moving)
       setIntegerParam(pC_->motorStatusCommsError_, 1);
       return asynError;
     }
+
+    //Don't send anything while the controller is not responding (see p6kController::pollCommsDown)
+    if (pC_->commsDown_) {
+      *moving = false;
+      setIntegerParam(pC_->motorStatusCommsError_, 1);
+      setStringParam(pC_->P6K_A_Error_, "Controller not responding");
+      callParamCallbacks();
+      pC_->pollEnd_ = epicsMonotonicGet();
+      return asynError;
+    }
+
+    //Move the drive power state on, and send a pending move if the drive is ready
+    driveService();
+
+    //Idle axes are only read when p6kController::scheduleAxisPolls says so,
+    //or if the bulk status read for the other axes this cycle has their status.
+    //Otherwise the parameters keep their values from the last read.
+    if ((!pollDue_) && (!bulkStatusValid_)) {
+      *moving = false;
+      pC_->pollEnd_ = epicsMonotonicGet();
+      return asynSuccess;
+    }
+    lastPoll_ = pC_->pollStart_;
     
     //Now poll axis status
     if ((status = getAxisStatus(moving)) != asynSuccess) {
@@ -1051,12 +1527,19 @@ asynStatus p6kAxis::poll(bool *moving)
       setStringParam(pC_->P6K_A_Error_, "Problem reading axis status");
       //setIntegerParam(pC_->motorStatusCommsError_, 1);
     } else {
+      //Read the status densely around the predicted end of a move
+      if (*moving) {
+        pollMoveEnd();
+      }
       if (!axisError_) {
-	setStringParam(pC_->P6K_A_Error_, " ");
+        setStringParam(pC_->P6K_A_Error_, " ");
       }
       setIntegerParam(pC_->motorStatusCommsError_, 0);
     }
   }
+
+  //The last axis poll marks the end of the poll cycle
+  pC_->pollEnd_ = epicsMonotonicGet();
   
   callParamCallbacks();
   return status;
@@ -1071,16 +1554,18 @@ asynStatus p6kAxis::poll(bool *moving)
  */
 asynStatus p6kAxis::getAxisStatus(bool *moving)
 {
-    char command[P6K_MAXBUF] = {0};
-    char response[P6K_MAXBUF] = {0};
+    char command[P6K_STATUS_MAXBUF] = {0};
+    const p6kParser *pResponse = NULL;
+    p6kView bits = {"", 0};
     bool stat = true;
-    int32_t nvals = 0;
-    int32_t axisNum = 0;
-    int32_t intVal = 0;
+    epicsInt32 intVal = 0;
     int32_t externalEncoderUse = 0;
-    int32_t externalEncoder = 0;
-    epicsInt32 modbusEncoder = 0;
-    char stringVal[P6K_MAXBUF] = {0};
+    epicsInt32 externalEncoder = 0;
+    epicsUInt64 externalEncoderTime = 0;
+    epicsInt64 modbusEncoder = 0;
+    epicsUInt64 modbusEncoderTime = 0;
+    epicsUInt64 tas = 0;
+    epicsUInt64 changed = 0;
     bool doneMoving = false;
     bool controllerDoneMoving = false;
     uint32_t problem = 0;
@@ -1106,53 +1591,74 @@ asynStatus p6kAxis::getAxisStatus(bool *moving)
       printErrors_ = true;
     }
 
-    /* Transfer axis status */
-    epicsSnprintf(command, P6K_MAXBUF, "%d%s", axisNo_, P6K_CMD_TAS);
-    stat = (pC_->lowLevelWriteRead(command, response) == asynSuccess) && stat;
-    if (stat) {
-      nvals = sscanf(response, "%d"P6K_CMD_TAS"%s", &axisNum, stringVal);
-      if (nvals != 2) {
-	stat = false;
-      } 
-    }
-    memset(command, 0, sizeof(command));
+    if (bulkStatusValid_) {
+      //Use the status read for all axes by p6kController::getBulkStatus this poll cycle.
+      tas = bulkTAS_;
+      setDoubleParam(pC_->motorPosition_, bulkTPC_);
+    } else {
+      /* Transfer axis status */
+      p6kCommand(P6K_CMDID_TAS, axisNo_).format(command, P6K_STATUS_MAXBUF);
+      stat = (pC_->lowLevelQuery(command, &pResponse) == asynSuccess) && stat;
+      if (stat) {
+        if (pResponse->getBits(P6K_CMD_TAS, &bits) == asynSuccess) {
+          tas = p6kParser::toMask(bits);
+        } else {
+          stat = false;
+        } 
+      }
 
-    /* Transfer current position and encoder position.*/
-    epicsSnprintf(command, P6K_MAXBUF, "%d%s", axisNo_, P6K_CMD_TPC);
-    stat = (pC_->lowLevelWriteRead(command, response) == asynSuccess) && stat;
-    if (stat) {
-      nvals = sscanf(response, "%d"P6K_CMD_TPC"%d", &axisNum, &intVal);
-      if (nvals == 2) {
-	setDoubleParam(pC_->motorPosition_, intVal);
+      /* Transfer current position and encoder position.*/
+      p6kCommand(P6K_CMDID_TPC, axisNo_).format(command, P6K_STATUS_MAXBUF);
+      stat = (pC_->lowLevelQuery(command, &pResponse) == asynSuccess) && stat;
+      if (stat) {
+        if (pResponse->getInt(P6K_CMD_TPC, &intVal) == asynSuccess) {
+          setDoubleParam(pC_->motorPosition_, intVal);
+        }
       }
     }
-    memset(command, 0, sizeof(command));
 
     //First check if we read the encoder position from a parameter.
     //Then check if we are reading the encoder via modbus.
     //Otherwise read from controller.
     pC_->getIntegerParam(axisNo_, pC_->P6K_A_ExternalEncoderUse_, &externalEncoderUse);
     if (externalEncoderUse == 1) {
-      //Allow time for encoder position to be written from data via writeFloat64
-      //Otherwise the positions are stale because we are blocked by the poller lock taken
-      //in asynMotorController::asynMotorPoller.
-      pC_->unlock();
-      epicsThreadSleep(0.01);
-      pC_->lock();
-      if (pC_->getIntegerParam(axisNo_, pC_->P6K_A_ExternalEncoder_, &externalEncoder) == asynSuccess) {
+      //Use the latest position written to ExternalEncoder. The sequence lock (p6kLatest)
+      //gives a consistent value and timestamp without the writer needing the
+      //port lock, so the value can be of any age. It is reported in
+      //ExternalEncoderAge_RBV, and checked against ExternalEncoderMaxAge.
+      double maxAge = 0.0;
+      double age = 0.0;
+      pC_->getDoubleParam(axisNo_, pC_->P6K_A_ExternalEncoderMaxAge_, &maxAge);
+      if (externalEncoder_.read(&externalEncoder, &externalEncoderTime)) {
+        age = (static_cast<double>(epicsMonotonicGet()) - static_cast<double>(externalEncoderTime)) / 1.0e9;
         setDoubleParam(pC_->motorEncoderPosition_, externalEncoder);
+        setDoubleParam(pC_->P6K_A_ExternalEncoderAge_, age);
         asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, 
-                    "%s: External encoder position on controller %s axis %d is %d\n", 
-                    functionName, pC_->portName, axisNo_, externalEncoder);
+                    "%s: External encoder position on controller %s axis %d is %d (%.3f s old)\n", 
+                    functionName, pC_->portName, axisNo_, externalEncoder, age);
+      }
+      if ((maxAge > 0) && ((externalEncoderTime == 0) || (age > maxAge))) {
+        if (printErrors_) {
+          if (externalEncoderTime == 0) {
+            asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
+                      "%s: External encoder position on controller %s axis %d has not been written.\n", 
+                      functionName, pC_->portName, axisNo_);
+          } else {
+            asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
+                      "%s: External encoder position on controller %s axis %d has not been updated for %.3f s.\n", 
+                      functionName, pC_->portName, axisNo_, age);
+          }
+          printNextError_ = false;
+        }
+        problem = 1;
       }
-    } else if (modbusEncPort_ != NULL) {
-      //We are reading the encoder position over modbus
-      //Apply a small delay to ensure we have an up to date value
-      epicsThreadSleep(0.1);
+    } else if (modbusEnc_) {
+      //We are reading the encoder position over modbus.
+      //Use the position cached by the modbus encoder thread.
       //Check if we care about bad readings
       epicsInt32 modbusEncCheck = 0;
       pC_->getIntegerParam(axisNo_, pC_->P6K_A_ModbusEncoderCheck_, &modbusEncCheck);
-      if (pasynInt32SyncIO->read(this->modbusEncPort_, &modbusEncoder, 1.0) != asynSuccess) {
+      if (pC_->modbus_->get(axisNo_, &modbusEncoder, &modbusEncoderTime) != asynSuccess) {
         if (modbusEncCheck != 0) {
           asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
                     "%s: ERROR: Problem reading modbus encoder position axis %d\n", 
@@ -1173,27 +1679,32 @@ asynStatus p6kAxis::getAxisStatus(bool *moving)
           setDoubleParam(pC_->motorEncoderPosition_, 0.0);
         } else {
           asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, 
-                    "%s: Modbus encoder position on controller %s axis %d is %d\n", 
-                    functionName, pC_->portName, axisNo_, modbusEncoder);
+                    "%s: Modbus encoder position on controller %s axis %d is %lld\n", 
+                    functionName, pC_->portName, axisNo_, static_cast<long long>(modbusEncoder));
           //Apply the count offset that we specified in the IOC startup script
           modbusEncoder = modbusEncoder + modbusEncOffset_;
-          setDoubleParam(pC_->motorEncoderPosition_, modbusEncoder);
+          setDoubleParam(pC_->motorEncoderPosition_, static_cast<double>(modbusEncoder));
         }
       }
+    } else if (bulkEncoderValid_) {
+      setDoubleParam(pC_->motorEncoderPosition_, bulkTPE_);
     } else {
       //Else we are just reading the encoder from the controller as normal
-      epicsSnprintf(command, P6K_MAXBUF, "%d%s", axisNo_, P6K_CMD_TPE);
-      stat = (pC_->lowLevelWriteRead(command, response) == asynSuccess) && stat;
+      p6kCommand(P6K_CMDID_TPE, axisNo_).format(command, P6K_STATUS_MAXBUF);
+      stat = (pC_->lowLevelQuery(command, &pResponse) == asynSuccess) && stat;
       if (stat) {
-        nvals = sscanf(response, "%d"P6K_CMD_TPE"%d", &axisNum, &intVal);
-        if (nvals == 2) {
+        if (pResponse->getInt(P6K_CMD_TPE, &intVal) == asynSuccess) {
           setDoubleParam(pC_->motorEncoderPosition_, intVal);
         }
       }
     }
-    memset(command, 0, sizeof(command));
+
+    //The cached status is only valid for one poll cycle.
+    bulkStatusValid_ = false;
+    bulkEncoderValid_ = false;
 
     if (!stat) {
+      tasMaskValid_ = false;
       if (printErrors_) {
 	asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
 		  "%s: ERROR: Problem reading position and status on controller %s, axis %d\n", 
@@ -1202,40 +1713,60 @@ asynStatus p6kAxis::getAxisStatus(bool *moving)
       }
     } else {
 
-      if (deferredMove_) {
+      //The status bits that changed since the last poll. Parameters that only
+      //depend on TAS are only set when their bits change.
+      changed = tasMaskValid_ ? (tas ^ tasMask_) : ~static_cast<epicsUInt64>(0);
+      tasMask_ = tas;
+      tasMaskValid_ = true;
+
+      if ((deferredMove_) || (drivePending_)) {
 	doneMoving = false; 
       } else {
-	doneMoving = !(stringVal[P6K_TAS_MOVING_] == pC_->P6K_ON_);
+	doneMoving = !p6kParser::testBit(tas, P6K_TAS_MOVING_);
       }
       
       if (doneMoving) {
 	if (driveType_ == P6K_SERVO_) {
-	  bool targetZone = (stringVal[P6K_TAS_TARGETZONE_] == pC_->P6K_ON_);
-	  doneMoving = targetZone && !(stringVal[P6K_TAS_TARGETTIMEOUT_] == pC_->P6K_ON_);
+	  bool targetZone = p6kParser::testBit(tas, P6K_TAS_TARGETZONE_);
+	  doneMoving = targetZone && !p6kParser::testBit(tas, P6K_TAS_TARGETTIMEOUT_);
 	}
       }
 
       controllerDoneMoving = doneMoving;
 
-      //Optionally delay the done moving callback at the end of a move
+      //Optionally delay the done moving callback at the end of a move.
+      //The poller is woken when the delay ends (see p6kController::pollAt), 
+      //and the time from then to setting done moving is the settle latency.
       double delayTime = 0.0;
       pC_->getDoubleParam(axisNo_, pC_->P6K_A_DelayTime_, &delayTime);
       if (delayTime > 0) {
 	if (doneMoving) {
+	  epicsUInt64 now = epicsMonotonicGet();
 	  if (movingLastPoll_) {
 	    delayDoneMove_ = true;
-	    doneTimeSecs_ = nowTimeSecs_;
+	    doneTime_ = now + static_cast<epicsUInt64>(delayTime * 1.0e9);
 	  }
 	  if (delayDoneMove_) {
-	    if ((nowTimeSecs_ - doneTimeSecs_) > delayTime) {
+	    if (now >= doneTime_) {
 	      delayDoneMove_ = false;
+	      setDoubleParam(pC_->P6K_A_SettleLatency_, (now - doneTime_) / 1.0e6);
+	    } else {
+	      pC_->pollAt(doneTime_);
 	    }
 	  }
 	}
+      } else {
+	delayDoneMove_ = false;
       }
       if (delayDoneMove_) {
 	doneMoving = false;
       }
+      //Record how far out the predicted end of the move was
+      if ((movingLastPoll_) && (controllerDoneMoving) && (predictedEnd_ != 0)) {
+        double error = (static_cast<double>(epicsMonotonicGet()) - static_cast<double>(predictedEnd_)) / 1.0e6;
+        setDoubleParam(pC_->P6K_A_PredictError_, error);
+        predictedEnd_ = 0;
+      }
       movingLastPoll_ = !controllerDoneMoving;
       
       if (!doneMoving) {
@@ -1247,20 +1778,37 @@ asynStatus p6kAxis::getAxisStatus(bool *moving)
       //Set MSTA bits
       stat = (setIntegerParam(pC_->motorStatusDone_, 
 	      doneMoving) == asynSuccess) && stat;
-      stat = (setIntegerParam(pC_->motorStatusMoving_, 
-	     (stringVal[P6K_TAS_MOVING_] == pC_->P6K_ON_)) == asynSuccess) && stat;
-      stat = (setIntegerParam(pC_->motorStatusDirection_, 
-             (stringVal[P6K_TAS_DIRECTION_] == pC_->P6K_OFF_)) == asynSuccess) && stat;
+      if (p6kParser::testBit(changed, P6K_TAS_MOVING_)) {
+	stat = (setIntegerParam(pC_->motorStatusMoving_, 
+	       p6kParser::testBit(tas, P6K_TAS_MOVING_)) == asynSuccess) && stat;
+      }
+      if (p6kParser::testBit(changed, P6K_TAS_DIRECTION_)) {
+	stat = (setIntegerParam(pC_->motorStatusDirection_, 
+	       !p6kParser::testBit(tas, P6K_TAS_DIRECTION_)) == asynSuccess) && stat;
+      }
+      //The limits are also set from TLIM below, so these are set every poll.
       stat = (setIntegerParam(pC_->motorStatusHighLimit_, 
-	    ((stringVal[P6K_TAS_POSLIM_] == pC_->P6K_ON_) || 
-	     (stringVal[P6K_TAS_POSLIMSOFT_] == pC_->P6K_ON_))) == asynSuccess) && stat;
+	    (p6kParser::testBit(tas, P6K_TAS_POSLIM_) || 
+	     p6kParser::testBit(tas, P6K_TAS_POSLIMSOFT_))) == asynSuccess) && stat;
       stat = (setIntegerParam(pC_->motorStatusLowLimit_, 
-	    ((stringVal[P6K_TAS_NEGLIM_] == pC_->P6K_ON_) || 
-             (stringVal[P6K_TAS_NEGLIMSOFT_] == pC_->P6K_ON_))) == asynSuccess) && stat;
-      stat = (setIntegerParam(pC_->motorStatusHomed_, 
-	     (stringVal[P6K_TAS_HOMED_] == pC_->P6K_ON_)) == asynSuccess) && stat;
-      stat = (setIntegerParam(pC_->motorStatusPowerOn_, 
-	     (stringVal[P6K_TAS_DRIVE_] == pC_->P6K_OFF_)) == asynSuccess) && stat;
+	    (p6kParser::testBit(tas, P6K_TAS_NEGLIM_) || 
+	     p6kParser::testBit(tas, P6K_TAS_NEGLIMSOFT_))) == asynSuccess) && stat;
+      if (p6kParser::testBit(changed, P6K_TAS_HOMED_)) {
+	stat = (setIntegerParam(pC_->motorStatusHomed_, 
+	       p6kParser::testBit(tas, P6K_TAS_HOMED_)) == asynSuccess) && stat;
+      }
+      if (p6kParser::testBit(changed, P6K_TAS_DRIVE_)) {
+	stat = (setIntegerParam(pC_->motorStatusPowerOn_, 
+	       !p6kParser::testBit(tas, P6K_TAS_DRIVE_)) == asynSuccess) && stat;
+	//Follow the drive being switched on or off outside the state machine
+	if (p6kParser::testBit(tas, P6K_TAS_DRIVE_)) {
+	  if (driveState_ == P6K_DRIVE_READY) {
+	    setDriveState(P6K_DRIVE_OFF, 0.0);
+	  }
+	} else if (driveState_ == P6K_DRIVE_OFF) {
+	  setDriveState(P6K_DRIVE_READY, 0.0);
+	}
+      }
 
       //Check TLIM uint32_t from controller object for limit switch status
       //We do this so that the axis object can reflect the limit
@@ -1288,32 +1836,36 @@ asynStatus p6kAxis::getAxisStatus(bool *moving)
       }
       
       //Set limit error message for users
-      if (stringVal[P6K_TAS_POSLIM_] == pC_->P6K_ON_) {
+      if (p6kParser::testBit(tas, P6K_TAS_POSLIM_)) {
 	axisError_ = true;
 	setStringParam(pC_->P6K_A_Error_, "ERROR: Hardware High Limit");
       }
-      if (stringVal[P6K_TAS_NEGLIM_] == pC_->P6K_ON_) {
+      if (p6kParser::testBit(tas, P6K_TAS_NEGLIM_)) {
 	axisError_ = true;
 	setStringParam(pC_->P6K_A_Error_, "ERROR: Hardware Low Limit");
       }
-      if (stringVal[P6K_TAS_POSLIMSOFT_] == pC_->P6K_ON_) {
+      if (p6kParser::testBit(tas, P6K_TAS_POSLIMSOFT_)) {
 	axisError_ = true;
 	setStringParam(pC_->P6K_A_Error_, "ERROR: Software High Limit");
       }
-      if (stringVal[P6K_TAS_NEGLIMSOFT_] == pC_->P6K_ON_) {
+      if (p6kParser::testBit(tas, P6K_TAS_NEGLIMSOFT_)) {
 	axisError_ = true;
 	setStringParam(pC_->P6K_A_Error_, "ERROR: Software Low Limit");
       }
 
       if (driveType_ == P6K_SERVO_) {
-	stat = (setIntegerParam(pC_->motorStatusFollowingError_, 
-               (stringVal[P6K_TAS_POSERROR_] == pC_->P6K_ON_)) == asynSuccess) && stat;
+	if (p6kParser::testBit(changed, P6K_TAS_POSERROR_)) {
+	  stat = (setIntegerParam(pC_->motorStatusFollowingError_, 
+		 p6kParser::testBit(tas, P6K_TAS_POSERROR_)) == asynSuccess) && stat;
+	}
       } else {
-	stat = (setIntegerParam(pC_->motorStatusFollowingError_, 
-               (stringVal[P6K_TAS_STALL_] == pC_->P6K_ON_)) == asynSuccess) && stat;
+	if (p6kParser::testBit(changed, P6K_TAS_STALL_)) {
+	  stat = (setIntegerParam(pC_->motorStatusFollowingError_, 
+		 p6kParser::testBit(tas, P6K_TAS_STALL_)) == asynSuccess) && stat;
+	}
       }
       
-      if (stringVal[P6K_TAS_STALL_] == pC_->P6K_ON_) {
+      if (p6kParser::testBit(tas, P6K_TAS_STALL_)) {
 	axisError_ = true;
 	setStringParam(pC_->P6K_A_Error_, "ERROR: Stall Detected");
       }
@@ -1325,8 +1877,11 @@ asynStatus p6kAxis::getAxisStatus(bool *moving)
       //We only detect drive fault input when a move is attempted.
       //Unless we also poll extended axis status (TASX), which always 
       //reports drive fault status.
-      if (stringVal[P6K_TAS_DRIVEFAULT_] == pC_->P6K_ON_) {
-	stat = (setIntegerParam(pC_->P6K_A_TAS_DriveFault_, 1) == asynSuccess) && stat;
+      if (p6kParser::testBit(changed, P6K_TAS_DRIVEFAULT_)) {
+	stat = (setIntegerParam(pC_->P6K_A_TAS_DriveFault_, 
+	       p6kParser::testBit(tas, P6K_TAS_DRIVEFAULT_)) == asynSuccess) && stat;
+      }
+      if (p6kParser::testBit(tas, P6K_TAS_DRIVEFAULT_)) {
 	problem = 1;
 	if (printErrors_) {
 	  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
@@ -1334,12 +1889,13 @@ asynStatus p6kAxis::getAxisStatus(bool *moving)
 		    functionName, pC_->portName, axisNo_);
 	  printNextError_ = false;
 	}
-      } else {
-	stat = (setIntegerParam(pC_->P6K_A_TAS_DriveFault_, 0) == asynSuccess) && stat;
       }
 
-      if (stringVal[P6K_TAS_TARGETTIMEOUT_] == pC_->P6K_ON_) {
-	stat = (setIntegerParam(pC_->P6K_A_TAS_Timeout_, 1) == asynSuccess) && stat;
+      if (p6kParser::testBit(changed, P6K_TAS_TARGETTIMEOUT_)) {
+	stat = (setIntegerParam(pC_->P6K_A_TAS_Timeout_, 
+	       p6kParser::testBit(tas, P6K_TAS_TARGETTIMEOUT_)) == asynSuccess) && stat;
+      }
+      if (p6kParser::testBit(tas, P6K_TAS_TARGETTIMEOUT_)) {
 	problem = 1;
 	if (printErrors_) {
 	  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
@@ -1347,12 +1903,13 @@ asynStatus p6kAxis::getAxisStatus(bool *moving)
 	  	    functionName, pC_->portName, axisNo_);
 	  printNextError_ = false;
 	}
-      } else {
-	stat = (setIntegerParam(pC_->P6K_A_TAS_Timeout_, 0) == asynSuccess) && stat;
       }
 
-      if (stringVal[P6K_TAS_POSERROR_] == pC_->P6K_ON_) {
-	stat = (setIntegerParam(pC_->P6K_A_TAS_PosErr_, 1) == asynSuccess) && stat;
+      if (p6kParser::testBit(changed, P6K_TAS_POSERROR_)) {
+	stat = (setIntegerParam(pC_->P6K_A_TAS_PosErr_, 
+	       p6kParser::testBit(tas, P6K_TAS_POSERROR_)) == asynSuccess) && stat;
+      }
+      if (p6kParser::testBit(tas, P6K_TAS_POSERROR_)) {
 	problem = 1;
 	if (printErrors_) {
 	  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
@@ -1360,8 +1917,6 @@ asynStatus p6kAxis::getAxisStatus(bool *moving)
 		    functionName, pC_->portName, axisNo_);
 	  printNextError_ = false;
 	}
-      } else {
-	stat = (setIntegerParam(pC_->P6K_A_TAS_PosErr_, 0) == asynSuccess) && stat;
       }
 
       stat = (setIntegerParam(pC_->motorStatusProblem_, (problem!=0)) == asynSuccess) && stat;
@@ -1371,6 +1926,7 @@ asynStatus p6kAxis::getAxisStatus(bool *moving)
       }
 
       if (!stat) {
+	tasMaskValid_ = false;
 	if (printErrors_) {
 	  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
 		    "%s: ERROR: Problem setting params on controller %s, axis %d\n", 
@@ -18,8 +18,27 @@
 #include "asynMotorController.h"
 #include "asynMotorAxis.h"
 
+#include "parker6kCommand.h"
+#include "parker6kLatest.h"
+
+#define P6K_STATUS_MAXBUF 64
+
+#include "parker6kCommandBatch.h"
+
 class p6kController;
 
+/**
+ * Drive power state of an axis, see p6kAxis::driveService.
+ * The order matches the DriveState_RBV record.
+ */
+enum p6kDriveState {
+  P6K_DRIVE_OFF,        //Drive off, or not known to be on
+  P6K_DRIVE_ENABLING,   //DRIVE1 is to be sent
+  P6K_DRIVE_SETTLING,   //DRIVE1 has been sent, waiting for the enable delay
+  P6K_DRIVE_READY,      //Drive on, moves are sent straight away
+  P6K_DRIVE_FAULT       //DRIVE SHUTDOWN seen, waiting to retry the enable
+};
+
 /**
  * p6kAxis derives from the virtual class asynMotorAxis. It re-implements some functions
  * and defines all the axis specific logic, including the polling function that
@@ -42,18 +61,51 @@ class p6kAxis : public asynMotorAxis
   asynStatus setHighLimit(double highLimit);
   asynStatus setLowLimit(double lowLimit);
   asynStatus disableSoftwareLimits(bool disable);
-  asynStatus modbusPortConnect(const char *modbusPort, int modbusAddr, int modbusOffset);
+  asynStatus modbusPortConnect(const char *modbusPort, int modbusAddr, int modbusOffset, int modbusWords);
   
   private:
   p6kController *pC_;
   
-  asynUser* modbusEncPort_;
+  bool modbusEnc_;
   epicsInt32 modbusEncAddr_;
   epicsInt32 modbusEncOffset_;
+  epicsInt32 modbusEncWords_;
+
+  //External encoder position, written by p6kController::writeInt32
+  p6kLatest externalEncoder_;
 
   bool movingLastPoll_;
   bool delayDoneMove_;
-  epicsFloat64 doneTimeSecs_;
+  epicsUInt64 doneTime_;       //Monotonic time the delayed done moving is due (ns)
+
+  //Poll schedule, set by p6kController::scheduleAxisPolls
+  bool pollDue_;
+  epicsUInt64 lastPoll_;     //Monotonic time of the last status read (ns), or 0
+  epicsUInt64 lastCommand_;  //Monotonic time of the last motion command (ns), or 0
+
+  //Drive power state machine, and the move or home waiting for the drive to be ready
+  p6kDriveState driveState_;
+  epicsUInt64 driveDeadline_;   //Monotonic time the settling or fault state ends (ns), or 0
+  bool driveRetried_;           //The pending move is already a DRIVE SHUTDOWN retry
+  bool drivePending_;
+  bool drivePendingMove_;       //The pending batch ends in GO, so start the move prediction
+  p6kCommandBatch driveBatch_;
+
+  //Predicted end of the current move, from the commanded profile
+  epicsFloat64 predictedTime_;  //Move time of the last move sent (s), or 0 if not known
+  epicsUInt64 predictedEnd_;    //Monotonic time the move should end (ns), or 0
+
+  //Status cache populated by p6kController::getBulkStatus
+  bool bulkStatusValid_;
+  bool bulkEncoderValid_;
+  epicsUInt64 bulkTAS_;       //TAS bits, from p6kParser::toMask
+  epicsInt32 bulkTPC_;
+  epicsInt32 bulkTPE_;
+
+  //TAS bits from the last poll, so that only the parameters
+  //whose bits have changed are set
+  epicsUInt64 tasMask_;
+  bool tasMaskValid_;
   
 
   asynStatus getAxisStatus(bool *moving);
@@ -61,8 +113,24 @@ class p6kAxis : public asynMotorAxis
   asynStatus readIntParam(const char *cmd, epicsUInt32 param, uint32_t *val);
   asynStatus readDoubleParam(const char *cmd, epicsUInt32 param, double *val);
   void printAxisParams(void);
-  asynStatus autoDriveEnable(void);
+  asynStatus autoDriveEnable(bool *ready);
+  void driveService(void);
+  void setDriveState(p6kDriveState state, double delay);
+  asynStatus driveRelease(void);
+  bool driveShutdown(const char *response);
+  void driveCancel(void);
+  void driveFail(const char *error);
+  void stopPending(void);
+  void setMoveError(const p6kCommandBatch *batch, int32_t failed, const char *response);
+  void batchError(const char *functionName);
+  asynStatus shadowAdd(p6kCommandBatch *batch, const p6kCommand &command);
+  void shadowCommit(void);
+  void shadowInvalidate(void);
   int32_t getScaleFactor(void);
+  void setCommanded(void);
+  void startPrediction(void);
+  bool cruising(epicsUInt64 now, double guard);
+  void pollMoveEnd(void);
 
   uint32_t deferredPosition_;
   uint32_t deferredMove_;
@@ -82,6 +150,17 @@ class p6kAxis : public asynMotorAxis
   uint32_t p6k_esk_;
   uint32_t p6k_estall_;
 
+  //Motion parameters last acknowledged by the controller, and the values sent
+  //in the current batch that have not been acknowledged yet. These are indexed
+  //by the shadow position in p6kCommandTable.
+  struct p6kShadow {
+    bool valid;
+    epicsInt64 value;
+    int32_t digits;
+  };
+  p6kShadow shadow_[P6K_CMD_SHADOW_NUM];
+  p6kShadow shadowPending_[P6K_CMD_SHADOW_NUM];
+
   static const epicsUInt32 P6K_TAS_MOVING_;
   static const epicsUInt32 P6K_TAS_DIRECTION_;
   static const epicsUInt32 P6K_TAS_ACCELERATING_;
@@ -112,6 +191,7 @@ class p6kAxis : public asynMotorAxis
   static const epicsUInt32 P6K_LIM_DISABLE_;
 
   static const char * P6K_DRIVE_SHUTDOWN_STR_;
+  static const epicsFloat64 P6K_DRIVE_RETRY_DELAY_;
 
   friend class p6kController;
 };
@@ -0,0 +1,283 @@
+/********************************************
+ *  parker6kCommand.cpp
+ *
+ *  Table of P6K commands, and a formatter
+ *  that builds them without printf.
+ *
+ ********************************************/
+
+#include <string.h>
+#include <math.h>
+
+#include "parker6kCommand.h"
+
+#define P6K_CMD_DESC(cmd, form, arg, shadow) {P6K_CMD_##cmd, sizeof(P6K_CMD_##cmd)-1, form, arg, shadow}
+
+/**
+ * The command table, in p6kCommandId order. Commands with the axis form
+ * can also be sent without an axis number, to read all the axes at once.
+ */
+const p6kCommandDesc p6kCommandTable[P6K_CMDID_NUM] = {
+  P6K_CMD_DESC(A,      P6K_FORM_AXIS,       P6K_ARG_FIXED,   2),
+  P6K_CMD_DESC(AA,     P6K_FORM_AXIS,       P6K_ARG_FIXED,   3),
+  P6K_CMD_DESC(AD,     P6K_FORM_AXIS,       P6K_ARG_FIXED,   4),
+  P6K_CMD_DESC(ADA,    P6K_FORM_AXIS,       P6K_ARG_FIXED,   5),
+  P6K_CMD_DESC(AXSDEF, P6K_FORM_AXIS,       P6K_ARG_INT,    -1),
+  P6K_CMD_DESC(CMDDIR, P6K_FORM_AXIS,       P6K_ARG_INT,    -1),
+  P6K_CMD_DESC(COMEXC, P6K_FORM_CONTROLLER, P6K_ARG_INT,    -1),
+  P6K_CMD_DESC(D,      P6K_FORM_AXIS,       P6K_ARG_INT,    -1),
+  P6K_CMD_DESC(DRES,   P6K_FORM_AXIS,       P6K_ARG_INT,    -1),
+  P6K_CMD_DESC(DRFEN,  P6K_FORM_AXIS,       P6K_ARG_INT,    -1),
+  P6K_CMD_DESC(DRIVE,  P6K_FORM_AXIS,       P6K_ARG_INT,    -1),
+  P6K_CMD_DESC(ECHO,   P6K_FORM_CONTROLLER, P6K_ARG_INT,    -1),
+  P6K_CMD_DESC(ENCCNT, P6K_FORM_AXIS,       P6K_ARG_INT,    -1),
+  P6K_CMD_DESC(ENCPOL, P6K_FORM_AXIS,       P6K_ARG_INT,    -1),
+  P6K_CMD_DESC(EOL,    P6K_FORM_CONTROLLER, P6K_ARG_STRING, -1),
+  P6K_CMD_DESC(EOT,    P6K_FORM_CONTROLLER, P6K_ARG_STRING, -1),
+  P6K_CMD_DESC(ERES,   P6K_FORM_AXIS,       P6K_ARG_INT,    -1),
+  P6K_CMD_DESC(ERRLVL, P6K_FORM_CONTROLLER, P6K_ARG_INT,    -1),
+  P6K_CMD_DESC(ESK,    P6K_FORM_AXIS,       P6K_ARG_INT,    -1),
+  P6K_CMD_DESC(ESTALL, P6K_FORM_AXIS,       P6K_ARG_INT,    -1),
+  P6K_CMD_DESC(GO,     P6K_FORM_AXIS,       P6K_ARG_NONE,   -1),
+  P6K_CMD_DESC(HOM,    P6K_FORM_AXIS,       P6K_ARG_INT,    -1),
+  P6K_CMD_DESC(HOMA,   P6K_FORM_AXIS,       P6K_ARG_FIXED,   7),
+  P6K_CMD_DESC(HOMAA,  P6K_FORM_AXIS,       P6K_ARG_FIXED,   8),
+  P6K_CMD_DESC(HOMAD,  P6K_FORM_AXIS,       P6K_ARG_FIXED,   9),
+  P6K_CMD_DESC(HOMADA, P6K_FORM_AXIS,       P6K_ARG_FIXED,  10),
+  P6K_CMD_DESC(HOMV,   P6K_FORM_AXIS,       P6K_ARG_FIXED,   6),
+  P6K_CMD_DESC(LH,     P6K_FORM_AXIS,       P6K_ARG_INT,    -1),
+  P6K_CMD_DESC(LS,     P6K_FORM_AXIS,       P6K_ARG_INT,    -1),
+  P6K_CMD_DESC(LSNEG,  P6K_FORM_AXIS,       P6K_ARG_INT,    -1),
+  P6K_CMD_DESC(LSPOS,  P6K_FORM_AXIS,       P6K_ARG_INT,    -1),
+  P6K_CMD_DESC(MA,     P6K_FORM_AXIS,       P6K_ARG_INT,     0),
+  P6K_CMD_DESC(OUT,    P6K_FORM_CONTROLLER, P6K_ARG_STRING, -1),
+  P6K_CMD_DESC(PESET,  P6K_FORM_AXIS,       P6K_ARG_INT,    -1),
+  P6K_CMD_DESC(PSET,   P6K_FORM_AXIS,       P6K_ARG_INT,    -1),
+  P6K_CMD_DESC(S,      P6K_FORM_AXIS,       P6K_ARG_NONE,   -1),
+  P6K_CMD_DESC(TCMDER, P6K_FORM_CONTROLLER, P6K_ARG_NONE,   -1),
+  P6K_CMD_DESC(TAS,    P6K_FORM_AXIS,       P6K_ARG_NONE,   -1),
+  P6K_CMD_DESC(TASX,   P6K_FORM_AXIS,       P6K_ARG_NONE,   -1),
+  P6K_CMD_DESC(TIN,    P6K_FORM_CONTROLLER, P6K_ARG_NONE,   -1),
+  P6K_CMD_DESC(TLIM,   P6K_FORM_CONTROLLER, P6K_ARG_NONE,   -1),
+  P6K_CMD_DESC(TOUT,   P6K_FORM_CONTROLLER, P6K_ARG_NONE,   -1),
+  P6K_CMD_DESC(TPC,    P6K_FORM_AXIS,       P6K_ARG_NONE,   -1),
+  P6K_CMD_DESC(TPE,    P6K_FORM_AXIS,       P6K_ARG_NONE,   -1),
+  P6K_CMD_DESC(TREV,   P6K_FORM_CONTROLLER, P6K_ARG_NONE,   -1),
+  P6K_CMD_DESC(TSS,    P6K_FORM_CONTROLLER, P6K_ARG_NONE,   -1),
+  P6K_CMD_DESC(V,      P6K_FORM_AXIS,       P6K_ARG_FIXED,   1),
+};
+
+//Fails to compile if an entry is added to p6kCommandId but not the table
+typedef char p6kCommandTableSizeCheck[(sizeof(p6kCommandTable)/sizeof(p6kCommandTable[0]) == P6K_CMDID_NUM) ? 1 : -1];
+
+static const double p6kPow10Double[P6K_CMD_MAXDIGITS+1] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+};
+
+static const char P6K_IMMEDIATE_ = '!';
+
+/**
+ * p6kCommand constructor, for a command without an argument.
+ * @param id The command
+ * @param axis The axis number (from 1), or 0 to send it without an axis number.
+ */
+p6kCommand::p6kCommand(p6kCommandId id, int32_t axis)
+  : id_(id), axis_(axis), immediate_(false), value_(0), digits_(0)
+{
+}
+
+/**
+ * Create a command with an integer argument (eg. 1MA1).
+ */
+p6kCommand p6kCommand::integer(p6kCommandId id, int32_t axis, epicsInt32 value)
+{
+  p6kCommand command(id, axis);
+  command.value_ = value;
+  return command;
+}
+
+/**
+ * Create a command with a fixed point argument (eg. 1V2.5000).
+ * The value is rounded to the number of digits, which is what is
+ * compared by sameValue.
+ * @param id The command
+ * @param axis The axis number
+ * @param value The value to send
+ * @param digits The number of digits after the decimal point (0 to P6K_CMD_MAXDIGITS)
+ */
+p6kCommand p6kCommand::fixed(p6kCommandId id, int32_t axis, double value, int32_t digits)
+{
+  digits = clampDigits(digits);
+  return fixedScaled(id, axis, scale(value, digits), digits);
+}
+
+/**
+ * Create a command with a fixed point argument that has already been
+ * scaled by 10^digits and rounded (eg. 25000 with 4 digits for 1V2.5000).
+ */
+p6kCommand p6kCommand::fixedScaled(p6kCommandId id, int32_t axis, epicsInt64 scaled, int32_t digits)
+{
+  p6kCommand command(id, axis);
+  command.value_ = scaled;
+  command.digits_ = clampDigits(digits);
+  return command;
+}
+
+/**
+ * Send this command as an immediate command (eg. !1S).
+ * @return This command, so that calls can be chained.
+ */
+p6kCommand &p6kCommand::immediate(void)
+{
+  immediate_ = true;
+  return *this;
+}
+
+/**
+ * Write the command into a buffer, with a null terminator.
+ * String arguments are not formatted here, the caller appends them.
+ * @param buffer The buffer to write into
+ * @param maxChars The size of the buffer
+ * @return The length of the command, or 0 if it does not fit.
+ */
+size_t p6kCommand::format(char *buffer, size_t maxChars) const
+{
+  char temp[P6K_CMD_MAXBUF];
+  const p6kCommandDesc &desc = getDesc();
+  size_t len = 0;
+
+  //Write straight into the buffer if the longest command fits
+  char *out = (maxChars >= P6K_CMD_MAXBUF) ? buffer : temp;
+
+  if (immediate_) {
+    out[len++] = P6K_IMMEDIATE_;
+  }
+  if ((desc.form == P6K_FORM_AXIS) && (axis_ > 0)) {
+    len += formatInt(out+len, axis_, 0);
+  }
+  memcpy(out+len, desc.name, desc.nameLen);
+  len += desc.nameLen;
+  if (desc.arg == P6K_ARG_INT) {
+    len += formatInt(out+len, value_, 0);
+  } else if (desc.arg == P6K_ARG_FIXED) {
+    len += formatInt(out+len, value_, digits_);
+  }
+
+  if (len >= maxChars) {
+    if (maxChars > 0) {
+      buffer[0] = '\0';
+    }
+    return 0;
+  }
+  if (out != buffer) {
+    memcpy(buffer, temp, len);
+  }
+  buffer[len] = '\0';
+
+  return len;
+}
+
+/**
+ * @return The command ID
+ */
+p6kCommandId p6kCommand::getId(void) const
+{
+  return id_;
+}
+
+/**
+ * @return The table entry for the command
+ */
+const p6kCommandDesc &p6kCommand::getDesc(void) const
+{
+  return p6kCommandTable[id_];
+}
+
+/**
+ * @return The argument. Fixed point values are scaled by 10^digits.
+ */
+epicsInt64 p6kCommand::getValue(void) const
+{
+  return value_;
+}
+
+/**
+ * @return The number of digits after the decimal point
+ */
+int32_t p6kCommand::getDigits(void) const
+{
+  return digits_;
+}
+
+/**
+ * @return true if the other command would send the same argument,
+ * at the precision sent to the controller.
+ */
+bool p6kCommand::sameValue(const p6kCommand &other) const
+{
+  return ((value_ == other.value_) && (digits_ == other.digits_));
+}
+
+/**
+ * Look up 10^digits, instead of calling pow.
+ * @param digits The power (0 to P6K_CMD_MAXDIGITS, clamped)
+ */
+double p6kCommand::powerOf10(int32_t digits)
+{
+  return p6kPow10Double[clampDigits(digits)];
+}
+
+/**
+ * Scale a value by 10^digits and round it to the nearest integer.
+ */
+epicsInt64 p6kCommand::scale(double value, int32_t digits)
+{
+  double scaled = value * powerOf10(digits);
+  return static_cast<epicsInt64>((scaled < 0) ? ceil(scaled - 0.5) : floor(scaled + 0.5));
+}
+
+int32_t p6kCommand::clampDigits(int32_t digits)
+{
+  if (digits < 0) {
+    return 0;
+  } else if (digits > P6K_CMD_MAXDIGITS) {
+    return P6K_CMD_MAXDIGITS;
+  }
+  return digits;
+}
+
+/**
+ * Write a scaled integer as a decimal number with a fixed number of digits
+ * after the point. This gives the same result as "%.*f" on value/10^digits,
+ * and "%d" when digits is 0. The output is not null terminated.
+ * @param buffer Buffer with room for at least 22 characters (sign, 19 digits and the point)
+ * @param value The value, scaled by 10^digits
+ * @param digits The number of digits after the decimal point
+ * @return The number of characters written
+ */
+size_t p6kCommand::formatInt(char *buffer, epicsInt64 value, int32_t digits)
+{
+  char reversed[P6K_CMD_MAXBUF];
+  size_t count = 0;
+  size_t len = 0;
+  //Work with the magnitude as unsigned, so the most negative value is ok
+  epicsUInt64 magnitude = (value < 0) ? (0 - static_cast<epicsUInt64>(value)) : static_cast<epicsUInt64>(value);
+
+  //At least one digit before the point
+  do {
+    if ((digits > 0) && (count == static_cast<size_t>(digits))) {
+      reversed[count++] = '.';
+    }
+    reversed[count++] = static_cast<char>('0' + (magnitude % 10));
+    magnitude /= 10;
+  } while ((magnitude > 0) || (count <= static_cast<size_t>(digits)));
+
+  if (value < 0) {
+    buffer[len++] = '-';
+  }
+  while (count > 0) {
+    buffer[len++] = reversed[--count];
+  }
+
+  return len;
+}
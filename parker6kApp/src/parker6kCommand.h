@@ -0,0 +1,163 @@
+/********************************************
+ *  parker6kCommand.h
+ *
+ *  Table of P6K commands, and a formatter
+ *  that builds them without printf.
+ *
+ ********************************************/
+
+#ifndef parker6kCommand_H
+#define parker6kCommand_H
+
+#include <stddef.h>
+#include "stdint.h"
+
+#include <epicsTypes.h>
+
+//Controller commands
+#define P6K_CMD_A        "A"
+#define P6K_CMD_AA       "AA"
+#define P6K_CMD_AD       "AD"
+#define P6K_CMD_ADA      "ADA"
+#define P6K_CMD_AXSDEF   "AXSDEF"
+#define P6K_CMD_CMDDIR   "CMDDIR"
+#define P6K_CMD_COMEXC   "COMEXC"
+#define P6K_CMD_D        "D"
+#define P6K_CMD_DRES     "DRES"
+#define P6K_CMD_DRFEN    "DRFEN"
+#define P6K_CMD_DRIVE    "DRIVE"
+#define P6K_CMD_ECHO     "ECHO"
+#define P6K_CMD_ENCCNT   "ENCCNT"
+#define P6K_CMD_ENCPOL   "ENCPOL"
+#define P6K_CMD_EOL      "EOL"
+#define P6K_CMD_EOT      "EOT"
+#define P6K_CMD_ERES     "ERES"
+#define P6K_CMD_ERRLVL   "ERRLVL"
+#define P6K_CMD_ESK      "ESK"
+#define P6K_CMD_ESTALL   "ESTALL"
+#define P6K_CMD_GO       "GO"
+#define P6K_CMD_HOM      "HOM"
+#define P6K_CMD_HOMA     "HOMA"
+#define P6K_CMD_HOMAA    "HOMAA"
+#define P6K_CMD_HOMAD    "HOMAD"
+#define P6K_CMD_HOMADA   "HOMADA"
+#define P6K_CMD_HOMV     "HOMV"
+#define P6K_CMD_LH       "LH"
+#define P6K_CMD_LS       "LS"
+#define P6K_CMD_LSNEG    "LSNEG"
+#define P6K_CMD_LSPOS    "LSPOS"
+#define P6K_CMD_MA       "MA"
+#define P6K_CMD_OUT      "OUT"
+#define P6K_CMD_PESET    "PESET"
+#define P6K_CMD_PSET     "PSET"
+#define P6K_CMD_S        "S"
+#define P6K_CMD_TCMDER   "TCMDER"
+#define P6K_CMD_TAS      "TAS"
+#define P6K_CMD_TASX     "TASX"
+#define P6K_CMD_TIN      "TIN"
+#define P6K_CMD_TLIM     "TLIM"
+#define P6K_CMD_TOUT     "TOUT"
+#define P6K_CMD_TPC      "TPC"
+#define P6K_CMD_TPE      "TPE"
+#define P6K_CMD_TREV     "TREV"
+#define P6K_CMD_TSS      "TSS"
+#define P6K_CMD_V        "V"
+
+//Long enough for ! + axis number + command name + a 64 bit fixed point argument
+#define P6K_CMD_MAXBUF 48
+
+//The largest number of digits after the decimal point that can be formatted
+#define P6K_CMD_MAXDIGITS 9
+
+//The number of motion parameters that are cached by p6kAxis
+#define P6K_CMD_SHADOW_NUM 11
+
+/**
+ * Identifies a command in the command table. The order must match p6kCommandTable.
+ */
+enum p6kCommandId {
+  P6K_CMDID_A, P6K_CMDID_AA, P6K_CMDID_AD, P6K_CMDID_ADA, P6K_CMDID_AXSDEF,
+  P6K_CMDID_CMDDIR, P6K_CMDID_COMEXC, P6K_CMDID_D, P6K_CMDID_DRES, P6K_CMDID_DRFEN,
+  P6K_CMDID_DRIVE, P6K_CMDID_ECHO, P6K_CMDID_ENCCNT, P6K_CMDID_ENCPOL, P6K_CMDID_EOL,
+  P6K_CMDID_EOT, P6K_CMDID_ERES, P6K_CMDID_ERRLVL, P6K_CMDID_ESK, P6K_CMDID_ESTALL,
+  P6K_CMDID_GO, P6K_CMDID_HOM, P6K_CMDID_HOMA, P6K_CMDID_HOMAA, P6K_CMDID_HOMAD,
+  P6K_CMDID_HOMADA, P6K_CMDID_HOMV, P6K_CMDID_LH, P6K_CMDID_LS, P6K_CMDID_LSNEG,
+  P6K_CMDID_LSPOS, P6K_CMDID_MA, P6K_CMDID_OUT, P6K_CMDID_PESET, P6K_CMDID_PSET,
+  P6K_CMDID_S, P6K_CMDID_TCMDER, P6K_CMDID_TAS, P6K_CMDID_TASX, P6K_CMDID_TIN,
+  P6K_CMDID_TLIM, P6K_CMDID_TOUT, P6K_CMDID_TPC, P6K_CMDID_TPE, P6K_CMDID_TREV,
+  P6K_CMDID_TSS, P6K_CMDID_V,
+  P6K_CMDID_NUM
+};
+
+/**
+ * How a command is addressed. Axis commands are prefixed by the
+ * axis number (eg. 1TPC), controller commands are not (eg. TSS).
+ */
+enum p6kCommandForm {
+  P6K_FORM_CONTROLLER,
+  P6K_FORM_AXIS
+};
+
+/**
+ * The type of the argument that follows the command name.
+ */
+enum p6kArgType {
+  P6K_ARG_NONE,
+  P6K_ARG_INT,
+  P6K_ARG_FIXED,
+  P6K_ARG_STRING
+};
+
+/**
+ * Description of a command. The table of these is constant data, so it is
+ * set up at compile time.
+ */
+struct p6kCommandDesc {
+  const char *name;
+  uint32_t nameLen;
+  p6kCommandForm form;
+  p6kArgType arg;
+  int32_t shadow;    //Position in the p6kAxis motion parameter cache, or -1
+};
+
+extern const p6kCommandDesc p6kCommandTable[P6K_CMDID_NUM];
+
+/**
+ * A single typed command, for example axis 1, command V, value 2.5000.
+ * Fixed point values are held as an integer scaled by 10^digits, so two
+ * commands can be compared exactly at the precision sent to the controller.
+ * format() writes the command straight into a transmit buffer.
+ */
+class p6kCommand {
+
+ public:
+  p6kCommand(p6kCommandId id, int32_t axis);
+
+  static p6kCommand integer(p6kCommandId id, int32_t axis, epicsInt32 value);
+  static p6kCommand fixed(p6kCommandId id, int32_t axis, double value, int32_t digits);
+  static p6kCommand fixedScaled(p6kCommandId id, int32_t axis, epicsInt64 scaled, int32_t digits);
+
+  p6kCommand &immediate(void);
+  size_t format(char *buffer, size_t maxChars) const;
+
+  p6kCommandId getId(void) const;
+  const p6kCommandDesc &getDesc(void) const;
+  epicsInt64 getValue(void) const;
+  int32_t getDigits(void) const;
+  bool sameValue(const p6kCommand &other) const;
+
+  static double powerOf10(int32_t digits);
+  static epicsInt64 scale(double value, int32_t digits);
+
+ private:
+  p6kCommandId id_;
+  int32_t axis_;
+  bool immediate_;
+  epicsInt64 value_;
+  int32_t digits_;
+
+  static int32_t clampDigits(int32_t digits);
+  static size_t formatInt(char *buffer, epicsInt64 value, int32_t digits);
+};
+
+#endif /* parker6kCommand_H */
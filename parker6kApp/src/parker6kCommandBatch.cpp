@@ -0,0 +1,216 @@
+/********************************************
+ *  parker6kCommandBatch.cpp
+ *
+ *  Builder for a group of P6K commands that
+ *  are sent to the controller as a single
+ *  command line.
+ *
+ ********************************************/
+
+#include <string.h>
+#include <ctype.h>
+#include <stdarg.h>
+
+#include <epicsStdio.h>
+
+#include "parker6kCommandBatch.h"
+
+const char p6kCommandBatch::P6K_DELIMITER_ = ':';
+
+/**
+ * p6kCommandBatch constructor. Creates an empty batch.
+ */
+p6kCommandBatch::p6kCommandBatch()
+{
+  clear();
+}
+
+/**
+ * Remove all commands from the batch.
+ */
+void p6kCommandBatch::clear(void)
+{
+  line_[0] = '\0';
+  for (uint32_t i=0; i<P6K_BATCH_MAXCMDS; ++i) {
+    commands_[i][0] = '\0';
+    ids_[i] = P6K_CMDID_NUM;
+  }
+  count_ = 0;
+  length_ = 0;
+}
+
+/**
+ * Add a command to the end of the batch.
+ * @param format printf style format for the command, followed by the arguments.
+ * @return asynStatus. asynError if the command does not fit in the batch.
+ */
+asynStatus p6kCommandBatch::add(const char *format, ...)
+{
+  va_list args;
+  int len = 0;
+
+  if (count_ >= P6K_BATCH_MAXCMDS) {
+    return asynError;
+  }
+
+  char *command = commands_[count_];
+  va_start(args, format);
+  len = epicsVsnprintf(command, sizeof(commands_[0]), format, args);
+  va_end(args);
+
+  if ((len <= 0) || (static_cast<size_t>(len) >= sizeof(commands_[0]))) {
+    command[0] = '\0';
+    return asynError;
+  }
+
+  ids_[count_] = P6K_CMDID_NUM;
+  return append(len);
+}
+
+/**
+ * Add a typed command to the end of the batch.
+ * @param command The command to add
+ * @return asynStatus. asynError if the command does not fit in the batch.
+ */
+asynStatus p6kCommandBatch::add(const p6kCommand &command)
+{
+  if (count_ >= P6K_BATCH_MAXCMDS) {
+    return asynError;
+  }
+
+  size_t len = command.format(commands_[count_], sizeof(commands_[0]));
+  if (len == 0) {
+    return asynError;
+  }
+
+  ids_[count_] = command.getId();
+  return append(len);
+}
+
+/**
+ * Append the command that has just been written to commands_[count_] to the line.
+ * @param len The length of the command
+ * @return asynStatus. asynError if the line is full.
+ */
+asynStatus p6kCommandBatch::append(size_t len)
+{
+  char *command = commands_[count_];
+
+  //Allow for the delimiter
+  if ((length_ + len + 1) >= sizeof(line_)) {
+    command[0] = '\0';
+    ids_[count_] = P6K_CMDID_NUM;
+    return asynError;
+  }
+
+  if (count_ > 0) {
+    line_[length_++] = P6K_DELIMITER_;
+  }
+  memcpy(line_+length_, command, len);
+  length_ += len;
+  line_[length_] = '\0';
+  ++count_;
+
+  return asynSuccess;
+}
+
+/**
+ * @return The number of commands in the batch
+ */
+uint32_t p6kCommandBatch::size(void) const
+{
+  return count_;
+}
+
+/**
+ * @return The command line to send to the controller.
+ */
+const char *p6kCommandBatch::getLine(void) const
+{
+  return line_;
+}
+
+/**
+ * @param index The position of the command in the batch (0 based)
+ * @return The sub-command, or an empty string if index is out of range.
+ */
+const char *p6kCommandBatch::getCommand(uint32_t index) const
+{
+  if (index >= count_) {
+    return "";
+  }
+  return commands_[index];
+}
+
+/**
+ * @param index The position of the command in the batch (0 based)
+ * @return The ID of a typed command, or P6K_CMDID_NUM if the command was
+ * added as a string or index is out of range.
+ */
+p6kCommandId p6kCommandBatch::getCommandId(uint32_t index) const
+{
+  if (index >= count_) {
+    return P6K_CMDID_NUM;
+  }
+  return ids_[index];
+}
+
+/**
+ * Find the position of a command in the batch. This is used to map the
+ * command reported by the controller (using TCMDER) back to the sub-command
+ * that failed. An exact match is tried first, then a match on the axis
+ * number and command name only, in case the controller formats the
+ * arguments differently.
+ * @param command The command to search for
+ * @return The position of the command (0 based), or -1 if it was not found.
+ */
+int32_t p6kCommandBatch::findCommand(const char *command) const
+{
+  if (command == NULL) {
+    return -1;
+  }
+
+  while (isspace(static_cast<unsigned char>(*command))) {
+    ++command;
+  }
+
+  for (uint32_t i=0; i<count_; ++i) {
+    if (strcmp(commands_[i], command) == 0) {
+      return i;
+    }
+  }
+
+  size_t nameLen = commandNameLength(command);
+  if (nameLen == 0) {
+    return -1;
+  }
+  for (uint32_t i=0; i<count_; ++i) {
+    if ((commandNameLength(commands_[i]) == nameLen) &&
+        (strncmp(commands_[i], command, nameLen) == 0)) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * Return the length of the immediate prefix, axis number and command name
+ * at the start of a command (eg. 4 for 1ADA10.0).
+ */
+size_t p6kCommandBatch::commandNameLength(const char *command)
+{
+  size_t len = 0;
+
+  if (command[len] == '!') {
+    ++len;
+  }
+  while (isdigit(static_cast<unsigned char>(command[len]))) {
+    ++len;
+  }
+  while (isalpha(static_cast<unsigned char>(command[len]))) {
+    ++len;
+  }
+
+  return len;
+}
@@ -0,0 +1,59 @@
+/********************************************
+ *  parker6kCommandBatch.h
+ *
+ *  Builder for a group of P6K commands that
+ *  are sent to the controller as a single
+ *  command line.
+ *
+ ********************************************/
+
+#ifndef parker6kCommandBatch_H
+#define parker6kCommandBatch_H
+
+#include <stddef.h>
+#include "stdint.h"
+
+#include "asynDriver.h"
+
+#include "parker6kCommand.h"
+
+#define P6K_BATCH_MAXBUF 1024
+#define P6K_BATCH_MAXCMDS 16
+
+/**
+ * p6kCommandBatch joins several controller commands into one line,
+ * separated by the P6K command delimiter (:). The controller executes
+ * the commands in order and sends back a single prompt, so a group of
+ * commands costs one round trip. The position of each sub-command is
+ * recorded so that an error can be mapped back to the command that caused it.
+ * Typed commands (p6kCommand) are formatted straight into the batch, and their
+ * IDs are kept so that callers can tell which commands a batch contains.
+ */
+class p6kCommandBatch {
+
+ public:
+  p6kCommandBatch();
+
+  void clear(void);
+  asynStatus add(const char *format, ...);
+  asynStatus add(const p6kCommand &command);
+  uint32_t size(void) const;
+  const char *getLine(void) const;
+  const char *getCommand(uint32_t index) const;
+  p6kCommandId getCommandId(uint32_t index) const;
+  int32_t findCommand(const char *command) const;
+
+ private:
+  char line_[P6K_BATCH_MAXBUF];
+  char commands_[P6K_BATCH_MAXCMDS][P6K_BATCH_MAXBUF/P6K_BATCH_MAXCMDS];
+  p6kCommandId ids_[P6K_BATCH_MAXCMDS];
+  uint32_t count_;
+  size_t length_;
+
+  asynStatus append(size_t len);
+  static size_t commandNameLength(const char *command);
+
+  static const char P6K_DELIMITER_;
+};
+
+#endif /* parker6kCommandBatch_H */
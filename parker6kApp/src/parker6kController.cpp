@@ -24,6 +24,7 @@ using std::dec;
 
 #include <epicsTime.h>
 #include <epicsThread.h>
+#include <epicsEvent.h>
 #include <epicsExport.h>
 #include <epicsString.h>
 #include <iocsh.h>
@@ -44,10 +45,24 @@ const epicsUInt32 p6kController::P6K_FORCED_FAST_POLLS_ = 10;
 const epicsUInt32 p6kController::P6K_OK_ = 0;
 const epicsUInt32 p6kController::P6K_ERROR_ = 1;
 const epicsUInt32 p6kController::P6K_MAX_DIGITS_ = 4;
-
-const char * p6kController::P6K_ASYN_IEOS_ = ">";
-const char * p6kController::P6K_ASYN_IEOS_PROG_ = "-";
+//Minimum time between updates of the stats waveforms (seconds)
+const epicsFloat64 p6kController::P6K_STATS_PERIOD_ = 1.0;
+//Default time that an axis is read every poll after a command is sent to it (seconds)
+const epicsFloat64 p6kController::P6K_AXIS_ACTIVE_TIME_ = 2.0;
+//Time between status reads around the predicted end of a move (seconds)
+const epicsFloat64 p6kController::P6K_END_POLL_PERIOD_ = 0.005;
+const epicsUInt32 p6kController::P6K_BULK_MIN_AXES_ = 2;
+const epicsFloat64 p6kController::P6K_PROBE_MIN_DELAY_ = 0.5;
+const epicsFloat64 p6kController::P6K_PROBE_MAX_DELAY_ = 30.0;
+
+const char * p6kController::P6K_ASYN_IEOS_ = "";
 const char * p6kController::P6K_ASYN_OEOS_ = "\n";
+//Characters sent after a response (EOT) and at the end of a line (EOL), as ASCII codes.
+//The compact settings end each response with a single \r.
+const char * p6kController::P6K_EOT_DEFAULT_ = "13,0,0";
+const char * p6kController::P6K_EOT_COMPACT_ = "0,0,0";
+const char * p6kController::P6K_EOL_DEFAULT_ = "13,10,0";
+const char * p6kController::P6K_EOL_COMPACT_ = "13,0,0";
 
 const char p6kController::P6K_ON_         = '1';
 const char p6kController::P6K_OFF_        = '0';
@@ -79,6 +94,40 @@ extern "C" {
   asynStatus p6kCreateAxes(const char *p6kName, int numAxes);
   
   asynStatus p6kUpload(const char *p6kName, const char *filename);
+
+  asynStatus p6kSetLogFile(const char *p6kName, const char *filename);
+
+  asynStatus p6kSetQueryTier(const char *p6kName, const char *query, int tier, double period);
+}
+
+/**
+ * Called by the p6kTransport comms thread when an asynchronous request
+ * has completed. Wake up the poller so that it can process the result.
+ * This doesn't force any fast polls, since no command was sent
+ * (see p6kController::deadlinePoller).
+ */
+static void p6kTransportNotifyC(void *pPvt)
+{
+  p6kController *pController = static_cast<p6kController *>(pPvt);
+  pController->wakeupPoller();
+}
+
+/**
+ * C function wrapper for the deadline poller thread.
+ */
+static void p6kPollerTaskC(void *pPvt)
+{
+  p6kController *pController = static_cast<p6kController *>(pPvt);
+  pController->deadlinePoller();
+}
+
+/**
+ * Completion callback for the bulk status queries.
+ */
+static void p6kBulkStatusCallbackC(void *pPvt, const char *command, char *response, asynStatus status)
+{
+  p6kController *pController = static_cast<p6kController *>(pPvt);
+  pController->bulkStatusCallback(command, response, status);
 }
 
 /**
@@ -93,7 +142,7 @@ extern "C" {
  */
 p6kController::p6kController(const char *portName, const char *lowLevelPortName, int lowLevelPortAddress, 
 			     int numAxes, double movingPollPeriod, double idlePollPeriod)
-  : asynMotorController(portName, numAxes+1, NUM_MOTOR_DRIVER_PARAMS,
+  : asynMotorController(portName, numAxes+1, NUM_P6K_PARAMS,
 			0, // No additional interfaces
 			0, // No addition interrupt interfaces
 			ASYN_CANBLOCK | ASYN_MULTIDEVICE, 
@@ -112,6 +161,34 @@ p6kController::p6kController(const char *portName, const char *lowLevelPortName,
   lastTimeSecs_ = 0.0;
   printNextError_ = false;
   printErrors_ = true;
+  transport_ = NULL;
+  logger_ = new p6kLogger(portName);
+  modbus_ = new p6kModbusEncoders(portName);
+  rxLen_ = 0;
+  rxBuffer_[0] = '\0';
+  syncCount_ = 0;
+  bulkStat_ = true;
+  bulkNumTAS_ = 0;
+  lockDepth_ = 0;
+  lockStart_ = 0;
+  pollStart_ = 0;
+  pollEnd_ = 0;
+  statsTime_ = 0;
+  statsCount_ = 0;
+  queryBytesSaved_ = 0;
+  axisPollNext_ = 0;
+  pollerThread_ = NULL;
+  pollCount_ = 0;
+  statsPollCount_ = 0;
+  pollMissed_ = 0;
+  lastPollStart_ = 0;
+  timerAt_ = 0;
+  commsDown_ = false;
+  probeDelay_ = 0;
+  nextProbe_ = 0;
+  replyMismatch_ = 0;
+  compactFraming_ = false;
+  statsBytes_ = 0;
 
   pAxes_ = (p6kAxis **)(asynMotorController::pAxes_);
 
@@ -138,6 +215,64 @@ p6kController::p6kController(const char *portName, const char *lowLevelPortName,
   createParam(P6K_C_OUT_BitString,          asynParamInt32, &P6K_C_OUT_Bit_);
   createParam(P6K_C_OUT_ValString,          asynParamInt32, &P6K_C_OUT_Val_);
   createParam(P6K_C_OUT_AllString,          asynParamInt32, &P6K_C_OUT_All_);
+  createParam(P6K_C_MaxInFlightString,      asynParamInt32, &P6K_C_MaxInFlight_);
+  createParam(P6K_C_BulkStatusString,       asynParamInt32, &P6K_C_BulkStatus_);
+  createParam(P6K_C_StatsResetString,       asynParamInt32, &P6K_C_StatsReset_);
+  createParam(P6K_C_StatsCountString,       asynParamFloat64Array, &P6K_C_StatsCount_);
+  createParam(P6K_C_StatsBytesOutString,    asynParamFloat64Array, &P6K_C_StatsBytesOut_);
+  createParam(P6K_C_StatsBytesInString,     asynParamFloat64Array, &P6K_C_StatsBytesIn_);
+  createParam(P6K_C_StatsErrorsString,      asynParamFloat64Array, &P6K_C_StatsErrors_);
+  createParam(P6K_C_StatsTimeoutsString,    asynParamFloat64Array, &P6K_C_StatsTimeouts_);
+  createParam(P6K_C_StatsRateString,        asynParamFloat64, &P6K_C_StatsRate_);
+  createParam(P6K_C_StatsBucketsString,     asynParamFloat64Array, &P6K_C_StatsBuckets_);
+  createParam(P6K_C_StatsRttQueryString,    asynParamFloat64Array, &P6K_C_StatsRttQuery_);
+  createParam(P6K_C_StatsRttWriteString,    asynParamFloat64Array, &P6K_C_StatsRttWrite_);
+  createParam(P6K_C_StatsRttImmediateString, asynParamFloat64Array, &P6K_C_StatsRttImmediate_);
+  createParam(P6K_C_StatsRttOtherString,    asynParamFloat64Array, &P6K_C_StatsRttOther_);
+  createParam(P6K_C_PollTimeString,         asynParamFloat64, &P6K_C_PollTime_);
+  createParam(P6K_C_PollTimeMaxString,      asynParamFloat64, &P6K_C_PollTimeMax_);
+  createParam(P6K_C_PollHistString,         asynParamFloat64Array, &P6K_C_PollHist_);
+  createParam(P6K_C_LockHoldMaxString,      asynParamFloat64, &P6K_C_LockHoldMax_);
+  createParam(P6K_C_LockHistString,         asynParamFloat64Array, &P6K_C_LockHist_);
+  createParam(P6K_C_LogDroppedString,       asynParamInt32, &P6K_C_LogDropped_);
+  createParam(P6K_C_TASX_EnableString,      asynParamInt32, &P6K_C_TASX_Enable_);
+  for (int32_t query=0; query<P6K_QUERY_NUM; ++query) {
+    char name[P6K_MAXBUF_] = {0};
+    const char *queryName = queries_.getName(static_cast<p6kQueryId>(query));
+    epicsSnprintf(name, P6K_MAXBUF_, "%s%s", P6K_C_QueryPeriodString, queryName);
+    createParam(name,                       asynParamFloat64, &P6K_C_QueryPeriod_[query]);
+    epicsSnprintf(name, P6K_MAXBUF_, "%s%s", P6K_C_QueryTierString, queryName);
+    createParam(name,                       asynParamInt32, &P6K_C_QueryTier_[query]);
+  }
+  createParam(P6K_C_QuerySkippedString,     asynParamFloat64, &P6K_C_QuerySkipped_);
+  createParam(P6K_C_QueryBytesSavedString,  asynParamFloat64, &P6K_C_QueryBytesSaved_);
+  createParam(P6K_C_QuerySavedRateString,   asynParamFloat64, &P6K_C_QuerySavedRate_);
+  createParam(P6K_C_AxisScheduleString,     asynParamInt32, &P6K_C_AxisSchedule_);
+  createParam(P6K_C_AxisActiveTimeString,   asynParamFloat64, &P6K_C_AxisActiveTime_);
+  createParam(P6K_C_AxesPolledString,       asynParamInt32, &P6K_C_AxesPolled_);
+  createParam(P6K_C_PollRateString,         asynParamFloat64, &P6K_C_PollRate_);
+  createParam(P6K_C_PollMissedString,       asynParamInt32, &P6K_C_PollMissed_);
+  createParam(P6K_C_PollJitterString,       asynParamFloat64, &P6K_C_PollJitter_);
+  createParam(P6K_C_PollJitterMaxString,    asynParamFloat64, &P6K_C_PollJitterMax_);
+  createParam(P6K_C_JitterHistString,       asynParamFloat64Array, &P6K_C_JitterHist_);
+  createParam(P6K_C_CommsDownString,        asynParamInt32, &P6K_C_CommsDown_);
+  createParam(P6K_C_CommsFailLimitString,   asynParamInt32, &P6K_C_CommsFailLimit_);
+  createParam(P6K_C_CommsOutagesString,     asynParamInt32, &P6K_C_CommsOutages_);
+  createParam(P6K_C_ProbeDelayString,       asynParamFloat64, &P6K_C_ProbeDelay_);
+  createParam(P6K_C_AdaptiveTimeoutString,  asynParamInt32, &P6K_C_AdaptiveTimeout_);
+  createParam(P6K_C_TimeoutMinString,       asynParamFloat64, &P6K_C_TimeoutMin_);
+  createParam(P6K_C_TimeoutMaxString,       asynParamFloat64, &P6K_C_TimeoutMax_);
+  createParam(P6K_C_TimeoutSrttString,      asynParamFloat64Array, &P6K_C_TimeoutSrtt_);
+  createParam(P6K_C_TimeoutRttVarString,    asynParamFloat64Array, &P6K_C_TimeoutRttVar_);
+  createParam(P6K_C_TimeoutRtoString,       asynParamFloat64Array, &P6K_C_TimeoutRto_);
+  createParam(P6K_C_ReplyMismatchString,    asynParamInt32, &P6K_C_ReplyMismatch_);
+  createParam(P6K_C_ResyncsString,          asynParamInt32, &P6K_C_Resyncs_);
+  createParam(P6K_C_ResyncDiscardedString,  asynParamFloat64, &P6K_C_ResyncDiscarded_);
+  createParam(P6K_C_CompactFramingString,   asynParamInt32, &P6K_C_CompactFraming_);
+  createParam(P6K_C_PollBytesString,        asynParamFloat64, &P6K_C_PollBytes_);
+  createParam(P6K_C_ModbusPeriodString,     asynParamFloat64, &P6K_C_ModbusPeriod_);
+  createParam(P6K_C_ModbusReadTimeString,   asynParamFloat64, &P6K_C_ModbusReadTime_);
+  createParam(P6K_C_ModbusErrorsString,     asynParamInt32, &P6K_C_ModbusErrors_);
   createParam(P6K_C_LastParamString,        asynParamInt32, &P6K_C_LastParam_);
 
   //Create axis specific parameters
@@ -164,12 +299,34 @@ p6kController::p6kController(const char *portName, const char *lowLevelPortName,
   createParam(P6K_A_AutoDriveEnableString,  asynParamInt32, &P6K_A_AutoDriveEnable_);
   createParam(P6K_A_AutoDriveEnableDelayString,  asynParamInt32, &P6K_A_AutoDriveEnableDelay_);
   createParam(P6K_A_DriveRetryString,       asynParamInt32, &P6K_A_DriveRetry_);
+  createParam(P6K_A_DriveStateString,       asynParamInt32, &P6K_A_DriveState_);
   createParam(P6K_A_ExternalEncoderUseString, asynParamInt32, &P6K_A_ExternalEncoderUse_);
   createParam(P6K_A_ExternalEncoderString, asynParamInt32, &P6K_A_ExternalEncoder_);
+  createParam(P6K_A_ExternalEncoderMaxAgeString, asynParamFloat64, &P6K_A_ExternalEncoderMaxAge_);
+  createParam(P6K_A_ExternalEncoderAgeString, asynParamFloat64, &P6K_A_ExternalEncoderAge_);
   createParam(P6K_A_ModbusEncoderString, asynParamInt32, &P6K_A_ModbusEncoder_);
   createParam(P6K_A_ModbusEncoderAddrString, asynParamInt32, &P6K_A_ModbusEncoderAddr_);
   createParam(P6K_A_ModbusEncoderOffsetString, asynParamInt32, &P6K_A_ModbusEncoderOffset_);
   createParam(P6K_A_ModbusEncoderCheckString, asynParamInt32, &P6K_A_ModbusEncoderCheck_);
+  createParam(P6K_A_StopLatencyString, asynParamFloat64, &P6K_A_StopLatency_);
+  createParam(P6K_A_SettleLatencyString, asynParamFloat64, &P6K_A_SettleLatency_);
+  createParam(P6K_A_TASX_BitsString, asynParamInt32, &P6K_A_TASX_Bits_);
+  createParam(P6K_A_PredictEnableString, asynParamInt32, &P6K_A_PredictEnable_);
+  createParam(P6K_A_CruisePollPeriodString, asynParamFloat64, &P6K_A_CruisePollPeriod_);
+  createParam(P6K_A_PredictedTimeString, asynParamFloat64, &P6K_A_PredictedTime_);
+  createParam(P6K_A_PredictErrorString, asynParamFloat64, &P6K_A_PredictError_);
+
+  //Default query schedule. The limits are used by the axis poll, so they are
+  //read every poll. The rest change rarely, so are read at the idle poll rate.
+  //The digital outputs are also read straight after they are written.
+  queries_.setTier(P6K_QUERY_TSS,  P6K_TIER_BACKGROUND);
+  queries_.setTier(P6K_QUERY_TLIM, P6K_TIER_EVERY_POLL);
+  queries_.setTier(P6K_QUERY_TIN,  P6K_TIER_PERIODIC);
+  queries_.setTier(P6K_QUERY_TOUT, P6K_TIER_PERIODIC);
+  queries_.setTier(P6K_QUERY_TASX, P6K_TIER_BACKGROUND);
+  for (int32_t query=0; query<P6K_QUERY_NUM; ++query) {
+    queries_.setPeriod(static_cast<p6kQueryId>(query), idlePollPeriod_);
+  }
 
   //Create dummy axis for asyn address 0. This is used for controller parameters.
   printf("%s: Create pAxisZero for controller parameters.\n", functionName);
@@ -178,9 +335,9 @@ p6kController::p6kController(const char *portName, const char *lowLevelPortName,
   //Connect our Asyn user to the low level port that is a parameter to this constructor
   //NOTE:
   // The P6K will send back a command with a \r\r\n> \n>
-  // The low level port EOS will remove the first >. 
-  // We will need to deal with the rest in p6kController::lowLevelWriteRead
-  // Error responses are handled differently, and unfortunately rely on a asyn timeout.
+  // Error responses end with a ? prompt instead of a >, so there is no 
+  // input EOS. p6kTransport::readResponse looks for either prompt.
+  // All I/O on the low level port is done by the p6kTransport comms thread.
   printf("%s: Connect to low level Asyn port.\n", functionName);
   if (lowLevelPortConnect(lowLevelPortName, lowLevelPortAddress, &lowLevelPortUser_, 
 			  P6K_ASYN_IEOS_, P6K_ASYN_OEOS_) != asynSuccess) {
@@ -188,6 +345,13 @@ p6kController::p6kController(const char *portName, const char *lowLevelPortName,
     setIntegerParam(P6K_C_CommsError_, P6K_ERROR_);
   } else {
     setIntegerParam(P6K_C_CommsError_, P6K_OK_);
+    transport_ = new p6kTransport(lowLevelPortUser_, portName, p6kTransportNotifyC, this);
+    transport_->setStats(&stats_);
+    transport_->setLogger(logger_);
+    if (transport_->start() != asynSuccess) {
+      printf("%s: Failed to start comms thread for %s\n", functionName, lowLevelPortName);
+      setIntegerParam(P6K_C_CommsError_, P6K_ERROR_);
+    }
   }
 
   char command[P6K_MAXBUF_] = {0};
@@ -227,6 +391,48 @@ p6kController::p6kController(const char *portName, const char *lowLevelPortName,
     paramStatus = ((setIntegerParam(P6K_C_TIN_Bits_, 0) == asynSuccess) && paramStatus);
     paramStatus = ((setIntegerParam(P6K_C_OUT_Bit_, 1) == asynSuccess) && paramStatus);
     paramStatus = ((setIntegerParam(P6K_C_OUT_All_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(P6K_C_BulkStatus_, 1) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(P6K_C_MaxInFlight_, 1) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(P6K_C_StatsReset_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(P6K_C_StatsRate_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(P6K_C_PollTime_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(P6K_C_PollTimeMax_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(P6K_C_LockHoldMax_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(P6K_C_LogDropped_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(P6K_C_TASX_Enable_, 0) == asynSuccess) && paramStatus);
+    for (int32_t query=0; query<P6K_QUERY_NUM; ++query) {
+      p6kQueryId id = static_cast<p6kQueryId>(query);
+      paramStatus = ((setDoubleParam(P6K_C_QueryPeriod_[query], queries_.getPeriod(id)) == asynSuccess) && paramStatus);
+      paramStatus = ((setIntegerParam(P6K_C_QueryTier_[query], queries_.getTier(id)) == asynSuccess) && paramStatus);
+    }
+    paramStatus = ((setDoubleParam(P6K_C_QuerySkipped_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(P6K_C_QueryBytesSaved_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(P6K_C_QuerySavedRate_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(P6K_C_AxisSchedule_, 1) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(P6K_C_AxisActiveTime_, P6K_AXIS_ACTIVE_TIME_) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(P6K_C_AxesPolled_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(P6K_C_PollRate_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(P6K_C_PollMissed_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(P6K_C_PollJitter_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(P6K_C_PollJitterMax_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(P6K_C_CommsDown_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(P6K_C_CommsFailLimit_, 3) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(P6K_C_CommsOutages_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(P6K_C_ProbeDelay_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(P6K_C_AdaptiveTimeout_, 1) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(P6K_C_ReplyMismatch_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(P6K_C_Resyncs_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(P6K_C_ResyncDiscarded_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(P6K_C_CompactFraming_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(P6K_C_PollBytes_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(P6K_C_ModbusPeriod_, modbus_->getPeriod()) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(P6K_C_ModbusReadTime_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(P6K_C_ModbusErrors_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(P6K_C_TimeoutMin_, transport_->getTimeouts()->getMin()) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(P6K_C_TimeoutMax_, transport_->getTimeouts()->getMax()) == asynSuccess) && paramStatus);
+    for (int32_t axis=1; axis<=numAxes; ++axis) {
+      paramStatus = ((setIntegerParam(axis, P6K_A_TASX_Bits_, 0) == asynSuccess) && paramStatus);
+    }
     callParamCallbacks();
 
     if (!paramStatus) {
@@ -325,22 +531,84 @@ asynStatus p6kController::printConnectedStatus()
 }
 
 /**
- * Wrapper for asynOctetSyncIO write/read functions.
+ * Send a command and return a copy of the response.
  * @param command - String command to send.
  * @response response - String response back.
  */
 asynStatus p6kController::lowLevelWriteRead(const char *command, char *response)
+{
+  const p6kParser *pResponse = NULL;
+  asynStatus status = lowLevelQuery(command, &pResponse);
+
+  pResponse->copyBody(response, P6K_MAXBUF_);
+
+  return status;
+}
+
+/**
+ * Send an immediate command (eg. a stop) and return a copy of the response.
+ * The controller lock is released while the command is with the transport,
+ * which sends it ahead of any queued commands, so the reply doesn't wait
+ * for the poller or anything else that holds the lock. The reply is parsed
+ * into local buffers for the same reason. This must be called with the
+ * controller lock held. Other threads can run while the lock is released, so
+ * the caller must have finished changing the axis state first (see 
+ * p6kAxis::stopPending).
+ * @param command - String command to send. This must be a single immediate command.
+ * @response response - String response back.
+ */
+asynStatus p6kController::lowLevelWriteReadImmediate(const char *command, char *response)
 {
   bool stat = true;
-  int32_t eomReason = 0;
-  size_t nwrite = 0;
-  size_t nread = 0;
-  char temp[P6K_MAXBUF_] = {0};
-  static const char *functionName = "p6kController::lowLevelWriteRead";
+  asynStatus status = asynSuccess;
+  char input[P6K_MAXBUF] = {0};
+  size_t len = 0;
+  p6kParser parser;
+  static const char *functionName = "p6kController::lowLevelWriteReadImmediate";
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+
+  if ((!lowLevelPortUser_) || (!transport_)) {
+    setIntegerParam(P6K_C_CommsError_, P6K_ERROR_);
+    return asynError;
+  }
+
+  asynPrint(lowLevelPortUser_, ASYN_TRACEIO_DRIVER, "%s: command: %s\n", functionName, command);
+
+  ++syncCount_;
+
+  unlock();
+  stat = (transport_->writeRead(command, input, P6K_MAXBUF_, &len) == asynSuccess) && stat;
+  lock();
+
+  status = checkResponse(command, &parser, input, len, stat);
+  parser.copyBody(response, P6K_MAXBUF_);
+
+  return status;
+}
+
+/**
+ * Send a command and parse the response, without copying it.
+ * The response is held in a buffer owned by the controller, so it is only
+ * valid until the next command is sent. This must be called with the 
+ * controller lock held.
+ * @param command - String command to send.
+ * @param ppResponse - Set to the parsed response (or error message).
+ * @return asynStatus
+ */
+asynStatus p6kController::lowLevelQuery(const char *command, const p6kParser **ppResponse)
+{
+  bool stat = true;
+  static const char *functionName = "p6kController::lowLevelQuery";
 
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+
+  rxLen_ = 0;
+  rxBuffer_[0] = '\0';
+  parser_.parse(rxBuffer_, rxLen_);
+  *ppResponse = &parser_;
   
-  if (!lowLevelPortUser_) {
+  if ((!lowLevelPortUser_) || (!transport_)) {
     setIntegerParam(P6K_C_CommsError_, P6K_ERROR_);
     return asynError;
   }
@@ -348,59 +616,77 @@ asynStatus p6kController::lowLevelWriteRead(const char *command, char *response)
   asynPrint(lowLevelPortUser_, ASYN_TRACEIO_DRIVER, "%s: command: %s\n", functionName, command);
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s: command: %s\n", functionName, command);   
 
-  int32_t log = 0;
-  getIntegerParam(P6K_C_Log_, &log);
-  if (log != 0) {
-    printf("%s > %s\n", this->portName, command);
-  }
+  //Count synchronous commands, so that getBulkStatus can tell if anything 
+  //was sent while it was waiting for the status replies.
+  ++syncCount_;
 
-  memset(response, 0, strlen(response));
+  stat = (transport_->writeRead(command, rxBuffer_, P6K_MAXBUF_, &rxLen_) == asynSuccess) && stat;
+
+  return checkResponse(command, &parser_, rxBuffer_, rxLen_, stat);
+}
+
+/**
+ * Parse the raw response to a command, and check it for errors.
+ * This also sets the comms error status.
+ * @param command The command that was sent
+ * @param parser The parser to use. This will refer to the input buffer.
+ * @param input The raw response
+ * @param len The number of characters in the raw response
+ * @param stat false if the transaction itself failed (eg. a timeout)
+ * @return asynStatus
+ */
+asynStatus p6kController::checkResponse(const char *command, p6kParser *parser, 
+                                        const char *input, size_t len, bool stat)
+{
+  static const char *functionName = "p6kController::checkResponse";
 
-  // Check if we are defining a program using DEF. If so, change the 
-  // input EOS character from > to -. If we sending an END then change it back.
-  if (strncmp(command, "DEF", 3) == 0) {
-    pasynOctetSyncIO->setInputEos(lowLevelPortUser_, P6K_ASYN_IEOS_PROG_, strlen(P6K_ASYN_IEOS_PROG_) );
-  } else if (strncmp(command, "END", 3) == 0) {
-    pasynOctetSyncIO->setInputEos(lowLevelPortUser_, P6K_ASYN_IEOS_, strlen(P6K_ASYN_IEOS_) );
-  }
-  
-  stat = (pasynOctetSyncIO->writeRead(lowLevelPortUser_ ,
-				       command, strlen(command),
-				       temp, P6K_MAXBUF_,
-				       P6K_TIMEOUT_,
-				       &nwrite, &nread, &eomReason ) == asynSuccess) && stat;
-  
   if (!stat) {
     if (printErrors_) {
       asynPrint(lowLevelPortUser_, ASYN_TRACE_ERROR, 
-		"%s: Error from pasynOctetSyncIO->writeRead. command: %s\n", 
+		"%s: Error from p6kTransport. command: %s\n", 
 		functionName, command);
     }
+    //We may have lost the connection, or the command may have been rejected,
+    //so don't rely on the cached motion parameters any more.
+    invalidateShadows();
     setIntegerParam(P6K_C_CommsError_, P6K_ERROR_);
   } else {
     setIntegerParam(P6K_C_CommsError_, P6K_OK_);
   }
 
-  //Search for an error response
-  if (errorResponse(temp, response) == asynSuccess) {
-    asynPrint(lowLevelPortUser_, ASYN_TRACE_ERROR, 
-	      "%s: ERROR: Command %s returned an error: %s\n", functionName, command, response);
+  //The P6K will send back a command with a \r\r\n> \n>
+  //p6kTransport will have removed both prompts, and leaves the ? on an error.
+  if (parser->parse(input, len) != asynSuccess) {
+    if (printErrors_) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+                "%s Could not find correct trailer.\n", functionName);
+    }
     stat = false;
   }
 
-  //The P6K will send back a command with a \r\r\n> \n>
-  //The low level port asyn EOS will remove the first >
-  //(or we removed the error char in the errorResponse function)
-  //We deal with the rest in this function.
-  stat = (trimResponse(temp, response) == asynSuccess) && stat;
-
-  asynPrint(lowLevelPortUser_, ASYN_TRACEIO_DRIVER, "%s: response: %s\n", functionName, response); 
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s: response: %s\n", functionName, response); 
+  p6kView body = parser->getBody();
+  int bodyLen = static_cast<int>(body.len);
 
-  if (log != 0) {
-    printf("%s < %s\n", this->portName, response);
+  if (parser->isError()) {
+    asynPrint(lowLevelPortUser_, ASYN_TRACE_ERROR, 
+	      "%s: ERROR: Command %s returned an error: %.*s\n", functionName, command, bodyLen, body.data);
+    stat = false;
+  } else if ((stat) && (!parser->matches(command))) {
+    //This is a late reply to an earlier command. Don't use it, and make sure the
+    //transport throws away any others before the next command.
+    asynPrint(lowLevelPortUser_, ASYN_TRACE_ERROR, 
+	      "%s: ERROR: Reply to command %s does not match: %.*s\n", functionName, command, bodyLen, body.data);
+    ++replyMismatch_;
+    if (transport_ != NULL) {
+      transport_->requestResync();
+    }
+    setIntegerParam(P6K_C_CommsError_, P6K_ERROR_);
+    stat = false;
   }
 
+  asynPrint(lowLevelPortUser_, ASYN_TRACEIO_DRIVER, "%s: response: %.*s\n", functionName, bodyLen, body.data); 
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s: response: %.*s\n", functionName, bodyLen, body.data); 
+
   if (!stat) {
     return asynError;
   }
@@ -409,100 +695,57 @@ asynStatus p6kController::lowLevelWriteRead(const char *command, char *response)
 }
 
 /**
- * The P6K will send back an error string with a ? prompt afterwards it.
- * We search for this before dealing with a successful command. An error
- * response would have caused an Asyn timeout, because there was no standard
- * IEOS character and by defaut we search for the character that terminates a
- * successful command.
- * @param input - input buffer. This will be modified.
- * @param output - output buffer. No bigger than P6K_MAXBUF_.
- */
-asynStatus p6kController::errorResponse(char *input, char *output)
-{
-  static const char *trailer = "?";
-  static const char *header = "*";
-  
-  static const char *functionName = "p6kController::errorResponse";
-
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
-
-  if (input == NULL) {
-    return asynError;
-  }
-
-  char *pTrailer = strstr(input, trailer);
-
-  if (pTrailer != NULL) {
-    *pTrailer = '\0';
-    //Remove leading '*' character. Make sure it's there first.
-    //For error strings there may be some leading chars before the '*'
-    char *pHeader = strstr(input, header);
-    if (pHeader != NULL) {
-      pHeader++;
-      if (output != NULL) {
-	strncpy(output, pHeader, P6K_MAXBUF_-1);
-      }
-      return asynSuccess;
-    }
-  } 
-
-  //asynError is used to indicate we have not found an error
-  return asynError;
-}
-
-/**
- * Remove a \r\r\n from an input buffer.
- * Also remove leading '*' character. 
- * @param input - input buffer. This will be modified.
- * @param output - output buffer. No bigger than P6K_MAXBUF_.
+ * Send a batch of commands to the controller as a single command line,
+ * so that the whole batch costs one round trip.
+ * If the controller returns an error, TCMDER is used to find out which
+ * command in the batch caused it. 
+ * @param batch The commands to send
+ * @param response The response (or error message) from the controller
+ * @param failed This is set to the position in the batch of the command that failed,
+ *        or -1 if there was no error or the command could not be identified.
+ * @return asynStatus
  */
-asynStatus p6kController::trimResponse(char *input, char *output)
+asynStatus p6kController::lowLevelWriteReadBatch(const p6kCommandBatch *batch, char *response, int32_t *failed)
 {
   asynStatus status = asynSuccess;
-  static const char *trailer = "\r\r\n";
-  static const char *smallTrailer = "\r\n";
-  static const char *header = "*";
-  static const char *functionName = "p6kController::trimResponse";
+  char error[P6K_MAXBUF] = {0};
+  static const char *functionName = "p6kController::lowLevelWriteReadBatch";
 
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
 
-  if (input == NULL) {
-    return asynError;
+  *failed = -1;
+
+  if (batch->size() == 0) {
+    return asynSuccess;
   }
 
-  char *pTrailer = strstr(input, trailer);
-  if (pTrailer != NULL) {
-    *pTrailer = '\0';
-  } else {
-    //Try the smallTrailer instead
-    pTrailer = strstr(input, smallTrailer);
-    if (pTrailer != NULL) {
-      *pTrailer = '\0';
-    } else {
-      if (printErrors_) {
-	asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
-		  "%s Could not find correct trailer.\n", functionName);
+  status = lowLevelWriteRead(batch->getLine(), response);
+
+  //An empty response means we had no reply at all, so don't try to ask 
+  //the controller what went wrong.
+  if ((status != asynSuccess) && (response[0] != '\0')) {
+    if (batch->size() == 1) {
+      *failed = 0;
+    } else if (lowLevelWriteRead(P6K_CMD_TCMDER, error) == asynSuccess) {
+      char *pCommand = error;
+      if (strncmp(pCommand, P6K_CMD_TCMDER, strlen(P6K_CMD_TCMDER)) == 0) {
+        pCommand += strlen(P6K_CMD_TCMDER);
       }
-      status = asynError;
+      *failed = batch->findCommand(pCommand);
     }
-  }
-
-  //Remove leading '*' character. Make sure it's there first.
-  //Occasionally there may be some leading chars before the '*', eg a space.
-  char *pHeader = strstr(input, header);
-  if (pHeader != NULL) {
-    pHeader++;
-    if (output != NULL) {
-      strncpy(output, pHeader, P6K_MAXBUF_-1);
+    if (*failed >= 0) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+                "%s: ERROR: Command %s in batch %s failed: %s\n", 
+                functionName, batch->getCommand(*failed), batch->getLine(), response);
     }
   }
 
   return status;
 }
 
-
 /**
- * asynReport function. Currently this just calls the base class. 
+ * asynReport function. Level 1 and above prints the command counters,
+ * and level 2 and above prints the timing histograms.
  */
 void p6kController::report(FILE *fp, int level)
 {
@@ -519,6 +762,12 @@ void p6kController::report(FILE *fp, int level)
       fprintf(fp, "  axis %d\n", 
               pAxis->axisNo_);
     }
+    stats_.report(fp, level);
+    queries_.report(fp);
+    if (transport_ != NULL) {
+      transport_->getTimeouts()->report(fp);
+    }
+    modbus_->report(fp);
   }
 
   // Call the base class method
@@ -556,6 +805,30 @@ asynStatus p6kController::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
 		functionName, pAxis->axisNo_);
       value = 0.0;
     }
+  } else if ((function == P6K_C_TimeoutMin_) || (function == P6K_C_TimeoutMax_)) {
+    if (transport_ != NULL) {
+      p6kTimeout *timeouts = transport_->getTimeouts();
+      if (function == P6K_C_TimeoutMin_) {
+        timeouts->setBounds(value, timeouts->getMax());
+      } else {
+        timeouts->setBounds(timeouts->getMin(), value);
+      }
+      status = (setDoubleParam(P6K_C_TimeoutMin_, timeouts->getMin()) == asynSuccess) && status;
+      status = (setDoubleParam(P6K_C_TimeoutMax_, timeouts->getMax()) == asynSuccess) && status;
+      getDoubleParam(function, &value);
+    }
+  } else if (function == P6K_C_ModbusPeriod_) {
+    modbus_->setPeriod(value);
+    value = modbus_->getPeriod();
+    status = (setDoubleParam(P6K_C_ModbusPeriod_, value) == asynSuccess) && status;
+  } else {
+    for (int32_t query=0; query<P6K_QUERY_NUM; ++query) {
+      if (function == P6K_C_QueryPeriod_[query]) {
+        queries_.setPeriod(static_cast<p6kQueryId>(query), value);
+        value = queries_.getPeriod(static_cast<p6kQueryId>(query));
+        status = (pAxis->setDoubleParam(function, value) == asynSuccess) && status;
+      }
+    }
   }
 
   //Call base class method. This will handle callCallbacks even if the function was handled here.
@@ -605,6 +878,8 @@ asynStatus p6kController::writeInt32(asynUser *pasynUser, epicsInt32 value)
     } else {
       status = (pAxis->disableSoftwareLimits(true) == asynSuccess) && status;
     }
+  } else if (function == P6K_A_ExternalEncoder_) {
+    pAxis->externalEncoder_.write(value);
   } else if (function == P6K_C_OUT_Bit_) {
     if ((value < 1) || (value > 8)) {
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
@@ -620,6 +895,46 @@ asynStatus p6kController::writeInt32(asynUser *pasynUser, epicsInt32 value)
   } else if (function == P6K_C_OUT_All_) {
     if (value != 0) value = 1;
     status = (setDigitalOutputs(value) == asynSuccess) && status;
+  } else if (function == P6K_C_MaxInFlight_) {
+    if (transport_ != NULL) {
+      transport_->setMaxInFlight(value);
+      value = transport_->getMaxInFlight();
+    }
+  } else if (function == P6K_C_CommsFailLimit_) {
+    if (value < 0) value = 0;
+    if (transport_ != NULL) {
+      transport_->setFailLimit(value);
+    }
+  } else if (function == P6K_C_CompactFraming_) {
+    if (value != 0) value = 1;
+    status = (setFraming(value == 1) == asynSuccess) && status;
+  } else if (function == P6K_C_AdaptiveTimeout_) {
+    if (value != 0) value = 1;
+    if (transport_ != NULL) {
+      transport_->getTimeouts()->setEnabled(value == 1);
+    }
+  } else if (function == P6K_C_Log_) {
+    logger_->setEnabled(value != 0);
+  } else if (function == P6K_C_StatsReset_) {
+    if (value != 0) {
+      stats_.reset();
+      statsCount_ = 0;
+      queries_.resetCounters();
+      queryBytesSaved_ = 0;
+      pollMissed_ = 0;
+      if (transport_ != NULL) {
+        transport_->getTimeouts()->resetCounters();
+      }
+      publishStats(true);
+    }
+    value = 0;
+  } else {
+    for (int32_t query=0; query<P6K_QUERY_NUM; ++query) {
+      if (function == P6K_C_QueryTier_[query]) {
+        queries_.setTier(static_cast<p6kQueryId>(query), static_cast<p6kQueryTier>(value));
+        value = queries_.getTier(static_cast<p6kQueryId>(query));
+      }
+    }
   }
 
   status = (pAxis->setIntegerParam(function, value) == asynSuccess) && status;
@@ -675,6 +990,9 @@ asynStatus p6kController::setDigitalOutput(epicsInt32 bit, epicsInt32 enable)
     return asynError;
   }
 
+  //Read back the outputs on the next poll, whatever their tier
+  queries_.force(P6K_QUERY_TOUT);
+
   return asynSuccess;
 }
 
@@ -707,6 +1025,8 @@ asynStatus p6kController::setDigitalOutputs(epicsInt32 enable)
     return asynError;
   }
 
+  queries_.force(P6K_QUERY_TOUT);
+
   return asynSuccess;
 }
 
@@ -723,7 +1043,7 @@ asynStatus p6kController::setDigitalOutputs(epicsInt32 enable)
  */
 asynStatus p6kController::getDigital(const char *command, size_t size, uint32_t *bits)
 {
-  char response[P6K_MAXBUF_] = {0};  
+  const p6kParser *pResponse = NULL;
   bool stat = true;
   uint32_t offset = 0;
 
@@ -732,21 +1052,22 @@ asynStatus p6kController::getDigital(const char *command, size_t size, uint32_t
   const char *functionName = "parker6kController::getDigital";
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s.\n", functionName);
 
-  stat = (lowLevelWriteRead(command, response) == asynSuccess) && stat;
+  stat = (lowLevelQuery(command, &pResponse) == asynSuccess) && stat;
   if (!stat) {
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
 	      "%s: ERROR: failed to send %s\n", 
 	      functionName, command);
     return asynError;
   } else {
-    for (uint32_t bit=size; bit<P6K_MAXBUF_; ++bit) {
+    p6kView response = pResponse->getBody();
+    for (uint32_t bit=size; bit<response.len; ++bit) {
       if (bit >= P6K_UINT32_SIZE_) {
 	break;
       }
-      if (response[bit] == P6K_UNDERSCORE_) {
+      if (response.data[bit] == P6K_UNDERSCORE_) {
 	++offset;
       } else {
-	*bits |= ((response[bit] == P6K_ON_) << (bit-offset-size));
+	*bits |= ((response.data[bit] == P6K_ON_) << (bit-offset-size));
       }
     }
   }
@@ -754,6 +1075,200 @@ asynStatus p6kController::getDigital(const char *command, size_t size, uint32_t
   return asynSuccess;
 }
 
+/**
+ * Read one of the digital status queries (TLIM, TOUT or TIN) if it is due,
+ * and put the bits into a param. If it is not due the param keeps its last value.
+ * @param id The query. The command sent is the query name.
+ * @param param The param to put the bits into
+ * @param now The start time of this poll (ns)
+ * @param moving true if any axis is moving
+ * @return true if the query was not due or succeeded, false if it failed
+ */
+bool p6kController::pollDigital(p6kQueryId id, int param, epicsUInt64 now, bool moving)
+{
+  const char *command = queries_.getName(id);
+  uint32_t bits = 0;
+  bool stat = true;
+
+  if (!queries_.isDue(id, now, moving)) {
+    return true;
+  }
+
+  stat = (getDigital(command, strlen(command), &bits) == asynSuccess) && stat;
+  if (stat) {
+    queries_.done(id, now, lastQueryBytes(command));
+  }
+  stat = (setIntegerParam(param, bits) == asynSuccess) && stat;
+
+  return stat;
+}
+
+/**
+ * Read the extended axis status of all axes using the axis-less form of TASX,
+ * and put the bits for each axis into P6K_A_TASX_Bits_.
+ * @return asynStatus
+ */
+asynStatus p6kController::getTASX(void)
+{
+  const p6kParser *pResponse = NULL;
+  p6kView fields[P6K_MAXAXES_];
+  int32_t num = 0;
+  bool stat = true;
+  static const char *functionName = "p6kController::getTASX";
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+
+  stat = (lowLevelQuery(P6K_CMD_TASX, &pResponse) == asynSuccess) && stat;
+  if (!stat) {
+    return asynError;
+  }
+  queries_.done(P6K_QUERY_TASX, pollStart_, lastQueryBytes(P6K_CMD_TASX));
+
+  num = pResponse->getList(P6K_CMD_TASX, fields, P6K_MAXAXES_);
+  for (int32_t i=0; (i<num) && (i+1<numAxes_); ++i) {
+    stat = (setIntegerParam(i+1, P6K_A_TASX_Bits_, p6kParser::toBits(fields[i])) == asynSuccess) && stat;
+  }
+
+  return stat ? asynSuccess : asynError;
+}
+
+/**
+ * Decide which axes are read by the following p6kAxis::poll calls.
+ * Axes that are moving, waiting for the done moving delay, have a deferred move, 
+ * or were sent a command in the last P6K_C_AxisActiveTime_ seconds are read every poll.
+ * Axes that are cruising (see p6kAxis::cruising) are only due once per cruise poll
+ * period, and are not counted otherwise, so a cycle where every moving axis is 
+ * cruising doesn't read the bulk status (see poll).
+ * The idle axes are read in turn, so that each one is read about once per idle 
+ * poll period, however fast the poller is running because of the other axes.
+ * The number of idle axes read each cycle is spread evenly using the time since
+ * the last cycle. So the cost of a fast poll cycle depends on the number of 
+ * moving axes rather than the number of axes. If P6K_C_AxisSchedule_ is 0 all 
+ * axes are read every poll.
+ * @return The number of axes to be read this poll cycle
+ */
+int32_t p6kController::scheduleAxisPolls(void)
+{
+  p6kAxis *pAxis = NULL;
+  int32_t enable = 0;
+  double activeTime = 0.0;
+  int32_t numAxes = numAxes_ - 1;
+  int32_t numIdle = 0;
+  int32_t polled = 0;
+
+  getIntegerParam(P6K_C_AxisSchedule_, &enable);
+  getDoubleParam(P6K_C_AxisActiveTime_, &activeTime);
+
+  //Time since the last poll cycle started
+  double cycle = (lastPollStart_ != 0) ? ((pollStart_ - lastPollStart_) / 1.0e9) : idlePollPeriod_;
+  lastPollStart_ = pollStart_;
+
+  for (int32_t axis=1; axis<=numAxes; ++axis) {
+    pAxis = getAxis(axis);
+    if (pAxis == NULL) {
+      continue;
+    }
+    if ((enable == 1) && (pAxis->cruising(pollStart_, 2.0*movingPollPeriod_))) {
+      //Moving, but well before the predicted end of the move. Read it at the cruise poll period.
+      double cruisePeriod = 0.0;
+      getDoubleParam(axis, P6K_A_CruisePollPeriod_, &cruisePeriod);
+      pAxis->pollDue_ = (((pollStart_ - pAxis->lastPoll_) / 1.0e9) >= (cruisePeriod - (cycle / 2.0)));
+      if (pAxis->pollDue_) {
+        ++polled;
+      }
+      continue;
+    }
+    pAxis->pollDue_ = ((enable != 1) || (pAxis->lastPoll_ == 0) || 
+                       (pAxis->movingLastPoll_) || (pAxis->delayDoneMove_) || (pAxis->deferredMove_) ||
+                       ((pAxis->lastCommand_ != 0) && (((pollStart_ - pAxis->lastCommand_) / 1.0e9) < activeTime)));
+    if (pAxis->pollDue_) {
+      ++polled;
+    } else {
+      ++numIdle;
+    }
+  }
+
+  if ((numIdle > 0) && (idlePollPeriod_ > 0.0)) {
+    //The number of idle axes to read this cycle, so that they are all read once per idle poll period
+    int32_t budget = static_cast<int32_t>(ceil(numIdle * cycle / idlePollPeriod_));
+    //An axis is stale if it would be more than half a cycle late at the next cycle
+    double stale = idlePollPeriod_ - (cycle / 2.0);
+
+    for (int32_t i=0; (i<numAxes) && (budget>0); ++i) {
+      int32_t axis = 1 + ((axisPollNext_ + i) % numAxes);
+      pAxis = getAxis(axis);
+      if ((pAxis == NULL) || (pAxis->pollDue_)) {
+        continue;
+      }
+      if (((pollStart_ - pAxis->lastPoll_) / 1.0e9) >= stale) {
+        pAxis->pollDue_ = true;
+        --budget;
+        ++polled;
+        axisPollNext_ = axis % numAxes;
+      }
+    }
+  }
+
+  setIntegerParam(P6K_C_AxesPolled_, polled);
+
+  return polled;
+}
+
+/**
+ * Ask the poller for a poll cycle at a given time, as well as the polls on 
+ * the deadline grid. Only the earliest time asked for is kept. The requests are
+ * cleared at the start of each poll cycle, so an axis that still needs a timed
+ * poll must ask again each time it is polled. This must be called with the lock held.
+ * @param time Monotonic time of the poll (ns)
+ */
+void p6kController::pollAt(epicsUInt64 time)
+{
+  if ((timerAt_ == 0) || (time < timerAt_)) {
+    timerAt_ = time;
+  }
+}
+
+/**
+ * @param time Monotonic time (ns)
+ * @return true if a command was sent to any axis at or after the time
+ */
+bool p6kController::commandedSince(epicsUInt64 time)
+{
+  p6kAxis *pAxis = NULL;
+
+  for (int32_t axis=1; axis<numAxes_; ++axis) {
+    pAxis = getAxis(axis);
+    if ((pAxis != NULL) && (pAxis->lastCommand_ >= time)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @return true if any axis was moving at the last poll
+ */
+bool p6kController::anyAxisMoving(void)
+{
+  p6kAxis *pAxis = NULL;
+
+  for (int32_t axis=1; axis<numAxes_; ++axis) {
+    pAxis = getAxis(axis);
+    if ((pAxis != NULL) && (pAxis->movingLastPoll_)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @return The number of characters sent and received by the last lowLevelQuery of a command.
+ */
+size_t p6kController::lastQueryBytes(const char *command)
+{
+  return strlen(command) + strlen(P6K_ASYN_OEOS_) + rxLen_;
+}
+
 
 /**
  * Deal with controller specific asynOctet params.
@@ -782,7 +1297,9 @@ asynStatus p6kController::writeOctet(asynUser *pasynUser, const char *value,
     } 
     
     if (function == P6K_C_Command_) {
-      //Send command to controller
+      //Send command to controller. This may change motion parameters
+      //behind our back, so forget the cached values.
+      invalidateShadows();
       epicsSnprintf(command, P6K_MAXBUF_, "%s", value);
       if (lowLevelWriteRead(command, response) != asynSuccess) {
 	epicsSnprintf(error, P6K_MAXBUF_, "Command %s failed", command);
@@ -852,7 +1369,7 @@ p6kAxis* p6kController::getAxis(int axisNo)
 }
 
 /**
- * Wrapper for asynMotorController::startPoller.
+ * Start the deadline poller thread. This replaces the asynMotorController poller.
  * @return asynStatus
  */
 asynStatus p6kController::startPoller(void)
@@ -862,11 +1379,134 @@ asynStatus p6kController::startPoller(void)
 
   printf("%s: Starting poller.\n", functionName);
 
-  status = asynMotorController::startPoller(movingPollPeriod_, idlePollPeriod_, P6K_FORCED_FAST_POLLS_);
+  char threadName[P6K_MAXBUF_] = {0};
+  epicsSnprintf(threadName, P6K_MAXBUF_, "%sPoller", this->portName);
+  pollerThread_ = epicsThreadCreate(threadName, epicsThreadPriorityMedium,
+                                    epicsThreadGetStackSize(epicsThreadStackMedium),
+                                    (EPICSTHREADFUNC)p6kPollerTaskC, this);
+  if (pollerThread_ == NULL) {
+    printf("%s: ERROR: Failed to create poller thread for %s\n", functionName, this->portName);
+  } else {
+    status = asynSuccess;
+  }
 
   return status;
 }
 
+/**
+ * The poller thread. This does the same work as asynMotorController::asynMotorPoller
+ * (the controller poll then each axis poll, with the lock held), but each poll is 
+ * started at a deadline on a fixed grid, rather than a fixed time after the last poll 
+ * finished. So the poll rate doesn't drift as the poll time changes. 
+ * If a poll cycle overruns one or more deadlines they are counted as missed, and the
+ * next poll is at the next deadline on the grid. The time from a deadline to the 
+ * start of its poll is recorded as the jitter.
+ * wakeupPoller (eg. at the start of a move) still starts a poll straight away, and 
+ * if a command was sent to an axis since the last poll started it forces 
+ * P6K_FORCED_FAST_POLLS_ polls at the moving poll period. These extra polls
+ * don't move the grid, and are not counted for the jitter or missed deadlines.
+ * An axis can also ask for a poll at a given time with pollAt (eg. when the drive
+ * enable delay ends). These timed polls don't move the grid either.
+ */
+void p6kController::deadlinePoller(void)
+{
+  p6kAxis *pAxis = NULL;
+  epicsUInt64 deadline = epicsMonotonicGet();
+  epicsUInt64 next = deadline;
+  epicsUInt64 periodNs = 0;
+  epicsUInt64 now = 0;
+  double period = idlePollPeriod_;
+  uint32_t forcedFastPolls = 0;
+  bool anyMoving = false;
+  epicsUInt64 wake = 0;
+  epicsUInt64 timer = 0;
+  bool moving = false;
+  bool woken = false;
+  bool timed = false;
+  epicsUInt64 cycleStart = deadline;
+
+  while (true) {
+    woken = false;
+    timed = false;
+    //Wake at the next deadline on the grid, or earlier if an axis asked for a timed poll
+    wake = (period > 0.0) ? next : 0;
+    if ((timer != 0) && ((wake == 0) || (timer < wake))) {
+      wake = timer;
+      timed = true;
+    }
+    now = epicsMonotonicGet();
+    if (wake == 0) {
+      epicsEventWait(pollEventId_);
+      woken = true;
+    } else if (wake > now) {
+      woken = (epicsEventWaitWithTimeout(pollEventId_, (wake - now) / 1.0e9) == epicsEventOK);
+    }
+    if (woken) {
+      timed = false;
+    }
+
+    now = epicsMonotonicGet();
+    lock();
+    if (shuttingDown_) {
+      unlock();
+      break;
+    }
+
+    //Only a wakeup after a command (eg. a move) forces fast polls. The transport
+    //also wakes us when a status reply arrives, and that shouldn't.
+    if ((woken) && (commandedSince(cycleStart))) {
+      forcedFastPolls = P6K_FORCED_FAST_POLLS_;
+    }
+    cycleStart = now;
+
+    if ((!woken) && (!timed)) {
+      deadline = next;
+      stats_.recordTime(P6K_STATS_HIST_JITTER, (now > deadline) ? ((now - deadline) / 1.0e9) : 0.0);
+    }
+    pollCount_ += 1;
+
+    //The axes ask for their timed polls again during this cycle
+    timerAt_ = 0;
+    anyMoving = false;
+    poll();
+    for (int32_t axis=0; axis<numAxes_; ++axis) {
+      pAxis = getAxis(axis);
+      if (pAxis == NULL) {
+        continue;
+      }
+      moving = false;
+      pAxis->poll(&moving);
+      if (moving) {
+        anyMoving = true;
+      }
+    }
+
+    if (forcedFastPolls > 0) {
+      period = movingPollPeriod_;
+      --forcedFastPolls;
+    } else {
+      period = anyMoving ? movingPollPeriod_ : idlePollPeriod_;
+    }
+
+    //The next deadline is a whole number of periods after the last one
+    if (period > 0.0) {
+      periodNs = static_cast<epicsUInt64>(period * 1.0e9);
+      next = deadline + periodNs;
+      now = epicsMonotonicGet();
+      if (next <= now) {
+        epicsUInt64 missed = ((now - next) / periodNs) + 1;
+        if ((!woken) && (!timed)) {
+          pollMissed_ += static_cast<epicsUInt32>(missed);
+        }
+        next += missed * periodNs;
+      }
+    }
+
+    timer = timerAt_;
+    unlock();
+  }
+}
+
 
 /** 
  * Polls the controller, rather than individual axis.
@@ -874,20 +1514,27 @@ asynStatus p6kController::startPoller(void)
  */
 asynStatus p6kController::poll()
 {
-  char command[P6K_MAXBUF] = {0};
-  char response[P6K_MAXBUF] = {0};
   bool stat = true;
-  int32_t nvals = 0;
-  uint32_t bits = 0;
-  char stringVal[P6K_MAXBUF] = {0};
+  const p6kParser *pResponse = NULL;
+  p6kView tss = {"", 0};
   static const char *functionName = "p6kController::poll";
 
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
 
-  if (!lowLevelPortUser_) {
+  if ((!lowLevelPortUser_) || (!transport_)) {
     return asynError;
   }
 
+  //Record the duration of the previous poll cycle (this poll and the axis polls after it)
+  if (pollEnd_ > pollStart_) {
+    stats_.recordTime(P6K_STATS_HIST_POLL, (pollEnd_ - pollStart_) / 1.0e9);
+  }
+  pollStart_ = epicsMonotonicGet();
+  publishStats(false);
+
+  //Deal with any asynchronous replies that arrived since the last poll
+  transport_->processCompletions();
+
   /* Get the time and decide if we want to print errors.*/
   epicsTimeGetCurrent(&nowTime_);
   nowTimeSecs_ = nowTime_.secPastEpoch;
@@ -902,58 +1549,96 @@ asynStatus p6kController::poll()
     printErrors_ = true;
   }
 
-  //Set any controller specific parameters. 
-  //Some of these may be used by the axis poll to set axis bits.
-
-  //Transfer limit and home status and pack into uint32_t param.
+  //If the controller has stopped responding, only send a probe now and then.
+  //Everything else fails straight away, so the lock is not held for a timeout.
+  if ((commsDown_) || (transport_->isDown())) {
+    if (pollCommsDown() != asynSuccess) {
+      pollEnd_ = epicsMonotonicGet();
+      callParamCallbacks();
+      return asynError;
+    }
+  }
+
+  //Set any controller specific parameters. 
+  //Some of these may be used by the axis poll to set axis bits.
+  //The controller-wide queries are only sent when they are due (see p6kQueryScheduler).
+  //The moving state is from the previous axis polls.
+  const bool moving = anyAxisMoving();
+
+  //Transfer limit and home status and pack into uint32_t param.
   int32_t tlim = 0;
   getIntegerParam(P6K_C_TLIM_Enable_, &tlim);
-  setIntegerParam(P6K_C_TLIM_Bits_, 0);
-  if (tlim == 1) {
-    bits = 0;
-    stat = (getDigital(P6K_CMD_TLIM, (sizeof(P6K_CMD_TLIM)-1), &bits) == asynSuccess) && stat;
-    stat = (setIntegerParam(P6K_C_TLIM_Bits_, bits) == asynSuccess) && stat;
+  if (tlim != 1) {
+    setIntegerParam(P6K_C_TLIM_Bits_, 0);
+  } else {
+    stat = pollDigital(P6K_QUERY_TLIM, P6K_C_TLIM_Bits_, pollStart_, moving) && stat;
   }
 
   //Transfer input and output signals and pack into uint32_t param.
   int32_t inout = 0;
   getIntegerParam(P6K_C_INOUT_Enable_, &inout);
-  setIntegerParam(P6K_C_TOUT_Bits_, 0);
-  setIntegerParam(P6K_C_TIN_Bits_, 0);
-  if (inout == 1) {
-    bits = 0;
-    stat = (getDigital(P6K_CMD_TOUT, (sizeof(P6K_CMD_TOUT)-1), &bits) == asynSuccess) && stat;
-    stat = (setIntegerParam(P6K_C_TOUT_Bits_, bits) == asynSuccess) && stat;
-
-    bits = 0;
-    stat = (getDigital(P6K_CMD_TIN, (sizeof(P6K_CMD_TIN)-1), &bits) == asynSuccess) && stat;
-    stat = (setIntegerParam(P6K_C_TIN_Bits_, bits) == asynSuccess) && stat;
+  if (inout != 1) {
+    setIntegerParam(P6K_C_TOUT_Bits_, 0);
+    setIntegerParam(P6K_C_TIN_Bits_, 0);
+  } else {
+    stat = pollDigital(P6K_QUERY_TOUT, P6K_C_TOUT_Bits_, pollStart_, moving) && stat;
+    stat = pollDigital(P6K_QUERY_TIN, P6K_C_TIN_Bits_, pollStart_, moving) && stat;
   }
   
+  //Decide which axes read their status this poll cycle
+  int32_t polled = scheduleAxisPolls();
+
+  //Transfer the status of all axes in one transaction per query type.
+  //The results are cached on each axis and used by the following p6kAxis::poll,
+  //including the axes that were not due. This is only done if it saves
+  //transactions, ie. if at least P6K_BULK_MIN_AXES_ axes (or all of them) are due.
+  //Otherwise the axes that are due read their own status, and nothing 
+  //is read if no axis is due.
+  int32_t bulk = 0;
+  getIntegerParam(P6K_C_BulkStatus_, &bulk);
+  if ((bulk == 1) && (polled > 0) && 
+      ((polled >= static_cast<int32_t>(P6K_BULK_MIN_AXES_)) || (polled >= (numAxes_ - 1)))) {
+    stat = (getBulkStatus() == asynSuccess) && stat;
+  } else {
+    invalidateBulkStatus();
+  }
+
   //Transfer system status
-  epicsSnprintf(command, P6K_MAXBUF, "%s", P6K_CMD_TSS);
-  stat = (lowLevelWriteRead(command, response) == asynSuccess) && stat;
-  if (stat) {
-    nvals = sscanf(response, P6K_CMD_TSS"%s", stringVal);
-    if (nvals <= 0) {
-      stat = false;
-      if (printErrors_) {
-	asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
-		  "%s: ERROR: Problem reading TSS on controller %s\n", 
-		  functionName, this->portName);
+  if ((stat) && (queries_.isDue(P6K_QUERY_TSS, pollStart_, moving))) {
+    stat = (lowLevelQuery(P6K_CMD_TSS, &pResponse) == asynSuccess) && stat;
+    if (stat) {
+      if (pResponse->getBits(P6K_CMD_TSS, &tss) != asynSuccess) {
+        stat = false;
+        if (printErrors_) {
+          asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+                    "%s: ERROR: Problem reading TSS on controller %s\n", 
+                    functionName, this->portName);
+        }
       }
     }
-  }
-  memset(command, 0, sizeof(command));
    
-  if (stat) {
-    stat = (setIntegerParam(P6K_C_TSS_SystemReady_, (stringVal[P6K_TSS_SYSTEMREADY_] == P6K_ON_)) == asynSuccess) && stat;
-    stat = (setIntegerParam(P6K_C_TSS_ProgRunning_, (stringVal[P6K_TSS_PROGRUNNING_] == P6K_ON_)) == asynSuccess) && stat;
-    stat = (setIntegerParam(P6K_C_TSS_Immediate_,   (stringVal[P6K_TSS_IMMEDIATE_]   == P6K_ON_)) == asynSuccess) && stat;
-    stat = (setIntegerParam(P6K_C_TSS_CmdError_,    (stringVal[P6K_TSS_CMDERROR_]    == P6K_ON_)) == asynSuccess) && stat;
-    stat = (setIntegerParam(P6K_C_TSS_MemError_,    (stringVal[P6K_TSS_MEMERROR_]    == P6K_ON_)) == asynSuccess) && stat;
+    if (stat) {
+      queries_.done(P6K_QUERY_TSS, pollStart_, lastQueryBytes(P6K_CMD_TSS));
+      stat = (setIntegerParam(P6K_C_TSS_SystemReady_, (p6kParser::getChar(tss, P6K_TSS_SYSTEMREADY_) == P6K_ON_)) == asynSuccess) && stat;
+      stat = (setIntegerParam(P6K_C_TSS_ProgRunning_, (p6kParser::getChar(tss, P6K_TSS_PROGRUNNING_) == P6K_ON_)) == asynSuccess) && stat;
+      stat = (setIntegerParam(P6K_C_TSS_Immediate_,   (p6kParser::getChar(tss, P6K_TSS_IMMEDIATE_)   == P6K_ON_)) == asynSuccess) && stat;
+      stat = (setIntegerParam(P6K_C_TSS_CmdError_,    (p6kParser::getChar(tss, P6K_TSS_CMDERROR_)    == P6K_ON_)) == asynSuccess) && stat;
+      stat = (setIntegerParam(P6K_C_TSS_MemError_,    (p6kParser::getChar(tss, P6K_TSS_MEMERROR_)    == P6K_ON_)) == asynSuccess) && stat;
+    }
+  }
+
+  //Transfer the extended axis status (TASX) of all axes
+  int32_t tasx = 0;
+  getIntegerParam(P6K_C_TASX_Enable_, &tasx);
+  if (tasx != 1) {
+    for (int32_t axis=1; axis<numAxes_; ++axis) {
+      setIntegerParam(axis, P6K_A_TASX_Bits_, 0);
+    }
+  } else if (queries_.isDue(P6K_QUERY_TASX, pollStart_, moving)) {
+    stat = (getTASX() == asynSuccess) && stat;
   }
   
+  pollEnd_ = epicsMonotonicGet();
   callParamCallbacks();
 
   if (!stat) {
@@ -980,6 +1665,501 @@ asynStatus p6kController::poll()
 }
 
 
+/**
+ * Lock the controller. This is the asynPortDriver lock, with the time
+ * recorded so that unlock can measure how long it was held.
+ */
+asynStatus p6kController::lock(void)
+{
+  asynStatus status = asynMotorController::lock();
+
+  if (lockDepth_++ == 0) {
+    lockStart_ = epicsMonotonicGet();
+  }
+
+  return status;
+}
+
+/**
+ * Unlock the controller, and record the lock hold time when the
+ * outermost lock is released.
+ */
+asynStatus p6kController::unlock(void)
+{
+  if (lockDepth_ > 0) {
+    if (--lockDepth_ == 0) {
+      stats_.recordTime(P6K_STATS_HIST_LOCK, (epicsMonotonicGet() - lockStart_) / 1.0e9);
+    }
+  }
+
+  return asynMotorController::unlock();
+}
+
+/**
+ * Read the stats waveforms. Other arrays are handled by the base class.
+ */
+asynStatus p6kController::readFloat64Array(asynUser *pasynUser, epicsFloat64 *value,
+                                           size_t nElements, size_t *nIn)
+{
+  int32_t count = getStatsArray(pasynUser->reason, value, nElements);
+
+  if (count < 0) {
+    return asynMotorController::readFloat64Array(pasynUser, value, nElements, nIn);
+  }
+
+  *nIn = count;
+  return asynSuccess;
+}
+
+/**
+ * Copy one of the stats arrays. The per class arrays (including the
+ * timeout estimates, in ms) are indexed by p6kStatsClass, the histograms by bucket, and the bucket array holds the 
+ * upper edge of each bucket in ms.
+ * @param function The parameter
+ * @param value The array to fill in
+ * @param nElements The size of the array
+ * @return The number of elements copied, or -1 if function is not a stats array.
+ */
+int32_t p6kController::getStatsArray(int function, epicsFloat64 *value, size_t nElements)
+{
+  p6kStatsCounters counters[P6K_STATS_NUM_CLASSES];
+  p6kStatsHistogram histogram;
+  int32_t hist = -1;
+  size_t count = 0;
+
+  if ((function == P6K_C_StatsCount_) || (function == P6K_C_StatsBytesOut_) ||
+      (function == P6K_C_StatsBytesIn_) || (function == P6K_C_StatsErrors_) ||
+      (function == P6K_C_StatsTimeouts_)) {
+    stats_.getCounters(counters);
+    for (count=0; (count<nElements) && (count<P6K_STATS_NUM_CLASSES); ++count) {
+      if (function == P6K_C_StatsCount_) {
+        value[count] = counters[count].count;
+      } else if (function == P6K_C_StatsBytesOut_) {
+        value[count] = counters[count].bytesOut;
+      } else if (function == P6K_C_StatsBytesIn_) {
+        value[count] = counters[count].bytesIn;
+      } else if (function == P6K_C_StatsErrors_) {
+        value[count] = counters[count].errors;
+      } else {
+        value[count] = counters[count].timeouts;
+      }
+    }
+    return count;
+  }
+
+  if ((function == P6K_C_TimeoutSrtt_) || (function == P6K_C_TimeoutRttVar_) ||
+      (function == P6K_C_TimeoutRto_)) {
+    if (transport_ == NULL) {
+      return 0;
+    }
+    p6kTimeoutEstimate estimate;
+    for (count=0; (count<nElements) && (count<P6K_STATS_NUM_CLASSES); ++count) {
+      transport_->getTimeouts()->getEstimate(static_cast<p6kStatsClass>(count), &estimate);
+      if (function == P6K_C_TimeoutSrtt_) {
+        value[count] = estimate.srtt * 1000.0;
+      } else if (function == P6K_C_TimeoutRttVar_) {
+        value[count] = estimate.rttvar * 1000.0;
+      } else {
+        value[count] = estimate.rto * 1000.0;
+      }
+    }
+    return count;
+  }
+
+  if (function == P6K_C_StatsBuckets_) {
+    for (count=0; (count<nElements) && (count<P6K_STATS_BUCKETS); ++count) {
+      value[count] = p6kStats::getBucketEdge(count) * 1000.0;
+    }
+    return count;
+  }
+
+  if (function == P6K_C_StatsRttQuery_) {
+    hist = P6K_STATS_QUERY;
+  } else if (function == P6K_C_StatsRttWrite_) {
+    hist = P6K_STATS_WRITE;
+  } else if (function == P6K_C_StatsRttImmediate_) {
+    hist = P6K_STATS_IMMEDIATE;
+  } else if (function == P6K_C_StatsRttOther_) {
+    hist = P6K_STATS_OTHER;
+  } else if (function == P6K_C_PollHist_) {
+    hist = P6K_STATS_HIST_POLL;
+  } else if (function == P6K_C_LockHist_) {
+    hist = P6K_STATS_HIST_LOCK;
+  } else if (function == P6K_C_JitterHist_) {
+    hist = P6K_STATS_HIST_JITTER;
+  } else {
+    return -1;
+  }
+
+  stats_.getHistogram(static_cast<p6kStatsHist>(hist), &histogram);
+  for (count=0; (count<nElements) && (count<P6K_STATS_BUCKETS); ++count) {
+    value[count] = histogram.buckets[count];
+  }
+  return count;
+}
+
+/**
+ * Update the stats parameters and waveforms. This is called by the poller, with the
+ * controller lock held, and only does anything every P6K_STATS_PERIOD_ seconds.
+ * @param force Update now, whatever the time since the last update.
+ */
+void p6kController::publishStats(bool force)
+{
+  epicsFloat64 value[P6K_STATS_BUCKETS];
+  p6kStatsHistogram histogram;
+  const epicsUInt64 now = epicsMonotonicGet();
+  const double elapsed = (now - statsTime_) / 1.0e9;
+  const int arrays[] = {P6K_C_StatsCount_, P6K_C_StatsBytesOut_, P6K_C_StatsBytesIn_,
+                        P6K_C_StatsErrors_, P6K_C_StatsTimeouts_, P6K_C_StatsBuckets_,
+                        P6K_C_StatsRttQuery_, P6K_C_StatsRttWrite_, P6K_C_StatsRttImmediate_,
+                        P6K_C_StatsRttOther_, P6K_C_PollHist_, P6K_C_LockHist_, P6K_C_JitterHist_,
+                        P6K_C_TimeoutSrtt_, P6K_C_TimeoutRttVar_, P6K_C_TimeoutRto_};
+
+  if ((!force) && (statsTime_ != 0) && (elapsed < P6K_STATS_PERIOD_)) {
+    return;
+  }
+
+  //Command throughput since the last update
+  epicsFloat64 count = stats_.getTotalCount();
+  if ((statsTime_ != 0) && (elapsed > 0) && (count >= statsCount_)) {
+    setDoubleParam(P6K_C_StatsRate_, (count - statsCount_) / elapsed);
+  }
+  statsCount_ = count;
+
+  //Achieved poll rate since the last update
+  if ((statsTime_ != 0) && (elapsed > 0) && (pollCount_ >= statsPollCount_)) {
+    setDoubleParam(P6K_C_PollRate_, (pollCount_ - statsPollCount_) / elapsed);
+  }
+
+  //Characters sent and received per poll cycle, including any other commands
+  epicsFloat64 bytes = stats_.getTotalBytes();
+  if ((statsTime_ != 0) && (pollCount_ > statsPollCount_) && (bytes >= statsBytes_)) {
+    setDoubleParam(P6K_C_PollBytes_, (bytes - statsBytes_) / (pollCount_ - statsPollCount_));
+  }
+  statsBytes_ = bytes;
+  statsPollCount_ = pollCount_;
+
+  //Link use saved by the query scheduler
+  epicsFloat64 saved = queries_.getBytesSaved();
+  if ((statsTime_ != 0) && (elapsed > 0) && (saved >= queryBytesSaved_)) {
+    setDoubleParam(P6K_C_QuerySavedRate_, (saved - queryBytesSaved_) / elapsed);
+  }
+  queryBytesSaved_ = saved;
+  setDoubleParam(P6K_C_QuerySkipped_, queries_.getSkipped());
+  setDoubleParam(P6K_C_QueryBytesSaved_, saved);
+  statsTime_ = now;
+
+  stats_.getHistogram(P6K_STATS_HIST_POLL, &histogram);
+  setDoubleParam(P6K_C_PollTime_, histogram.last * 1000.0);
+  setDoubleParam(P6K_C_PollTimeMax_, histogram.max * 1000.0);
+  stats_.getHistogram(P6K_STATS_HIST_LOCK, &histogram);
+  setDoubleParam(P6K_C_LockHoldMax_, histogram.max * 1000.0);
+  stats_.getHistogram(P6K_STATS_HIST_JITTER, &histogram);
+  setDoubleParam(P6K_C_PollJitter_, histogram.last * 1000.0);
+  setDoubleParam(P6K_C_PollJitterMax_, histogram.max * 1000.0);
+  setIntegerParam(P6K_C_PollMissed_, static_cast<int>(pollMissed_));
+  setIntegerParam(P6K_C_LogDropped_, static_cast<int>(logger_->getDropped()));
+  setDoubleParam(P6K_C_ModbusReadTime_, modbus_->getReadTime() * 1000.0);
+  setIntegerParam(P6K_C_ModbusErrors_, static_cast<int>(modbus_->getErrors()));
+  setIntegerParam(P6K_C_ReplyMismatch_, static_cast<int>(replyMismatch_));
+  if (transport_ != NULL) {
+    setIntegerParam(P6K_C_Resyncs_, static_cast<int>(transport_->getResyncs()));
+    setDoubleParam(P6K_C_ResyncDiscarded_, transport_->getDiscarded());
+  }
+
+  for (size_t i=0; i<sizeof(arrays)/sizeof(arrays[0]); ++i) {
+    int32_t n = getStatsArray(arrays[i], value, P6K_STATS_BUCKETS);
+    if (n > 0) {
+      doCallbacksFloat64Array(value, n, arrays[i], 0);
+    }
+  }
+}
+
+/**
+ * Read the status of all axes using the axis-less forms of TAS, TPC and TPE.
+ * The controller replies with a comma separated list, one field per axis,
+ * which is distributed into the status cache of each axis. The cache is consumed
+ * by the next p6kAxis::poll, so each poll cycle costs three transactions rather than
+ * three per axis. If a reply does not contain a field for an axis, that axis
+ * falls back to reading its own status.
+ * The three queries are submitted to the transport together, and the controller
+ * lock is released while they are in flight, so that motion commands from other
+ * threads don't have to wait for the poll. If any command was sent in the meantime
+ * the results are thrown away, because they may predate a move.
+ * @return asynStatus
+ */
+asynStatus p6kController::getBulkStatus(void)
+{
+  bool stat = true;
+  uint32_t syncCount = 0;
+  static const char *functionName = "p6kController::getBulkStatus";
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+
+  //Invalidate any old cached status first, in case a query fails.
+  invalidateBulkStatus();
+
+  bulkStat_ = true;
+  bulkNumTAS_ = 0;
+  stat = (transport_->submit(P6K_CMD_TAS, p6kBulkStatusCallbackC, this) == asynSuccess) && stat;
+  stat = (transport_->submit(P6K_CMD_TPC, p6kBulkStatusCallbackC, this) == asynSuccess) && stat;
+  stat = (transport_->submit(P6K_CMD_TPE, p6kBulkStatusCallbackC, this) == asynSuccess) && stat;
+
+  syncCount = syncCount_;
+  this->unlock();
+  stat = (transport_->waitOutstanding(P6K_TIMEOUT_*3) == asynSuccess) && stat;
+  this->lock();
+
+  transport_->processCompletions();
+  stat = bulkStat_ && stat;
+
+  if (syncCount != syncCount_) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, 
+              "%s: Commands were sent during the status read. Discarding bulk status.\n", functionName);
+    invalidateBulkStatus();
+  }
+
+  if (!stat) {
+    invalidateBulkStatus();
+    if (printErrors_) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+		"%s: ERROR: Problem reading bulk axis status on controller %s\n", 
+		functionName, this->portName);
+    }
+    return asynError;
+  }
+
+  return asynSuccess;
+}
+
+/**
+ * Completion callback for the TAS, TPC and TPE queries sent by getBulkStatus.
+ * This is run by p6kTransport::processCompletions with the controller lock held.
+ * The replies arrive in the order the queries were submitted.
+ * @param command The command that was sent
+ * @param input The raw response
+ * @param status The status of the transaction
+ */
+void p6kController::bulkStatusCallback(const char *command, char *input, asynStatus status)
+{
+  p6kParser parser;
+  p6kView fields[P6K_MAXAXES_];
+  int32_t num = 0;
+  p6kAxis *pAxis = NULL;
+
+  if (checkResponse(command, &parser, input, strlen(input), (status == asynSuccess)) != asynSuccess) {
+    bulkStat_ = false;
+    return;
+  }
+
+  num = parser.getList(command, fields, P6K_MAXAXES_);
+
+  if (strcmp(command, P6K_CMD_TAS) == 0) {
+    bulkNumTAS_ = num;
+    for (int32_t i=0; i<num; ++i) {
+      pAxis = getAxis(i+1);
+      if (pAxis != NULL) {
+        pAxis->bulkTAS_ = p6kParser::toMask(fields[i]);
+      }
+    }
+  } else if (strcmp(command, P6K_CMD_TPC) == 0) {
+    for (int32_t i=0; (i<num) && (i<bulkNumTAS_); ++i) {
+      pAxis = getAxis(i+1);
+      if ((pAxis != NULL) && (p6kParser::toInt(fields[i], &pAxis->bulkTPC_) == asynSuccess)) {
+        pAxis->bulkStatusValid_ = true;
+      }
+    }
+  } else if (strcmp(command, P6K_CMD_TPE) == 0) {
+    for (int32_t i=0; i<num; ++i) {
+      pAxis = getAxis(i+1);
+      if ((pAxis != NULL) && (p6kParser::toInt(fields[i], &pAxis->bulkTPE_) == asynSuccess)) {
+        pAxis->bulkEncoderValid_ = true;
+      }
+    }
+  }
+}
+
+/**
+ * Mark the bulk status cache on all axes as out of date, so that 
+ * each axis reads its own status on the next poll.
+ */
+void p6kController::invalidateBulkStatus(void)
+{
+  p6kAxis *pAxis = NULL;
+
+  for (int32_t axis=1; axis<numAxes_; ++axis) {
+    pAxis = getAxis(axis);
+    if (pAxis != NULL) {
+      pAxis->bulkStatusValid_ = false;
+      pAxis->bulkEncoderValid_ = false;
+    }
+  }
+}
+
+/**
+ * Called by poll when the transport has marked the controller as down.
+ * Nothing is sent except a probe (TSS), and the time between probes doubles
+ * each time there is no response, up to P6K_PROBE_MAX_DELAY_. The controller
+ * lock is released while waiting for the probe.
+ * @return asynSuccess once the controller is responding and has been resynchronised.
+ */
+asynStatus p6kController::pollCommsDown(void)
+{
+  asynStatus status = asynSuccess;
+  char response[P6K_MAXBUF] = {0};
+  size_t nread = 0;
+  epicsUInt64 now = epicsMonotonicGet();
+  static const char *functionName = "p6kController::pollCommsDown";
+
+  if (!commsDown_) {
+    //First poll since the controller stopped responding
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s: ERROR: Controller %s is not responding. Probing every %.1f to %.1f seconds.\n",
+              functionName, this->portName, P6K_PROBE_MIN_DELAY_, P6K_PROBE_MAX_DELAY_);
+    commsDown_ = true;
+    probeDelay_ = P6K_PROBE_MIN_DELAY_;
+    nextProbe_ = now + static_cast<epicsUInt64>(probeDelay_ * 1.0e9);
+    setIntegerParam(P6K_C_CommsDown_, 1);
+    setIntegerParam(P6K_C_CommsOutages_, static_cast<int>(transport_->getOutages()));
+    setDoubleParam(P6K_C_ProbeDelay_, probeDelay_);
+    setIntegerParam(P6K_C_CommsError_, P6K_ERROR_);
+    setStringParam(P6K_C_Error_, "Controller not responding");
+    return asynError;
+  }
+
+  //The transport is no longer down if the fail limit was set to 0
+  if (transport_->isDown()) {
+    if (now < nextProbe_) {
+      return asynError;
+    }
+
+    unlock();
+    status = transport_->probe(P6K_CMD_TSS, response, sizeof(response), &nread);
+    lock();
+
+    if (status != asynSuccess) {
+      probeDelay_ *= 2;
+      if (probeDelay_ > P6K_PROBE_MAX_DELAY_) {
+        probeDelay_ = P6K_PROBE_MAX_DELAY_;
+      }
+      nextProbe_ = epicsMonotonicGet() + static_cast<epicsUInt64>(probeDelay_ * 1.0e9);
+      setDoubleParam(P6K_C_ProbeDelay_, probeDelay_);
+      return asynError;
+    }
+  }
+
+  return resync();
+}
+
+/**
+ * Set up the controller again after it has stopped responding, in case
+ * it was power cycled. The comms settings from the constructor are sent again,
+ * the cached axis state is thrown away and each axis is initialised again.
+ * If any of this fails, it is tried again on the next poll.
+ * @return asynStatus
+ */
+asynStatus p6kController::resync(void)
+{
+  bool stat = true;
+  char command[P6K_MAXBUF] = {0};
+  char response[P6K_MAXBUF] = {0};
+  p6kAxis *pAxis = NULL;
+  static const char *functionName = "p6kController::resync";
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s: Controller %s is responding. Reading the axis setup again.\n",
+            functionName, this->portName);
+
+  epicsSnprintf(command, P6K_MAXBUF_, "%s0", P6K_CMD_ECHO);
+  stat = (lowLevelWriteRead(command, response) == asynSuccess) && stat;
+  epicsSnprintf(command, P6K_MAXBUF_, "%s1", P6K_CMD_COMEXC);
+  stat = (lowLevelWriteRead(command, response) == asynSuccess) && stat;
+  if (compactFraming_) {
+    stat = (setFraming(true) == asynSuccess) && stat;
+  }
+
+  invalidateShadows();
+  invalidateBulkStatus();
+  for (int32_t query=0; query<P6K_QUERY_NUM; ++query) {
+    queries_.force(static_cast<p6kQueryId>(query));
+  }
+
+  for (int32_t axis=1; axis<numAxes_; ++axis) {
+    pAxis = getAxis(axis);
+    if (pAxis != NULL) {
+      //Make sure the axis is read on this poll cycle
+      pAxis->lastPoll_ = 0;
+      stat = (pAxis->getAxisInitialStatus() == asynSuccess) && stat;
+      pAxis->callParamCallbacks();
+    }
+  }
+
+  if (!stat) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s: ERROR: Failed to set up controller %s again.\n",
+              functionName, this->portName);
+    return asynError;
+  }
+
+  commsDown_ = false;
+  probeDelay_ = 0;
+  setIntegerParam(P6K_C_CommsDown_, 0);
+  setDoubleParam(P6K_C_ProbeDelay_, probeDelay_);
+  return asynSuccess;
+}
+
+/**
+ * Set the characters the controller sends around each response.
+ * By default a response ends with EOT (\r) and EOL (\r\n) before the prompt,
+ * eg. *1TPC+100\r\r\n>. Compact framing turns off EOT and ends lines with
+ * \r only, eg. *1TPC+100\r>, which saves 2 characters per reply and 1 per
+ * acknowledgement. p6kTransport and p6kParser accept both, so the replies to
+ * these commands are read correctly whichever way round they take effect.
+ * ERRLVL4 is also sent, since the driver relies on the > and ? prompts.
+ * @param compact true for compact framing, false for the controller defaults
+ * @return asynStatus
+ */
+asynStatus p6kController::setFraming(bool compact)
+{
+  bool stat = true;
+  char command[P6K_MAXBUF] = {0};
+  char response[P6K_MAXBUF] = {0};
+  static const char *functionName = "p6kController::setFraming";
+
+  epicsSnprintf(command, P6K_MAXBUF_, "%s4", P6K_CMD_ERRLVL);
+  stat = (lowLevelWriteRead(command, response) == asynSuccess) && stat;
+  epicsSnprintf(command, P6K_MAXBUF_, "%s%s", P6K_CMD_EOT, compact ? P6K_EOT_COMPACT_ : P6K_EOT_DEFAULT_);
+  stat = (lowLevelWriteRead(command, response) == asynSuccess) && stat;
+  epicsSnprintf(command, P6K_MAXBUF_, "%s%s", P6K_CMD_EOL, compact ? P6K_EOL_COMPACT_ : P6K_EOL_DEFAULT_);
+  stat = (lowLevelWriteRead(command, response) == asynSuccess) && stat;
+
+  if (!stat) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s: ERROR: Failed to set %s framing on controller %s\n",
+              functionName, compact ? "compact" : "default", this->portName);
+    return asynError;
+  }
+
+  compactFraming_ = compact;
+  return asynSuccess;
+}
+
+/**
+ * Forget the motion parameters cached on all axes, so that 
+ * they are sent to the controller again on the next move.
+ */
+void p6kController::invalidateShadows(void)
+{
+  p6kAxis *pAxis = NULL;
+
+  for (int32_t axis=0; axis<numAxes_; ++axis) {
+    pAxis = getAxis(axis);
+    if (pAxis != NULL) {
+      pAxis->shadowInvalidate();
+    }
+  }
+}
+
 /**
  * Write a configuration file to the controller. This function reads a ASCII file
  * that should only contain P6K commands terminated by a newline. 
@@ -1067,11 +2247,58 @@ asynStatus p6kController::upload(const char *filename)
     callParamCallbacks();
   }
 
+  //The configuration may have changed any of the motion parameters
+  invalidateShadows();
+
   epicsThreadSleep(5);
 
   return status;
 }
 
+/**
+ * Send the comms log (enabled by P6K_C_Log_) to a file rather than the console.
+ * @param filename The file to append to, or an empty string for the console.
+ * @return asynStatus
+ */
+asynStatus p6kController::setLogFile(const char *filename)
+{
+  return logger_->setFile(filename);
+}
+
+/**
+ * Set how often one of the controller-wide status queries is sent.
+ * @param query The query command (TSS, TLIM, TIN, TOUT or TASX)
+ * @param tier 0=every poll, 1=periodic, 2=background (see p6kQueryTier)
+ * @param period The period in seconds for the periodic and background tiers.
+ *        Zero or less keeps the current period.
+ * @return asynStatus
+ */
+asynStatus p6kController::setQueryTier(const char *query, int tier, double period)
+{
+  static const char *functionName = "p6kController::setQueryTier";
+
+  int32_t id = p6kQueryScheduler::find(query);
+  if (id < 0) {
+    printf("%s: ERROR: Unknown query %s\n", functionName, query ? query : "");
+    return asynError;
+  }
+  if ((tier < 0) || (tier >= P6K_TIER_NUM)) {
+    printf("%s: ERROR: Tier %d out of range (0 to %d)\n", functionName, tier, P6K_TIER_NUM-1);
+    return asynError;
+  }
+
+  queries_.setTier(static_cast<p6kQueryId>(id), static_cast<p6kQueryTier>(tier));
+  if (period > 0.0) {
+    queries_.setPeriod(static_cast<p6kQueryId>(id), period);
+  }
+
+  setIntegerParam(P6K_C_QueryTier_[id], queries_.getTier(static_cast<p6kQueryId>(id)));
+  setDoubleParam(P6K_C_QueryPeriod_[id], queries_.getPeriod(static_cast<p6kQueryId>(id)));
+  callParamCallbacks();
+
+  return asynSuccess;
+}
+
 
 /**
  * Implement co-ordinated moves.
@@ -1104,7 +2331,8 @@ asynStatus p6kController::setDeferredMoves(bool deferMoves)
     pAxis = getAxis(axis);
     if (pAxis != NULL) {
       if (pAxis->deferredMove_) {
-	epicsSnprintf(command, P6K_MAXBUF, "%dD%d", pAxis->axisNo_, pAxis->deferredPosition_);
+	pAxis->setCommanded();
+	p6kCommand::integer(P6K_CMDID_D, pAxis->axisNo_, static_cast<epicsInt32>(pAxis->deferredPosition_)).format(command, P6K_MAXBUF);
 	stat = (lowLevelWriteRead(command, response) == asynSuccess) && stat;
 	if (static_cast<uint32_t>(axis) <= P6K_MAXAXES_) {
 	  move[axis] = 1;
@@ -1132,6 +2360,12 @@ asynStatus p6kController::setDeferredMoves(bool deferMoves)
     } else {
       setStringParam(P6K_C_Error_, " ");
       status = asynSuccess;
+      for (int32_t axis=0; axis<numAxes_; axis++) {
+        pAxis = getAxis(axis);
+        if ((pAxis != NULL) && (pAxis->deferredMove_)) {
+          pAxis->startPrediction();
+        }
+      }
     }
     
   }
@@ -1227,7 +2461,8 @@ asynStatus p6kCreateModbusEncAxis(const char *p6kName,    //specify which contro
                                   int axis,               //axis number (start from 1)
                                   const char *modbusPort, //modbus asyn port
                                   int modbusAddr,         //modbus address offset (in 16-bit words)
-                                  int modbusOffset)       //modbus encoder offset
+                                  int modbusOffset,       //modbus encoder offset
+                                  int modbusWords)        //registers per count (2 or 4, 0 means 2)
                                   
 {
   p6kController *pC;
@@ -1253,7 +2488,10 @@ asynStatus p6kCreateModbusEncAxis(const char *p6kName,    //specify which contro
   pC->lock();
   pAxis = new p6kAxis(pC, axis);
 
-  if (pAxis->modbusPortConnect(modbusPort, modbusAddr, modbusOffset) != asynSuccess) {
+  if (modbusWords == 0) {
+    modbusWords = 2;
+  }
+  if (pAxis->modbusPortConnect(modbusPort, modbusAddr, modbusOffset, modbusWords) != asynSuccess) {
     printf("%s::%s: ERROR Failed to connect to modbus port %s, addr %d\n.",
 	   driverName, functionName, modbusPort, modbusAddr);
     status = asynError;
@@ -1324,6 +2562,51 @@ asynStatus p6kUpload(const char *p6kName, const char *filename)
   return status;
 }
 
+/**
+ * Wrapper for p6kController::setLogFile.
+ * @param p6kName Controller port name
+ * @param filename The file to append the comms log to. An empty string means the console.
+ */
+asynStatus p6kSetLogFile(const char *p6kName, const char *filename)
+{
+  p6kController *pC;
+  static const char *functionName = "p6kSetLogFile";
+  pC = (p6kController*) findAsynPortDriver(p6kName);
+  if (!pC) {
+    printf("%s:%s: Error port %s not found\n",
+           driverName, functionName, p6kName);
+    return asynError;
+  }
+
+  return pC->setLogFile(filename);
+}
+
+/**
+ * Wrapper for p6kController::setQueryTier.
+ * @param p6kName Controller port name
+ * @param query The query command (TSS, TLIM, TIN, TOUT or TASX)
+ * @param tier 0=every poll, 1=periodic, 2=background
+ * @param period The period in seconds. Zero or less keeps the current period.
+ */
+asynStatus p6kSetQueryTier(const char *p6kName, const char *query, int tier, double period)
+{
+  asynStatus status = asynError;
+  p6kController *pC;
+  static const char *functionName = "p6kSetQueryTier";
+  pC = (p6kController*) findAsynPortDriver(p6kName);
+  if (!pC) {
+    printf("%s:%s: Error port %s not found\n",
+           driverName, functionName, p6kName);
+    return asynError;
+  }
+
+  pC->lock();
+  status = pC->setQueryTier(query, tier, period);
+  pC->unlock();
+
+  return status;
+}
+
 
 
 /* Code for iocsh registration */
@@ -1366,16 +2649,18 @@ static const iocshArg p6kCreateModbusEncAxisArg1 = {"Axis number", iocshArgInt};
 static const iocshArg p6kCreateModbusEncAxisArg2 = {"Modbus Port Name", iocshArgString};
 static const iocshArg p6kCreateModbusEncAxisArg3 = {"Modbus Port Address", iocshArgInt};
 static const iocshArg p6kCreateModbusEncAxisArg4 = {"Modbus Enc Offset", iocshArgInt};
+static const iocshArg p6kCreateModbusEncAxisArg5 = {"Modbus Enc Words", iocshArgInt};
 static const iocshArg * const p6kCreateModbusEncAxisArgs[] = {&p6kCreateModbusEncAxisArg0,
                                                               &p6kCreateModbusEncAxisArg1,
                                                               &p6kCreateModbusEncAxisArg2,
                                                               &p6kCreateModbusEncAxisArg3,
-                                                              &p6kCreateModbusEncAxisArg4};
-static const iocshFuncDef configp6kModbusEncAxis = {"p6kCreateModbusEncAxis", 5, p6kCreateModbusEncAxisArgs};
+                                                              &p6kCreateModbusEncAxisArg4,
+                                                              &p6kCreateModbusEncAxisArg5};
+static const iocshFuncDef configp6kModbusEncAxis = {"p6kCreateModbusEncAxis", 6, p6kCreateModbusEncAxisArgs};
 
 static void configp6kModbusEncAxisCallFunc(const iocshArgBuf *args)
 {
-  p6kCreateModbusEncAxis(args[0].sval, args[1].ival, args[2].sval, args[3].ival, args[4].ival);
+  p6kCreateModbusEncAxis(args[0].sval, args[1].ival, args[2].sval, args[3].ival, args[4].ival, args[5].ival);
 }
 
 /* p6kCreateAxes */
@@ -1401,6 +2686,32 @@ static void configp6kUploadCallFunc(const iocshArgBuf *args)
   p6kUpload(args[0].sval, args[1].sval);
 }
 
+/* p6kSetLogFile */
+static const iocshArg p6kSetLogFileArg0 = {"Controller port name", iocshArgString};
+static const iocshArg p6kSetLogFileArg1 = {"Filename", iocshArgString};
+static const iocshArg * const p6kSetLogFileArgs[] = {&p6kSetLogFileArg0,
+						     &p6kSetLogFileArg1};
+static const iocshFuncDef configp6kSetLogFile = {"p6kSetLogFile", 2, p6kSetLogFileArgs};
+static void configp6kSetLogFileCallFunc(const iocshArgBuf *args)
+{
+  p6kSetLogFile(args[0].sval, args[1].sval);
+}
+
+/* p6kSetQueryTier */
+static const iocshArg p6kSetQueryTierArg0 = {"Controller port name", iocshArgString};
+static const iocshArg p6kSetQueryTierArg1 = {"Query (TSS, TLIM, TIN, TOUT or TASX)", iocshArgString};
+static const iocshArg p6kSetQueryTierArg2 = {"Tier (0=every poll, 1=periodic, 2=background)", iocshArgInt};
+static const iocshArg p6kSetQueryTierArg3 = {"Period (s)", iocshArgDouble};
+static const iocshArg * const p6kSetQueryTierArgs[] = {&p6kSetQueryTierArg0,
+						       &p6kSetQueryTierArg1,
+						       &p6kSetQueryTierArg2,
+						       &p6kSetQueryTierArg3};
+static const iocshFuncDef configp6kSetQueryTier = {"p6kSetQueryTier", 4, p6kSetQueryTierArgs};
+static void configp6kSetQueryTierCallFunc(const iocshArgBuf *args)
+{
+  p6kSetQueryTier(args[0].sval, args[1].sval, args[2].ival, args[3].dval);
+}
+
 
 static void p6kControllerRegister(void)
 {
@@ -1409,6 +2720,8 @@ static void p6kControllerRegister(void)
   iocshRegister(&configp6kModbusEncAxis,      configp6kModbusEncAxisCallFunc);
   iocshRegister(&configp6kAxes,               configp6kAxesCallFunc);
   iocshRegister(&configp6kUpload,             configp6kUploadCallFunc);
+  iocshRegister(&configp6kSetLogFile,         configp6kSetLogFileCallFunc);
+  iocshRegister(&configp6kSetQueryTier,       configp6kSetQueryTierCallFunc);
 }
 epicsExportRegistrar(p6kControllerRegister);
 
@@ -15,6 +15,14 @@
 #include "asynMotorController.h"
 #include "asynMotorAxis.h"
 #include "parker6kAxis.h"
+#include "parker6kCommand.h"
+#include "parker6kCommandBatch.h"
+#include "parker6kTransport.h"
+#include "parker6kParser.h"
+#include "parker6kStats.h"
+#include "parker6kLogger.h"
+#include "parker6kQueryScheduler.h"
+#include "parker6kModbus.h"
 
 #define P6K_C_FirstParamString "P6K_C_FIRSTPARAM"
 #define P6K_C_LastParamString  "P6K_C_LASTPARAM"
@@ -39,6 +47,58 @@
 #define P6K_C_OUT_BitString         "P6K_C_OUT_BIT"
 #define P6K_C_OUT_ValString         "P6K_C_OUT_VAL"
 #define P6K_C_OUT_AllString         "P6K_C_OUT_ALL"
+#define P6K_C_BulkStatusString      "P6K_C_BULKSTATUS"
+#define P6K_C_MaxInFlightString     "P6K_C_MAXINFLIGHT"
+#define P6K_C_StatsResetString      "P6K_C_STATS_RESET"
+#define P6K_C_StatsCountString      "P6K_C_STATS_COUNT"
+#define P6K_C_StatsBytesOutString   "P6K_C_STATS_BYTES_OUT"
+#define P6K_C_StatsBytesInString    "P6K_C_STATS_BYTES_IN"
+#define P6K_C_StatsErrorsString     "P6K_C_STATS_ERRORS"
+#define P6K_C_StatsTimeoutsString   "P6K_C_STATS_TIMEOUTS"
+#define P6K_C_StatsRateString       "P6K_C_STATS_RATE"
+#define P6K_C_StatsBucketsString    "P6K_C_STATS_BUCKETS"
+#define P6K_C_StatsRttQueryString   "P6K_C_STATS_RTT_QUERY"
+#define P6K_C_StatsRttWriteString   "P6K_C_STATS_RTT_WRITE"
+#define P6K_C_StatsRttImmediateString "P6K_C_STATS_RTT_IMMEDIATE"
+#define P6K_C_StatsRttOtherString   "P6K_C_STATS_RTT_OTHER"
+#define P6K_C_PollTimeString        "P6K_C_POLL_TIME"
+#define P6K_C_PollTimeMaxString     "P6K_C_POLL_TIME_MAX"
+#define P6K_C_PollHistString        "P6K_C_POLL_HIST"
+#define P6K_C_LockHoldMaxString     "P6K_C_LOCK_HOLD_MAX"
+#define P6K_C_LockHistString        "P6K_C_LOCK_HIST"
+#define P6K_C_LogDroppedString      "P6K_C_LOG_DROPPED"
+#define P6K_C_TASX_EnableString     "P6K_C_TASX_ENABLE"
+#define P6K_C_QueryPeriodString     "P6K_C_QUERY_PERIOD_" //Followed by the query name (eg. P6K_C_QUERY_PERIOD_TSS)
+#define P6K_C_QueryTierString       "P6K_C_QUERY_TIER_"   //Followed by the query name (eg. P6K_C_QUERY_TIER_TSS)
+#define P6K_C_QuerySkippedString    "P6K_C_QUERY_SKIPPED"
+#define P6K_C_QueryBytesSavedString "P6K_C_QUERY_BYTES_SAVED"
+#define P6K_C_QuerySavedRateString  "P6K_C_QUERY_SAVED_RATE"
+#define P6K_C_AxisScheduleString    "P6K_C_AXIS_SCHEDULE"
+#define P6K_C_AxisActiveTimeString  "P6K_C_AXIS_ACTIVE_TIME"
+#define P6K_C_AxesPolledString      "P6K_C_AXES_POLLED"
+#define P6K_C_PollRateString        "P6K_C_POLL_RATE"
+#define P6K_C_PollMissedString      "P6K_C_POLL_MISSED"
+#define P6K_C_PollJitterString      "P6K_C_POLL_JITTER"
+#define P6K_C_PollJitterMaxString   "P6K_C_POLL_JITTER_MAX"
+#define P6K_C_JitterHistString      "P6K_C_JITTER_HIST"
+#define P6K_C_CommsDownString       "P6K_C_COMMS_DOWN"
+#define P6K_C_CommsFailLimitString  "P6K_C_COMMS_FAIL_LIMIT"
+#define P6K_C_CommsOutagesString    "P6K_C_COMMS_OUTAGES"
+#define P6K_C_ProbeDelayString      "P6K_C_PROBE_DELAY"
+#define P6K_C_AdaptiveTimeoutString "P6K_C_ADAPTIVE_TIMEOUT"
+#define P6K_C_TimeoutMinString      "P6K_C_TIMEOUT_MIN"
+#define P6K_C_TimeoutMaxString      "P6K_C_TIMEOUT_MAX"
+#define P6K_C_TimeoutSrttString     "P6K_C_TIMEOUT_SRTT"
+#define P6K_C_TimeoutRttVarString   "P6K_C_TIMEOUT_RTTVAR"
+#define P6K_C_TimeoutRtoString      "P6K_C_TIMEOUT_RTO"
+#define P6K_C_ReplyMismatchString   "P6K_C_REPLY_MISMATCH"
+#define P6K_C_ResyncsString         "P6K_C_RESYNCS"
+#define P6K_C_ResyncDiscardedString "P6K_C_RESYNC_DISCARDED"
+#define P6K_C_CompactFramingString  "P6K_C_COMPACT_FRAMING"
+#define P6K_C_PollBytesString       "P6K_C_POLL_BYTES"
+#define P6K_C_ModbusPeriodString    "P6K_C_MODBUS_PERIOD"
+#define P6K_C_ModbusReadTimeString  "P6K_C_MODBUS_READ_TIME"
+#define P6K_C_ModbusErrorsString    "P6K_C_MODBUS_ERRORS"
 
 //Axis specific parameters
 #define P6K_A_DRESString       "P6K_A_DRES"
@@ -62,58 +122,26 @@
 #define P6K_A_AutoDriveEnableString  "P6K_A_AUTO_DRIVE_ENABLE"
 #define P6K_A_AutoDriveEnableDelayString  "P6K_A_AUTO_DRIVE_ENABLE_DELAY"
 #define P6K_A_DriveRetryString  "P6K_A_DRIVE_RETRY"
+#define P6K_A_DriveStateString  "P6K_A_DRIVE_STATE"
 #define P6K_A_ExternalEncoderUseString  "P6K_A_EXT_ENC_USE"
 #define P6K_A_ExternalEncoderString  "P6K_A_EXT_ENC"
+#define P6K_A_ExternalEncoderMaxAgeString  "P6K_A_EXT_ENC_MAX_AGE"
+#define P6K_A_ExternalEncoderAgeString  "P6K_A_EXT_ENC_AGE"
 #define P6K_A_ModbusEncoderString  "P6K_A_MODBUS_ENC"
 #define P6K_A_ModbusEncoderAddrString  "P6K_A_MODBUS_ENC_ADDR"
 #define P6K_A_ModbusEncoderOffsetString  "P6K_A_MODBUS_ENC_OFFSET"
 #define P6K_A_ModbusEncoderCheckString  "P6K_A_MODBUS_ENC_CHECK"
+#define P6K_A_StopLatencyString  "P6K_A_STOP_LATENCY"
+#define P6K_A_SettleLatencyString  "P6K_A_SETTLE_LATENCY"
+#define P6K_A_TASX_BitsString  "P6K_A_TASX_BITS"
+#define P6K_A_PredictEnableString  "P6K_A_PREDICT_ENABLE"
+#define P6K_A_CruisePollPeriodString  "P6K_A_CRUISE_POLL_PERIOD"
+#define P6K_A_PredictedTimeString  "P6K_A_PREDICTED_TIME"
+#define P6K_A_PredictErrorString  "P6K_A_PREDICT_ERROR"
 
 #define P6K_MAXBUF 1024
 
-//Controller commands
-#define P6K_CMD_A        "A"
-#define P6K_CMD_AA       "AA"
-#define P6K_CMD_AD       "AD"
-#define P6K_CMD_ADA      "ADA"
-#define P6K_CMD_AXSDEF   "AXSDEF"
-#define P6K_CMD_CMDDIR   "CMDDIR"
-#define P6K_CMD_COMEXC   "COMEXC"
-#define P6K_CMD_D        "D"
-#define P6K_CMD_DRES     "DRES"
-#define P6K_CMD_DRFEN    "DRFEN"
-#define P6K_CMD_DRIVE    "DRIVE"
-#define P6K_CMD_ECHO     "ECHO"
-#define P6K_CMD_ENCCNT   "ENCCNT"
-#define P6K_CMD_ENCPOL   "ENCPOL"
-#define P6K_CMD_ERES     "ERES"
-#define P6K_CMD_ESK      "ESK"
-#define P6K_CMD_ESTALL   "ESTALL"
-#define P6K_CMD_GO       "GO"
-#define P6K_CMD_HOM      "HOM"
-#define P6K_CMD_HOMA     "HOMA"
-#define P6K_CMD_HOMAA    "HOMAA"
-#define P6K_CMD_HOMAD    "HOMAD"
-#define P6K_CMD_HOMADA   "HOMADA"
-#define P6K_CMD_HOMV     "HOMV"
-#define P6K_CMD_LH       "LH"
-#define P6K_CMD_LS       "LS"
-#define P6K_CMD_LSNEG    "LSNEG"
-#define P6K_CMD_LSPOS    "LSPOS"
-#define P6K_CMD_MA       "MA"
-#define P6K_CMD_OUT      "OUT"
-#define P6K_CMD_PESET    "PESET"
-#define P6K_CMD_PSET     "PSET"
-#define P6K_CMD_S        "S"
-#define P6K_CMD_TAS      "TAS"
-#define P6K_CMD_TIN      "TIN"
-#define P6K_CMD_TLIM     "TLIM"
-#define P6K_CMD_TOUT     "TOUT"
-#define P6K_CMD_TPC      "TPC"
-#define P6K_CMD_TPE      "TPE"
-#define P6K_CMD_TREV     "TREV"
-#define P6K_CMD_TSS      "TSS"
-#define P6K_CMD_V        "V"
+//The controller commands (P6K_CMD_*) are defined in parker6kCommand.h
 
 /**
  * p6kController derives from the virtual class asynMotorController.
@@ -135,12 +163,20 @@ class p6kController : public asynMotorController {
   asynStatus setDeferredMoves(bool deferMoves);
   virtual asynStatus writeOctet(asynUser *pasynUser, const char *value, 
                                     size_t nChars, size_t *nActual);
+  virtual asynStatus readFloat64Array(asynUser *pasynUser, epicsFloat64 *value,
+                                      size_t nElements, size_t *nIn);
+  virtual asynStatus lock(void);
+  virtual asynStatus unlock(void);
   void report(FILE *fp, int level);
   p6kAxis* getAxis(asynUser *pasynUser);
   p6kAxis* getAxis(int axisNo);
   asynStatus poll();
 
   asynStatus upload(const char *filename); 
+  asynStatus setLogFile(const char *filename);
+  asynStatus setQueryTier(const char *query, int tier, double period);
+  void bulkStatusCallback(const char *command, char *input, asynStatus status);
+  void deadlinePoller(void);
 
  protected:
   p6kAxis **pAxes_;       /**< Array of pointers to axis objects */
@@ -175,12 +211,22 @@ class p6kController : public asynMotorController {
   int P6K_A_AutoDriveEnable_;
   int P6K_A_AutoDriveEnableDelay_;
   int P6K_A_DriveRetry_;
+  int P6K_A_DriveState_;
   int P6K_A_ExternalEncoderUse_;
   int P6K_A_ExternalEncoder_;
+  int P6K_A_ExternalEncoderMaxAge_;
+  int P6K_A_ExternalEncoderAge_;
   int P6K_A_ModbusEncoder_;
   int P6K_A_ModbusEncoderAddr_;
   int P6K_A_ModbusEncoderOffset_;
   int P6K_A_ModbusEncoderCheck_;
+  int P6K_A_StopLatency_;
+  int P6K_A_SettleLatency_;
+  int P6K_A_TASX_Bits_;
+  int P6K_A_PredictEnable_;
+  int P6K_A_CruisePollPeriod_;
+  int P6K_A_PredictedTime_;
+  int P6K_A_PredictError_;
   int P6K_C_TSS_SystemReady_;
   int P6K_C_TSS_ProgRunning_;
   int P6K_C_TSS_Immediate_;
@@ -194,6 +240,58 @@ class p6kController : public asynMotorController {
   int P6K_C_OUT_Bit_;
   int P6K_C_OUT_Val_;
   int P6K_C_OUT_All_;
+  int P6K_C_BulkStatus_;
+  int P6K_C_MaxInFlight_;
+  int P6K_C_StatsReset_;
+  int P6K_C_StatsCount_;
+  int P6K_C_StatsBytesOut_;
+  int P6K_C_StatsBytesIn_;
+  int P6K_C_StatsErrors_;
+  int P6K_C_StatsTimeouts_;
+  int P6K_C_StatsRate_;
+  int P6K_C_StatsBuckets_;
+  int P6K_C_StatsRttQuery_;
+  int P6K_C_StatsRttWrite_;
+  int P6K_C_StatsRttImmediate_;
+  int P6K_C_StatsRttOther_;
+  int P6K_C_PollTime_;
+  int P6K_C_PollTimeMax_;
+  int P6K_C_PollHist_;
+  int P6K_C_LockHoldMax_;
+  int P6K_C_LockHist_;
+  int P6K_C_LogDropped_;
+  int P6K_C_TASX_Enable_;
+  int P6K_C_QueryPeriod_[P6K_QUERY_NUM];
+  int P6K_C_QueryTier_[P6K_QUERY_NUM];
+  int P6K_C_QuerySkipped_;
+  int P6K_C_QueryBytesSaved_;
+  int P6K_C_QuerySavedRate_;
+  int P6K_C_AxisSchedule_;
+  int P6K_C_AxisActiveTime_;
+  int P6K_C_AxesPolled_;
+  int P6K_C_PollRate_;
+  int P6K_C_PollMissed_;
+  int P6K_C_PollJitter_;
+  int P6K_C_PollJitterMax_;
+  int P6K_C_JitterHist_;
+  int P6K_C_CommsDown_;
+  int P6K_C_CommsFailLimit_;
+  int P6K_C_CommsOutages_;
+  int P6K_C_ProbeDelay_;
+  int P6K_C_AdaptiveTimeout_;
+  int P6K_C_TimeoutMin_;
+  int P6K_C_TimeoutMax_;
+  int P6K_C_TimeoutSrtt_;
+  int P6K_C_TimeoutRttVar_;
+  int P6K_C_TimeoutRto_;
+  int P6K_C_ReplyMismatch_;
+  int P6K_C_Resyncs_;
+  int P6K_C_ResyncDiscarded_;
+  int P6K_C_CompactFraming_;
+  int P6K_C_PollBytes_;
+  int P6K_C_ModbusPeriod_;
+  int P6K_C_ModbusReadTime_;
+  int P6K_C_ModbusErrors_;
   int P6K_C_LastParam_;
   #define LAST_P6K_PARAM P6K_C_LastParam_
 
@@ -206,16 +304,64 @@ class p6kController : public asynMotorController {
   epicsFloat64 lastTimeSecs_;
   bool printNextError_;
   bool printErrors_;
+  p6kTransport *transport_;
+  p6kLogger *logger_;
+  p6kModbusEncoders *modbus_;
+  char rxBuffer_[P6K_MAXBUF];
+  size_t rxLen_;
+  p6kParser parser_;
+  uint32_t syncCount_;
+  bool bulkStat_;
+  int32_t bulkNumTAS_;
   double movingPollPeriod_;
   double idlePollPeriod_;
+  p6kStats stats_;
+  uint32_t lockDepth_;
+  epicsUInt64 lockStart_;
+  epicsUInt64 pollStart_;
+  epicsUInt64 pollEnd_;
+  epicsUInt64 statsTime_;
+  epicsFloat64 statsCount_;
+  p6kQueryScheduler queries_;
+  epicsFloat64 queryBytesSaved_;
+  int32_t axisPollNext_;
+  epicsThreadId pollerThread_;
+  epicsFloat64 pollCount_;
+  epicsFloat64 statsPollCount_;
+  epicsUInt32 pollMissed_;
+  epicsUInt64 lastPollStart_;
+  epicsUInt64 timerAt_;
+  bool commsDown_;
+  double probeDelay_;
+  epicsUInt64 nextProbe_;
+  epicsUInt32 replyMismatch_;
+  bool compactFraming_;
+  epicsFloat64 statsBytes_;
   asynStatus lowLevelWriteRead(const char *command, char *response);
-  asynStatus trimResponse(char *input, char *output);
-  asynStatus errorResponse(char *input, char *output);
+  asynStatus lowLevelWriteReadImmediate(const char *command, char *response);
+  asynStatus lowLevelWriteReadBatch(const p6kCommandBatch *batch, char *response, int32_t *failed);
+  asynStatus lowLevelQuery(const char *command, const p6kParser **ppResponse);
+  asynStatus checkResponse(const char *command, p6kParser *parser, const char *input, size_t len, bool stat);
   asynStatus lowLevelPortConnect(const char *port, int addr, asynUser **ppasynUser, const char *inputEos, const char *outputEos);
   asynStatus startPoller(void);
   asynStatus setDigitalOutput(epicsInt32 bit, epicsInt32 enable);
   asynStatus setDigitalOutputs(epicsInt32 enable);
   asynStatus getDigital(const char *command, size_t size, uint32_t *bits);
+  asynStatus getBulkStatus(void);
+  bool pollDigital(p6kQueryId id, int param, epicsUInt64 now, bool moving);
+  asynStatus getTASX(void);
+  bool anyAxisMoving(void);
+  bool commandedSince(epicsUInt64 time);
+  int32_t scheduleAxisPolls(void);
+  void pollAt(epicsUInt64 time);
+  size_t lastQueryBytes(const char *command);
+  void invalidateShadows(void);
+  void invalidateBulkStatus(void);
+  asynStatus pollCommsDown(void);
+  asynStatus resync(void);
+  asynStatus setFraming(bool compact);
+  int32_t getStatsArray(int function, epicsFloat64 *value, size_t nElements);
+  void publishStats(bool force);
 
   //static class data members
 
@@ -227,10 +373,20 @@ class p6kController : public asynMotorController {
   static const epicsUInt32 P6K_ERROR_;
   static const epicsUInt32 P6K_ERROR_PRINT_TIME_;
   static const epicsUInt32 P6K_MAX_DIGITS_;
+  static const epicsFloat64 P6K_STATS_PERIOD_;
+  static const epicsFloat64 P6K_AXIS_ACTIVE_TIME_;
+  static const epicsFloat64 P6K_END_POLL_PERIOD_;
+  static const epicsUInt32 P6K_BULK_MIN_AXES_;
+  static const epicsFloat64 P6K_PROBE_MIN_DELAY_;
+  static const epicsFloat64 P6K_PROBE_MAX_DELAY_;
 
   static const char * P6K_ASYN_IEOS_;
-  static const char * P6K_ASYN_IEOS_PROG_;
   static const char * P6K_ASYN_OEOS_;
+  static const char * P6K_EOT_DEFAULT_;
+  static const char * P6K_EOT_COMPACT_;
+  static const char * P6K_EOL_DEFAULT_;
+  static const char * P6K_EOL_COMPACT_;
+
 
   static const char P6K_ON_;
   static const char P6K_OFF_;
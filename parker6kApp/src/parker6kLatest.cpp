@@ -0,0 +1,82 @@
+/********************************************
+ *  parker6kLatest.cpp
+ *
+ *  Lock free latest value slot, used to pass
+ *  external encoder positions to the poller.
+ *
+ ********************************************/
+
+#include <epicsAtomic.h>
+#include <epicsTime.h>
+#include <epicsThread.h>
+
+#include "parker6kLatest.h"
+
+p6kLatest::p6kLatest()
+{
+  sequence_ = 0;
+  value_ = 0;
+  time_ = 0;
+}
+
+/**
+ * Store a new value, timestamped now.
+ * @param value The value
+ */
+void p6kLatest::write(epicsInt32 value)
+{
+  epicsUInt64 now = epicsMonotonicGet();
+
+  epicsAtomicIncrIntT(&sequence_);
+  epicsAtomicWriteMemoryBarrier();
+  value_ = value;
+  time_ = (now != 0) ? now : 1;
+  epicsAtomicWriteMemoryBarrier();
+  epicsAtomicIncrIntT(&sequence_);
+}
+
+/**
+ * Copy the latest value and the time it was written.
+ * @param value The value
+ * @param time Monotonic time of the write (ns)
+ * @return false if nothing has been written since construction or clear()
+ */
+bool p6kLatest::read(epicsInt32 *value, epicsUInt64 *time) const
+{
+  int before = 0;
+  int after = 0;
+  epicsInt32 readValue = 0;
+  epicsUInt64 readTime = 0;
+
+  for (;;) {
+    before = epicsAtomicGetIntT(&sequence_);
+    if ((before & 1) == 0) {
+      epicsAtomicReadMemoryBarrier();
+      readValue = value_;
+      readTime = time_;
+      epicsAtomicReadMemoryBarrier();
+      after = epicsAtomicGetIntT(&sequence_);
+      if (after == before) {
+        break;
+      }
+    }
+    //The writer only stores two values, so this is rarely needed
+    epicsThreadSleep(0.0);
+  }
+
+  *value = readValue;
+  *time = readTime;
+  return (readTime != 0);
+}
+
+/**
+ * Forget the value, so that read() returns false until the next write.
+ */
+void p6kLatest::clear(void)
+{
+  epicsAtomicIncrIntT(&sequence_);
+  epicsAtomicWriteMemoryBarrier();
+  time_ = 0;
+  epicsAtomicWriteMemoryBarrier();
+  epicsAtomicIncrIntT(&sequence_);
+}
@@ -0,0 +1,39 @@
+/********************************************
+ *  parker6kLatest.h
+ *
+ *  Lock free latest value slot, used to pass
+ *  external encoder positions to the poller.
+ *
+ ********************************************/
+
+#ifndef parker6kLatest_H
+#define parker6kLatest_H
+
+#include "stdint.h"
+
+#include <epicsTypes.h>
+
+/**
+ * p6kLatest holds the most recent value written to it, with the monotonic
+ * time it was written. It is a sequence lock: the writer makes the sequence
+ * number odd, stores the value and time, then makes it even again. A reader
+ * copies the value and time and retries if the sequence number was odd or
+ * changed while it was copying, so it never sees a half written pair and
+ * never blocks the writer. There must only be one writer at a time.
+ */
+class p6kLatest {
+
+ public:
+  p6kLatest();
+
+  void write(epicsInt32 value);
+  bool read(epicsInt32 *value, epicsUInt64 *time) const;
+  void clear(void);
+
+ private:
+  int sequence_;
+  epicsInt32 value_;
+  epicsUInt64 time_;    //Monotonic time of the last write (ns), or 0 if never written
+};
+
+#endif /* parker6kLatest_H */
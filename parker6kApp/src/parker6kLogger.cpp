@@ -0,0 +1,242 @@
+/********************************************
+ *  parker6kLogger.cpp
+ *
+ *  Comms logger for the P6K driver, using a
+ *  lock free ring buffer and a drain thread.
+ *
+ ********************************************/
+
+#include <string.h>
+
+#include <epicsAtomic.h>
+#include <epicsStdio.h>
+
+#include "parker6kLogger.h"
+#include "parker6kParser.h"
+
+//How often the drain thread empties the ring (seconds)
+const double p6kLogger::P6K_LOG_PERIOD_ = 0.1;
+
+/**
+ * C function wrapper for the drain thread.
+ */
+static void p6kLoggerTaskC(void *pPvt)
+{
+  p6kLogger *pLogger = static_cast<p6kLogger *>(pPvt);
+  pLogger->drainTask();
+}
+
+/**
+ * p6kLogger constructor. Logging is disabled, and the drain thread
+ * is started the first time it is enabled.
+ * @param name The controller port name, printed with each record.
+ */
+p6kLogger::p6kLogger(const char *name)
+{
+  epicsSnprintf(name_, sizeof(name_), "%s", name);
+  head_ = 0;
+  tail_ = 0;
+  dropped_ = 0;
+  enabled_ = 0;
+  thread_ = NULL;
+  file_ = NULL;
+  fileLock_ = epicsMutexMustCreate();
+}
+
+p6kLogger::~p6kLogger()
+{
+  //The drain thread runs for the life of the IOC, like the comms thread,
+  //so we don't destroy anything it might be using.
+}
+
+/**
+ * Add a transaction to the ring. This is called by the comms thread, and
+ * only copies the data, so it does not add any noticeable time to a transaction.
+ * @param command The command that was sent
+ * @param response The raw response
+ * @param responseLen The number of characters in the response
+ * @param status The status of the transaction
+ */
+void p6kLogger::log(const char *command, const char *response, size_t responseLen, asynStatus status)
+{
+  if (!epicsAtomicGetIntT(&enabled_)) {
+    return;
+  }
+
+  //head_ is only written by this thread, so it doesn't need an atomic read
+  size_t head = head_;
+  if ((head - epicsAtomicGetSizeT(&tail_)) >= P6K_LOG_RINGSIZE) {
+    epicsAtomicIncrSizeT(&dropped_);
+    return;
+  }
+
+  p6kLogRecord *record = &ring_[head & (P6K_LOG_RINGSIZE-1)];
+  epicsTimeGetCurrent(&record->time);
+  record->status = status;
+
+  record->commandLen = strlen(command);
+  if (record->commandLen > sizeof(record->command)) {
+    record->commandLen = sizeof(record->command);
+  }
+  memcpy(record->command, command, record->commandLen);
+
+  record->responseLen = responseLen;
+  if (record->responseLen > sizeof(record->response)) {
+    record->responseLen = sizeof(record->response);
+  }
+  memcpy(record->response, response, record->responseLen);
+
+  //Publish the record to the drain thread
+  epicsAtomicSetSizeT(&head_, head+1);
+}
+
+/**
+ * Turn logging on or off. The drain thread is started the first time.
+ */
+void p6kLogger::setEnabled(bool enabled)
+{
+  if ((enabled) && (thread_ == NULL)) {
+    if (start() != asynSuccess) {
+      return;
+    }
+  }
+  epicsAtomicSetIntT(&enabled_, enabled ? 1 : 0);
+}
+
+/**
+ * @return true if logging is on
+ */
+bool p6kLogger::getEnabled(void)
+{
+  return (epicsAtomicGetIntT(&enabled_) != 0);
+}
+
+/**
+ * Send the log to a file instead of the console.
+ * @param filename The file to append to, or an empty string for the console.
+ * @return asynStatus. asynError if the file could not be opened.
+ */
+asynStatus p6kLogger::setFile(const char *filename)
+{
+  asynStatus status = asynSuccess;
+  FILE *file = NULL;
+
+  if ((filename != NULL) && (filename[0] != '\0')) {
+    file = fopen(filename, "a");
+    if (file == NULL) {
+      printf("p6kLogger::setFile: ERROR: Could not open %s. Logging to the console.\n", filename);
+      status = asynError;
+    }
+  }
+
+  epicsMutexMustLock(fileLock_);
+  if (file_ != NULL) {
+    fclose(file_);
+  }
+  file_ = file;
+  epicsMutexUnlock(fileLock_);
+
+  return status;
+}
+
+/**
+ * @return The number of records that were dropped because the ring was full.
+ */
+size_t p6kLogger::getDropped(void)
+{
+  return epicsAtomicGetSizeT(&dropped_);
+}
+
+/**
+ * The drain thread. This wakes up every P6K_LOG_PERIOD_ and writes out
+ * all the records in the ring.
+ */
+void p6kLogger::drainTask(void)
+{
+  size_t reported = 0;
+
+  while (true) {
+    epicsThreadSleep(P6K_LOG_PERIOD_);
+    drain();
+
+    size_t dropped = getDropped();
+    if (dropped != reported) {
+      epicsMutexMustLock(fileLock_);
+      FILE *fp = (file_ != NULL) ? file_ : stdout;
+      fprintf(fp, "%s: %lu log records dropped\n", name_, static_cast<unsigned long>(dropped - reported));
+      fflush(fp);
+      epicsMutexUnlock(fileLock_);
+      reported = dropped;
+    }
+  }
+}
+
+/**
+ * Start the drain thread.
+ * @return asynStatus
+ */
+asynStatus p6kLogger::start(void)
+{
+  char threadName[P6K_LOG_NAME_MAXBUF] = {0};
+
+  epicsSnprintf(threadName, sizeof(threadName), "%sLog", name_);
+  thread_ = epicsThreadCreate(threadName, epicsThreadPriorityLow,
+                              epicsThreadGetStackSize(epicsThreadStackMedium),
+                              (EPICSTHREADFUNC)p6kLoggerTaskC, this);
+  if (thread_ == NULL) {
+    printf("p6kLogger::start: ERROR: Failed to create log thread for %s\n", name_);
+    return asynError;
+  }
+
+  return asynSuccess;
+}
+
+/**
+ * Write out all the records that are in the ring.
+ */
+void p6kLogger::drain(void)
+{
+  //tail_ is only written by this thread
+  size_t tail = tail_;
+  const size_t head = epicsAtomicGetSizeT(&head_);
+
+  if (tail == head) {
+    return;
+  }
+
+  epicsMutexMustLock(fileLock_);
+  while (tail != head) {
+    write(&ring_[tail & (P6K_LOG_RINGSIZE-1)]);
+    ++tail;
+    //Give the slot back to the producer
+    epicsAtomicSetSizeT(&tail_, tail);
+  }
+  fflush((file_ != NULL) ? file_ : stdout);
+  epicsMutexUnlock(fileLock_);
+}
+
+/**
+ * Format one record. Must be called with fileLock_ held.
+ * The response is printed the same way as the old console log, with the
+ * header and trailer removed, and error replies are marked with a ?.
+ */
+void p6kLogger::write(const p6kLogRecord *record)
+{
+  FILE *fp = (file_ != NULL) ? file_ : stdout;
+  char timeStr[40] = {0};
+  p6kParser parser;
+
+  epicsTimeToStrftime(timeStr, sizeof(timeStr), "%Y/%m/%d %H:%M:%S.%06f", &record->time);
+  fprintf(fp, "%s %s > %.*s\n", timeStr, name_,
+          static_cast<int>(record->commandLen), record->command);
+
+  if (record->status != asynSuccess) {
+    fprintf(fp, "%s %s < (no response, status %d)\n", timeStr, name_, record->status);
+    return;
+  }
+
+  parser.parse(record->response, record->responseLen);
+  p6kView body = parser.getBody();
+  fprintf(fp, "%s %s %c %.*s\n", timeStr, name_, parser.isError() ? '?' : '<',
+          static_cast<int>(body.len), body.data);
+}
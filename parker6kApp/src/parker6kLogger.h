@@ -0,0 +1,81 @@
+/********************************************
+ *  parker6kLogger.h
+ *
+ *  Comms logger for the P6K driver, using a
+ *  lock free ring buffer and a drain thread.
+ *
+ ********************************************/
+
+#ifndef parker6kLogger_H
+#define parker6kLogger_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "stdint.h"
+
+#include <epicsTypes.h>
+#include <epicsTime.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+
+#include "asynDriver.h"
+
+//Number of records in the ring. This must be a power of 2.
+#define P6K_LOG_RINGSIZE 256
+#define P6K_LOG_COMMAND_MAXBUF 128
+#define P6K_LOG_RESPONSE_MAXBUF 256
+#define P6K_LOG_NAME_MAXBUF 64
+
+/**
+ * One logged transaction. The response is raw, as read by p6kTransport.
+ */
+struct p6kLogRecord {
+  epicsTimeStamp time;
+  asynStatus status;
+  size_t commandLen;
+  size_t responseLen;
+  char command[P6K_LOG_COMMAND_MAXBUF];
+  char response[P6K_LOG_RESPONSE_MAXBUF];
+};
+
+/**
+ * p6kLogger records the commands sent to the controller and the responses,
+ * without doing any formatting or I/O on the thread that sends them.
+ * Records are copied into a ring buffer by a single producer (the p6kTransport
+ * comms thread) and a drain thread formats them to the console or a file.
+ * The ring indexes are only written by one thread each, using epicsAtomic,
+ * so the producer never blocks. If the ring is full the record is dropped
+ * and counted, and the drain thread reports how many were lost.
+ */
+class p6kLogger {
+
+ public:
+  p6kLogger(const char *name);
+  virtual ~p6kLogger();
+
+  void log(const char *command, const char *response, size_t responseLen, asynStatus status);
+  void setEnabled(bool enabled);
+  bool getEnabled(void);
+  asynStatus setFile(const char *filename);
+  size_t getDropped(void);
+  void drainTask(void);
+
+ private:
+  char name_[P6K_LOG_NAME_MAXBUF];
+  p6kLogRecord ring_[P6K_LOG_RINGSIZE];
+  size_t head_;      //Next record to write. Only written by the producer.
+  size_t tail_;      //Next record to read. Only written by the drain thread.
+  size_t dropped_;
+  int enabled_;
+  epicsThreadId thread_;
+  epicsMutexId fileLock_;
+  FILE *file_;
+
+  asynStatus start(void);
+  void drain(void);
+  void write(const p6kLogRecord *record);
+
+  static const double P6K_LOG_PERIOD_;
+};
+
+#endif /* parker6kLogger_H */
@@ -0,0 +1,379 @@
+/********************************************
+ *  parker6kModbus.cpp
+ *
+ *  Reads the encoder positions of all the
+ *  Modbus encoder axes on one thread, in as
+ *  few block reads as possible.
+ *
+ ********************************************/
+
+#include <string.h>
+
+#include <epicsTime.h>
+#include <epicsStdio.h>
+
+#include "asynInt32ArraySyncIO.h"
+
+#include "parker6kModbus.h"
+
+//Default time between reads (seconds)
+const double p6kModbusEncoders::P6K_MODBUS_PERIOD_ = 0.1;
+//Timeout for each block read (seconds)
+const double p6kModbusEncoders::P6K_MODBUS_TIMEOUT_ = 1.0;
+//A position older than this many periods (plus the timeout) is stale
+const double p6kModbusEncoders::P6K_MODBUS_STALE_PERIODS_ = 5.0;
+
+/**
+ * C function wrapper for the read thread.
+ */
+static void p6kModbusTaskC(void *pPvt)
+{
+  p6kModbusEncoders *pEncoders = static_cast<p6kModbusEncoders *>(pPvt);
+  pEncoders->pollTask();
+}
+
+/**
+ * p6kModbusEncoders constructor. The read thread is started
+ * when the first encoder is added.
+ * @param name The controller port name, used to name the thread.
+ */
+p6kModbusEncoders::p6kModbusEncoders(const char *name)
+{
+  epicsSnprintf(name_, sizeof(name_), "%s", name);
+  lock_ = epicsMutexMustCreate();
+  thread_ = NULL;
+  period_ = P6K_MODBUS_PERIOD_;
+  readTime_ = 0.0;
+  errors_ = 0;
+  numBlocks_ = 0;
+  numEncoders_ = 0;
+  memset(blocks_, 0, sizeof(blocks_));
+  memset(encoders_, 0, sizeof(encoders_));
+}
+
+p6kModbusEncoders::~p6kModbusEncoders()
+{
+  //The read thread runs for the life of the IOC, like the comms thread,
+  //so we don't destroy anything it might be using.
+}
+
+/**
+ * Add an encoder. It goes into an existing block on the same Modbus port
+ * if the block would still be no more than P6K_MODBUS_MAX_REGISTERS long.
+ * @param axis The axis number
+ * @param port The Modbus asyn port
+ * @param addr The first register of the count (the asyn address on the Modbus port)
+ * @param words 2 for a 32 bit count, or 4 for a 64 bit count
+ * @return asynStatus
+ */
+asynStatus p6kModbusEncoders::add(int32_t axis, const char *port, int32_t addr, int32_t words)
+{
+  int32_t block = 0;
+  asynStatus status = asynSuccess;
+
+  if (((words != 2) && (words != 4)) || (addr < 0)) {
+    printf("p6kModbusEncoders::add: ERROR: %s axis %d. Counts must be 2 or 4 registers.\n", name_, axis);
+    return asynError;
+  }
+
+  epicsMutexMustLock(lock_);
+
+  if (numEncoders_ >= P6K_MODBUS_MAX_ENCODERS) {
+    epicsMutexUnlock(lock_);
+    printf("p6kModbusEncoders::add: ERROR: %s has too many Modbus encoders.\n", name_);
+    return asynError;
+  }
+
+  for (block=0; block<numBlocks_; ++block) {
+    p6kModbusBlock *pBlock = &blocks_[block];
+    if (strcmp(pBlock->port, port) != 0) {
+      continue;
+    }
+    int32_t start = (addr < pBlock->start) ? addr : pBlock->start;
+    int32_t end = pBlock->start + pBlock->count;
+    if ((addr + words) > end) {
+      end = addr + words;
+    }
+    if ((end - start) <= P6K_MODBUS_MAX_REGISTERS) {
+      if ((start != pBlock->start) || ((end - start) != pBlock->count)) {
+        pBlock->start = start;
+        pBlock->count = end - start;
+        pBlock->changed = true;
+      }
+      break;
+    }
+  }
+
+  if (block == numBlocks_) {
+    if (numBlocks_ >= P6K_MODBUS_MAX_BLOCKS) {
+      epicsMutexUnlock(lock_);
+      printf("p6kModbusEncoders::add: ERROR: %s has too many Modbus blocks.\n", name_);
+      return asynError;
+    }
+    p6kModbusBlock *pBlock = &blocks_[numBlocks_++];
+    epicsSnprintf(pBlock->port, sizeof(pBlock->port), "%s", port);
+    pBlock->start = addr;
+    pBlock->count = words;
+    pBlock->changed = true;
+    pBlock->pasynUser = NULL;
+  }
+
+  p6kModbusEncoder *pEncoder = &encoders_[numEncoders_++];
+  pEncoder->axis = axis;
+  pEncoder->block = block;
+  pEncoder->addr = addr;
+  pEncoder->words = words;
+  pEncoder->value = 0;
+  pEncoder->time = 0;
+  pEncoder->status = asynDisconnected;
+
+  if (thread_ == NULL) {
+    status = start();
+  }
+
+  epicsMutexUnlock(lock_);
+
+  return status;
+}
+
+/**
+ * Get the cached position of an axis. This never waits for Modbus.
+ * @param axis The axis number
+ * @param value The count from the last good read
+ * @param time Monotonic time of the last good read (ns), or 0 if there has not been one
+ * @return The status of the last read, or asynTimeout if the position is stale
+ */
+asynStatus p6kModbusEncoders::get(int32_t axis, epicsInt64 *value, epicsUInt64 *time)
+{
+  asynStatus status = asynError;
+
+  epicsMutexMustLock(lock_);
+  for (int32_t i=0; i<numEncoders_; ++i) {
+    if (encoders_[i].axis == axis) {
+      *value = encoders_[i].value;
+      *time = encoders_[i].time;
+      status = encoders_[i].status;
+      double maxAge = (P6K_MODBUS_STALE_PERIODS_ * period_) + P6K_MODBUS_TIMEOUT_;
+      if ((status == asynSuccess) && ((epicsMonotonicGet() - encoders_[i].time) / 1.0e9 > maxAge)) {
+        status = asynTimeout;
+      }
+      break;
+    }
+  }
+  epicsMutexUnlock(lock_);
+
+  return status;
+}
+
+/**
+ * Set the time between reads.
+ * @param period The period (seconds). This is at least 0.01.
+ */
+void p6kModbusEncoders::setPeriod(double period)
+{
+  epicsMutexMustLock(lock_);
+  period_ = (period >= 0.01) ? period : 0.01;
+  epicsMutexUnlock(lock_);
+}
+
+double p6kModbusEncoders::getPeriod(void)
+{
+  double value = 0.0;
+
+  epicsMutexMustLock(lock_);
+  value = period_;
+  epicsMutexUnlock(lock_);
+
+  return value;
+}
+
+/**
+ * @return The time taken to read all the blocks last time (seconds)
+ */
+double p6kModbusEncoders::getReadTime(void)
+{
+  double value = 0.0;
+
+  epicsMutexMustLock(lock_);
+  value = readTime_;
+  epicsMutexUnlock(lock_);
+
+  return value;
+}
+
+/**
+ * @return The number of block reads that failed
+ */
+epicsFloat64 p6kModbusEncoders::getErrors(void)
+{
+  epicsFloat64 value = 0;
+
+  epicsMutexMustLock(lock_);
+  value = errors_;
+  epicsMutexUnlock(lock_);
+
+  return value;
+}
+
+/**
+ * Print the blocks and the cached positions.
+ */
+void p6kModbusEncoders::report(FILE *fp)
+{
+  epicsMutexMustLock(lock_);
+  if (numEncoders_ > 0) {
+    fprintf(fp, "  Modbus encoders, period %.3f s, last read %.3f ms, %.0f errors\n",
+            period_, readTime_ * 1000.0, errors_);
+    for (int32_t i=0; i<numBlocks_; ++i) {
+      fprintf(fp, "    block %d: port %s, registers %d to %d\n", i, blocks_[i].port,
+              blocks_[i].start, blocks_[i].start + blocks_[i].count - 1);
+    }
+    for (int32_t i=0; i<numEncoders_; ++i) {
+      fprintf(fp, "    axis %d: block %d, register %d, %d bit, value %lld, status %d\n",
+              encoders_[i].axis, encoders_[i].block, encoders_[i].addr, encoders_[i].words * 16,
+              static_cast<long long>(encoders_[i].value), encoders_[i].status);
+    }
+  }
+  epicsMutexUnlock(lock_);
+}
+
+/**
+ * The read thread. This reads every block once per period.
+ */
+void p6kModbusEncoders::pollTask(void)
+{
+  epicsUInt64 start = 0;
+  double elapsed = 0.0;
+  int32_t numBlocks = 0;
+
+  while (true) {
+    start = epicsMonotonicGet();
+
+    epicsMutexMustLock(lock_);
+    numBlocks = numBlocks_;
+    epicsMutexUnlock(lock_);
+
+    for (int32_t block=0; block<numBlocks; ++block) {
+      readBlock(block);
+    }
+
+    elapsed = (epicsMonotonicGet() - start) / 1.0e9;
+    epicsMutexMustLock(lock_);
+    readTime_ = elapsed;
+    double delay = period_ - elapsed;
+    epicsMutexUnlock(lock_);
+
+    epicsThreadSleep((delay > 0.0) ? delay : 0.0);
+  }
+}
+
+/**
+ * Start the read thread. Must be called with lock_ held.
+ * @return asynStatus
+ */
+asynStatus p6kModbusEncoders::start(void)
+{
+  char threadName[P6K_MODBUS_NAME_MAXBUF] = {0};
+
+  epicsSnprintf(threadName, sizeof(threadName), "%sModbus", name_);
+  thread_ = epicsThreadCreate(threadName, epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackMedium),
+                              (EPICSTHREADFUNC)p6kModbusTaskC, this);
+  if (thread_ == NULL) {
+    printf("p6kModbusEncoders::start: ERROR: Failed to create Modbus thread for %s\n", name_);
+    return asynError;
+  }
+
+  return asynSuccess;
+}
+
+/**
+ * Read one block and update the encoders in it. This is only called by the
+ * read thread, which is the only user of the block's asynUser, so the lock is
+ * not held during the read.
+ * @param block The block number
+ */
+void p6kModbusEncoders::readBlock(int32_t block)
+{
+  epicsInt32 registers[P6K_MODBUS_MAX_REGISTERS];
+  char port[P6K_MODBUS_NAME_MAXBUF] = {0};
+  p6kModbusBlock *pBlock = &blocks_[block];
+  size_t nread = 0;
+  int32_t start = 0;
+  int32_t count = 0;
+  bool changed = false;
+  asynStatus status = asynSuccess;
+
+  epicsMutexMustLock(lock_);
+  memcpy(port, pBlock->port, sizeof(port));
+  start = pBlock->start;
+  count = pBlock->count;
+  changed = pBlock->changed;
+  pBlock->changed = false;
+  epicsMutexUnlock(lock_);
+
+  //The asyn address is the first register, so connect again if that has moved
+  if ((changed) || (pBlock->pasynUser == NULL)) {
+    if (pBlock->pasynUser != NULL) {
+      pasynInt32ArraySyncIO->disconnect(pBlock->pasynUser);
+      pBlock->pasynUser = NULL;
+    }
+    status = pasynInt32ArraySyncIO->connect(port, start, &pBlock->pasynUser, "UINT16");
+    if ((status != asynSuccess) || (pBlock->pasynUser == NULL)) {
+      pBlock->pasynUser = NULL;
+      status = asynDisconnected;
+    }
+  }
+
+  if (status == asynSuccess) {
+    status = pasynInt32ArraySyncIO->read(pBlock->pasynUser, registers, count, &nread, P6K_MODBUS_TIMEOUT_);
+  }
+  if ((status == asynSuccess) && (nread < static_cast<size_t>(count))) {
+    status = asynError;
+  }
+
+  decode(block, start, registers, count, status);
+}
+
+/**
+ * Update the cached positions of the encoders in a block.
+ * @param block The block number
+ * @param start The first register that was read
+ * @param registers The registers that were read
+ * @param count The number of registers
+ * @param status The status of the read
+ */
+void p6kModbusEncoders::decode(int32_t block, int32_t start, const epicsInt32 *registers, int32_t count, asynStatus status)
+{
+  epicsUInt64 now = epicsMonotonicGet();
+
+  epicsMutexMustLock(lock_);
+  if (status != asynSuccess) {
+    errors_ += 1;
+  }
+  for (int32_t i=0; i<numEncoders_; ++i) {
+    p6kModbusEncoder *pEncoder = &encoders_[i];
+    if (pEncoder->block != block) {
+      continue;
+    }
+    int32_t offset = pEncoder->addr - start;
+    if ((status != asynSuccess) || (offset < 0) || ((offset + pEncoder->words) > count)) {
+      //The block may have grown since it was read. It is read again next period.
+      pEncoder->status = (status != asynSuccess) ? status : pEncoder->status;
+      continue;
+    }
+    //Most significant word first
+    epicsUInt64 raw = 0;
+    for (int32_t word=0; word<pEncoder->words; ++word) {
+      raw = (raw << 16) | (static_cast<epicsUInt32>(registers[offset + word]) & 0xFFFFU);
+    }
+    if (pEncoder->words == 2) {
+      pEncoder->value = static_cast<epicsInt32>(static_cast<epicsUInt32>(raw));
+    } else {
+      pEncoder->value = static_cast<epicsInt64>(raw);
+    }
+    pEncoder->time = now;
+    pEncoder->status = asynSuccess;
+  }
+  epicsMutexUnlock(lock_);
+}
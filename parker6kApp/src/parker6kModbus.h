@@ -0,0 +1,98 @@
+/********************************************
+ *  parker6kModbus.h
+ *
+ *  Reads the encoder positions of all the
+ *  Modbus encoder axes on one thread, in as
+ *  few block reads as possible.
+ *
+ ********************************************/
+
+#ifndef parker6kModbus_H
+#define parker6kModbus_H
+
+#include <stdio.h>
+#include "stdint.h"
+
+#include <epicsTypes.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+
+#include "asynDriver.h"
+
+#define P6K_MODBUS_MAX_ENCODERS 32
+#define P6K_MODBUS_MAX_BLOCKS 8
+#define P6K_MODBUS_NAME_MAXBUF 64
+//The most registers a Modbus read holding registers request can return
+#define P6K_MODBUS_MAX_REGISTERS 125
+
+/**
+ * One contiguous range of registers on a Modbus port, read in one transaction.
+ */
+struct p6kModbusBlock {
+  char port[P6K_MODBUS_NAME_MAXBUF];
+  int32_t start;          //First register (the asyn address on the Modbus port)
+  int32_t count;          //Number of registers
+  bool changed;           //The range has changed, so the thread must connect again
+  asynUser *pasynUser;    //Only used by the thread
+};
+
+/**
+ * The cached position of one encoder.
+ */
+struct p6kModbusEncoder {
+  int32_t axis;
+  int32_t block;
+  int32_t addr;           //First register of the count
+  int32_t words;          //2 for a 32 bit count, 4 for a 64 bit count
+  epicsInt64 value;
+  epicsUInt64 time;       //Monotonic time of the last good read (ns), or 0
+  asynStatus status;      //Status of the last read
+};
+
+/**
+ * p6kModbusEncoders reads the encoder counts for all the axes created with
+ * p6kCreateModbusEncAxis on one controller. The registers on each Modbus port
+ * are grouped into blocks of up to P6K_MODBUS_MAX_REGISTERS, and each block is
+ * read with one asynInt32Array read (drvInfo UINT16) from a separate thread,
+ * once per period. Counts are 2 or 4 registers, most significant word first,
+ * the same as the INT32_BE and INT64_BE formats in the Modbus driver.
+ * The positions are kept in a timestamped cache, so the poller only has to copy
+ * them and never waits for Modbus. The cache is protected by an internal mutex.
+ */
+class p6kModbusEncoders {
+
+ public:
+  p6kModbusEncoders(const char *name);
+  virtual ~p6kModbusEncoders();
+
+  asynStatus add(int32_t axis, const char *port, int32_t addr, int32_t words);
+  asynStatus get(int32_t axis, epicsInt64 *value, epicsUInt64 *time);
+  void setPeriod(double period);
+  double getPeriod(void);
+  double getReadTime(void);
+  epicsFloat64 getErrors(void);
+  void report(FILE *fp);
+  void pollTask(void);
+
+ private:
+  char name_[P6K_MODBUS_NAME_MAXBUF];
+  epicsMutexId lock_;
+  epicsThreadId thread_;
+  double period_;
+  double readTime_;       //Time taken to read all the blocks last time (s)
+  epicsFloat64 errors_;
+  int32_t numBlocks_;
+  int32_t numEncoders_;
+  p6kModbusBlock blocks_[P6K_MODBUS_MAX_BLOCKS];
+  p6kModbusEncoder encoders_[P6K_MODBUS_MAX_ENCODERS];
+
+  asynStatus start(void);
+  void readBlock(int32_t block);
+  void decode(int32_t block, int32_t start, const epicsInt32 *registers, int32_t count, asynStatus status);
+
+  static const double P6K_MODBUS_PERIOD_;
+  static const double P6K_MODBUS_TIMEOUT_;
+  static const double P6K_MODBUS_STALE_PERIODS_;
+};
+
+#endif /* parker6kModbus_H */
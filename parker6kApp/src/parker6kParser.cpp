@@ -0,0 +1,482 @@
+/********************************************
+ *  parker6kParser.cpp
+ *
+ *  Single pass parser for P6K responses.
+ *
+ ********************************************/
+
+#include <string.h>
+
+#include "parker6kParser.h"
+
+/**
+ * p6kParser constructor. The body is empty until parse is called.
+ */
+p6kParser::p6kParser()
+{
+  body_.data = "";
+  body_.len = 0;
+  error_ = false;
+  trailer_ = false;
+}
+
+/**
+ * Find the body of a response. The body starts after the first '*' and
+ * ends at the trailer, which is the first \r or \n. By default the P6K ends
+ * a response with \r\r\n, and with compact framing (EOT0,0,0 and EOL13,0,0) with
+ * a single \r. If there is a '?' after the '*' the response is an error, and the
+ * body is the error message.
+ * @param buffer The receive buffer. This is not modified, and must stay valid
+ *        while the parser is in use.
+ * @param len The number of characters in the buffer
+ * @return asynStatus. asynError if the trailer was not found.
+ */
+asynStatus p6kParser::parse(const char *buffer, size_t len)
+{
+  size_t header = len;
+  size_t question = len;
+  size_t trailer = len;
+
+  //Record the position of the first header, error prompt and trailer
+  for (size_t i=0; i<len; ++i) {
+    const char c = buffer[i];
+    if (c == '*') {
+      if (header == len) {
+        header = i;
+      }
+    } else if (c == '?') {
+      if (question == len) {
+        question = i;
+      }
+    } else if ((c == '\r') || (c == '\n')) {
+      if (trailer == len) {
+        trailer = i;
+      }
+    }
+  }
+
+  size_t end = len;
+  error_ = ((question < len) && (header < question));
+  if (error_) {
+    end = question;
+  }
+  trailer_ = (trailer < end);
+  if (trailer_) {
+    end = trailer;
+  }
+
+  if (header < end) {
+    body_.data = buffer + header + 1;
+    body_.len = end - header - 1;
+  } else {
+    body_.data = buffer + end;
+    body_.len = 0;
+  }
+
+  if (!trailer_) {
+    return asynError;
+  }
+
+  return asynSuccess;
+}
+
+/**
+ * @return true if the response was an error message
+ */
+bool p6kParser::isError(void) const
+{
+  return error_;
+}
+
+/**
+ * @return true if the response had a \r\n trailer
+ */
+bool p6kParser::hasTrailer(void) const
+{
+  return trailer_;
+}
+
+/**
+ * @return A view of the response body (or error message)
+ */
+p6kView p6kParser::getBody(void) const
+{
+  return body_;
+}
+
+/**
+ * Copy the response body into a null terminated string.
+ * @param output The buffer to copy into
+ * @param maxChars The size of the output buffer
+ * @return The number of characters copied
+ */
+size_t p6kParser::copyBody(char *output, size_t maxChars) const
+{
+  size_t len = body_.len;
+
+  if (maxChars == 0) {
+    return 0;
+  }
+  if (len > maxChars-1) {
+    len = maxChars-1;
+  }
+  memcpy(output, body_.data, len);
+  output[len] = '\0';
+
+  return len;
+}
+
+/**
+ * Check that the response is the reply to a command. The P6K starts the
+ * reply to a query with the axis number and command name (eg. *1TPC+100
+ * for 1TPC), so a reply to a different command or axis can be detected.
+ * Responses without a body (eg. to 1V2.0), error messages and batches
+ * (which have a body for each command) are not checked.
+ * @param command The command that was sent
+ * @return false if the body starts with a different axis or command name.
+ */
+bool p6kParser::matches(const char *command) const
+{
+  const char *cmd = command;
+  const char *pos = body_.data;
+  const char *end = body_.data + body_.len;
+  size_t len = 0;
+
+  if ((body_.len == 0) || (error_) || (strchr(command, ':') != NULL)) {
+    return true;
+  }
+
+  while ((*cmd == '!') || (*cmd == ' ')) {
+    ++cmd;
+  }
+  while ((cmd[len] >= '0') && (cmd[len] <= '9')) {
+    ++len;
+  }
+  while (((cmd[len] >= 'A') && (cmd[len] <= 'Z')) || ((cmd[len] >= 'a') && (cmd[len] <= 'z'))) {
+    ++len;
+  }
+
+  while ((pos < end) && (*pos == ' ')) {
+    ++pos;
+  }
+  if ((static_cast<size_t>(end-pos) < len) || (strncmp(pos, cmd, len) != 0)) {
+    return false;
+  }
+
+  //The command name must not carry on (eg. a TASX reply to TAS)
+  pos += len;
+  if ((pos < end) && (((*pos >= 'A') && (*pos <= 'Z')) || ((*pos >= 'a') && (*pos <= 'z')))) {
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Read an integer response, for example 1TPC+100.
+ * @param cmd The command name that prefixes the value (eg. TPC)
+ * @param value The value read
+ * @return asynStatus
+ */
+asynStatus p6kParser::getInt(const char *cmd, epicsInt32 *value) const
+{
+  return toInt(getValue(cmd), value);
+}
+
+/**
+ * Read a floating point response, for example 1V+2.0000.
+ * @param cmd The command name that prefixes the value (eg. V)
+ * @param value The value read
+ * @return asynStatus
+ */
+asynStatus p6kParser::getDouble(const char *cmd, double *value) const
+{
+  return toDouble(getValue(cmd), value);
+}
+
+/**
+ * Read a bit string response, for example 1TAS0000_0000_...
+ * @param cmd The command name that prefixes the bits (eg. TAS)
+ * @param bits A view of the bit string, up to the first space
+ * @return asynStatus. asynError if there is no bit string.
+ */
+asynStatus p6kParser::getBits(const char *cmd, p6kView *bits) const
+{
+  p6kView value = getValue(cmd);
+  size_t len = 0;
+
+  while ((value.len > 0) && (value.data[0] == ' ')) {
+    ++value.data;
+    --value.len;
+  }
+  while ((len < value.len) && (value.data[len] != ' ')) {
+    ++len;
+  }
+  if (len == 0) {
+    return asynError;
+  }
+
+  bits->data = value.data;
+  bits->len = len;
+  return asynSuccess;
+}
+
+/**
+ * Split a response to an axis-less command into per-axis fields.
+ * For example, TPC returns *TPC+100,-25,+0,+0. The leading command name
+ * is skipped if it is present.
+ * @param cmd The command that was sent (eg. TPC)
+ * @param fields Array that is populated with a view of each field
+ * @param maxFields The size of the fields array
+ * @return The number of fields found
+ */
+int32_t p6kParser::getList(const char *cmd, p6kView *fields, int32_t maxFields) const
+{
+  const char *pos = body_.data;
+  const char *end = body_.data + body_.len;
+  size_t cmdLen = strlen(cmd);
+  int32_t count = 0;
+
+  while ((pos < end) && (*pos == ' ')) {
+    ++pos;
+  }
+  if ((static_cast<size_t>(end-pos) >= cmdLen) && (strncmp(pos, cmd, cmdLen) == 0)) {
+    pos += cmdLen;
+  }
+
+  while ((pos < end) && (count < maxFields)) {
+    while ((pos < end) && (*pos == ' ')) {
+      ++pos;
+    }
+    const char *comma = pos;
+    while ((comma < end) && (*comma != ',')) {
+      ++comma;
+    }
+    fields[count].data = pos;
+    fields[count].len = comma - pos;
+    ++count;
+    pos = comma + 1;
+  }
+
+  return count;
+}
+
+/**
+ * @param view The characters to look at
+ * @param index The position of the character
+ * @return The character at index, or 0 if index is past the end of the view
+ */
+char p6kParser::getChar(p6kView view, size_t index)
+{
+  if (index >= view.len) {
+    return '\0';
+  }
+  return view.data[index];
+}
+
+/**
+ * Convert a field to an integer. Leading spaces and a sign are allowed,
+ * and conversion stops at the first character that is not a digit.
+ * The digits are accumulated unsigned, so a value that doesn't fit in an
+ * epicsInt32 is reported rather than overflowing.
+ * @param field The characters to convert
+ * @param value The result. This is not changed on an error.
+ * @return asynStatus. asynError if there were no digits, asynOverflow if
+ *         the value is out of range.
+ */
+asynStatus p6kParser::toInt(p6kView field, epicsInt32 *value)
+{
+  size_t i = 0;
+  bool negative = false;
+  epicsUInt64 result = 0;
+  //The magnitude of the most negative value is one more than the most positive
+  const epicsUInt64 limit = 2147483647ULL;
+
+  while ((i < field.len) && (field.data[i] == ' ')) {
+    ++i;
+  }
+  if ((i < field.len) && ((field.data[i] == '+') || (field.data[i] == '-'))) {
+    negative = (field.data[i] == '-');
+    ++i;
+  }
+
+  size_t start = i;
+  while ((i < field.len) && (field.data[i] >= '0') && (field.data[i] <= '9')) {
+    result = (result * 10) + static_cast<epicsUInt64>(field.data[i] - '0');
+    if (result > limit + 1) {
+      //Out of range. Keep scanning the digits, but don't let the 64 bit value wrap.
+      result = limit + 2;
+    }
+    ++i;
+  }
+  if (i == start) {
+    return asynError;
+  }
+  if (result > (negative ? limit + 1 : limit)) {
+    return asynOverflow;
+  }
+
+  if (negative) {
+    *value = (result == limit + 1) ? (-static_cast<epicsInt32>(limit) - 1) : -static_cast<epicsInt32>(result);
+  } else {
+    *value = static_cast<epicsInt32>(result);
+  }
+  return asynSuccess;
+}
+
+/**
+ * Convert a field to a double. Leading spaces, a sign, a decimal point and
+ * an exponent are allowed, and conversion stops at the first character that
+ * is not part of the number.
+ * @param field The characters to convert
+ * @param value The result
+ * @return asynStatus. asynError if there were no digits.
+ */
+asynStatus p6kParser::toDouble(p6kView field, double *value)
+{
+  size_t i = 0;
+  bool negative = false;
+  double mantissa = 0.0;
+  int32_t digits = 0;
+  int32_t exponent = 0;
+
+  while ((i < field.len) && (field.data[i] == ' ')) {
+    ++i;
+  }
+  if ((i < field.len) && ((field.data[i] == '+') || (field.data[i] == '-'))) {
+    negative = (field.data[i] == '-');
+    ++i;
+  }
+
+  while ((i < field.len) && (field.data[i] >= '0') && (field.data[i] <= '9')) {
+    mantissa = (mantissa * 10.0) + (field.data[i] - '0');
+    ++digits;
+    ++i;
+  }
+  if ((i < field.len) && (field.data[i] == '.')) {
+    ++i;
+    while ((i < field.len) && (field.data[i] >= '0') && (field.data[i] <= '9')) {
+      mantissa = (mantissa * 10.0) + (field.data[i] - '0');
+      ++digits;
+      --exponent;
+      ++i;
+    }
+  }
+  if (digits == 0) {
+    return asynError;
+  }
+
+  if ((i+1 < field.len) && ((field.data[i] == 'e') || (field.data[i] == 'E'))) {
+    p6kView expField = {field.data + i + 1, field.len - i - 1};
+    epicsInt32 exp = 0;
+    if (toInt(expField, &exp) == asynSuccess) {
+      exponent += exp;
+    }
+  }
+
+  //Scale by dividing, so that values like 0.1 are as close as strtod gets them
+  double scale = 1.0;
+  for (int32_t e = (exponent < 0 ? -exponent : exponent); e > 0; --e) {
+    scale *= 10.0;
+  }
+  mantissa = (exponent < 0) ? (mantissa / scale) : (mantissa * scale);
+
+  *value = negative ? -mantissa : mantissa;
+  return asynSuccess;
+}
+
+/**
+ * Pack a bit string (eg. 0100_0010) into an integer. The first bit goes into
+ * bit 0, underscores are skipped, and anything after the first 32 bits is ignored.
+ * @param field The bit string
+ * @return The bits
+ */
+epicsUInt32 p6kParser::toBits(p6kView field)
+{
+  return static_cast<epicsUInt32>(toMask(field) & 0xFFFFFFFFU);
+}
+
+/**
+ * Pack a bit string (eg. 0100_0010) into a 64 bit mask. The first bit goes into
+ * bit 0, underscores are skipped, and anything after the first 64 bits is ignored.
+ * Any character other than 1 is a zero bit.
+ *
+ * Status strings (TAS, TASX, TSS, etc.) are groups of four bits separated by
+ * underscores. For these each group is loaded as one 32 bit word, and checked and
+ * packed with a few word operations, without a branch per character. Anything
+ * else is decoded a character at a time.
+ * @param field The bit string
+ * @return The bits
+ */
+epicsUInt64 p6kParser::toMask(p6kView field)
+{
+  const unsigned char *data = reinterpret_cast<const unsigned char *>(field.data);
+  size_t groups = (field.len + 1) / 5;
+  epicsUInt64 mask = 0;
+  epicsUInt32 bit = 0;
+
+  if ((groups > 0) && (groups <= 16) && (((field.len + 1) % 5) == 0)) {
+    epicsUInt32 invalid = 0;
+    for (size_t group=0; group<groups; ++group) {
+      const unsigned char *pos = data + 5*group;
+      //Assembled byte by byte so that the first character is always in the low byte
+      epicsUInt32 word = static_cast<epicsUInt32>(pos[0])
+        | (static_cast<epicsUInt32>(pos[1]) << 8)
+        | (static_cast<epicsUInt32>(pos[2]) << 16)
+        | (static_cast<epicsUInt32>(pos[3]) << 24);
+      //Non-zero unless all four characters are 0 or 1, and the group is followed by _
+      invalid |= (word ^ 0x30303030U) & 0xFEFEFEFEU;
+      if (group+1 < groups) {
+        invalid |= pos[4] ^ '_';
+      }
+      //Move the low bit of each byte into bits 24 to 27. None of the partial
+      //products overlap, so there are no carries into those bits.
+      epicsUInt32 nibble = (((word & 0x01010101U) * 0x01020408U) >> 24) & 0xFU;
+      mask |= static_cast<epicsUInt64>(nibble) << (4*group);
+    }
+    if (invalid == 0) {
+      return mask;
+    }
+    mask = 0;
+  }
+
+  for (size_t i=0; (i<field.len) && (bit<64); ++i) {
+    if (data[i] == '_') {
+      continue;
+    }
+    if (data[i] == '1') {
+      mask |= (static_cast<epicsUInt64>(1) << bit);
+    }
+    ++bit;
+  }
+
+  return mask;
+}
+
+/**
+ * Return a view of the value in the body, after the optional axis number
+ * and the command name.
+ * @param cmd The command name (eg. TPC)
+ * @return A view of the value, which is empty if the command name was not found.
+ */
+p6kView p6kParser::getValue(const char *cmd) const
+{
+  const char *pos = body_.data;
+  const char *end = body_.data + body_.len;
+  size_t cmdLen = strlen(cmd);
+  p6kView value = {end, 0};
+
+  while ((pos < end) && (*pos == ' ')) {
+    ++pos;
+  }
+  while ((pos < end) && (*pos >= '0') && (*pos <= '9')) {
+    ++pos;
+  }
+  if ((static_cast<size_t>(end-pos) < cmdLen) || (strncmp(pos, cmd, cmdLen) != 0)) {
+    return value;
+  }
+
+  value.data = pos + cmdLen;
+  value.len = end - value.data;
+  return value;
+}
@@ -0,0 +1,75 @@
+/********************************************
+ *  parker6kParser.h
+ *
+ *  Single pass parser for P6K responses.
+ *
+ ********************************************/
+
+#ifndef parker6kParser_H
+#define parker6kParser_H
+
+#include <stddef.h>
+#include "stdint.h"
+
+#include <epicsTypes.h>
+
+#include "asynDriver.h"
+
+/**
+ * A view of part of a receive buffer. This is not null terminated.
+ */
+struct p6kView {
+  const char *data;
+  size_t len;
+};
+
+/**
+ * p6kParser finds the body of a P6K response in one pass over the receive buffer,
+ * without copying it. A successful response looks like *1TPC+100\r\r\n and an
+ * error response looks like *UNDEFINED LABEL\r\n? (the > prompt has already been
+ * removed by p6kTransport). With compact framing the trailer is a single \r. The typed accessors return values or views into the
+ * receive buffer, which must not change while the parser is in use.
+ */
+class p6kParser {
+
+ public:
+  p6kParser();
+
+  asynStatus parse(const char *buffer, size_t len);
+  bool isError(void) const;
+  bool hasTrailer(void) const;
+  p6kView getBody(void) const;
+  size_t copyBody(char *output, size_t maxChars) const;
+  bool matches(const char *command) const;
+
+  asynStatus getInt(const char *cmd, epicsInt32 *value) const;
+  asynStatus getDouble(const char *cmd, double *value) const;
+  asynStatus getBits(const char *cmd, p6kView *bits) const;
+  int32_t getList(const char *cmd, p6kView *fields, int32_t maxFields) const;
+
+  static char getChar(p6kView view, size_t index);
+  static asynStatus toInt(p6kView field, epicsInt32 *value);
+  static asynStatus toDouble(p6kView field, double *value);
+  static epicsUInt32 toBits(p6kView field);
+  static epicsUInt64 toMask(p6kView field);
+  static bool testBit(epicsUInt64 mask, epicsUInt32 bit);
+
+ private:
+  p6kView body_;
+  bool error_;
+  bool trailer_;
+
+  p6kView getValue(const char *cmd) const;
+};
+
+/**
+ * @param mask A mask from toMask
+ * @param bit The bit number, counting from 0 for the first bit in the string
+ * @return true if the bit is set
+ */
+inline bool p6kParser::testBit(epicsUInt64 mask, epicsUInt32 bit)
+{
+  return ((mask >> bit) & 1) != 0;
+}
+
+#endif /* parker6kParser_H */
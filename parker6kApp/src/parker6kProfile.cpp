@@ -0,0 +1,69 @@
+/********************************************
+ *  parker6kProfile.cpp
+ *
+ *  Predicts how long a move will take on the
+ *  controller from the commanded profile.
+ *
+ ********************************************/
+
+#include <math.h>
+
+#include "parker6kProfile.h"
+
+/**
+ * p6kProfile constructor.
+ * @param velocity The velocity (V)
+ * @param accel The acceleration (A)
+ * @param avgAccel The average acceleration (AA). If this is zero or more than A, A is used.
+ * @param decel The deceleration (AD)
+ * @param avgDecel The average deceleration (ADA). If this is zero or more than AD, AD is used.
+ */
+p6kProfile::p6kProfile(double velocity, double accel, double avgAccel, double decel, double avgDecel)
+{
+  velocity_ = fabs(velocity);
+  accel = fabs(accel);
+  decel = fabs(decel);
+  avgAccel = fabs(avgAccel);
+  avgDecel = fabs(avgDecel);
+  avgAccel_ = ((avgAccel > 0.0) && (avgAccel < accel)) ? avgAccel : accel;
+  avgDecel_ = ((avgDecel > 0.0) && (avgDecel < decel)) ? avgDecel : decel;
+}
+
+p6kProfile::~p6kProfile()
+{
+}
+
+/**
+ * @return true if the profile has a non zero velocity, acceleration and deceleration.
+ */
+bool p6kProfile::isValid(void) const
+{
+  return ((velocity_ > 0.0) && (avgAccel_ > 0.0) && (avgDecel_ > 0.0));
+}
+
+/**
+ * Calculate the time from GO to the end of the commanded profile.
+ * This does not include any settling time in the target zone.
+ * @param distance The distance to move. The sign is ignored.
+ * @return The move time in seconds, or 0 if the profile is not valid.
+ */
+double p6kProfile::moveTime(double distance) const
+{
+  if (!isValid()) {
+    return 0.0;
+  }
+
+  distance = fabs(distance);
+
+  double accelDist = (velocity_ * velocity_) / (2.0 * avgAccel_);
+  double decelDist = (velocity_ * velocity_) / (2.0 * avgDecel_);
+
+  if ((accelDist + decelDist) <= distance) {
+    //Reaches V, then cruises
+    return (velocity_ / avgAccel_) + (velocity_ / avgDecel_) + ((distance - accelDist - decelDist) / velocity_);
+  }
+
+  //Short move that never reaches V
+  double peak = sqrt((2.0 * distance * avgAccel_ * avgDecel_) / (avgAccel_ + avgDecel_));
+  return (peak / avgAccel_) + (peak / avgDecel_);
+}
@@ -0,0 +1,35 @@
+/********************************************
+ *  parker6kProfile.h
+ *
+ *  Predicts how long a move will take on the
+ *  controller from the commanded profile.
+ *
+ ********************************************/
+
+#ifndef parker6kProfile_H
+#define parker6kProfile_H
+
+/**
+ * p6kProfile calculates the duration of a 6K move from the distance and the
+ * V, A, AA, AD and ADA parameters. AA and ADA are the average acceleration and
+ * deceleration. When they are less than A and AD the controller uses an S curve,
+ * but the time and distance needed to reach V depend only on the average, so the 
+ * S curve and trapezoidal cases are handled the same way.
+ * All values are in the same units (eg. steps, steps/s and steps/s/s).
+ */
+class p6kProfile {
+
+ public:
+  p6kProfile(double velocity, double accel, double avgAccel, double decel, double avgDecel);
+  virtual ~p6kProfile();
+
+  double moveTime(double distance) const;
+  bool isValid(void) const;
+
+ private:
+  double velocity_;
+  double avgAccel_;
+  double avgDecel_;
+};
+
+#endif /* parker6kProfile_H */
@@ -0,0 +1,210 @@
+/********************************************
+ *  parker6kQueryScheduler.cpp
+ *
+ *  Decides which controller-wide status
+ *  queries are sent on each poll.
+ *
+ ********************************************/
+
+#include <string.h>
+
+#include <epicsString.h>
+
+#include "parker6kQueryScheduler.h"
+#include "parker6kCommand.h"
+
+const char *p6kQueryScheduler::P6K_QUERY_NAMES_[P6K_QUERY_NUM] = {
+  P6K_CMD_TSS, P6K_CMD_TLIM, P6K_CMD_TIN, P6K_CMD_TOUT, P6K_CMD_TASX
+};
+
+const char *p6kQueryScheduler::P6K_TIER_NAMES_[P6K_TIER_NUM] = {
+  "every poll", "periodic", "background"
+};
+
+/**
+ * p6kQueryScheduler constructor. All queries are sent every poll until
+ * the controller sets up the tiers.
+ */
+p6kQueryScheduler::p6kQueryScheduler()
+{
+  memset(queries_, 0, sizeof(queries_));
+  for (int32_t i=0; i<P6K_QUERY_NUM; ++i) {
+    queries_[i].name = P6K_QUERY_NAMES_[i];
+    queries_[i].tier = P6K_TIER_EVERY_POLL;
+    queries_[i].period = 0.0;
+  }
+}
+
+p6kQueryScheduler::~p6kQueryScheduler()
+{
+}
+
+/**
+ * Set how often a query is sent.
+ * @param id The query
+ * @param tier The tier. Out of range values are ignored.
+ */
+void p6kQueryScheduler::setTier(p6kQueryId id, p6kQueryTier tier)
+{
+  if ((id < 0) || (id >= P6K_QUERY_NUM) || (tier < 0) || (tier >= P6K_TIER_NUM)) {
+    return;
+  }
+  queries_[id].tier = tier;
+}
+
+/**
+ * Set the period of a query. This is used by the periodic and background tiers.
+ * @param id The query
+ * @param period The period in seconds. Negative values are treated as 0.
+ */
+void p6kQueryScheduler::setPeriod(p6kQueryId id, double period)
+{
+  if ((id < 0) || (id >= P6K_QUERY_NUM)) {
+    return;
+  }
+  queries_[id].period = (period > 0.0) ? period : 0.0;
+}
+
+p6kQueryTier p6kQueryScheduler::getTier(p6kQueryId id) const
+{
+  return queries_[id].tier;
+}
+
+double p6kQueryScheduler::getPeriod(p6kQueryId id) const
+{
+  return queries_[id].period;
+}
+
+/**
+ * @return The controller command for a query (eg. TSS)
+ */
+const char *p6kQueryScheduler::getName(p6kQueryId id) const
+{
+  return queries_[id].name;
+}
+
+/**
+ * Decide if a query should be sent on this poll. If not, it is counted as skipped.
+ * @param id The query
+ * @param now The monotonic time of this poll (ns)
+ * @param moving true if any axis is moving
+ * @return true if the query should be sent
+ */
+bool p6kQueryScheduler::isDue(p6kQueryId id, epicsUInt64 now, bool moving)
+{
+  p6kQuery *query = &queries_[id];
+  double period = query->period;
+  bool due = true;
+
+  if ((query->tier != P6K_TIER_EVERY_POLL) && (!query->forced) && (query->last != 0)) {
+    if ((query->tier == P6K_TIER_BACKGROUND) && (moving)) {
+      period *= P6K_QUERY_MOVING_SCALE;
+    }
+    due = ((now - query->last) / 1.0e9) >= period;
+  }
+
+  if (!due) {
+    query->skipped += 1;
+    query->bytesSaved += query->bytes;
+  }
+
+  return due;
+}
+
+/**
+ * Record that a query was sent.
+ * @param id The query
+ * @param now The monotonic time of this poll (ns)
+ * @param bytes The number of characters sent and received
+ */
+void p6kQueryScheduler::done(p6kQueryId id, epicsUInt64 now, size_t bytes)
+{
+  p6kQuery *query = &queries_[id];
+
+  query->last = now;
+  query->bytes = bytes;
+  query->forced = false;
+  query->sent += 1;
+}
+
+/**
+ * Send a query on the next poll, for example after writing to the outputs.
+ */
+void p6kQueryScheduler::force(p6kQueryId id)
+{
+  if ((id < 0) || (id >= P6K_QUERY_NUM)) {
+    return;
+  }
+  queries_[id].forced = true;
+}
+
+/**
+ * @return The total number of queries not sent, compared to sending them all every poll.
+ */
+epicsFloat64 p6kQueryScheduler::getSkipped(void) const
+{
+  epicsFloat64 total = 0;
+
+  for (int32_t i=0; i<P6K_QUERY_NUM; ++i) {
+    total += queries_[i].skipped;
+  }
+  return total;
+}
+
+/**
+ * @return An estimate of the number of characters not sent or received,
+ * based on the size of the last transaction for each query.
+ */
+epicsFloat64 p6kQueryScheduler::getBytesSaved(void) const
+{
+  epicsFloat64 total = 0;
+
+  for (int32_t i=0; i<P6K_QUERY_NUM; ++i) {
+    total += queries_[i].bytesSaved;
+  }
+  return total;
+}
+
+/**
+ * Zero the sent, skipped and saved counters. The schedule is not changed.
+ */
+void p6kQueryScheduler::resetCounters(void)
+{
+  for (int32_t i=0; i<P6K_QUERY_NUM; ++i) {
+    queries_[i].sent = 0;
+    queries_[i].skipped = 0;
+    queries_[i].bytesSaved = 0;
+  }
+}
+
+/**
+ * Print the schedule and counters for each query.
+ */
+void p6kQueryScheduler::report(FILE *fp)
+{
+  fprintf(fp, "  %-10s %-12s %10s %10s %10s %12s\n",
+          "query", "tier", "period s", "sent", "skipped", "bytes saved");
+  for (int32_t i=0; i<P6K_QUERY_NUM; ++i) {
+    const p6kQuery *query = &queries_[i];
+    fprintf(fp, "  %-10s %-12s %10.3f %10.0f %10.0f %12.0f\n", query->name,
+            P6K_TIER_NAMES_[query->tier], query->period, query->sent, query->skipped, query->bytesSaved);
+  }
+}
+
+/**
+ * Look up a query by its controller command (eg. TSS). The match is not case sensitive.
+ * @param name The command
+ * @return The p6kQueryId, or -1 if there is no query with that name.
+ */
+int32_t p6kQueryScheduler::find(const char *name)
+{
+  if (name == NULL) {
+    return -1;
+  }
+  for (int32_t i=0; i<P6K_QUERY_NUM; ++i) {
+    if (epicsStrCaseCmp(name, P6K_QUERY_NAMES_[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,98 @@
+/********************************************
+ *  parker6kQueryScheduler.h
+ *
+ *  Decides which controller-wide status
+ *  queries are sent on each poll.
+ *
+ ********************************************/
+
+#ifndef parker6kQueryScheduler_H
+#define parker6kQueryScheduler_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "stdint.h"
+
+#include <epicsTypes.h>
+
+/**
+ * The controller-wide status queries that are scheduled.
+ * The axis status (TAS, TPC and TPE) is always read every poll.
+ */
+enum p6kQueryId {
+  P6K_QUERY_TSS,
+  P6K_QUERY_TLIM,
+  P6K_QUERY_TIN,
+  P6K_QUERY_TOUT,
+  P6K_QUERY_TASX,
+  P6K_QUERY_NUM
+};
+
+/**
+ * How often a query is sent.
+ */
+enum p6kQueryTier {
+  P6K_TIER_EVERY_POLL,  //Every poll, at the moving or idle poll rate
+  P6K_TIER_PERIODIC,    //When the query period has passed
+  P6K_TIER_BACKGROUND,  //When the query period has passed, but P6K_QUERY_MOVING_SCALE times
+                        //less often while any axis is moving
+  P6K_TIER_NUM
+};
+
+//How much longer a background query waits while axes are moving
+#define P6K_QUERY_MOVING_SCALE 10
+
+/**
+ * The schedule and counters for one query.
+ */
+struct p6kQuery {
+  const char *name;
+  p6kQueryTier tier;
+  double period;        //Seconds
+  bool forced;          //Send on the next poll, whatever the tier
+  epicsUInt64 last;     //Monotonic time it was last sent (ns), or 0
+  size_t bytes;         //Characters sent and received the last time it was sent
+  epicsFloat64 sent;
+  epicsFloat64 skipped;
+  epicsFloat64 bytesSaved;
+};
+
+/**
+ * p6kQueryScheduler holds a period and a tier for each controller-wide status
+ * query, and decides on each poll which of them are due. Every poll that a query
+ * is not sent is counted, along with the number of characters the last one took,
+ * to show how much of the link has been saved compared to reading everything every poll.
+ * It is only used by the poller and the parameter writes, with the controller
+ * lock held, so it has no lock of its own.
+ */
+class p6kQueryScheduler {
+
+ public:
+  p6kQueryScheduler();
+  virtual ~p6kQueryScheduler();
+
+  void setTier(p6kQueryId id, p6kQueryTier tier);
+  void setPeriod(p6kQueryId id, double period);
+  p6kQueryTier getTier(p6kQueryId id) const;
+  double getPeriod(p6kQueryId id) const;
+  const char *getName(p6kQueryId id) const;
+
+  bool isDue(p6kQueryId id, epicsUInt64 now, bool moving);
+  void done(p6kQueryId id, epicsUInt64 now, size_t bytes);
+  void force(p6kQueryId id);
+
+  epicsFloat64 getSkipped(void) const;
+  epicsFloat64 getBytesSaved(void) const;
+  void resetCounters(void);
+  void report(FILE *fp);
+
+  static int32_t find(const char *name);
+
+ private:
+  p6kQuery queries_[P6K_QUERY_NUM];
+
+  static const char *P6K_QUERY_NAMES_[P6K_QUERY_NUM];
+  static const char *P6K_TIER_NAMES_[P6K_TIER_NUM];
+};
+
+#endif /* parker6kQueryScheduler_H */
@@ -0,0 +1,351 @@
+/********************************************
+ *  parker6kStats.cpp
+ *
+ *  Command counters and timing histograms
+ *  for the P6K driver.
+ *
+ ********************************************/
+
+#include <string.h>
+#include <ctype.h>
+
+#include "parker6kStats.h"
+
+const char *p6kStats::P6K_STATS_NAMES_[P6K_STATS_NUM_HIST] = {
+  "query", "write", "immediate", "other", "poll", "lock", "jitter"
+};
+
+/**
+ * p6kStats constructor. All counters start at zero.
+ */
+p6kStats::p6kStats()
+{
+  lock_ = epicsMutexMustCreate();
+  reset();
+}
+
+p6kStats::~p6kStats()
+{
+  epicsMutexDestroy(lock_);
+}
+
+/**
+ * Record a completed command.
+ * @param command The command that was sent
+ * @param bytesIn The number of characters in the response
+ * @param rtt The time from writing the command to reading the prompt (seconds)
+ * @param status The status of the transaction
+ * @param errorReply true if the controller replied with an error message
+ */
+void p6kStats::recordCommand(const char *command, size_t bytesIn, double rtt, asynStatus status, bool errorReply)
+{
+  p6kStatsClass cls = classify(command);
+  int32_t id = identify(command);
+  size_t bytesOut = strlen(command);
+
+  epicsMutexMustLock(lock_);
+  addCommand(&counters_[cls], bytesOut, bytesIn, status, errorReply);
+  addCommand(&commands_[id], bytesOut, bytesIn, status, errorReply);
+  //Only time complete transactions, so that timeouts don't fill the top bucket
+  if (status == asynSuccess) {
+    addTime(&hist_[cls], rtt);
+  }
+  epicsMutexUnlock(lock_);
+}
+
+/**
+ * Add a command to a set of counters. Must be called with lock_ held.
+ */
+void p6kStats::addCommand(p6kStatsCounters *counters, size_t bytesOut, size_t bytesIn,
+                          asynStatus status, bool errorReply)
+{
+  counters->count += 1;
+  counters->bytesOut += bytesOut;
+  counters->bytesIn += bytesIn;
+  if (status == asynTimeout) {
+    counters->timeouts += 1;
+  } else if ((status != asynSuccess) || (errorReply)) {
+    counters->errors += 1;
+  }
+}
+
+/**
+ * Record a time in one of the histograms.
+ * @param hist The histogram
+ * @param seconds The time to record
+ */
+void p6kStats::recordTime(p6kStatsHist hist, double seconds)
+{
+  if ((hist < 0) || (hist >= P6K_STATS_NUM_HIST)) {
+    return;
+  }
+
+  epicsMutexMustLock(lock_);
+  addTime(&hist_[hist], seconds);
+  epicsMutexUnlock(lock_);
+}
+
+/**
+ * Set all the counters and histograms back to zero.
+ */
+void p6kStats::reset(void)
+{
+  epicsMutexMustLock(lock_);
+  memset(counters_, 0, sizeof(counters_));
+  memset(commands_, 0, sizeof(commands_));
+  memset(hist_, 0, sizeof(hist_));
+  epicsMutexUnlock(lock_);
+}
+
+/**
+ * Copy the counters for all command classes.
+ * @param counters Array of P6K_STATS_NUM_CLASSES counters, indexed by p6kStatsClass
+ */
+void p6kStats::getCounters(p6kStatsCounters *counters)
+{
+  epicsMutexMustLock(lock_);
+  memcpy(counters, counters_, sizeof(counters_));
+  epicsMutexUnlock(lock_);
+}
+
+/**
+ * Copy the counters for each command.
+ * @param counters Array of P6K_STATS_NUM_COMMANDS counters, indexed by p6kCommandId
+ */
+void p6kStats::getCommandCounters(p6kStatsCounters *counters)
+{
+  epicsMutexMustLock(lock_);
+  memcpy(counters, commands_, sizeof(commands_));
+  epicsMutexUnlock(lock_);
+}
+
+/**
+ * Copy one of the histograms.
+ * @param hist The histogram to copy
+ * @param histogram The copy
+ */
+void p6kStats::getHistogram(p6kStatsHist hist, p6kStatsHistogram *histogram)
+{
+  if ((hist < 0) || (hist >= P6K_STATS_NUM_HIST)) {
+    memset(histogram, 0, sizeof(*histogram));
+    return;
+  }
+
+  epicsMutexMustLock(lock_);
+  *histogram = hist_[hist];
+  epicsMutexUnlock(lock_);
+}
+
+/**
+ * @return The number of commands recorded, for all classes.
+ */
+epicsFloat64 p6kStats::getTotalCount(void)
+{
+  epicsFloat64 total = 0;
+
+  epicsMutexMustLock(lock_);
+  for (int32_t i=0; i<P6K_STATS_NUM_CLASSES; ++i) {
+    total += counters_[i].count;
+  }
+  epicsMutexUnlock(lock_);
+
+  return total;
+}
+
+/**
+ * @return The number of characters sent and received, for all classes.
+ */
+epicsFloat64 p6kStats::getTotalBytes(void)
+{
+  epicsFloat64 total = 0;
+
+  epicsMutexMustLock(lock_);
+  for (int32_t i=0; i<P6K_STATS_NUM_CLASSES; ++i) {
+    total += counters_[i].bytesOut + counters_[i].bytesIn;
+  }
+  epicsMutexUnlock(lock_);
+
+  return total;
+}
+
+/**
+ * Print the counters. Level 2 and above also prints the counters for each
+ * command and the histograms.
+ */
+void p6kStats::report(FILE *fp, int level)
+{
+  p6kStatsCounters counters[P6K_STATS_NUM_CLASSES];
+  p6kStatsCounters commands[P6K_STATS_NUM_COMMANDS];
+  p6kStatsHistogram hist[P6K_STATS_NUM_HIST];
+
+  epicsMutexMustLock(lock_);
+  memcpy(counters, counters_, sizeof(counters_));
+  memcpy(commands, commands_, sizeof(commands_));
+  memcpy(hist, hist_, sizeof(hist_));
+  epicsMutexUnlock(lock_);
+
+  fprintf(fp, "  %-10s %10s %12s %12s %8s %8s %10s %10s\n",
+          "commands", "count", "bytes out", "bytes in", "errors", "timeouts", "mean ms", "max ms");
+  for (int32_t i=0; i<P6K_STATS_NUM_CLASSES; ++i) {
+    fprintf(fp, "  %-10s %10.0f %12.0f %12.0f %8.0f %8.0f %10.3f %10.3f\n", P6K_STATS_NAMES_[i],
+            counters[i].count, counters[i].bytesOut, counters[i].bytesIn, counters[i].errors, counters[i].timeouts,
+            (hist[i].count > 0) ? (hist[i].sum / hist[i].count * 1000.0) : 0.0, hist[i].max * 1000.0);
+  }
+  for (int32_t i=P6K_STATS_NUM_CLASSES; i<P6K_STATS_NUM_HIST; ++i) {
+    fprintf(fp, "  %-10s %10.0f %12s %12s %8s %8s %10.3f %10.3f\n", P6K_STATS_NAMES_[i],
+            hist[i].count, "", "", "", "",
+            (hist[i].count > 0) ? (hist[i].sum / hist[i].count * 1000.0) : 0.0, hist[i].max * 1000.0);
+  }
+
+  if (level < 2) {
+    return;
+  }
+
+  //Only the commands that have been sent
+  fprintf(fp, "  %-10s %10s %12s %12s %8s %8s\n",
+          "command", "count", "bytes out", "bytes in", "errors", "timeouts");
+  for (int32_t i=0; i<P6K_STATS_NUM_COMMANDS; ++i) {
+    if (commands[i].count > 0) {
+      fprintf(fp, "  %-10s %10.0f %12.0f %12.0f %8.0f %8.0f\n",
+              (i < P6K_CMDID_NUM) ? p6kCommandTable[i].name : "(other)",
+              commands[i].count, commands[i].bytesOut, commands[i].bytesIn,
+              commands[i].errors, commands[i].timeouts);
+    }
+  }
+
+  fprintf(fp, "  Histograms (count per bucket, upper edge in ms):\n");
+  fprintf(fp, "  %10s", "< ms");
+  for (int32_t i=0; i<P6K_STATS_NUM_HIST; ++i) {
+    fprintf(fp, " %10s", P6K_STATS_NAMES_[i]);
+  }
+  fprintf(fp, "\n");
+  for (int32_t bucket=0; bucket<P6K_STATS_BUCKETS; ++bucket) {
+    if (bucket < P6K_STATS_BUCKETS-1) {
+      fprintf(fp, "  %10.3f", getBucketEdge(bucket) * 1000.0);
+    } else {
+      fprintf(fp, "  %10s", "inf");
+    }
+    for (int32_t i=0; i<P6K_STATS_NUM_HIST; ++i) {
+      fprintf(fp, " %10.0f", hist[i].buckets[bucket]);
+    }
+    fprintf(fp, "\n");
+  }
+}
+
+/**
+ * Work out the class of a command from its first sub-command.
+ * Batches (more than one command separated by :) count as writes.
+ * @param command The command
+ * @return p6kStatsClass
+ */
+p6kStatsClass p6kStats::classify(const char *command)
+{
+  const char *pos = command;
+
+  if (*pos == '!') {
+    return P6K_STATS_IMMEDIATE;
+  }
+  if (strchr(pos, ':') != NULL) {
+    return P6K_STATS_WRITE;
+  }
+
+  while (isdigit(static_cast<unsigned char>(*pos))) {
+    ++pos;
+  }
+  const char *name = pos;
+  while (isalpha(static_cast<unsigned char>(*pos))) {
+    ++pos;
+  }
+  if (pos == name) {
+    return P6K_STATS_OTHER;
+  }
+  if (*pos != '\0') {
+    return P6K_STATS_WRITE;
+  }
+  if (*name == 'T') {
+    return P6K_STATS_QUERY;
+  }
+
+  return P6K_STATS_OTHER;
+}
+
+/**
+ * Find the command that a command line starts with, ignoring any ! and axis
+ * number (eg. 1V2.0:1D100:1GO is counted as V).
+ * @param command The command line
+ * @return The p6kCommandId, or P6K_CMDID_NUM if it is not in p6kCommandTable
+ */
+int32_t p6kStats::identify(const char *command)
+{
+  const char *pos = command;
+
+  if (*pos == '!') {
+    ++pos;
+  }
+  while (isdigit(static_cast<unsigned char>(*pos))) {
+    ++pos;
+  }
+  const char *name = pos;
+  while (isalpha(static_cast<unsigned char>(*pos))) {
+    ++pos;
+  }
+  size_t len = pos - name;
+
+  for (int32_t id=0; id<P6K_CMDID_NUM; ++id) {
+    if ((p6kCommandTable[id].nameLen == len) && (strncmp(p6kCommandTable[id].name, name, len) == 0)) {
+      return id;
+    }
+  }
+
+  return P6K_CMDID_NUM;
+}
+
+/**
+ * @param seconds A time
+ * @return The histogram bucket for the time
+ */
+int32_t p6kStats::getBucket(double seconds)
+{
+  double edge = P6K_STATS_FIRST_EDGE;
+  int32_t bucket = 0;
+
+  while ((bucket < P6K_STATS_BUCKETS-1) && (seconds >= edge)) {
+    edge *= 2.0;
+    ++bucket;
+  }
+
+  return bucket;
+}
+
+/**
+ * @param bucket A histogram bucket
+ * @return The upper edge of the bucket (seconds). The last bucket has no upper edge,
+ * and the value returned is the lower edge.
+ */
+double p6kStats::getBucketEdge(int32_t bucket)
+{
+  double edge = P6K_STATS_FIRST_EDGE;
+
+  if (bucket >= P6K_STATS_BUCKETS-1) {
+    bucket = P6K_STATS_BUCKETS-2;
+  }
+  for (int32_t i=0; i<bucket; ++i) {
+    edge *= 2.0;
+  }
+
+  return edge;
+}
+
+/**
+ * Add a time to a histogram. Must be called with lock_ held.
+ */
+void p6kStats::addTime(p6kStatsHistogram *histogram, double seconds)
+{
+  histogram->buckets[getBucket(seconds)] += 1;
+  histogram->count += 1;
+  histogram->sum += seconds;
+  histogram->last = seconds;
+  if (seconds > histogram->max) {
+    histogram->max = seconds;
+  }
+}
@@ -0,0 +1,120 @@
+/********************************************
+ *  parker6kStats.h
+ *
+ *  Command counters and timing histograms
+ *  for the P6K driver.
+ *
+ ********************************************/
+
+#ifndef parker6kStats_H
+#define parker6kStats_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "stdint.h"
+
+#include <epicsTypes.h>
+#include <epicsMutex.h>
+
+#include "asynDriver.h"
+
+#include "parker6kCommand.h"
+
+//Number of histogram buckets. Bucket 0 is below P6K_STATS_FIRST_EDGE,
+//each bucket after that is twice as wide, and the last one has no upper limit.
+#define P6K_STATS_BUCKETS 16
+#define P6K_STATS_FIRST_EDGE 0.000125
+
+/**
+ * The types of command that are counted separately.
+ */
+enum p6kStatsClass {
+  P6K_STATS_QUERY,      //Status queries (eg. 1TAS, TSS)
+  P6K_STATS_WRITE,      //Commands with arguments, and batches (eg. 1V2.0:1D100:1GO)
+  P6K_STATS_IMMEDIATE,  //Immediate commands (eg. !1S)
+  P6K_STATS_OTHER,      //Anything else (eg. 1GO, program upload)
+  P6K_STATS_NUM_CLASSES
+};
+
+//Number of per-command counters. The last one is for commands that
+//are not in p6kCommandTable (eg. program upload).
+#define P6K_STATS_NUM_COMMANDS (P6K_CMDID_NUM + 1)
+
+/**
+ * The timing histograms. The first P6K_STATS_NUM_CLASSES are the round trip
+ * times for each command class.
+ */
+enum p6kStatsHist {
+  P6K_STATS_HIST_POLL = P6K_STATS_NUM_CLASSES,  //Poll cycle duration
+  P6K_STATS_HIST_LOCK,                          //Controller lock hold time
+  P6K_STATS_HIST_JITTER,                        //Poll start time after its deadline
+  P6K_STATS_NUM_HIST
+};
+
+/**
+ * A log bucketed histogram of times, with the count, total and maximum.
+ */
+struct p6kStatsHistogram {
+  epicsFloat64 buckets[P6K_STATS_BUCKETS];
+  epicsFloat64 count;
+  epicsFloat64 sum;
+  epicsFloat64 max;
+  epicsFloat64 last;
+};
+
+/**
+ * Counters for one command class, or one command.
+ */
+struct p6kStatsCounters {
+  epicsFloat64 count;
+  epicsFloat64 bytesOut;
+  epicsFloat64 bytesIn;
+  epicsFloat64 errors;
+  epicsFloat64 timeouts;
+};
+
+/**
+ * p6kStats collects counters and timing histograms. The counters are kept for
+ * each command class and for each command (by p6kCommandId, using the first
+ * command on the line). The round trip time histograms are kept for each class,
+ * which is what p6kTimeout uses. Commands are recorded by
+ * the p6kTransport comms thread, and the poll and lock times by the controller,
+ * so all access is protected by an internal mutex. Nothing else is locked while
+ * it is held, so it can be used with or without the controller lock.
+ */
+class p6kStats {
+
+ public:
+  p6kStats();
+  virtual ~p6kStats();
+
+  void recordCommand(const char *command, size_t bytesIn, double rtt, asynStatus status, bool errorReply);
+  void recordTime(p6kStatsHist hist, double seconds);
+  void reset(void);
+
+  void getCounters(p6kStatsCounters *counters);
+  void getCommandCounters(p6kStatsCounters *counters);
+  void getHistogram(p6kStatsHist hist, p6kStatsHistogram *histogram);
+  epicsFloat64 getTotalCount(void);
+  epicsFloat64 getTotalBytes(void);
+  void report(FILE *fp, int level);
+
+  static p6kStatsClass classify(const char *command);
+  static int32_t identify(const char *command);
+  static int32_t getBucket(double seconds);
+  static double getBucketEdge(int32_t bucket);
+
+ private:
+  epicsMutexId lock_;
+  p6kStatsCounters counters_[P6K_STATS_NUM_CLASSES];
+  p6kStatsCounters commands_[P6K_STATS_NUM_COMMANDS];
+  p6kStatsHistogram hist_[P6K_STATS_NUM_HIST];
+
+  void addTime(p6kStatsHistogram *histogram, double seconds);
+  static void addCommand(p6kStatsCounters *counters, size_t bytesOut, size_t bytesIn,
+                         asynStatus status, bool errorReply);
+
+  static const char *P6K_STATS_NAMES_[P6K_STATS_NUM_HIST];
+};
+
+#endif /* parker6kStats_H */
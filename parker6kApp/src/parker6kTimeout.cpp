@@ -0,0 +1,221 @@
+/********************************************
+ *  parker6kTimeout.cpp
+ *
+ *  Response timeouts for the P6K driver,
+ *  from the measured round trip times.
+ *
+ ********************************************/
+
+#include <string.h>
+#include <math.h>
+
+#include "parker6kTimeout.h"
+
+//Default lower bound for the timeout (seconds)
+const double p6kTimeout::P6K_TIMEOUT_MIN_ = 0.05;
+//Smallest margin above the smoothed round trip time (seconds)
+const double p6kTimeout::P6K_TIMEOUT_GRANULARITY_ = 0.01;
+
+const char *p6kTimeout::P6K_TIMEOUT_NAMES_[P6K_STATS_NUM_CLASSES] = {
+  "query", "write", "immediate", "other"
+};
+
+/**
+ * p6kTimeout constructor. Adaptive timeouts are enabled, but
+ * every class uses the maximum until it has been measured.
+ * @param maxTimeout The maximum timeout (seconds)
+ */
+p6kTimeout::p6kTimeout(double maxTimeout)
+{
+  lock_ = epicsMutexMustCreate();
+  enabled_ = true;
+  min_ = P6K_TIMEOUT_MIN_;
+  max_ = maxTimeout;
+  memset(estimates_, 0, sizeof(estimates_));
+  for (int32_t i=0; i<P6K_STATS_NUM_CLASSES; ++i) {
+    estimates_[i].rto = max_;
+  }
+}
+
+p6kTimeout::~p6kTimeout()
+{
+  epicsMutexDestroy(lock_);
+}
+
+/**
+ * Only status queries use the adaptive timeout. Any other command may have
+ * been carried out even if its response is late (eg. GO), so reporting it
+ * as failed early would be wrong. They always wait for the maximum.
+ * @param cls The command class
+ * @return How long to wait for the response to a command (seconds)
+ */
+double p6kTimeout::getTimeout(p6kStatsClass cls)
+{
+  double timeout = 0.0;
+
+  epicsMutexMustLock(lock_);
+  timeout = ((enabled_) && (cls == P6K_STATS_QUERY)) ? estimates_[cls].rto : max_;
+  epicsMutexUnlock(lock_);
+
+  return timeout;
+}
+
+/**
+ * Add a round trip time to the estimate for a class. Only commands that
+ * got a response should be measured.
+ * @param cls The command class
+ * @param rtt The round trip time (seconds)
+ */
+void p6kTimeout::sample(p6kStatsClass cls, double rtt)
+{
+  epicsMutexMustLock(lock_);
+  p6kTimeoutEstimate *estimate = &estimates_[cls];
+  if (estimate->samples == 0) {
+    estimate->srtt = rtt;
+    estimate->rttvar = rtt / 2.0;
+  } else {
+    estimate->rttvar = 0.75 * estimate->rttvar + 0.25 * fabs(estimate->srtt - rtt);
+    estimate->srtt = 0.875 * estimate->srtt + 0.125 * rtt;
+  }
+  estimate->samples += 1;
+  update(estimate);
+  epicsMutexUnlock(lock_);
+}
+
+/**
+ * Back off after a command in a class got no response. The timeout for
+ * the class doubles, up to the maximum, until the next sample.
+ * @param cls The command class
+ */
+void p6kTimeout::timedOut(p6kStatsClass cls)
+{
+  epicsMutexMustLock(lock_);
+  p6kTimeoutEstimate *estimate = &estimates_[cls];
+  estimate->rto *= 2.0;
+  if (estimate->rto > max_) {
+    estimate->rto = max_;
+  }
+  estimate->backoffs += 1;
+  epicsMutexUnlock(lock_);
+}
+
+/**
+ * Turn adaptive timeouts on or off. When off, the maximum is always used,
+ * but the estimates are still kept up to date.
+ */
+void p6kTimeout::setEnabled(bool enabled)
+{
+  epicsMutexMustLock(lock_);
+  enabled_ = enabled;
+  epicsMutexUnlock(lock_);
+}
+
+/**
+ * Set the range of the timeout.
+ * @param minTimeout The minimum timeout (seconds)
+ * @param maxTimeout The maximum timeout (seconds). This is also used until a class has been measured.
+ */
+void p6kTimeout::setBounds(double minTimeout, double maxTimeout)
+{
+  epicsMutexMustLock(lock_);
+  min_ = (minTimeout > 0.0) ? minTimeout : 0.0;
+  max_ = (maxTimeout > min_) ? maxTimeout : min_;
+  for (int32_t i=0; i<P6K_STATS_NUM_CLASSES; ++i) {
+    if (estimates_[i].samples == 0) {
+      estimates_[i].rto = max_;
+    } else {
+      update(&estimates_[i]);
+    }
+  }
+  epicsMutexUnlock(lock_);
+}
+
+double p6kTimeout::getMin(void)
+{
+  double value = 0.0;
+
+  epicsMutexMustLock(lock_);
+  value = min_;
+  epicsMutexUnlock(lock_);
+
+  return value;
+}
+
+double p6kTimeout::getMax(void)
+{
+  double value = 0.0;
+
+  epicsMutexMustLock(lock_);
+  value = max_;
+  epicsMutexUnlock(lock_);
+
+  return value;
+}
+
+/**
+ * Copy the estimate for one class.
+ * @param cls The command class
+ * @param estimate The estimate
+ */
+void p6kTimeout::getEstimate(p6kStatsClass cls, p6kTimeoutEstimate *estimate)
+{
+  epicsMutexMustLock(lock_);
+  *estimate = estimates_[cls];
+  epicsMutexUnlock(lock_);
+}
+
+/**
+ * Zero the sample and backoff counters. The estimates are kept.
+ */
+void p6kTimeout::resetCounters(void)
+{
+  epicsMutexMustLock(lock_);
+  for (int32_t i=0; i<P6K_STATS_NUM_CLASSES; ++i) {
+    //Keep a non-zero sample count, so that the next sample is smoothed
+    estimates_[i].samples = (estimates_[i].samples > 0) ? 1 : 0;
+    estimates_[i].backoffs = 0;
+  }
+  epicsMutexUnlock(lock_);
+}
+
+/**
+ * Print the estimate for each class.
+ */
+void p6kTimeout::report(FILE *fp)
+{
+  p6kTimeoutEstimate estimates[P6K_STATS_NUM_CLASSES];
+
+  epicsMutexMustLock(lock_);
+  memcpy(estimates, estimates_, sizeof(estimates_));
+  bool enabled = enabled_;
+  double minTimeout = min_;
+  double maxTimeout = max_;
+  epicsMutexUnlock(lock_);
+
+  fprintf(fp, "  Timeouts %s, %.3f to %.3f s\n", enabled ? "adaptive" : "fixed", minTimeout, maxTimeout);
+  fprintf(fp, "  %-10s %10s %10s %10s %10s %10s\n",
+          "class", "srtt ms", "rttvar ms", "rto ms", "samples", "backoffs");
+  for (int32_t i=0; i<P6K_STATS_NUM_CLASSES; ++i) {
+    fprintf(fp, "  %-10s %10.3f %10.3f %10.3f %10.0f %10.0f\n", P6K_TIMEOUT_NAMES_[i],
+            estimates[i].srtt * 1000.0, estimates[i].rttvar * 1000.0, estimates[i].rto * 1000.0,
+            estimates[i].samples, estimates[i].backoffs);
+  }
+}
+
+/**
+ * Calculate the timeout from the estimate. Must be called with lock_ held.
+ */
+void p6kTimeout::update(p6kTimeoutEstimate *estimate)
+{
+  double margin = 4.0 * estimate->rttvar;
+
+  if (margin < P6K_TIMEOUT_GRANULARITY_) {
+    margin = P6K_TIMEOUT_GRANULARITY_;
+  }
+  estimate->rto = estimate->srtt + margin;
+  if (estimate->rto < min_) {
+    estimate->rto = min_;
+  } else if (estimate->rto > max_) {
+    estimate->rto = max_;
+  }
+}
@@ -0,0 +1,80 @@
+/********************************************
+ *  parker6kTimeout.h
+ *
+ *  Response timeouts for the P6K driver,
+ *  from the measured round trip times.
+ *
+ ********************************************/
+
+#ifndef parker6kTimeout_H
+#define parker6kTimeout_H
+
+#include <stdio.h>
+#include "stdint.h"
+
+#include <epicsTypes.h>
+#include <epicsMutex.h>
+
+#include "parker6kStats.h"
+
+/**
+ * The round trip estimate for one command class. Times are in seconds.
+ */
+struct p6kTimeoutEstimate {
+  double srtt;          //Smoothed round trip time
+  double rttvar;        //Smoothed mean deviation of the round trip time
+  double rto;           //The timeout used for the next command
+  epicsFloat64 samples;
+  epicsFloat64 backoffs;
+};
+
+/**
+ * p6kTimeout keeps a smoothed round trip time and mean deviation for each
+ * command class (see p6kStats::classify), the same way TCP does (Jacobson/Karels),
+ * and uses them to decide how long to wait for a response:
+ *
+ *   srtt   = 7/8 srtt + 1/8 rtt
+ *   rttvar = 3/4 rttvar + 1/4 |srtt - rtt|
+ *   rto    = srtt + max(P6K_TIMEOUT_GRANULARITY, 4 rttvar)
+ *
+ * bounded by the minimum and maximum timeout. Only status queries wait for
+ * rto. The other classes are measured, but always wait for the maximum, since
+ * a write that times out may still have been carried out. Until a class has
+ * a sample, and when adaptive timeouts are disabled, the maximum is used. Each timeout
+ * doubles the timeout for that class (up to the maximum) until the next sample.
+ * It is updated by the p6kTransport comms thread and read by the controller,
+ * so all access is protected by an internal mutex.
+ */
+class p6kTimeout {
+
+ public:
+  p6kTimeout(double maxTimeout);
+  virtual ~p6kTimeout();
+
+  double getTimeout(p6kStatsClass cls);
+  void sample(p6kStatsClass cls, double rtt);
+  void timedOut(p6kStatsClass cls);
+
+  void setEnabled(bool enabled);
+  void setBounds(double minTimeout, double maxTimeout);
+  double getMin(void);
+  double getMax(void);
+  void getEstimate(p6kStatsClass cls, p6kTimeoutEstimate *estimate);
+  void resetCounters(void);
+  void report(FILE *fp);
+
+ private:
+  epicsMutexId lock_;
+  bool enabled_;
+  double min_;
+  double max_;
+  p6kTimeoutEstimate estimates_[P6K_STATS_NUM_CLASSES];
+
+  void update(p6kTimeoutEstimate *estimate);
+
+  static const double P6K_TIMEOUT_MIN_;
+  static const double P6K_TIMEOUT_GRANULARITY_;
+  static const char *P6K_TIMEOUT_NAMES_[P6K_STATS_NUM_CLASSES];
+};
+
+#endif /* parker6kTimeout_H */
@@ -0,0 +1,1003 @@
+/********************************************
+ *  parker6kTransport.cpp
+ *
+ *  Request queue and comms thread for the
+ *  low level P6K asyn port.
+ *
+ ********************************************/
+
+#include <string.h>
+
+#include <epicsTime.h>
+#include <epicsStdio.h>
+
+#include "asynOctetSyncIO.h"
+
+#include "parker6kTransport.h"
+#include "parker6kStats.h"
+#include "parker6kLogger.h"
+
+const double p6kTransport::P6K_TRANSPORT_TIMEOUT_ = 5.0;
+const double p6kTransport::P6K_TRANSPORT_PROBE_TIMEOUT_ = 1.0;
+const uint32_t p6kTransport::P6K_TRANSPORT_FAIL_LIMIT_ = 3;
+const double p6kTransport::P6K_TRANSPORT_DRAIN_TIME_ = 0.05;
+const char *p6kTransport::P6K_SENTINEL_ = "P6KSYNC";
+const char *p6kTransport::P6K_EOL_DEFAULT_ = "EOL13,10,0";
+
+const char p6kTransport::P6K_PROMPT_ = '>';
+const char p6kTransport::P6K_PROMPT_PROG_ = '-';
+const char p6kTransport::P6K_PROMPT_ERROR_ = '?';
+const char p6kTransport::P6K_IMMEDIATE_ = '!';
+
+/**
+ * C function wrapper for the comms thread.
+ */
+static void p6kTransportTaskC(void *pPvt)
+{
+  p6kTransport *pTransport = static_cast<p6kTransport *>(pPvt);
+  pTransport->commsTask();
+}
+
+/**
+ * p6kTransport constructor.
+ * @param pasynUser The asynUser for the low level port. This must already be connected,
+ *        with no input EOS. The transport is the only user of it after this.
+ * @param name Name used for the comms thread and in messages.
+ * @param notify Function called by the comms thread when an asynchronous request completes.
+ * @param notifyPvt Pointer passed to notify.
+ */
+p6kTransport::p6kTransport(asynUser *pasynUser, const char *name, p6kNotifyCallback notify, void *notifyPvt)
+  : pasynUser_(pasynUser), notify_(notify), notifyPvt_(notifyPvt), timeouts_(P6K_TRANSPORT_TIMEOUT_)
+{
+  epicsSnprintf(name_, sizeof(name_), "%s", name);
+  thread_ = NULL;
+  maxInFlight_ = 1;
+  outstanding_ = 0;
+  waiting_ = false;
+  programMode_ = false;
+  defaultFraming_ = true;
+  rxLen_ = 0;
+  down_ = false;
+  failures_ = 0;
+  failLimit_ = P6K_TRANSPORT_FAIL_LIMIT_;
+  outages_ = 0;
+  resync_ = false;
+  resyncs_ = 0;
+  sentinel_ = 0;
+  discarded_ = 0;
+  stats_ = NULL;
+  logger_ = NULL;
+
+  lock_ = epicsMutexMustCreate();
+  workEvent_ = epicsEventMustCreate(epicsEventEmpty);
+  completeEvent_ = epicsEventMustCreate(epicsEventEmpty);
+
+  free_ = NULL;
+  for (uint32_t i=0; i<P6K_TRANSPORT_MAXREQS; ++i) {
+    requests_[i].doneEvent = epicsEventMustCreate(epicsEventEmpty);
+    requests_[i].next = free_;
+    free_ = &requests_[i];
+  }
+  queueHead_ = NULL;
+  queueTail_ = NULL;
+  priorityHead_ = NULL;
+  priorityTail_ = NULL;
+  completeHead_ = NULL;
+  completeTail_ = NULL;
+}
+
+p6kTransport::~p6kTransport()
+{
+  //The comms thread runs for the life of the IOC, like the poller,
+  //so we don't destroy anything it might be using.
+}
+
+/**
+ * Start the comms thread.
+ * @return asynStatus
+ */
+asynStatus p6kTransport::start(void)
+{
+  char threadName[P6K_TRANSPORT_MAXBUF] = {0};
+
+  epicsSnprintf(threadName, sizeof(threadName), "%sComms", name_);
+  thread_ = epicsThreadCreate(threadName, epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackMedium),
+                              (EPICSTHREADFUNC)p6kTransportTaskC, this);
+  if (thread_ == NULL) {
+    printf("p6kTransport::start: ERROR: Failed to create comms thread for %s\n", name_);
+    return asynError;
+  }
+
+  return asynSuccess;
+}
+
+/**
+ * Send a command and wait for the response.
+ * This blocks the calling thread, but not the comms thread, so other
+ * requests can be pipelined with it.
+ * @param command The command to send
+ * @param response The raw response, including any error prompt
+ * @param maxChars The size of the response buffer
+ * @param nread The number of characters in the response
+ * @return asynStatus
+ */
+asynStatus p6kTransport::writeRead(const char *command, char *response, size_t maxChars, size_t *nread)
+{
+  return waitRequest(command, false, 0.0, response, maxChars, nread);
+}
+
+/**
+ * Send a command to find out if the controller is responding again.
+ * This is sent even when the controller is marked as down, and uses
+ * a shorter timeout than normal commands. It should be a command
+ * with a short response that does not change anything (eg. TSS).
+ * @param command The command to send
+ * @param response The raw response, including any error prompt
+ * @param maxChars The size of the response buffer
+ * @param nread The number of characters in the response
+ * @return asynStatus. asynSuccess if the controller responded.
+ */
+asynStatus p6kTransport::probe(const char *command, char *response, size_t maxChars, size_t *nread)
+{
+  return waitRequest(command, true, P6K_TRANSPORT_PROBE_TIMEOUT_, response, maxChars, nread);
+}
+
+/**
+ * Queue a request and wait for the response. Used by writeRead and probe.
+ */
+asynStatus p6kTransport::waitRequest(const char *command, bool probe, double timeout,
+                                     char *response, size_t maxChars, size_t *nread)
+{
+  asynStatus status = asynSuccess;
+  p6kRequest *request = NULL;
+
+  epicsMutexMustLock(lock_);
+  request = allocRequest(command);
+  if (request != NULL) {
+    request->probe = probe;
+    request->timeout = timeout;
+    request->callback = NULL;
+    request->pvt = NULL;
+    queueRequest(request);
+  }
+  epicsMutexUnlock(lock_);
+
+  if (request == NULL) {
+    return asynError;
+  }
+
+  epicsEventSignal(workEvent_);
+
+  epicsEventMustWait(request->doneEvent);
+
+  status = request->status;
+  *nread = request->nread;
+  if (*nread > maxChars-1) {
+    *nread = maxChars-1;
+  }
+  memcpy(response, request->response, *nread);
+  response[*nread] = '\0';
+
+  epicsMutexMustLock(lock_);
+  freeRequest(request);
+  epicsMutexUnlock(lock_);
+
+  return status;
+}
+
+/**
+ * Queue a command without waiting for the response.
+ * The callback is run from processCompletions once the response has arrived.
+ * @param command The command to send
+ * @param callback The function to call with the response
+ * @param pvt Pointer passed to the callback
+ * @return asynStatus. asynError if the request queue is full.
+ */
+asynStatus p6kTransport::submit(const char *command, p6kRequestCallback callback, void *pvt)
+{
+  p6kRequest *request = NULL;
+
+  epicsMutexMustLock(lock_);
+  request = allocRequest(command);
+  if (request != NULL) {
+    request->callback = callback;
+    request->pvt = pvt;
+    ++outstanding_;
+    queueRequest(request);
+  }
+  epicsMutexUnlock(lock_);
+
+  if (request == NULL) {
+    return asynError;
+  }
+
+  epicsEventSignal(workEvent_);
+
+  return asynSuccess;
+}
+
+/**
+ * Run the callbacks for all the asynchronous requests that have completed,
+ * in the order they were submitted. This should be called by the owner, with
+ * its own lock held if the callbacks need it.
+ * @return The number of callbacks that were run
+ */
+int32_t p6kTransport::processCompletions(void)
+{
+  int32_t count = 0;
+  p6kRequest *request = NULL;
+
+  epicsMutexMustLock(lock_);
+  request = completeHead_;
+  completeHead_ = NULL;
+  completeTail_ = NULL;
+  epicsMutexUnlock(lock_);
+
+  while (request != NULL) {
+    p6kRequest *next = request->next;
+    if (request->callback != NULL) {
+      request->callback(request->pvt, request->command, request->response, request->status);
+    }
+    epicsMutexMustLock(lock_);
+    freeRequest(request);
+    epicsMutexUnlock(lock_);
+    request = next;
+    ++count;
+  }
+
+  return count;
+}
+
+/**
+ * Wait until the comms thread has completed all the asynchronous requests
+ * submitted so far. The callbacks still need to be run using processCompletions.
+ * The notify function is not called for requests that complete while we are
+ * waiting, since the caller will process them itself.
+ * @param timeout The maximum time to wait (seconds)
+ * @return asynStatus. asynTimeout if there are still requests outstanding.
+ */
+asynStatus p6kTransport::waitOutstanding(double timeout)
+{
+  asynStatus status = asynSuccess;
+  epicsTimeStamp start;
+  epicsTimeStamp now;
+
+  epicsMutexMustLock(lock_);
+  waiting_ = true;
+  epicsMutexUnlock(lock_);
+
+  epicsTimeGetCurrent(&start);
+  while (getOutstanding() > 0) {
+    epicsTimeGetCurrent(&now);
+    double remaining = timeout - epicsTimeDiffInSeconds(&now, &start);
+    if (remaining <= 0) {
+      status = asynTimeout;
+      break;
+    }
+    epicsEventWaitWithTimeout(completeEvent_, remaining);
+  }
+
+  epicsMutexMustLock(lock_);
+  waiting_ = false;
+  epicsMutexUnlock(lock_);
+
+  return status;
+}
+
+/**
+ * @return The number of asynchronous requests that the comms thread has not completed yet.
+ */
+uint32_t p6kTransport::getOutstanding(void)
+{
+  uint32_t outstanding = 0;
+
+  epicsMutexMustLock(lock_);
+  outstanding = outstanding_;
+  epicsMutexUnlock(lock_);
+
+  return outstanding;
+}
+
+/**
+ * Set the number of commands that are written before waiting for the responses.
+ * A value of 1 means each command waits for the previous response.
+ * @param maxInFlight The number of commands (1 to P6K_TRANSPORT_MAXINFLIGHT)
+ */
+void p6kTransport::setMaxInFlight(uint32_t maxInFlight)
+{
+  if (maxInFlight < 1) {
+    maxInFlight = 1;
+  } else if (maxInFlight > P6K_TRANSPORT_MAXINFLIGHT) {
+    maxInFlight = P6K_TRANSPORT_MAXINFLIGHT;
+  }
+
+  epicsMutexMustLock(lock_);
+  maxInFlight_ = maxInFlight;
+  epicsMutexUnlock(lock_);
+}
+
+/**
+ * @return The number of commands that are written before waiting for the responses.
+ */
+uint32_t p6kTransport::getMaxInFlight(void)
+{
+  uint32_t maxInFlight = 0;
+
+  epicsMutexMustLock(lock_);
+  maxInFlight = maxInFlight_;
+  epicsMutexUnlock(lock_);
+
+  return maxInFlight;
+}
+
+/**
+ * Set the object used to count commands and time the round trips.
+ * This must be called before start.
+ * @param stats The stats object, or NULL to disable the counters.
+ */
+void p6kTransport::setStats(p6kStats *stats)
+{
+  stats_ = stats;
+}
+
+/**
+ * Set the logger that records each transaction.
+ * This must be called before start.
+ * @param logger The logger, or NULL to disable logging.
+ */
+void p6kTransport::setLogger(p6kLogger *logger)
+{
+  logger_ = logger;
+}
+
+/**
+ * @return true if the controller has stopped responding, and requests
+ * other than probes are failing without being sent.
+ */
+bool p6kTransport::isDown(void)
+{
+  bool down = false;
+
+  epicsMutexMustLock(lock_);
+  down = down_;
+  epicsMutexUnlock(lock_);
+
+  return down;
+}
+
+/**
+ * Set the number of consecutive transactions without a response
+ * before the controller is marked as down.
+ * @param failLimit The number of transactions. 0 disables fast failure.
+ */
+void p6kTransport::setFailLimit(uint32_t failLimit)
+{
+  epicsMutexMustLock(lock_);
+  failLimit_ = failLimit;
+  if ((failLimit_ == 0) && (down_)) {
+    down_ = false;
+    failures_ = 0;
+  }
+  epicsMutexUnlock(lock_);
+}
+
+/**
+ * @return The number of consecutive transactions that have had no response.
+ */
+uint32_t p6kTransport::getFailures(void)
+{
+  uint32_t failures = 0;
+
+  epicsMutexMustLock(lock_);
+  failures = failures_;
+  epicsMutexUnlock(lock_);
+
+  return failures;
+}
+
+/**
+ * @return The number of times the controller has been marked as down.
+ */
+uint32_t p6kTransport::getOutages(void)
+{
+  uint32_t outages = 0;
+
+  epicsMutexMustLock(lock_);
+  outages = outages_;
+  epicsMutexUnlock(lock_);
+
+  return outages;
+}
+
+/**
+ * @return The round trip estimates used for the response timeouts.
+ */
+p6kTimeout *p6kTransport::getTimeouts(void)
+{
+  return &timeouts_;
+}
+
+/**
+ * Resynchronise the input before the next group is sent. This is called by
+ * the owner when a reply does not match the command it was sent for.
+ */
+void p6kTransport::requestResync(void)
+{
+  epicsMutexMustLock(lock_);
+  resync_ = true;
+  epicsMutexUnlock(lock_);
+}
+
+/**
+ * @return The number of times the input has been resynchronised.
+ */
+uint32_t p6kTransport::getResyncs(void)
+{
+  uint32_t resyncs = 0;
+
+  epicsMutexMustLock(lock_);
+  resyncs = resyncs_;
+  epicsMutexUnlock(lock_);
+
+  return resyncs;
+}
+
+/**
+ * @return The number of stale characters thrown away when resynchronising.
+ */
+epicsFloat64 p6kTransport::getDiscarded(void)
+{
+  epicsFloat64 discarded = 0;
+
+  epicsMutexMustLock(lock_);
+  discarded = discarded_;
+  epicsMutexUnlock(lock_);
+
+  return discarded;
+}
+
+/**
+ * The comms thread. This takes up to maxInFlight requests from the queues,
+ * sends them and reads the responses, until the queues are empty.
+ * Immediate commands are taken first, so they only have to wait for the
+ * group that is already in flight.
+ * While the controller is down, everything except probes fails straight away.
+ */
+void p6kTransport::commsTask(void)
+{
+  p6kRequest *requests[P6K_TRANSPORT_MAXINFLIGHT] = {NULL};
+  p6kRequest *send[P6K_TRANSPORT_MAXINFLIGHT] = {NULL};
+  uint32_t count = 0;
+  uint32_t sendCount = 0;
+  bool down = false;
+
+  while (true) {
+    epicsEventMustWait(workEvent_);
+
+    while (true) {
+      count = 0;
+      epicsMutexMustLock(lock_);
+      while ((priorityHead_ != NULL) && (count < maxInFlight_)) {
+        requests[count++] = priorityHead_;
+        priorityHead_ = priorityHead_->next;
+      }
+      if (priorityHead_ == NULL) {
+        priorityTail_ = NULL;
+      }
+      while ((queueHead_ != NULL) && (count < maxInFlight_)) {
+        requests[count++] = queueHead_;
+        queueHead_ = queueHead_->next;
+      }
+      if (queueHead_ == NULL) {
+        queueTail_ = NULL;
+      }
+      down = down_;
+      epicsMutexUnlock(lock_);
+
+      if (count == 0) {
+        break;
+      }
+
+      sendCount = 0;
+      for (uint32_t i=0; i<count; ++i) {
+        if ((down) && (!requests[i]->probe)) {
+          requests[i]->status = asynDisconnected;
+        } else {
+          send[sendCount++] = requests[i];
+        }
+      }
+
+      if (sendCount > 0) {
+        transact(send, sendCount);
+      }
+
+      for (uint32_t i=0; i<count; ++i) {
+        completeRequest(requests[i]);
+      }
+    }
+  }
+}
+
+/**
+ * Write a group of commands and read the responses, in order.
+ * If a response does not arrive, we don't know where we are in the
+ * stream any more, so the rest of the group fails too.
+ * The round trip time of each response is measured from when it could
+ * have started, which is the later of the command being written and the
+ * previous response arriving, so that a pipelined group doesn't inflate
+ * the estimates.
+ * @param requests The requests to send
+ * @param count The number of requests
+ */
+void p6kTransport::transact(p6kRequest **requests, uint32_t count)
+{
+  asynStatus status = asynSuccess;
+  size_t nwrite = 0;
+  uint32_t written = 0;
+  epicsUInt64 previous = 0;
+  epicsUInt64 now = 0;
+  static const char *functionName = "p6kTransport::transact";
+
+  //Discard anything left over from the last group. Nothing should be, since
+  //each reply is read up to the end of its trailer.
+  pasynOctetSyncIO->flush(pasynUser_);
+  rxLen_ = 0;
+
+  //Make sure no late replies are still on their way
+  epicsMutexMustLock(lock_);
+  bool resync = resync_;
+  epicsMutexUnlock(lock_);
+  if (resync) {
+    double timeout = requests[0]->probe ? requests[0]->timeout : timeouts_.getMax();
+    status = resynchronise(timeout);
+    if (status != asynSuccess) {
+      updateHealth(status, requests[0]->probe, timeout);
+      for (uint32_t i=0; i<count; ++i) {
+        requests[i]->status = status;
+        if (logger_ != NULL) {
+          logger_->log(requests[i]->command, requests[i]->response, 0, status);
+        }
+      }
+      return;
+    }
+  }
+
+  for (written=0; written<count; ++written) {
+    requests[written]->sent = epicsMonotonicGet();
+    status = pasynOctetSyncIO->write(pasynUser_, requests[written]->command,
+                                     strlen(requests[written]->command),
+                                     P6K_TRANSPORT_TIMEOUT_, &nwrite);
+    if (status != asynSuccess) {
+      asynPrint(pasynUser_, ASYN_TRACE_ERROR,
+                "%s: ERROR: Failed to write command %s on %s\n",
+                functionName, requests[written]->command, name_);
+      updateHealth(status, requests[written]->probe, timeouts_.getMax());
+      requestResync();
+      break;
+    }
+  }
+
+  for (uint32_t i=0; i<count; ++i) {
+    if ((i < written) && (status == asynSuccess)) {
+      p6kStatsClass cls = p6kStats::classify(requests[i]->command);
+      double timeout = requests[i]->timeout;
+      if (timeout <= 0.0) {
+        timeout = timeouts_.getTimeout(cls);
+      }
+      status = readResponse(requests[i], timeout);
+      requests[i]->status = status;
+      now = epicsMonotonicGet();
+      if (status == asynSuccess) {
+        timeouts_.sample(cls, (now - ((previous > requests[i]->sent) ? previous : requests[i]->sent)) / 1.0e9);
+      } else if (status == asynTimeout) {
+        timeouts_.timedOut(cls);
+      }
+      previous = now;
+      updateHealth(status, requests[i]->probe, timeout);
+      if (status != asynSuccess) {
+        //The rest of the group has been written, so their replies are still to come
+        requestResync();
+      }
+    } else {
+      requests[i]->status = (status == asynSuccess) ? asynError : status;
+    }
+    if (stats_ != NULL) {
+      stats_->recordCommand(requests[i]->command, requests[i]->nread,
+                            (epicsMonotonicGet() - requests[i]->sent) / 1.0e9,
+                            requests[i]->status, requests[i]->errorReply);
+    }
+    if (logger_ != NULL) {
+      logger_->log(requests[i]->command, requests[i]->response,
+                   requests[i]->nread, requests[i]->status);
+    }
+  }
+}
+
+/**
+ * Throw away any late replies, so that the next response read is the reply to
+ * the next command. A WRITE command with a unique sentinel is sent, and everything
+ * up to the sentinel and the prompt after it is discarded. The controller handles
+ * commands in order, so any late replies must arrive before it. This takes one
+ * round trip. While a program is being defined the WRITE would become part of
+ * the program, so instead we wait until nothing has arrived for P6K_TRANSPORT_DRAIN_TIME_.
+ * @param timeout The time to wait for the sentinel (seconds)
+ * @return asynStatus. asynTimeout if the sentinel did not arrive.
+ */
+asynStatus p6kTransport::resynchronise(double timeout)
+{
+  asynStatus status = asynSuccess;
+  int eomReason = 0;
+  char command[P6K_TRANSPORT_MAXBUF] = {0};
+  char token[P6K_TRANSPORT_MAXBUF] = {0};
+  char buffer[P6K_TRANSPORT_MAXBUF] = {0};
+  size_t len = 0;
+  size_t chunk = 0;
+  size_t nwrite = 0;
+  size_t tokenLen = 0;
+  bool found = false;
+  epicsUInt64 now = epicsMonotonicGet();
+  const epicsUInt64 deadline = now + static_cast<epicsUInt64>(timeout * 1.0e9);
+  epicsFloat64 discarded = 0;
+  static const char *functionName = "p6kTransport::resynchronise";
+
+  discarded = rxLen_;
+  rxLen_ = 0;
+
+  if (programMode_) {
+    do {
+      chunk = 0;
+      status = pasynOctetSyncIO->read(pasynUser_, buffer, sizeof(buffer)-1,
+                                      P6K_TRANSPORT_DRAIN_TIME_, &chunk, &eomReason);
+      discarded += chunk;
+      now = epicsMonotonicGet();
+    } while ((chunk > 0) && (now < deadline));
+    status = (chunk > 0) ? asynTimeout : asynSuccess;
+  } else {
+    epicsSnprintf(token, sizeof(token), "%s%u", P6K_SENTINEL_, ++sentinel_);
+    epicsSnprintf(command, sizeof(command), "WRITE\"%s\"", token);
+    tokenLen = strlen(token);
+
+    status = pasynOctetSyncIO->write(pasynUser_, command, strlen(command), timeout, &nwrite);
+
+    while ((status == asynSuccess) && (len < sizeof(buffer)-1)) {
+      now = epicsMonotonicGet();
+      if (now >= deadline) {
+        status = asynTimeout;
+        break;
+      }
+      chunk = 0;
+      status = pasynOctetSyncIO->read(pasynUser_, buffer+len, sizeof(buffer)-1-len,
+                                      (deadline-now)/1.0e9, &chunk, &eomReason);
+      len += chunk;
+      buffer[len] = '\0';
+      if (status != asynSuccess) {
+        break;
+      }
+
+      if (!found) {
+        char *pos = strstr(buffer, token);
+        if (pos != NULL) {
+          found = true;
+          pos += tokenLen;
+          discarded += (pos - buffer) - tokenLen;
+          len = strlen(pos);
+          memmove(buffer, pos, len+1);
+        } else if (len > tokenLen) {
+          //Keep enough to find a sentinel that has only partly arrived
+          discarded += len - tokenLen;
+          memmove(buffer, buffer + len - tokenLen, tokenLen+1);
+          len = tokenLen;
+        }
+      }
+      if (found) {
+        //With the default framing, wait for the second prompt too
+        const char *prompt = strchr(buffer, P6K_PROMPT_);
+        if ((prompt != NULL) && ((!defaultFraming_) || (strstr(prompt+1, "\n>") != NULL))) {
+          break;
+        }
+        if (strchr(buffer, P6K_PROMPT_ERROR_) != NULL) {
+          break;
+        }
+      }
+    }
+
+    if ((status == asynSuccess) && (!found)) {
+      status = asynOverflow;
+    }
+
+    if (logger_ != NULL) {
+      logger_->log(command, buffer, len, status);
+    }
+
+    //Discard anything after the sentinel response
+    if (status == asynSuccess) {
+      pasynOctetSyncIO->flush(pasynUser_);
+    }
+  }
+
+  epicsMutexMustLock(lock_);
+  ++resyncs_;
+  discarded_ += discarded;
+  if (status == asynSuccess) {
+    resync_ = false;
+  }
+  epicsMutexUnlock(lock_);
+
+  if (status != asynSuccess) {
+    asynPrint(pasynUser_, ASYN_TRACE_ERROR,
+              "%s: ERROR: Failed to resynchronise with controller %s. Status %d\n",
+              functionName, name_, status);
+  } else if (discarded > 0) {
+    asynPrint(pasynUser_, ASYN_TRACE_ERROR,
+              "%s: Discarded %.0f late characters from controller %s\n",
+              functionName, discarded, name_);
+  }
+
+  return status;
+}
+
+/**
+ * Count consecutive transactions that got no response, and mark the controller
+ * as down or up. Requests that fail because an earlier one in the group did
+ * are not counted. A response that overflowed the buffer still means the
+ * controller is there. A timeout shorter than the maximum (an adaptive timeout)
+ * is not counted either, so a latency spike doesn't mark the controller down.
+ * It doesn't clear the count.
+ * @param status The status of the transaction
+ * @param probe true if the request was a probe
+ * @param timeout The time that was waited for the response (seconds)
+ */
+void p6kTransport::updateHealth(asynStatus status, bool probe, double timeout)
+{
+  static const char *functionName = "p6kTransport::updateHealth";
+
+  if ((status == asynTimeout) && (!probe) && (timeout < timeouts_.getMax())) {
+    return;
+  }
+
+  epicsMutexMustLock(lock_);
+  if ((status == asynSuccess) || (status == asynOverflow)) {
+    failures_ = 0;
+    if ((down_) && (probe)) {
+      down_ = false;
+      asynPrint(pasynUser_, ASYN_TRACE_ERROR,
+                "%s: Controller %s is responding again\n", functionName, name_);
+    }
+  } else {
+    ++failures_;
+    if ((!down_) && (failLimit_ > 0) && (failures_ >= failLimit_)) {
+      down_ = true;
+      ++outages_;
+      asynPrint(pasynUser_, ASYN_TRACE_ERROR,
+                "%s: ERROR: Controller %s not responding after %u attempts. Failing commands until it responds.\n",
+                functionName, name_, failures_);
+    }
+  }
+  epicsMutexUnlock(lock_);
+}
+
+/**
+ * Read a response from the controller, up to and including the prompt.
+ * The P6K ends a successful command with a > prompt (or - if we are
+ * defining a program) and an error with a ? prompt, so we can't use a fixed
+ * input EOS. Instead we read whatever has arrived and return as soon as
+ * either prompt is found at the start of a line, so that an error costs one
+ * round trip rather than an asyn timeout.
+ * With the default framing a successful reply ends \r\r\n> \n>, so we also
+ * read the second prompt. Otherwise it could arrive after the next command is
+ * written and be taken as an empty reply to it. If it doesn't arrive within
+ * P6K_TRANSPORT_DRAIN_TIME_ of the first prompt the reply is still used, but
+ * the stream is resynchronised before the next group.
+ * Anything read after the end of the reply (the start of the next reply when
+ * commands are pipelined) is kept in rx_ for the next call.
+ * The success prompt is removed from the buffer. The error prompt is left in,
+ * for p6kParser to find.
+ * Once the start of the response has arrived the controller is clearly there,
+ * so a long response gets at least the maximum timeout to finish.
+ * @param request The request to read the response for
+ * @param timeout The time to wait for the prompt (seconds)
+ * @return asynStatus. asynTimeout if no prompt arrived in time.
+ */
+asynStatus p6kTransport::readResponse(p6kRequest *request, double timeout)
+{
+  asynStatus status = asynSuccess;
+  int eomReason = 0;
+  char *buffer = request->response;
+  size_t maxChars = sizeof(request->response);
+  size_t len = 0;
+  size_t chunk = 0;
+  size_t scanned = 0;
+  size_t end = 0;
+  size_t next = 0;
+  bool prompted = false;
+  epicsUInt64 now = 0;
+  const epicsUInt64 start = epicsMonotonicGet();
+  epicsUInt64 deadline = start + static_cast<epicsUInt64>(timeout * 1.0e9);
+  const epicsUInt64 longDeadline = start + static_cast<epicsUInt64>(timeouts_.getMax() * 1.0e9);
+
+  // Check if we are defining a program using DEF. If so, the controller
+  // prompt changes from > to -. If we sending an END then change it back.
+  if (strncmp(request->command, "DEF", 3) == 0) {
+    programMode_ = true;
+  } else if (strncmp(request->command, "END", 3) == 0) {
+    programMode_ = false;
+  }
+  const char prompt = programMode_ ? P6K_PROMPT_PROG_ : P6K_PROMPT_;
+  //Only the > prompt is followed by a second one
+  const bool trailer = defaultFraming_ && (!programMode_);
+
+  //Start with anything that arrived after the previous reply
+  len = (rxLen_ < maxChars-1) ? rxLen_ : maxChars-1;
+  memcpy(buffer, rx_, len);
+  buffer[len] = '\0';
+  rxLen_ = 0;
+  request->nread = 0;
+
+  while (true) {
+    //Only look at the new characters. A prompt must be at the start of a line,
+    //which ends with \r\n by default or just \r with compact framing.
+    for (; (scanned < len) && (next == 0); ++scanned) {
+      if ((scanned > 0) && (buffer[scanned-1] != '\n') && (buffer[scanned-1] != '\r')) {
+        continue;
+      }
+      if (prompted) {
+        if ((buffer[scanned] == P6K_PROMPT_) && (buffer[scanned-1] == '\n')) {
+          next = scanned+1;
+        }
+      } else if (buffer[scanned] == prompt) {
+        prompted = true;
+        end = scanned;
+        if (!trailer) {
+          next = scanned+1;
+        } else {
+          //The second prompt is sent straight after the first
+          deadline = epicsMonotonicGet() + static_cast<epicsUInt64>(P6K_TRANSPORT_DRAIN_TIME_ * 1.0e9);
+        }
+      } else if (buffer[scanned] == P6K_PROMPT_ERROR_) {
+        request->errorReply = true;
+        end = scanned+1;
+        next = scanned+1;
+      }
+    }
+    if (next > 0) {
+      break;
+    }
+
+    now = epicsMonotonicGet();
+    if (now >= deadline) {
+      status = asynTimeout;
+      break;
+    }
+    if (len >= maxChars-1) {
+      status = asynOverflow;
+      break;
+    }
+
+    chunk = 0;
+    status = pasynOctetSyncIO->read(pasynUser_, buffer+len, maxChars-1-len,
+                                    (deadline-now)/1.0e9, &chunk, &eomReason);
+    len += chunk;
+    buffer[len] = '\0';
+    if ((len > 0) && (!prompted) && (deadline < longDeadline)) {
+      deadline = longDeadline;
+    }
+    if ((status != asynSuccess) && ((status != asynTimeout) || (len == 0) || (epicsMonotonicGet() >= deadline))) {
+      break;
+    }
+  }
+
+  if (prompted && (next == 0)) {
+    //The reply is complete but the second prompt didn't arrive
+    requestResync();
+    next = len;
+    status = asynSuccess;
+  }
+
+  if (next > 0) {
+    //Keep the start of the next reply
+    rxLen_ = len - next;
+    memcpy(rx_, buffer+next, rxLen_);
+    buffer[end] = '\0';
+    request->nread = end;
+  } else {
+    request->nread = len;
+  }
+
+  if ((status == asynSuccess) && (strncmp(request->command, "EOL", 3) == 0)) {
+    //The framing applies from the next reply
+    defaultFraming_ = (strcmp(request->command, P6K_EOL_DEFAULT_) == 0);
+  }
+
+  return status;
+}
+
+/**
+ * Take a request from the free list. Must be called with lock_ held.
+ */
+p6kRequest *p6kTransport::allocRequest(const char *command)
+{
+  p6kRequest *request = free_;
+
+  if (request == NULL) {
+    printf("p6kTransport::allocRequest: ERROR: Request queue full on %s. Command %s\n", name_, command);
+    return NULL;
+  }
+  free_ = request->next;
+
+  epicsSnprintf(request->command, sizeof(request->command), "%s", command);
+  request->response[0] = '\0';
+  request->nread = 0;
+  request->status = asynSuccess;
+  request->errorReply = false;
+  request->probe = false;
+  request->timeout = 0.0;
+  request->sent = 0;
+  request->next = NULL;
+
+  return request;
+}
+
+/**
+ * Return a request to the free list. Must be called with lock_ held.
+ */
+void p6kTransport::freeRequest(p6kRequest *request)
+{
+  request->next = free_;
+  free_ = request;
+}
+
+/**
+ * Add a request to the end of the queue, or the priority queue for
+ * immediate commands. Must be called with lock_ held.
+ */
+void p6kTransport::queueRequest(p6kRequest *request)
+{
+  request->next = NULL;
+  //Only a single immediate command jumps the queue. A command line with
+  //immediate and buffered commands in it is sent in order.
+  if ((request->command[0] == P6K_IMMEDIATE_) && (strchr(request->command, ':') == NULL)) {
+    if (priorityTail_ != NULL) {
+      priorityTail_->next = request;
+    } else {
+      priorityHead_ = request;
+    }
+    priorityTail_ = request;
+  } else {
+    if (queueTail_ != NULL) {
+      queueTail_->next = request;
+    } else {
+      queueHead_ = request;
+    }
+    queueTail_ = request;
+  }
+}
+
+/**
+ * Hand a completed request back. Synchronous callers are woken up, and
+ * asynchronous requests are added to the completed list for processCompletions.
+ */
+void p6kTransport::completeRequest(p6kRequest *request)
+{
+  if (request->callback == NULL) {
+    epicsEventSignal(request->doneEvent);
+    return;
+  }
+
+  epicsMutexMustLock(lock_);
+  request->next = NULL;
+  if (completeTail_ != NULL) {
+    completeTail_->next = request;
+  } else {
+    completeHead_ = request;
+  }
+  completeTail_ = request;
+  --outstanding_;
+  bool waiting = waiting_;
+  epicsMutexUnlock(lock_);
+
+  epicsEventSignal(completeEvent_);
+  if ((notify_ != NULL) && (!waiting)) {
+    notify_(notifyPvt_);
+  }
+}
@@ -0,0 +1,178 @@
+/********************************************
+ *  parker6kTransport.h
+ *
+ *  Request queue and comms thread for the
+ *  low level P6K asyn port.
+ *
+ ********************************************/
+
+#ifndef parker6kTransport_H
+#define parker6kTransport_H
+
+#include <stddef.h>
+#include "stdint.h"
+
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+#include <epicsTypes.h>
+
+#include "asynDriver.h"
+
+#include "parker6kTimeout.h"
+
+class p6kStats;
+class p6kLogger;
+
+#define P6K_TRANSPORT_MAXBUF 1024
+#define P6K_TRANSPORT_MAXREQS 32
+#define P6K_TRANSPORT_MAXINFLIGHT 8
+
+/**
+ * Function called when an asynchronous request has completed.
+ * This is called from p6kTransport::processCompletions, not from the comms thread.
+ * @param pvt The pointer passed to p6kTransport::submit
+ * @param command The command that was sent
+ * @param response The raw response, including any error prompt. This can be modified.
+ * @param status The status of the transaction
+ */
+typedef void (*p6kRequestCallback)(void *pvt, const char *command, char *response, asynStatus status);
+
+/**
+ * Function called by the comms thread when an asynchronous request has completed,
+ * so that the owner knows to call p6kTransport::processCompletions.
+ */
+typedef void (*p6kNotifyCallback)(void *pvt);
+
+/**
+ * A single command and its response.
+ */
+struct p6kRequest {
+  char command[P6K_TRANSPORT_MAXBUF];
+  char response[P6K_TRANSPORT_MAXBUF];
+  size_t nread;
+  asynStatus status;
+  bool errorReply;
+  bool probe;           //Sent even if the controller is not responding
+  double timeout;       //Seconds, or 0 to use the adaptive timeout
+  epicsUInt64 sent;
+  epicsEventId doneEvent;
+  p6kRequestCallback callback;
+  void *pvt;
+  p6kRequest *next;
+};
+
+/**
+ * p6kTransport owns the low level asynUser and a comms thread that does all
+ * the I/O on it. Requests are queued and the comms thread writes up to
+ * maxInFlight commands at a time before reading the responses, which are
+ * matched to the commands in order using the controller prompts.
+ * With the default framing each reply ends with a second prompt (\r\r\n> \n>),
+ * which is read as part of the reply, and anything that arrives after the end
+ * of a reply is kept for the next one, so pipelined replies stay in step.
+ * A single immediate command (starting with !) goes in a separate priority queue,
+ * which is always emptied before the normal queue.
+ * Callers can either wait for a response (writeRead) or submit a request
+ * with a callback and carry on (submit). Callbacks are run by the owner,
+ * by calling processCompletions, so that they run with the owner's lock held.
+ * The comms thread only ever takes the transport lock, so a caller can wait for
+ * a response while holding its own lock.
+ * The time to wait for each response comes from the measured round trip
+ * times (see p6kTimeout).
+ * After a timeout, or when the owner finds a reply that does not match its
+ * command, late replies may still be on their way. Before the next group is
+ * sent, the input is resynchronised by sending a WRITE command with a unique
+ * sentinel and discarding everything up to its echo.
+ * After failLimit consecutive transactions without a response within the maximum
+ * timeout the controller is marked as down, and every request fails straight away
+ * without being sent, except for probes. The first probe that gets a response marks the controller as up again.
+ */
+class p6kTransport {
+
+ public:
+  p6kTransport(asynUser *pasynUser, const char *name, p6kNotifyCallback notify, void *notifyPvt);
+  virtual ~p6kTransport();
+
+  asynStatus start(void);
+  asynStatus writeRead(const char *command, char *response, size_t maxChars, size_t *nread);
+  asynStatus probe(const char *command, char *response, size_t maxChars, size_t *nread);
+  asynStatus submit(const char *command, p6kRequestCallback callback, void *pvt);
+  int32_t processCompletions(void);
+  asynStatus waitOutstanding(double timeout);
+  uint32_t getOutstanding(void);
+  void setMaxInFlight(uint32_t maxInFlight);
+  uint32_t getMaxInFlight(void);
+  void setStats(p6kStats *stats);
+  void setLogger(p6kLogger *logger);
+  bool isDown(void);
+  void setFailLimit(uint32_t failLimit);
+  uint32_t getFailures(void);
+  uint32_t getOutages(void);
+  p6kTimeout *getTimeouts(void);
+  void requestResync(void);
+  uint32_t getResyncs(void);
+  epicsFloat64 getDiscarded(void);
+  void commsTask(void);
+
+ private:
+  asynUser *pasynUser_;
+  char name_[P6K_TRANSPORT_MAXBUF];
+  p6kNotifyCallback notify_;
+  void *notifyPvt_;
+  epicsThreadId thread_;
+  epicsMutexId lock_;
+  epicsEventId workEvent_;
+  epicsEventId completeEvent_;
+  uint32_t maxInFlight_;
+  uint32_t outstanding_;
+  bool waiting_;
+  bool programMode_;
+  bool defaultFraming_;
+  bool down_;
+  uint32_t failures_;
+  uint32_t failLimit_;
+  uint32_t outages_;
+  bool resync_;
+  uint32_t resyncs_;
+  uint32_t sentinel_;
+  epicsFloat64 discarded_;
+  p6kStats *stats_;
+  p6kLogger *logger_;
+  p6kTimeout timeouts_;
+
+  char rx_[P6K_TRANSPORT_MAXBUF];
+  size_t rxLen_;
+
+  p6kRequest requests_[P6K_TRANSPORT_MAXREQS];
+  p6kRequest *free_;
+  p6kRequest *queueHead_;
+  p6kRequest *queueTail_;
+  p6kRequest *priorityHead_;
+  p6kRequest *priorityTail_;
+  p6kRequest *completeHead_;
+  p6kRequest *completeTail_;
+
+  asynStatus waitRequest(const char *command, bool probe, double timeout,
+                         char *response, size_t maxChars, size_t *nread);
+  void updateHealth(asynStatus status, bool probe, double timeout);
+  p6kRequest *allocRequest(const char *command);
+  void freeRequest(p6kRequest *request);
+  void queueRequest(p6kRequest *request);
+  void completeRequest(p6kRequest *request);
+  void transact(p6kRequest **requests, uint32_t count);
+  asynStatus readResponse(p6kRequest *request, double timeout);
+  asynStatus resynchronise(double timeout);
+
+  static const double P6K_TRANSPORT_TIMEOUT_;
+  static const double P6K_TRANSPORT_PROBE_TIMEOUT_;
+  static const uint32_t P6K_TRANSPORT_FAIL_LIMIT_;
+  static const double P6K_TRANSPORT_DRAIN_TIME_;
+  static const char *P6K_SENTINEL_;
+  static const char *P6K_EOL_DEFAULT_;
+  static const char P6K_PROMPT_;
+  static const char P6K_PROMPT_PROG_;
+  static const char P6K_PROMPT_ERROR_;
+  static const char P6K_IMMEDIATE_;
+};
+
+#endif /* parker6kTransport_H */
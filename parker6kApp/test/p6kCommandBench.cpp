@@ -0,0 +1,141 @@
+/********************************************
+ *  p6kCommandBench.cpp
+ *
+ *  Microbenchmark comparing p6kCommand::format
+ *  with the epicsSnprintf and pow() command
+ *  building that it replaced. It also checks
+ *  that both give the same commands.
+ *
+ *  Usage: p6kCommandBench [iterations]
+ *
+ ********************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <epicsTime.h>
+#include <epicsStdio.h>
+
+#include "parker6kCommand.h"
+
+#define P6K_MAXBUF 1024
+
+static const int32_t maxDigits = 4;
+static char txBuffer[P6K_MAXBUF];
+
+/* The old p6kAxis::move acceleration commands */
+static long legacyAccel(long i)
+{
+  double accel = 12.34567 + i;
+  int iA = rint(pow(10.0, maxDigits) * accel);
+  double dA = iA / pow(10.0, maxDigits);
+  return epicsSnprintf(txBuffer, P6K_MAXBUF, "%d%s%.*f", 1, P6K_CMD_A, maxDigits, dA);
+}
+
+static long legacyVel(long i)
+{
+  double vel = -0.5 - i;
+  return epicsSnprintf(txBuffer, P6K_MAXBUF, "%d%s%.*f", 1, P6K_CMD_V, maxDigits, vel);
+}
+
+static long legacyPos(long i)
+{
+  return epicsSnprintf(txBuffer, P6K_MAXBUF, "%d%s%d", 1, P6K_CMD_D, static_cast<int>(i - 500000));
+}
+
+static long legacyStatus(long /*i*/)
+{
+  return epicsSnprintf(txBuffer, P6K_MAXBUF, "%d%s", 1, P6K_CMD_TAS);
+}
+
+static long commandAccel(long i)
+{
+  double accel = 12.34567 + i;
+  epicsInt64 iA = p6kCommand::scale(accel, maxDigits);
+  return p6kCommand::fixedScaled(P6K_CMDID_A, 1, iA, maxDigits).format(txBuffer, P6K_MAXBUF);
+}
+
+static long commandVel(long i)
+{
+  double vel = -0.5 - i;
+  return p6kCommand::fixed(P6K_CMDID_V, 1, vel, maxDigits).format(txBuffer, P6K_MAXBUF);
+}
+
+static long commandPos(long i)
+{
+  return p6kCommand::integer(P6K_CMDID_D, 1, static_cast<epicsInt32>(i - 500000)).format(txBuffer, P6K_MAXBUF);
+}
+
+static long commandStatus(long /*i*/)
+{
+  return p6kCommand(P6K_CMDID_TAS, 1).format(txBuffer, P6K_MAXBUF);
+}
+
+typedef long (*benchFunc)(long i);
+
+static double timeIt(benchFunc func, long iterations, long *check)
+{
+  epicsUInt64 start = epicsMonotonicGet();
+  for (long i=0; i<iterations; ++i) {
+    *check += func(i);
+  }
+  return (epicsMonotonicGet() - start) / static_cast<double>(iterations);
+}
+
+/* Check that both ways of building a command give the same string */
+static int compare(const char *name, benchFunc legacy, benchFunc command, long iterations)
+{
+  char expected[P6K_MAXBUF] = {0};
+
+  for (long i=0; i<iterations; ++i) {
+    legacy(i);
+    strcpy(expected, txBuffer);
+    command(i);
+    if (strcmp(expected, txBuffer) != 0) {
+      printf("MISMATCH %s: %s != %s\n", name, txBuffer, expected);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  long iterations = 1000000;
+  long check = 0;
+  int errors = 0;
+
+  if (argc > 1) {
+    iterations = atol(argv[1]);
+  }
+
+  struct {
+    const char *name;
+    benchFunc legacy;
+    benchFunc command;
+  } cases[] = {
+    {"1A", legacyAccel, commandAccel},
+    {"1V", legacyVel, commandVel},
+    {"1D", legacyPos, commandPos},
+    {"1TAS", legacyStatus, commandStatus},
+  };
+
+  for (size_t i=0; i<sizeof(cases)/sizeof(cases[0]); ++i) {
+    errors += compare(cases[i].name, cases[i].legacy, cases[i].command, 10000);
+  }
+
+  printf("Command formatting time (ns per command), %ld iterations\n", iterations);
+  printf("%10s %12s %12s %8s\n", "command", "legacy", "p6kCommand", "speedup");
+  for (size_t i=0; i<sizeof(cases)/sizeof(cases[0]); ++i) {
+    double legacy = timeIt(cases[i].legacy, iterations, &check);
+    double command = timeIt(cases[i].command, iterations, &check);
+    printf("%10s %12.1f %12.1f %8.1f\n", cases[i].name, legacy, command, legacy/command);
+  }
+
+  //Print the checksum so that the compiler can't remove the work
+  printf("(check %ld)\n", check);
+
+  return (errors == 0) ? 0 : 1;
+}
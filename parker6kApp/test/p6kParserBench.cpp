@@ -0,0 +1,310 @@
+/********************************************
+ *  p6kParserBench.cpp
+ *
+ *  Microbenchmark comparing p6kParser with
+ *  the strstr/strncpy/sscanf response handling
+ *  that it replaced, and a check that both give
+ *  the same results, and of p6kParser::toInt.
+ *
+ *  Usage: p6kParserBench [iterations]
+ *
+ ********************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <epicsTime.h>
+
+#include "parker6kParser.h"
+
+#define P6K_MAXBUF 1024
+
+/* Responses as they arrive from p6kTransport (with the > prompt removed) */
+static const char *tasResponse = "*1TAS0000_0000_0000_0000_0000_0000_0000_0000\r\r\n";
+static const char *tpcResponse = "*1TPC+12345\r\r\n";
+static const char *listResponse = "*TPC+12345,-200,+0,+0,+7,+0,+0,+1\r\r\n";
+static const char *errorMessage = "*UNDEFINED LABEL\r\n?";
+
+/* Copy of the old p6kController::errorResponse */
+static asynStatus legacyErrorResponse(char *input, char *output)
+{
+  char *pTrailer = strstr(input, "?");
+
+  if (pTrailer != NULL) {
+    *pTrailer = '\0';
+    char *pHeader = strstr(input, "*");
+    if (pHeader != NULL) {
+      pHeader++;
+      strncpy(output, pHeader, P6K_MAXBUF-1);
+      return asynSuccess;
+    }
+  }
+  return asynError;
+}
+
+/* Copy of the old p6kController::trimResponse */
+static asynStatus legacyTrimResponse(char *input, char *output)
+{
+  asynStatus status = asynSuccess;
+
+  char *pTrailer = strstr(input, "\r\r\n");
+  if (pTrailer != NULL) {
+    *pTrailer = '\0';
+  } else {
+    pTrailer = strstr(input, "\r\n");
+    if (pTrailer != NULL) {
+      *pTrailer = '\0';
+    } else {
+      status = asynError;
+    }
+  }
+
+  char *pHeader = strstr(input, "*");
+  if (pHeader != NULL) {
+    pHeader++;
+    strncpy(output, pHeader, P6K_MAXBUF-1);
+  }
+  return status;
+}
+
+/* The old lowLevelWriteRead response handling, into a caller's buffer */
+static asynStatus legacyResponse(const char *raw, char *response)
+{
+  char temp[P6K_MAXBUF] = {0};
+  asynStatus status = asynSuccess;
+
+  strncpy(temp, raw, P6K_MAXBUF-1);
+  memset(response, 0, strlen(response));
+  if (legacyErrorResponse(temp, response) == asynSuccess) {
+    status = asynError;
+  }
+  if (legacyTrimResponse(temp, response) != asynSuccess) {
+    status = asynError;
+  }
+  return status;
+}
+
+static void legacyTASBits(char *stringVal)
+{
+  char response[P6K_MAXBUF] = {0};
+  int axisNum = 0;
+  legacyResponse(tasResponse, response);
+  sscanf(response, "%dTAS%s", &axisNum, stringVal);
+}
+
+static long legacyTAS(void)
+{
+  char stringVal[P6K_MAXBUF] = {0};
+  legacyTASBits(stringVal);
+  return stringVal[0];
+}
+
+static long legacyTPC(void)
+{
+  char response[P6K_MAXBUF] = {0};
+  int axisNum = 0;
+  int intVal = 0;
+  legacyResponse(tpcResponse, response);
+  sscanf(response, "%dTPC%d", &axisNum, &intVal);
+  return intVal;
+}
+
+static long legacyList(void)
+{
+  char response[P6K_MAXBUF] = {0};
+  char *fields[8] = {NULL};
+  long sum = 0;
+  int count = 0;
+  legacyResponse(listResponse, response);
+  char *pField = response + 3;
+  while ((pField != NULL) && (*pField != '\0') && (count < 8)) {
+    fields[count++] = pField;
+    pField = strchr(pField, ',');
+    if (pField != NULL) {
+      *pField++ = '\0';
+    }
+  }
+  for (int i=0; i<count; ++i) {
+    sum += strtol(fields[i], NULL, 10);
+  }
+  return sum;
+}
+
+static long legacyError(void)
+{
+  char response[P6K_MAXBUF] = {0};
+  return legacyResponse(errorMessage, response);
+}
+
+/* The same work using p6kParser. The receive buffer copy is kept, since
+   p6kTransport still copies the response into the controller buffer. */
+static char rxBuffer[P6K_MAXBUF];
+
+static const p6kParser *receive(p6kParser *parser, const char *raw)
+{
+  size_t len = strlen(raw);
+  memcpy(rxBuffer, raw, len+1);
+  parser->parse(rxBuffer, len);
+  return parser;
+}
+
+static p6kView parserTASBits(p6kParser *parser)
+{
+  p6kView bits = {"", 0};
+  receive(parser, tasResponse)->getBits("TAS", &bits);
+  return bits;
+}
+
+static long parserTAS(void)
+{
+  p6kParser parser;
+  return parserTASBits(&parser).data[0];
+}
+
+static long parserTPC(void)
+{
+  p6kParser parser;
+  epicsInt32 intVal = 0;
+  receive(&parser, tpcResponse)->getInt("TPC", &intVal);
+  return intVal;
+}
+
+static long parserList(void)
+{
+  p6kParser parser;
+  p6kView fields[8];
+  long sum = 0;
+  int32_t count = receive(&parser, listResponse)->getList("TPC", fields, 8);
+  for (int32_t i=0; i<count; ++i) {
+    epicsInt32 intVal = 0;
+    p6kParser::toInt(fields[i], &intVal);
+    sum += intVal;
+  }
+  return sum;
+}
+
+static long parserError(void)
+{
+  p6kParser parser;
+  return receive(&parser, errorMessage)->isError();
+}
+
+typedef long (*benchFunc)(void);
+
+/* Check that both ways of handling each response give the same result */
+static int compare(void)
+{
+  int errors = 0;
+  char legacyBits[P6K_MAXBUF] = {0};
+  p6kParser parser;
+
+  legacyTASBits(legacyBits);
+  p6kView bits = parserTASBits(&parser);
+  if ((bits.len != strlen(legacyBits)) || (strncmp(bits.data, legacyBits, bits.len) != 0)) {
+    printf("MISMATCH nTAS: %.*s != %s\n", static_cast<int>(bits.len), bits.data, legacyBits);
+    ++errors;
+  }
+  if (parserTPC() != legacyTPC()) {
+    printf("MISMATCH nTPC: %ld != %ld\n", parserTPC(), legacyTPC());
+    ++errors;
+  }
+  if (parserList() != legacyList()) {
+    printf("MISMATCH TPC list: %ld != %ld\n", parserList(), legacyList());
+    ++errors;
+  }
+  if ((parserError() != 0) != (legacyError() != asynSuccess)) {
+    printf("MISMATCH error: %ld != %ld\n", parserError(), legacyError());
+    ++errors;
+  }
+  return errors;
+}
+
+/* Check p6kParser::toInt at the ends of the range, and that a field that
+   can't be converted leaves the value alone */
+static int checkToInt(void)
+{
+  static const epicsInt32 unchanged = 12345;
+  int errors = 0;
+
+  struct {
+    const char *field;
+    asynStatus status;
+    epicsInt32 value;
+  } cases[] = {
+    {"+0", asynSuccess, 0},
+    {"-7", asynSuccess, -7},
+    {" 42,", asynSuccess, 42},
+    {"2147483647", asynSuccess, 2147483647},
+    {"+2147483647", asynSuccess, 2147483647},
+    {"-2147483648", asynSuccess, -2147483647 - 1},
+    {"2147483648", asynOverflow, unchanged},
+    {"-2147483649", asynOverflow, unchanged},
+    {"-00000000000000000000000000000012", asynSuccess, -12},
+    {"123456789012345678901234567890", asynOverflow, unchanged},
+    {"-99999999999999999999999999999999", asynOverflow, unchanged},
+    {"", asynError, unchanged},
+    {"+", asynError, unchanged},
+    {"-", asynError, unchanged},
+    {"x1", asynError, unchanged},
+  };
+
+  for (size_t i=0; i<sizeof(cases)/sizeof(cases[0]); ++i) {
+    p6kView field = {cases[i].field, strlen(cases[i].field)};
+    epicsInt32 value = unchanged;
+    asynStatus status = p6kParser::toInt(field, &value);
+    if ((status != cases[i].status) || (value != cases[i].value)) {
+      printf("MISMATCH toInt \"%s\": status %d value %d, expected status %d value %d\n", 
+             cases[i].field, status, value, cases[i].status, cases[i].value);
+      ++errors;
+    }
+  }
+  return errors;
+}
+
+static double timeIt(benchFunc func, long iterations, long *check)
+{
+  epicsUInt64 start = epicsMonotonicGet();
+  for (long i=0; i<iterations; ++i) {
+    *check += func();
+  }
+  return (epicsMonotonicGet() - start) / static_cast<double>(iterations);
+}
+
+int main(int argc, char *argv[])
+{
+  long iterations = 1000000;
+  long check = 0;
+  int errors = 0;
+
+  if (argc > 1) {
+    iterations = atol(argv[1]);
+  }
+
+  errors += compare();
+  errors += checkToInt();
+
+  struct {
+    const char *name;
+    benchFunc legacy;
+    benchFunc parser;
+  } cases[] = {
+    {"nTAS", legacyTAS, parserTAS},
+    {"nTPC", legacyTPC, parserTPC},
+    {"TPC list", legacyList, parserList},
+    {"error", legacyError, parserError},
+  };
+
+  printf("Response handling time (ns per response), %ld iterations\n", iterations);
+  printf("%10s %12s %12s %8s\n", "response", "legacy", "p6kParser", "speedup");
+  for (size_t i=0; i<sizeof(cases)/sizeof(cases[0]); ++i) {
+    double legacy = timeIt(cases[i].legacy, iterations, &check);
+    double parser = timeIt(cases[i].parser, iterations, &check);
+    printf("%10s %12.1f %12.1f %8.1f\n", cases[i].name, legacy, parser, legacy/parser);
+  }
+
+  //Print the checksum so that the compiler can't remove the work
+  printf("(check %ld)\n", check);
+
+  return (errors == 0) ? 0 : 1;
+}
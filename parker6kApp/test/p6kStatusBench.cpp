@@ -0,0 +1,185 @@
+/********************************************
+ *  p6kStatusBench.cpp
+ *
+ *  Microbenchmark comparing p6kParser::toMask
+ *  with decoding one character at a time, for
+ *  the 8 axis bulk TAS reply, and counting the
+ *  status parameters that p6kAxis::getAxisStatus
+ *  sets with and without change detection.
+ *  It also checks that both decoders give the
+ *  same bits.
+ *
+ *  Usage: p6kStatusBench [iterations]
+ *
+ ********************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <epicsTime.h>
+
+#include "parker6kParser.h"
+
+#define P6K_MAXBUF 1024
+#define P6K_STATUS_MAXBUF 64
+#define P6K_BENCH_AXES 8
+
+/* Bulk TAS replies as they arrive from p6kTransport (with the > prompt removed).
+   Axis 1 starts moving in the second reply and stops in the third. */
+static const char *tasResponses[] = {
+  "*TAS0000_1000_0000_0000_0000_0001_0000_0000,0000_1000_0000_0000_0000_0001_0000_0000,"
+  "0000_1000_0000_0000_0000_0001_0000_0000,0000_1000_0000_0000_0000_0001_0000_0000,"
+  "0000_1000_0000_0000_0000_0001_0000_0000,0000_1000_0000_0000_0000_0001_0000_0000,"
+  "0000_1000_0000_0000_0000_0001_0000_0000,0000_1000_0000_0000_0000_0001_0000_0000\r\r\n",
+  "*TAS1011_1000_0000_0000_0000_0000_0000_0000,0000_1000_0000_0000_0000_0001_0000_0000,"
+  "0000_1000_0000_0000_0000_0001_0000_0000,0000_1000_0000_0000_0000_0001_0000_0000,"
+  "0000_1000_0000_0000_0000_0001_0000_0000,0000_1000_0000_0000_0000_0001_0000_0000,"
+  "0000_1000_0000_0000_0000_0001_0000_0000,0000_1000_0000_0000_0000_0001_0000_0000\r\r\n",
+  "*TAS0000_1000_0000_0000_0000_0001_0000_0000,0000_1000_0000_0000_0000_0001_0000_0000,"
+  "0000_1000_0000_0000_0000_0001_0000_0000,0000_1000_0000_0000_0000_0001_0000_0000,"
+  "0000_1000_0000_0000_0000_0001_0000_0000,0000_1000_0000_0000_0000_0001_0000_0000,"
+  "0000_1000_0000_0000_0000_0001_0000_0000,0000_1000_0000_0000_0000_0001_0000_0000\r\r\n",
+};
+static const long numResponses = sizeof(tasResponses)/sizeof(tasResponses[0]);
+
+/* The TAS bits that getAxisStatus sets parameters from */
+static const epicsUInt32 tasBit[] = {0, 1, 4, 11, 12, 13, 14, 15, 16, 17, 22, 23, 24};
+static const size_t numTasBits = sizeof(tasBit)/sizeof(tasBit[0]);
+
+/* The fields of each reply, split once by p6kParser, since that
+   part is the same before and after */
+static char rxBuffer[numResponses][P6K_MAXBUF];
+static p6kView tasFields[numResponses][P6K_BENCH_AXES];
+static int32_t tasNum[numResponses];
+
+static void receive(void)
+{
+  for (long i=0; i<numResponses; ++i) {
+    p6kParser parser;
+    size_t len = strlen(tasResponses[i]);
+    memcpy(rxBuffer[i], tasResponses[i], len+1);
+    parser.parse(rxBuffer[i], len);
+    tasNum[i] = parser.getList("TAS", tasFields[i], P6K_BENCH_AXES);
+  }
+}
+
+/* Decode one character at a time, as p6kParser::toBits used to */
+static epicsUInt64 scalarMask(p6kView field)
+{
+  epicsUInt64 mask = 0;
+  epicsUInt32 bit = 0;
+
+  for (size_t i=0; (i<field.len) && (bit<64); ++i) {
+    if (field.data[i] == '_') {
+      continue;
+    }
+    if (field.data[i] == '1') {
+      mask |= (static_cast<epicsUInt64>(1) << bit);
+    }
+    ++bit;
+  }
+  return mask;
+}
+
+typedef epicsUInt64 (*decodeFunc)(p6kView field);
+
+/* Decode every field of every reply */
+static double timeIt(decodeFunc func, long iterations, epicsUInt64 *check)
+{
+  epicsUInt64 start = epicsMonotonicGet();
+  for (long i=0; i<iterations; ++i) {
+    long reply = i % numResponses;
+    for (int32_t axis=0; axis<tasNum[reply]; ++axis) {
+      *check += func(tasFields[reply][axis]);
+    }
+  }
+  return (epicsMonotonicGet() - start) / static_cast<double>(iterations);
+}
+
+/* Count the status parameters set for each reply. getAxisStatus used
+   to set all of them every poll. Now it only sets the ones whose bits
+   changed since the last poll. */
+static void countParams(long iterations, long *legacy, long *changed)
+{
+  epicsUInt64 lastMask[P6K_BENCH_AXES] = {0};
+  bool lastValid[P6K_BENCH_AXES] = {false};
+
+  *legacy = 0;
+  *changed = 0;
+  for (long i=0; i<iterations; ++i) {
+    long reply = i % numResponses;
+    for (int32_t axis=0; axis<tasNum[reply]; ++axis) {
+      epicsUInt64 tas = p6kParser::toMask(tasFields[reply][axis]);
+      epicsUInt64 flipped = lastValid[axis] ? (tas ^ lastMask[axis]) : ~static_cast<epicsUInt64>(0);
+      lastMask[axis] = tas;
+      lastValid[axis] = true;
+      for (size_t bit=0; bit<numTasBits; ++bit) {
+        *legacy += 1;
+        *changed += p6kParser::testBit(flipped, tasBit[bit]) ? 1 : 0;
+      }
+    }
+  }
+}
+
+/* Check toMask against scalarMask for random strings of 0, 1, _ and
+   other characters, including the usual 0000_0000 layout. */
+static int compare(long iterations)
+{
+  static const char chars[] = "0101_x";
+  char buffer[P6K_STATUS_MAXBUF+16];
+
+  srand(1);
+  for (long i=0; i<iterations; ++i) {
+    size_t len = rand() % (sizeof(buffer)-1);
+    bool grouped = ((i % 2) == 0);
+    for (size_t j=0; j<len; ++j) {
+      if (grouped) {
+        buffer[j] = ((j % 5) == 4) ? '_' : chars[rand() % 2];
+        if ((rand() % 200) == 0) {
+          buffer[j] = chars[rand() % (sizeof(chars)-1)];
+        }
+      } else {
+        buffer[j] = chars[rand() % (sizeof(chars)-1)];
+      }
+    }
+    buffer[len] = '\0';
+    p6kView field = {buffer, len};
+    if (p6kParser::toMask(field) != scalarMask(field)) {
+      printf("MISMATCH %s\n", buffer);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  long iterations = 1000000;
+  epicsUInt64 check = 0;
+  long legacySets = 0;
+  long changedSets = 0;
+  int errors = 0;
+
+  if (argc > 1) {
+    iterations = atol(argv[1]);
+  }
+
+  errors += compare(100000);
+  receive();
+
+  double scalar = timeIt(scalarMask, iterations, &check);
+  double mask = timeIt(p6kParser::toMask, iterations, &check);
+  countParams(iterations, &legacySets, &changedSets);
+
+  printf("%d axis bulk TAS decoding (ns per reply), %ld iterations\n", P6K_BENCH_AXES, iterations);
+  printf("%12s %12s %8s\n", "scalar", "toMask", "speedup");
+  printf("%12.1f %12.1f %8.1f\n", scalar, mask, scalar/mask);
+  printf("Status parameters set per reply: every poll %.1f, changed bits only %.1f\n",
+         legacySets / static_cast<double>(iterations), changedSets / static_cast<double>(iterations));
+
+  //Print the checksum so that the compiler can't remove the work
+  printf("(check %llu)\n", static_cast<unsigned long long>(check));
+
+  return (errors == 0) ? 0 : 1;
+}